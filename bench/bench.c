@@ -0,0 +1,239 @@
+/******************************************************************************
+ * bench.c - Benchmarks of the hot paths of piratpkg
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <piratpkg.h>
+#include <config.h>
+#include <pkg.h>
+#include <db.h>
+#include <log.h>
+
+/*
+ * Runs against a root written by gen, see `make bench`. Each phase is timed
+ * on its own and printed as operations per second, followed by the peak RSS
+ * of the whole run.
+ */
+
+#define CONFIG_LOADS 1000
+#define MAX_PARSES 500 /* Parses never free anything, keep RSS bounded */
+#define UNINSTALLS 200
+
+struct arena g_arena;
+struct config g_config;
+
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _report(const char* what, size_t ops, double start)
+{
+    double secs = _now() - start;
+
+    printf("%-20s %8lu ops %10.2f ms %12.0f ops/s\n", what,
+           (unsigned long)ops, secs * 1e3, secs > 0 ? ops / secs : 0.0);
+}
+
+/* Every line of names.list, allocated in g_arena */
+static char** _read_names(const char* path, size_t* num_names)
+{
+    char line[MAX_LINE_LENGTH];
+    char** names = NULL;
+    size_t cap = 0;
+    FILE* file = fopen(path, "r");
+
+    *num_names = 0;
+    if (file == NULL)
+    {
+        ERROR("Failed to open '%s'\n", path);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (*num_names == cap)
+        {
+            char** grown;
+
+            cap = cap ? cap * 2 : 1024;
+            grown = arena_alloc(&g_arena, cap * sizeof(char*));
+            if (grown == NULL)
+                break;
+            if (*num_names > 0)
+                memcpy(grown, names, *num_names * sizeof(char*));
+            names = grown;
+        }
+        names[(*num_names)++] = strdup_safe(line);
+    }
+
+    fclose(file);
+    return names;
+}
+
+/* =============================================================================
+ * Phases
+ * ========================================================================== */
+
+static int _bench_config(const char* conf, size_t iterations)
+{
+    double start = _now();
+    size_t i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        if (config_load(conf) != ACTION_RET_OK)
+            return -1;
+    }
+    _report("config load", iterations, start);
+    return 0;
+}
+
+static int _bench_get_path(char** names, size_t num_names)
+{
+    char name[MAX_LINE_LENGTH];
+    double start = _now();
+    size_t i, misses = 0;
+
+    for (i = 0; i < num_names; i++)
+    {
+        strcpy(name, names[i]);
+        if (pkg_get_path(name) == NULL)
+            misses++;
+    }
+    _report("pkg_get_path", num_names, start);
+    return misses == 0 ? 0 : -1;
+}
+
+static int _bench_parse(char** names, size_t num_names)
+{
+    double start = _now();
+    size_t i;
+
+    for (i = 0; i < num_names; i++)
+    {
+        if (pkg_parse(names[i]) == NULL)
+            return -1;
+    }
+    _report("pkg_parse", num_names, start);
+    return 0;
+}
+
+static int _bench_installed(char** names, size_t num_names, struct db* db)
+{
+    double start = _now();
+    size_t i, found = 0;
+
+    if (db_load(db) != ACTION_RET_OK)
+        return -1;
+    _report("installed.list load", db->num_entries, start);
+
+    start = _now();
+    for (i = 0; i < num_names; i++)
+    {
+        if (db_find(db, names[i]) != NULL)
+            found++;
+    }
+    _report("installed check", num_names, start);
+    return found > 0 ? 0 : -1;
+}
+
+/* What uninstall does to installed.list, put back afterwards */
+static int _bench_uninstall(struct db* db, size_t count)
+{
+    struct db_entry* removed;
+    double start;
+    size_t i;
+
+    if (count > db->num_entries)
+        count = db->num_entries;
+    removed = arena_alloc(&g_arena, (count + 1) * sizeof(struct db_entry));
+    if (removed == NULL)
+        return -1;
+
+    start = _now();
+    for (i = 0; i < count; i++)
+    {
+        removed[i] = db->entries[(i * 7919) % db->num_entries];
+        if (db_remove(db, removed[i].name) != ACTION_RET_OK ||
+            db_save(db) != ACTION_RET_OK)
+            return -1;
+    }
+    _report("uninstall rewrite", count, start);
+
+    for (i = 0; i < count; i++)
+    {
+        if (db_add(db, removed[i].name, removed[i].version,
+                   removed[i].branch) != ACTION_RET_OK)
+            return -1;
+    }
+    return db_save(db) == ACTION_RET_OK ? 0 : -1;
+}
+
+/* =============================================================================
+ * Main
+ * ========================================================================== */
+
+int main(int argc, char** argv)
+{
+    char** names;
+    size_t num_names;
+    struct db db;
+    struct rusage usage;
+    char list[MAX_LINE_LENGTH];
+    const char* slash;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s BENCH_DIR/bench.conf\n", argv[0]);
+        return 1;
+    }
+
+    if (arena_init(&g_arena, DEFAULT_ARENA_SIZE) != 0)
+        return 1;
+    memset(&g_config, 0, sizeof(g_config));
+    g_config.jobs = 1;
+    g_config.no_confirm = true;
+
+    /* names.list sits next to the config */
+    slash = strrchr(argv[1], '/');
+    snprintf(list, sizeof(list), "%.*snames.list",
+             slash != NULL ? (int)(slash - argv[1] + 1) : 0, argv[1]);
+
+    names = _read_names(list, &num_names);
+    if (names == NULL || num_names == 0)
+        return 1;
+
+    if (_bench_config(argv[1], CONFIG_LOADS) != 0 ||
+        _bench_get_path(names, num_names) != 0 ||
+        _bench_parse(names,
+                     num_names < MAX_PARSES ? num_names : MAX_PARSES) != 0 ||
+        _bench_installed(names, num_names, &db) != 0 ||
+        _bench_uninstall(&db, UNINSTALLS) != 0)
+    {
+        ERROR("Benchmark failed\n");
+        arena_destroy(&g_arena);
+        return 1;
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-20s %8ld KiB\n", "peak RSS", usage.ru_maxrss);
+
+    arena_destroy(&g_arena);
+    return 0;
+}
@@ -0,0 +1,353 @@
+/******************************************************************************
+ * check.c - Checks of version ordering and dependency resolution
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <piratpkg.h>
+#include <config.h>
+#include <version.h>
+#include <solver.h>
+#include <pkg.h>
+#include <db.h>
+#include <fs.h>
+#include <strings.h>
+#include <log.h>
+
+/*
+ * Writes a small root under DIR, see `make check`:
+ *   DIR/check.conf                   config pointing at DIR/root
+ *   DIR/root/repo/core/<name>.pkg    the manifests below
+ *   DIR/root/etc/piratpkg/...        sendmail and guard, installed
+ * then compares versions and runs the solver against it. Each check prints
+ * one line, any failure makes the exit status 1.
+ */
+
+struct arena g_arena;
+struct config g_config;
+
+static size_t num_failed;
+
+static void _check(const char* what, int ok)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok)
+        num_failed++;
+}
+
+/* =============================================================================
+ * Versions
+ * ========================================================================== */
+
+struct vercase
+{
+    const char* a;
+    const char* b;
+    int sign; /* Of vercmp(a, b) */
+};
+
+static const struct vercase vercases[] = {
+    {"1.2", "1.10", -1},      {"1.10", "1.2", 1},
+    {"1.0", "1.0", 0},        {"1.0~rc1", "1.0", -1},
+    {"1.0", "1.0a", -1},      {"1.0a", "1.0.1", -1},
+    {"1.0~rc1", "1.0.1", -1}, {"1.0~rc1", "1.0~rc2", -1},
+    {"1.0~", "1.0", -1},      {"1.0-2", "1.0-10", -1},
+    /* Epochs outrank everything after them, a missing one is 0 */
+    {"1:0.9", "2.0", 1},      {"2.0", "1:0.9", -1},
+    {"0:1.0", "1.0", 0},      {"2:1.0", "1:9.9", 1},
+    {"1:1.0", "1:1.0", 0}};
+
+static void _check_versions(void)
+{
+    char what[128];
+    size_t i;
+
+    for (i = 0; i < sizeof(vercases) / sizeof(vercases[0]); i++)
+    {
+        const struct vercase* c = &vercases[i];
+        int cmp = vercmp(c->a, c->b);
+
+        snprintf(what, sizeof(what), "vercmp %s %s %s", c->a,
+                 c->sign < 0 ? "<" : c->sign > 0 ? ">" : "==", c->b);
+        _check(what, (cmp > 0) - (cmp < 0) == c->sign);
+    }
+}
+
+/* =============================================================================
+ * Fixture
+ * ========================================================================== */
+
+struct manifest
+{
+    const char* name;
+    const char* version;
+    const char* depends;
+    const char* provides;
+    const char* conflicts;
+    int installed;
+};
+
+static const struct manifest manifests[] = {
+    /* Needs a provider, exim can't be it next to sendmail */
+    {"mailer", "1.0", "mta", "", "", 0},
+    {"newmailer", "1.0", "mta>=3", "", "", 0},
+    {"postfix", "3.0", "", "mta=3.0", "", 0},
+    {"exim", "4.0", "", "mta", "sendmail", 0},
+    {"sendmail", "8.0", "", "", "", 1},
+    /* An installed package refusing a newcomer */
+    {"guard", "1.0", "", "", "intruder", 1},
+    {"intruder", "1.0", "", "", "", 0},
+    /* Conflicting requests, with one that has nothing to do with it */
+    {"left", "1.0", "", "", "right", 0},
+    {"right", "1.0", "", "", "", 0},
+    {"bystander", "1.0", "", "", "", 0}};
+
+#define NUM_MANIFESTS (sizeof(manifests) / sizeof(manifests[0]))
+
+static int _write_manifest(const char* repo, const struct manifest* m)
+{
+    char* path = arena_alloc(&g_arena, strlen(repo) + strlen(m->name) + 6);
+    FILE* file;
+
+    if (path == NULL)
+        return -1;
+    sprintf(path, "%s/%s.pkg", repo, m->name);
+
+    file = fopen(path, "w");
+    if (file == NULL)
+    {
+        ERROR("Failed to create '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(file,
+            "PACKAGE_NAME=%s\nPACKAGE_VERSION=%s\n"
+            "PACKAGE_DESCRIPTION=%s\nPACKAGE_MAINTAINERS=Check\n"
+            "PACKAGE_DEPENDS=%s\nPACKAGE_PROVIDES=%s\n"
+            "PACKAGE_CONFLICTS=%s\n"
+            "install() {\n    mkdir -p $DESTDIR/usr/share/%s\n}\n",
+            m->name, m->version, m->name, m->depends, m->provides,
+            m->conflicts, m->name);
+    fclose(file);
+    return 0;
+}
+
+/* Record m as installed the way a commit does */
+static int _write_installed(struct db* db, const struct manifest* m)
+{
+    struct pkg_ctx pkg;
+
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.name = (char*)m->name;
+    pkg.version = (char*)m->version;
+    pkg.description = (char*)m->name;
+    pkg.maintainers = "Check";
+    pkg.depends = (char*)m->depends;
+    pkg.provides = (char*)m->provides;
+    pkg.conflicts = (char*)m->conflicts;
+    pkg.branch = "core";
+    pkg.reason = PKG_REASON_EXPLICIT;
+
+    if (db_write_meta(&pkg) != ACTION_RET_OK ||
+        db_add(db, pkg.name, pkg.version, pkg.branch) != ACTION_RET_OK)
+        return -1;
+    return 0;
+}
+
+static int _write_fixture(const char* dir)
+{
+    char* root = fs_join(dir, "root");
+    char* repo = fs_join(root, "repo/core");
+    char* conf = fs_join(dir, "check.conf");
+    struct db db;
+    FILE* file;
+    size_t i;
+
+    if (fs_mkdir_p(repo, 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", repo, strerror(errno));
+        return -1;
+    }
+
+    file = fopen(conf, "w");
+    if (file == NULL)
+    {
+        ERROR("Failed to create '%s': %s\n", conf, strerror(errno));
+        return -1;
+    }
+    fprintf(file, "ROOT=%s\nREPO_BRANCHES=core\nDEFAULT_BRANCH=core\n"
+                  "CORE=repo/core/\n",
+            root);
+    fclose(file);
+
+    if (config_load(conf) != ACTION_RET_OK || db_load(&db) != ACTION_RET_OK)
+        return -1;
+
+    for (i = 0; i < NUM_MANIFESTS; i++)
+    {
+        if (_write_manifest(repo, &manifests[i]) != 0)
+            return -1;
+        if (manifests[i].installed && _write_installed(&db, &manifests[i]))
+            return -1;
+    }
+    return db_save(&db) == ACTION_RET_OK ? 0 : -1;
+}
+
+/* =============================================================================
+ * Solver
+ * ========================================================================== */
+
+/* Solve requests with stderr, where explanations go, captured into errors */
+static int _solve(const char* dir, const char* requests,
+                  struct solver_pkg** plan, size_t* num_plan, char* errors,
+                  size_t size)
+{
+    char* path = fs_join(dir, "errors.txt");
+    char* words[8];
+    char* copy = strdup_safe(requests);
+    char* save = NULL;
+    size_t n = 0, len;
+    int saved, fd, ret;
+    FILE* file;
+
+    words[n] = strtok_r(copy, " ", &save);
+    while (words[n] != NULL && n < 7)
+        words[++n] = strtok_r(NULL, " ", &save);
+
+    fflush(stderr);
+    saved = dup(STDERR_FILENO);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (saved < 0 || fd < 0)
+        return ACTION_RET_ERR_IO;
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+
+    ret = solver_solve(words, n, plan, num_plan);
+
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    errors[0] = '\0';
+    file = fopen(path, "r");
+    if (file != NULL)
+    {
+        len = fread(errors, 1, size - 1, file);
+        errors[len] = '\0';
+        fclose(file);
+    }
+    return ret;
+}
+
+static struct solver_pkg* _planned(struct solver_pkg* plan, size_t num_plan,
+                                   const char* name)
+{
+    size_t i;
+
+    for (i = 0; i < num_plan; i++)
+        if (strcmp(plan[i].name, name) == 0)
+            return &plan[i];
+    return NULL;
+}
+
+/* What name's first dependency in the plan resolved to */
+static const char* _provider(struct solver_pkg* plan, size_t num_plan,
+                             const char* name)
+{
+    struct solver_pkg* p = _planned(plan, num_plan, name);
+
+    if (p == NULL || p->num_deps != 1 || p->deps[0] >= num_plan)
+        return "";
+    return plan[p->deps[0]].name;
+}
+
+static void _check_solver(const char* dir)
+{
+    struct solver_pkg* plan;
+    size_t num_plan;
+    char errors[4096];
+    int ret;
+
+    ret = _solve(dir, "mailer", &plan, &num_plan, errors, sizeof(errors));
+    _check("provide satisfies a dependency",
+           ret == ACTION_RET_OK && num_plan == 2 &&
+               strcmp(_provider(plan, num_plan, "mailer"), "postfix") == 0 &&
+               plan[0].requested == 0 && plan[1].requested == 1);
+
+    ret = _solve(dir, "newmailer", &plan, &num_plan, errors, sizeof(errors));
+    _check("versioned provide satisfies a constraint",
+           ret == ACTION_RET_OK &&
+               strcmp(_provider(plan, num_plan, "newmailer"), "postfix") ==
+                   0);
+
+    ret = _solve(dir, "exim", &plan, &num_plan, errors, sizeof(errors));
+    _check("request conflicting with an installed package",
+           ret == ACTION_RET_PKG_ERR_CONFLICT &&
+               strstr(errors, "exim-4.0 conflicts with sendmail-8.0") !=
+                   NULL);
+
+    ret = _solve(dir, "intruder", &plan, &num_plan, errors, sizeof(errors));
+    _check("installed package conflicting with a request",
+           ret == ACTION_RET_PKG_ERR_CONFLICT &&
+               strstr(errors, "guard-1.0 (installed)") != NULL);
+
+    ret = _solve(dir, "left right", &plan, &num_plan, errors, sizeof(errors));
+    _check("conflict declared by the first request",
+           ret == ACTION_RET_PKG_ERR_CONFLICT);
+
+    ret = _solve(dir, "right left", &plan, &num_plan, errors, sizeof(errors));
+    _check("conflict declared by the second request",
+           ret == ACTION_RET_PKG_ERR_CONFLICT);
+
+    ret = _solve(dir, "left bystander right", &plan, &num_plan, errors,
+                 sizeof(errors));
+    _check("explanation names only the conflicting requests",
+           ret == ACTION_RET_PKG_ERR_CONFLICT &&
+               strstr(errors, "Can't install left right together") != NULL &&
+               strstr(errors, "bystander") == NULL);
+
+    ret = _solve(dir, "mailer bystander", &plan, &num_plan, errors,
+                 sizeof(errors));
+    _check("unrelated requests solve together",
+           ret == ACTION_RET_OK && num_plan == 3 &&
+               _planned(plan, num_plan, "exim") == NULL);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s DIR\n", argv[0]);
+        return 1;
+    }
+
+    if (arena_init(&g_arena, DEFAULT_ARENA_SIZE) != 0)
+        return 1;
+    memset(&g_config, 0, sizeof(g_config));
+    g_config.jobs = 1;
+    g_config.no_confirm = true;
+
+    _check_versions();
+
+    if (_write_fixture(argv[1]) != 0)
+    {
+        ERROR("Failed to write the fixture under %s\n", argv[1]);
+        arena_destroy(&g_arena);
+        return 1;
+    }
+    _check_solver(argv[1]);
+
+    printf("%lu failed\n", (unsigned long)num_failed);
+    arena_destroy(&g_arena);
+    return num_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+/******************************************************************************
+ * fakesh.c - Minimal stand-in shell for the sandbox benchmark
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Speaks just enough of what the sandbox sends for the benchmark: ":",
+ * "echo WORDS", "cat FILE" and "exit", one command per line. What the
+ * sandbox sends to carry state between functions is ignored, everything
+ * else is reported on stderr. Nothing is forked, so timing it against
+ * /bin/sh separates the cost of the sandbox protocol from the cost of the
+ * shell.
+ */
+
+static void _cat(const char* path)
+{
+    char buf[65536];
+    size_t n;
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "cat: %s: No such file or directory\n", path);
+        return;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        fwrite(buf, 1, n, stdout);
+    fclose(file);
+}
+
+int main(void)
+{
+    char line[4096];
+
+    while (fgets(line, sizeof(line), stdin) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (strcmp(line, ":") == 0 || line[0] == '\0')
+            ;
+        else if (strncmp(line, "set ", 4) == 0 ||
+                 strncmp(line, ". ", 2) == 0 ||
+                 strncmp(line, "export ", 7) == 0 ||
+                 strncmp(line, "pwd", 3) == 0)
+            ; /* State carried between functions, there is none */
+        else if (strcmp(line, "echo") == 0)
+            putchar('\n');
+        else if (strncmp(line, "echo ", 5) == 0)
+            printf("%s\n", line + 5);
+        else if (strncmp(line, "cat ", 4) == 0)
+            _cat(line + 4);
+        else if (strcmp(line, "exit") == 0)
+            break;
+        else
+        {
+            fprintf(stderr, "fakesh: %s: not supported\n", line);
+            fflush(stderr);
+        }
+
+        /* The sandbox waits for each command's output */
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,352 @@
+/******************************************************************************
+ * gen.c - Synthetic repository generator for the benchmarks
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Writes a root under DIR that looks like a long lived installation:
+ *   DIR/bench.conf                    config pointing at DIR/root
+ *   DIR/names.list                    every name a user could ask for
+ *   DIR/root/repo/<branch>/<name>.pkg manifests, about a fifth of them
+ *                                     shadowed by a newer one in the next
+ *                                     branch, plus REDIRECT chains
+ *   DIR/root/etc/piratpkg/...         installed.list and db/<name>/meta
+ * Everything comes from a fixed seed, so runs are comparable.
+ */
+
+#define MAX_CHAIN 3
+
+static const char* prefixes[] = {"lib", "py-", "perl-", "x", "", "font-",
+                                 "ruby-", "go-"};
+static const char* words[] = {
+    "configure", "--prefix=/usr", "--disable-static", "--enable-shared",
+    "make", "-j$JOBS", "install", "DESTDIR=$DESTDIR", "cp", "-r", "sed",
+    "-i", "s/foo/bar/", "Makefile.in", "mkdir", "-p", "$DESTDIR/usr/lib",
+    "ln", "-sf", "rm", "-rf", "docs/", "patch", "-Np1", "<", "fix.patch"};
+
+static unsigned long rng_state = 0x9e3779b97f4a7c15UL;
+
+static unsigned long _rand(void)
+{
+    /* xorshift, same sequence on every run */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static unsigned long _between(unsigned long lo, unsigned long hi)
+{
+    return lo + _rand() % (hi - lo + 1);
+}
+
+static int _mkdir_p(const char* path)
+{
+    char buf[4096];
+    char* p;
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (p = buf + 1; *p != '\0'; p++)
+    {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(buf, 0755) != 0 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+    return mkdir(buf, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+static FILE* _create(const char* fmt, const char* a, const char* b)
+{
+    char path[4096];
+    FILE* file;
+
+    snprintf(path, sizeof(path), fmt, a, b);
+    file = fopen(path, "w");
+    if (file == NULL)
+        fprintf(stderr, "gen: failed to create %s: %s\n", path,
+                strerror(errno));
+    return file;
+}
+
+static int _cmp_str(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* =============================================================================
+ * Manifests
+ * ========================================================================== */
+
+static void _write_function(FILE* file, const char* name)
+{
+    unsigned long lines = _between(3, 25), i, j;
+
+    fprintf(file, "%s() {\n", name);
+    for (i = 0; i < lines; i++)
+    {
+        unsigned long n = _between(2, 8);
+        fputs("    ", file);
+        for (j = 0; j < n; j++)
+            fprintf(file, "%s%s", j ? " " : "",
+                    words[_rand() % (sizeof(words) / sizeof(words[0]))]);
+        fputc('\n', file);
+    }
+    fputs("}\n", file);
+}
+
+static size_t _write_manifest(FILE* file, char** names, size_t i,
+                              const char* version)
+{
+    unsigned long num_deps = i > 0 ? _between(0, 4) : 0, d;
+    unsigned long num_sources = _between(1, 3), s;
+
+    fprintf(file, "PACKAGE_NAME=%s\n", names[i]);
+    fprintf(file, "PACKAGE_VERSION=%s\n", version);
+    fprintf(file, "PACKAGE_DESCRIPTION=Synthetic package number %lu used "
+                  "to benchmark piratpkg\n",
+            (unsigned long)i);
+    fprintf(file, "PACKAGE_MAINTAINERS=Bench <bench@piraterna.org>\n");
+
+    /* Only on earlier packages, so the graph stays acyclic */
+    fputs("PACKAGE_DEPENDS=", file);
+    for (d = 0; d < num_deps; d++)
+    {
+        size_t dep = _rand() % i;
+        if (_rand() % 4 == 0)
+            fprintf(file, "%s%s>=1.0", d ? " " : "", names[dep]);
+        else
+            fprintf(file, "%s%s", d ? " " : "", names[dep]);
+    }
+    fputc('\n', file);
+
+    fputs("SOURCES=", file);
+    for (s = 0; s < num_sources; s++)
+        fprintf(file, "%shttps://mirror.piraterna.org/%s/%s-%lu.tar.gz",
+                s ? " " : "", names[i], version, s);
+    fputc('\n', file);
+    fputs("SOURCES_SHA256=", file);
+    for (s = 0; s < num_sources; s++)
+    {
+        unsigned long k;
+        if (s)
+            fputc(' ', file);
+        for (k = 0; k < 4; k++)
+            fprintf(file, "%016lx", _rand());
+    }
+    fputc('\n', file);
+
+    _write_function(file, "configure");
+    _write_function(file, "build");
+    _write_function(file, "install");
+    return (size_t)ftell(file);
+}
+
+/* =============================================================================
+ * Main
+ * ========================================================================== */
+
+int main(int argc, char** argv)
+{
+    const char* dir;
+    unsigned long num_branches = 4, num_packages = 5000, num_installed = 2000;
+    char** names;
+    char** versions;
+    unsigned long* branch_of;
+    char** installed;
+    char path[4096];
+    FILE* conf;
+    FILE* list;
+    FILE* file;
+    unsigned long i, b, num_redirects = 0, num_manifests = 0;
+    size_t bytes = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s DIR [BRANCHES [PACKAGES [INSTALLED]]]\n",
+                argv[0]);
+        return 1;
+    }
+    dir = argv[1];
+    if (argc > 2)
+        num_branches = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        num_packages = strtoul(argv[3], NULL, 10);
+    if (argc > 4)
+        num_installed = strtoul(argv[4], NULL, 10);
+    if (num_branches < 1 || num_packages < 1)
+    {
+        fprintf(stderr, "gen: need at least one branch and package\n");
+        return 1;
+    }
+    if (num_installed > num_packages)
+        num_installed = num_packages;
+
+    names = calloc(num_packages, sizeof(char*));
+    versions = calloc(num_packages, sizeof(char*));
+    branch_of = calloc(num_packages, sizeof(unsigned long));
+    installed = calloc(num_installed + 1, sizeof(char*));
+    if (!names || !versions || !branch_of || !installed)
+        return 1;
+
+    for (b = 0; b < num_branches; b++)
+    {
+        snprintf(path, sizeof(path), "%s/root/repo/b%lu", dir, b);
+        if (_mkdir_p(path) != 0)
+        {
+            fprintf(stderr, "gen: failed to create %s: %s\n", path,
+                    strerror(errno));
+            return 1;
+        }
+    }
+    snprintf(path, sizeof(path), "%s/root/etc/piratpkg/db", dir);
+    if (_mkdir_p(path) != 0)
+        return 1;
+
+    /* ROOT has to be absolute */
+    dir = realpath(dir, NULL);
+    if (dir == NULL)
+        return 1;
+
+    for (i = 0; i < num_packages; i++)
+    {
+        names[i] = malloc(32);
+        versions[i] = malloc(32);
+        sprintf(names[i], "%s%05lu",
+                prefixes[_rand() % (sizeof(prefixes) / sizeof(prefixes[0]))],
+                i);
+        sprintf(versions[i], "%lu.%lu.%lu", _between(1, 9), _between(0, 30),
+                _between(0, 99));
+        branch_of[i] = _rand() % num_branches;
+    }
+
+    snprintf(path, sizeof(path), "%s/names.list", dir);
+    list = fopen(path, "w");
+    if (list == NULL)
+        return 1;
+
+    for (i = 0; i < num_packages; i++)
+    {
+        unsigned long chain;
+
+        snprintf(path, sizeof(path), "%s/root/repo/b%lu/%s.pkg", dir,
+                 branch_of[i], names[i]);
+        file = fopen(path, "w");
+        if (file == NULL)
+            return 1;
+        bytes += _write_manifest(file, names, i, versions[i]);
+        fclose(file);
+        num_manifests++;
+        fprintf(list, "%s\n", names[i]);
+
+        /* Shadowed by a newer build in the next branch */
+        if (num_branches > 1 && _rand() % 5 == 0)
+        {
+            b = (branch_of[i] + 1) % num_branches;
+            snprintf(path, sizeof(path), "%s/root/repo/b%lu/%s.pkg", dir, b,
+                     names[i]);
+            file = fopen(path, "w");
+            if (file == NULL)
+                return 1;
+            bytes += _write_manifest(file, names, i, versions[i]);
+            fclose(file);
+            num_manifests++;
+            fprintf(list, "%s:b%lu\n", names[i], b);
+        }
+
+        /* Renamed packages, each old name redirecting to the next */
+        if (_rand() % 20 == 0)
+        {
+            char target[64];
+            char alias[64];
+
+            strcpy(target, names[i]);
+            for (chain = _between(1, MAX_CHAIN); chain > 0; chain--)
+            {
+                sprintf(alias, "old%lu-%s", chain, names[i]);
+                snprintf(path, sizeof(path), "%s/root/repo/b%lu/%s.pkg", dir,
+                         branch_of[i], alias);
+                file = fopen(path, "w");
+                if (file == NULL)
+                    return 1;
+                fprintf(file, "REDIRECT=%s\n", target);
+                fclose(file);
+                fprintf(list, "%s\n", alias);
+                num_redirects++;
+                strcpy(target, alias);
+            }
+        }
+    }
+    fclose(list);
+
+    /* Spread the installed set over the whole universe */
+    for (i = 0; i < num_installed; i++)
+    {
+        unsigned long at = i * num_packages / num_installed;
+        char key[65];
+        unsigned long k;
+
+        installed[i] = malloc(128);
+        sprintf(installed[i], "%s\t%s\tb%lu", names[at], versions[at],
+                branch_of[at]);
+
+        snprintf(path, sizeof(path), "%s/root/etc/piratpkg/db/%s", dir,
+                 names[at]);
+        if (_mkdir_p(path) != 0)
+            return 1;
+        file = _create("%s/root/etc/piratpkg/db/%s/meta", dir, names[at]);
+        if (file == NULL)
+            return 1;
+        for (k = 0; k < 4; k++)
+            sprintf(key + k * 16, "%016lx", _rand());
+        fprintf(file,
+                "PACKAGE_NAME=%s\nPACKAGE_VERSION=%s\n"
+                "PACKAGE_DESCRIPTION=Synthetic package number %lu\n"
+                "PACKAGE_MAINTAINERS=Bench <bench@piraterna.org>\n"
+                "PACKAGE_DEPENDS=\nPACKAGE_PROVIDES=\nPACKAGE_CONFLICTS=\n"
+                "BRANCH=b%lu\nBUILD_KEY=%s\nREASON=explicit\n",
+                names[at], versions[at], at, branch_of[at], key);
+        fclose(file);
+    }
+
+    qsort(installed, num_installed, sizeof(char*), _cmp_str);
+    file = _create("%s/root/etc/piratpkg/installed.list%s", dir, "");
+    if (file == NULL)
+        return 1;
+    for (i = 0; i < num_installed; i++)
+        fprintf(file, "%s\n", installed[i]);
+    fclose(file);
+
+    snprintf(path, sizeof(path), "%s/bench.conf", dir);
+    conf = fopen(path, "w");
+    if (conf == NULL)
+        return 1;
+    fprintf(conf, "ROOT=%s/root\nREPO_BRANCHES=", dir);
+    for (b = 0; b < num_branches; b++)
+        fprintf(conf, "%sb%lu", b ? " " : "", b);
+    fprintf(conf, "\nDEFAULT_BRANCH=b0\n\n# Branches\n");
+    for (b = 0; b < num_branches; b++)
+        fprintf(conf, "B%lu=repo/b%lu/\n", b, b);
+    fclose(conf);
+
+    printf("Generated %lu manifests (%lu KiB) and %lu redirects in %lu "
+           "branches, %lu installed\n",
+           num_manifests, (unsigned long)(bytes / 1024), num_redirects,
+           num_branches, num_installed);
+    return 0;
+}
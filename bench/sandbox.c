@@ -0,0 +1,159 @@
+/******************************************************************************
+ * sandbox.c - Sandbox round-trip benchmark
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <piratpkg.h>
+#include <sandbox.h>
+#include <log.h>
+
+/*
+ * Times what every package pays for its sandbox: a shell per function, a
+ * command that does nothing, and a command with a lot of output.
+ * Each shell given on the command line is measured in turn, typically
+ * /bin/sh and bench/fakesh, so the numbers for the protocol itself can be
+ * told apart from those of the shell.
+ */
+
+#define SPAWNS 200
+#define ROUND_TRIPS 2000
+#define OUTPUT_RUNS 5
+#define OUTPUT_SIZE (16 * 1024 * 1024)
+
+struct arena g_arena;
+struct config g_config;
+
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _report(const char* what, size_t ops, double start)
+{
+    double secs = _now() - start;
+
+    printf("  %-18s %8lu ops %10.2f ms %10.1f us/op\n", what,
+           (unsigned long)ops, secs * 1e3, secs * 1e6 / ops);
+    fflush(stdout);
+}
+
+/* OUTPUT_SIZE bytes of text for the shells to cat */
+static int _write_output(char* path)
+{
+    char line[80];
+    size_t written = 0;
+    FILE* file;
+    int fd;
+
+    strcpy(path, "/tmp/piratpkg-bench-XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0 || (file = fdopen(fd, "w")) == NULL)
+    {
+        ERROR("Failed to create %s\n", path);
+        return -1;
+    }
+
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+    while (written < OUTPUT_SIZE)
+        written += fwrite(line, 1, sizeof(line), file);
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int _bench_shell(char* const envp[], const char* output)
+{
+    struct sandbox_ctx* ctx;
+    struct sandbox_usage usage;
+    char command[64];
+    double start;
+    size_t i;
+
+    ctx = sandbox_create(envp, NULL);
+    if (ctx == NULL)
+        return -1;
+
+    /* Every function starts a shell and is accounted for on exit */
+    start = _now();
+    for (i = 0; i < SPAWNS; i++)
+    {
+        if (sandbox_exec(ctx, ":", true) != 0 ||
+            sandbox_finish(ctx, &usage) != 0)
+            break;
+    }
+    _report("spawn", SPAWNS, start);
+
+    start = _now();
+    for (i = 0; i < ROUND_TRIPS; i++)
+    {
+        if (sandbox_exec(ctx, ":", true) != 0)
+            break;
+    }
+    _report("round trip", ROUND_TRIPS, start);
+
+    snprintf(command, sizeof(command), "cat %s", output);
+    start = _now();
+    for (i = 0; i < OUTPUT_RUNS; i++)
+    {
+        if (sandbox_exec(ctx, command, true) != 0)
+            break;
+    }
+    _report("output", OUTPUT_RUNS, start);
+    printf("  %-18s %8.1f MiB/s\n", "throughput",
+           OUTPUT_RUNS * (OUTPUT_SIZE / 1048576.0) / (_now() - start));
+
+    sandbox_destroy(ctx);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    char* envp[] = {NULL};
+    char output[64];
+    int i, status = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s SHELL...\n", argv[0]);
+        return 1;
+    }
+
+    if (arena_init(&g_arena, DEFAULT_ARENA_SIZE) != 0)
+        return 1;
+    memset(&g_config, 0, sizeof(g_config));
+
+    if (_write_output(output) != 0)
+        return 1;
+
+    for (i = 1; i < argc && status == 0; i++)
+    {
+        /* The shell is started from inside the sandbox directory */
+        g_config.sandbox_shell = realpath(argv[i], NULL);
+        if (g_config.sandbox_shell == NULL)
+        {
+            ERROR("No shell at %s\n", argv[i]);
+            status = -1;
+            break;
+        }
+
+        printf("%s\n", argv[i]);
+        status = _bench_shell(envp, output);
+    }
+
+    unlink(output);
+    arena_destroy(&g_arena);
+    return status == 0 ? 0 : 1;
+}
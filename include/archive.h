@@ -0,0 +1,102 @@
+/******************************************************************************
+ * archive.h - Binary package format
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_ARCHIVE_H
+#define PIRATPKG_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <hash.h>
+#include <db.h>
+
+/*
+ * A .ppkg file is a 16 byte header followed by a stream of records, read
+ * strictly front to back so archives can be piped:
+ *
+ *   header   "PPKGBIN\0", u32 version, u32 flags
+ *   record   u8 type, u8[3] reserved, u32 mode, u64 size, u32 path_len,
+ *            u32 pad, u8[32] sha256, then path_len bytes of path, pad zero
+ *            bytes and size bytes of data
+ *
+ * Regular files of at least ARCHIVE_ALIGN bytes are padded so their data
+ * starts block aligned, which lets extraction reflink it out of the archive.
+ *
+ * The first record is always ARCHIVE_REC_META (KEY=VALUE lines) and the
+ * last ARCHIVE_REC_END, whose sha256 covers every byte before it except
+ * regular file contents. Those are covered by their own record's sha256,
+ * the same hash recorded in the installed file manifest. Integers are
+ * little endian.
+ */
+#define ARCHIVE_MAGIC "PPKGBIN"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 16
+#define ARCHIVE_RECORD_SIZE 56
+#define ARCHIVE_EXT ".ppkg"
+#define ARCHIVE_ALIGN 4096
+
+#define ARCHIVE_REC_META 'M'
+#define ARCHIVE_REC_END 'E'
+/* File records reuse DB_FILE_REG, DB_FILE_DIR and DB_FILE_LNK */
+
+struct archive_writer
+{
+    int fd;
+    char* path;
+    char* tmp_path;
+    uint64_t offset; /* Bytes written so far */
+    struct sha256_ctx ctx;
+};
+
+struct archive_reader
+{
+    int fd;
+    struct sha256_ctx ctx;
+    uint64_t remaining; /* Unread data bytes of the current record */
+    char type;          /* Type of the current record */
+};
+
+struct archive_entry
+{
+    char type;
+    mode_t mode;
+    uint64_t size;
+    char* path;
+    char hash[SHA256_HEX_SIZE];
+};
+
+/* Writing */
+int archive_write_open(struct archive_writer* w, const char* path,
+                       const char* meta);
+int archive_write_file(struct archive_writer* w, const char* staging_dir,
+                       struct db_file* f);
+int archive_write_close(struct archive_writer* w);
+void archive_write_abort(struct archive_writer* w);
+
+/* Streaming reads, archive_read_next() returns 1 per record, 0 once the
+ * end record verified and a negative ACTION_RET_* on errors */
+int archive_read_open(struct archive_reader* r, const char* path);
+int archive_read_next(struct archive_reader* r, struct archive_entry* e);
+long archive_read_data(struct archive_reader* r, void* buf, size_t len);
+int archive_skip_data(struct archive_reader* r);
+
+/* Step over a regular file's data without reading it and return where it
+ * starts, or -1 (consuming nothing) when the archive can't seek */
+off_t archive_seek_data(struct archive_reader* r);
+void archive_read_close(struct archive_reader* r);
+
+/* Whole archives */
+int archive_create(const char* path, const char* meta, const char* staging_dir,
+                   struct db_file* files, size_t num_files);
+int archive_read_meta(const char* path, char** meta);
+int archive_extract(const char* path, const char* dest_dir,
+                    struct db_file** files, size_t* num_files);
+
+#endif /* PIRATPKG_ARCHIVE_H */
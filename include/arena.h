@@ -18,11 +18,15 @@
 
 #define DEFAULT_ARENA_SIZE 16384 /* 16KB */
 
+struct arena_block;
+
 struct arena
 {
-    void* base;    /* Base of the arena (memory pool) */
-    size_t size;   /* Total size of the arena */
-    size_t offset; /* Current allocation offset */
+    void* base;                 /* Base of the current block (memory pool) */
+    size_t size;                /* Total size of the current block */
+    size_t offset;              /* Current allocation offset */
+    struct arena_block* blocks; /* Retired blocks, kept alive until reset */
+    void* last;                 /* Most recent allocation, for realloc */
 };
 
 int arena_init(struct arena* arena, size_t size);
@@ -0,0 +1,52 @@
+/******************************************************************************
+ * budget.h - CPU, memory and IO budgets of builds
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_BUDGET_H
+#define PIRATPKG_BUDGET_H
+
+#include <piratpkg.h>
+
+/*
+ * Every branch may set <BRANCH>_CPUS, <BRANCH>_MEMORY_MAX and
+ * <BRANCH>_IO_WEIGHT in piratpkg.conf. Sandboxes of its packages then run
+ * in a cgroup v2 leaf of their own with cpu.max, memory.max and io.weight
+ * set from those. The leaves live under CGROUP_ROOT, or under the cgroup
+ * piratpkg was started in, which piratpkg moves itself out of. Either has
+ * to be delegated to the user running piratpkg.
+ *
+ * Without a usable cgroup the shells are pinned to as many CPUs as the
+ * branch may use, each budgeted branch on its own CPUs where there are
+ * enough, and get the memory budget as RLIMIT_AS. IO weights are then
+ * not enforced.
+ */
+
+#define BUDGET_CPU_PERIOD 100000 /* cpu.max period, microseconds */
+
+struct budget;
+
+/* Budget of a sandbox of branch, NULL branch or NULL return for none */
+struct budget* budget_create(const struct repo_branch* branch);
+
+/* Put the calling process under b. Only makes system calls, so it is safe
+ * between fork() and exec() of a threaded process. */
+void budget_enter(const struct budget* b);
+
+/* Kill everything in the cgroup leaf of b, if it has one */
+void budget_kill(const struct budget* b);
+
+/* Remove the cgroup leaf of b, once nothing runs in it anymore */
+void budget_destroy(struct budget* b);
+
+/* With --background, move the calling thread to SCHED_IDLE (SCHED_BATCH
+ * at the lowest nice value where that isn't allowed) and the idle IO
+ * class. Processes it forks after this inherit both. */
+void budget_background(void);
+
+#endif /* PIRATPKG_BUDGET_H */
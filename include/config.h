@@ -0,0 +1,21 @@
+/******************************************************************************
+ * config.h - Configuration file loading
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_CONFIG_H
+#define PIRATPKG_CONFIG_H
+
+/* Read the KEY=VALUE config file at path into g_config and validate it.
+ * Branch paths are made absolute under ROOT. */
+int config_load(const char* path);
+
+/* path inside ROOT, allocated in g_arena */
+char* get_full_path(const char* path);
+
+#endif /* PIRATPKG_CONFIG_H */
@@ -0,0 +1,64 @@
+/******************************************************************************
+ * copy.h - Parallel file copy workers
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_COPY_H
+#define PIRATPKG_COPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define COPY_MAX_WORKERS 8
+#define COPY_QUEUE_SIZE 64
+
+/*
+ * One file to write. Jobs only hold pointers, everything they point to must
+ * outlive copy_pool_finish(). Workers never touch g_arena.
+ */
+struct copy_job
+{
+    int src_fd;            /* Shared source read at src_off, or -1 */
+    const char* src_path;  /* Whole file to copy when src_fd is -1 */
+    off_t src_off;
+    off_t size;
+    const char* dst;
+    const char* rename_to; /* Renamed over once complete, or NULL */
+    mode_t mode;
+    const char* hash;      /* Expected sha256 of the result, or NULL */
+    const char* name;      /* Shown in error messages */
+};
+
+struct copy_pool
+{
+    pthread_t threads[COPY_MAX_WORKERS];
+    size_t num_threads;
+    struct copy_job queue[COPY_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    bool closing;
+    int error; /* First failure as an ACTION_RET_* code */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+/* Start up to workers threads, 0 picks one per CPU up to COPY_MAX_WORKERS.
+ * Without any threads jobs simply run on submit. */
+int copy_pool_start(struct copy_pool* pool, size_t workers);
+
+/* Queue a job, blocking while the queue is full. Returns the first error
+ * seen so far so callers can stop early. */
+int copy_pool_submit(struct copy_pool* pool, const struct copy_job* job);
+
+/* Wait for every queued job and stop the workers */
+int copy_pool_finish(struct copy_pool* pool);
+
+#endif /* PIRATPKG_COPY_H */
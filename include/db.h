@@ -0,0 +1,77 @@
+/******************************************************************************
+ * db.h - Installed package database
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_DB_H
+#define PIRATPKG_DB_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <hash.h>
+
+/*
+ * Layout under $ROOT/etc/piratpkg:
+ *   installed.list     "name<TAB>version<TAB>branch" per package, sorted
+ *   db/<name>/meta     KEY=VALUE metadata recorded at install time
+ *   db/<name>/files    tab separated file manifest, see struct db_file
+ */
+#define DB_DIR "etc/piratpkg"
+
+struct pkg_ctx;
+
+struct db_entry
+{
+    char* name;
+    char* version;
+    char* branch;
+};
+
+struct db
+{
+    struct db_entry* entries; /* Sorted by name */
+    size_t num_entries;
+    size_t cap;
+};
+
+/* File manifest entry types */
+#define DB_FILE_REG 'f'
+#define DB_FILE_DIR 'd'
+#define DB_FILE_LNK 'l'
+
+struct db_file
+{
+    char type;
+    mode_t mode;
+    off_t size;
+    char hash[SHA256_HEX_SIZE]; /* Contents, or link target for symlinks */
+    char* path;                 /* Absolute path inside ROOT */
+    char* target;               /* Symlink target, NULL otherwise */
+};
+
+/* Path of rel inside the database directory, allocated in g_arena */
+char* db_path(const char* rel);
+
+/* installed.list */
+int db_load(struct db* db);
+int db_save(struct db* db);
+struct db_entry* db_find(struct db* db, const char* name);
+int db_add(struct db* db, const char* name, const char* version,
+           const char* branch);
+int db_remove(struct db* db, const char* name);
+
+/* Per package records, meta uses the manifest's KEY=VALUE syntax */
+char* db_meta_text(struct pkg_ctx* pkg);
+int db_parse_meta(const char* text, struct pkg_ctx* pkg);
+int db_write_meta(struct pkg_ctx* pkg);
+int db_read_meta(const char* name, struct pkg_ctx* pkg);
+int db_write_files(const char* name, struct db_file* files, size_t num_files);
+int db_read_files(const char* name, struct db_file** files, size_t* num_files);
+int db_remove_package(const char* name);
+
+#endif /* PIRATPKG_DB_H */
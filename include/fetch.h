@@ -0,0 +1,37 @@
+/******************************************************************************
+ * fetch.h - Source downloads and the source cache
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_FETCH_H
+#define PIRATPKG_FETCH_H
+
+#include <stddef.h>
+
+struct pkg_ctx;
+
+/* Concurrent downloads while prefetching */
+#define FETCH_MAX_PARALLEL 8
+
+/*
+ * Sources are stored once, by sha256, under SOURCE_CACHE. Each one is looked
+ * for in SOURCE_MIRROR (as <sha256>, then by file name) before its own URL.
+ * URLs may be file:// or plain paths, anything else goes through curl or
+ * wget.
+ */
+
+/* Path a source with the given sha256 is cached at, allocated in g_arena */
+char* fetch_cache_path(const char* sha256);
+
+/* Download every missing source of the given packages in parallel */
+int fetch_sources(struct pkg_ctx** pkgs, size_t num_pkgs);
+
+/* Copy a package's cached sources into dir under their file names */
+int fetch_place(struct pkg_ctx* pkg, const char* dir);
+
+#endif /* PIRATPKG_FETCH_H */
@@ -0,0 +1,39 @@
+/******************************************************************************
+ * fs.h - Filesystem helpers
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_FS_H
+#define PIRATPKG_FS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Join two path components with exactly one '/', allocated in g_arena */
+char* fs_join(const char* a, const char* b);
+
+/* mkdir -p, existing directories are not an error */
+int fs_mkdir_p(const char* path, mode_t mode);
+
+/* rm -rf, never follows symlinks */
+int fs_remove_tree(const char* path);
+
+/* Copy len bytes of in starting at offset to out's current position, using
+ * copy_file_range() where the kernel allows it. A short source is EPIPE. */
+int fs_copy_range(int in, off_t offset, int out, off_t len);
+
+/* Copy a regular file's contents, creating dst with the given mode. Tries a
+ * FICLONE reflink first. */
+int fs_copy_file(const char* src, const char* dst, mode_t mode);
+
+/* Write to path.tmp and rename over path on close, so readers never see a
+ * torn file. fs_close_atomic() returns an ACTION_RET_* code. */
+FILE* fs_open_atomic(const char* path, char** tmp_path);
+int fs_close_atomic(FILE* file, const char* tmp_path, const char* path);
+
+#endif /* PIRATPKG_FS_H */
@@ -0,0 +1,39 @@
+/******************************************************************************
+ * hash.h - SHA-256 hashing
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_HASH_H
+#define PIRATPKG_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1) /* Including '\0' */
+
+struct sha256_ctx
+{
+    uint32_t state[8];
+    uint64_t length; /* Total message length in bytes */
+    unsigned char buffer[64];
+    size_t buffer_len;
+};
+
+void sha256_init(struct sha256_ctx* ctx);
+void sha256_update(struct sha256_ctx* ctx, const void* data, size_t len);
+void sha256_final(struct sha256_ctx* ctx, unsigned char digest[32]);
+
+/* Finish the hash and write it as lowercase hex into hex (SHA256_HEX_SIZE) */
+void sha256_final_hex(struct sha256_ctx* ctx, char* hex);
+
+/* One-shot helpers, both write lowercase hex into hex (SHA256_HEX_SIZE) */
+void sha256_hex(const void* data, size_t len, char* hex);
+int sha256_file(const char* path, char* hex);
+
+#endif /* PIRATPKG_HASH_H */
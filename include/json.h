@@ -0,0 +1,22 @@
+/******************************************************************************
+ * json.h - Minimal JSON output helpers
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_JSON_H
+#define PIRATPKG_JSON_H
+
+#include <stdio.h>
+
+/* Write str as a quoted JSON string, NULL is written as null */
+void json_string(FILE* out, const char* str);
+
+/* Write "key": "value" with a leading ", " unless first */
+void json_field(FILE* out, const char* key, const char* value, int first);
+
+#endif /* PIRATPKG_JSON_H */
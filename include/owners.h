@@ -0,0 +1,59 @@
+/******************************************************************************
+ * owners.h - Path ownership index
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_OWNERS_H
+#define PIRATPKG_OWNERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <db.h>
+
+/*
+ * Maps every installed file and symlink to the package owning it, stored as
+ * a compressed (radix) path trie in $ROOT/etc/piratpkg/owners.idx next to
+ * installed.list. Queries walk the mmap()ed file directly, so a lookup costs
+ * O(path length) no matter how many files are installed. A transaction
+ * thaws the trie into memory on its first update and keeps it there, each
+ * commit only writes it back.
+ */
+
+struct owners_node;
+struct owners_disk;
+
+struct owners_index
+{
+    /* Read-only view of owners.idx, NULL if it did not exist */
+    const struct owners_disk* disk;
+    size_t disk_size;
+
+    /* Editable trie, only built once the index is modified */
+    struct owners_node* root;
+    char** owners;
+    size_t num_owners;
+    size_t cap_owners;
+};
+
+int owners_load(struct owners_index* idx);
+void owners_close(struct owners_index* idx);
+
+/* Name of the package owning path, NULL if nobody does */
+const char* owners_find(struct owners_index* idx, const char* path);
+
+/* Updates, directories are never tracked since packages share them */
+int owners_add(struct owners_index* idx, const char* name,
+               struct db_file* files, size_t num_files);
+int owners_remove(struct owners_index* idx, const char* name,
+                  struct db_file* files, size_t num_files);
+int owners_save(struct owners_index* idx);
+
+/* Rebuild owners.idx from every recorded file manifest */
+int owners_rebuild(struct owners_index* idx);
+
+#endif /* PIRATPKG_OWNERS_H */
@@ -16,6 +16,7 @@
 
 #include <arena.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifndef _DEV
 #define DEFAULT_CONFIG_FILE "/etc/piratpkg/piratpkg.conf"
@@ -54,14 +55,33 @@ struct config
     char* repo_branches;          /* Available repository branches */
     char* default_branch;         /* Default branch to use */
     struct repo_branch* branches; /* Branch information */
+    char* binary_repo;            /* Prebuilt .ppkg archives */
+    char* build_cache;            /* Build outputs keyed by build key */
+    char* source_cache;           /* Downloaded sources keyed by sha256 */
+    char* source_mirror;          /* Tried before each source's own URL */
+    char* sandbox_shell;          /* Shell functions run in, /bin/sh */
+    char* cgroup_root;            /* Delegated cgroup for build budgets */
+    size_t jobs;                  /* Packages built at once (--jobs) */
+    int timings_threshold;        /* Percent slowdown flagged, -1 unset */
+    long function_timeout;        /* Seconds per function, 0 for none */
+    long idle_timeout;            /* Seconds without output, -1 unset */
     bool verbose;                 /* Verbose status*/
     bool no_confirm;              /* Auto append yes to questions */
+    bool json;                    /* Machine readable output (--json) */
+    bool dry_run;                 /* Only show what would be built */
+    bool background;              /* Build at idle priority */
+    bool resume;                  /* Finish an interrupted install */
 };
 
 struct repo_branch
 {
     char* name;
     char* path;
+
+    /* Build budget, <NAME>_CPUS and so on, 0 for none. See budget.h. */
+    double cpus;              /* CPUs, may be fractional */
+    unsigned long memory_max; /* Bytes */
+    unsigned long io_weight;  /* 1 to 10000 */
 };
 
 /* Globals */
@@ -13,6 +13,37 @@
 
 #include <stdbool.h>
 #include <sandbox.h>
+#include <hash.h>
+#include <db.h>
+#include <rdeps.h>
+#include <owners.h>
+
+/* The indexes commits update. A transaction loads them once and every
+ * commit writes them back, the ownership trie is only thawed the first time
+ * it changes. */
+struct pkg_db
+{
+    struct db db;
+    struct rdeps rdeps;
+    struct owners_index owners;
+};
+
+int pkg_db_open(struct pkg_db* pdb);
+void pkg_db_close(struct pkg_db* pdb);
+
+/* PREFIX of every function, relative to ROOT like everything staged */
+#define PKG_PREFIX "/usr"
+
+/* Why a package was installed, recorded as REASON in its meta */
+#define PKG_REASON_EXPLICIT "explicit"
+#define PKG_REASON_DEPENDENCY "dependency"
+
+/* Resources one function of a package used */
+struct pkg_usage
+{
+    const char* function;
+    struct sandbox_usage usage;
+};
 
 struct pkg_ctx
 {
@@ -22,15 +53,45 @@ struct pkg_ctx
     char* version;
     char* maintainers;
     char* branch;
+    char* path;    /* Manifest the package was parsed from */
+    char* depends;   /* PACKAGE_DEPENDS, whitespace separated constraints */
+    char* provides;  /* PACKAGE_PROVIDES, virtual names, "name[=version]" */
+    char* conflicts; /* PACKAGE_CONFLICTS, constraints */
+    char* triggers;  /* TRIGGERS, run once after the transaction */
+    const char* reason; /* PKG_REASON_*, why it was installed */
+
+    /* SOURCES and their SOURCES_SHA256, in the same order */
+    char** sources;
+    char** source_hashes;
+    size_t num_sources;
+
+    /* Hash of everything a build reads: manifest, envp and dependencies */
+    char build_key[SHA256_HEX_SIZE];
+    char manifest_hash[SHA256_HEX_SIZE]; /* Of the manifest alone */
+
+    /* Staging directory install() writes into, exported as DESTDIR */
+    char* destdir;
 
     /* Functions */
     struct function_entry** functions;
     size_t num_functions;
 
+    /* Staged tree, filled by pkg_unpack() or pkg_build() */
+    struct db_file* files;
+    size_t num_files;
+
     /* Sandbox */
     char* envp[256];
     size_t num_envp;
     struct sandbox_ctx* sandbox;
+
+    /* Functions of pkg_build() a failed build of the same manifest got
+     * through, in the work directory it left */
+    size_t num_done;
+
+    /* One per function run, in order */
+    struct pkg_usage* usage;
+    size_t num_usage;
 };
 
 typedef int (*function_callback_t)(struct pkg_ctx* pkg, char** args);
@@ -44,7 +105,67 @@ struct function_entry
 };
 
 struct pkg_ctx* pkg_parse(const char* package_name);
-int pkg_install(struct pkg_ctx* pkg);
-int pkg_uninstall(struct pkg_ctx* pkg);
+
+/* Manifest of "name[:branch]", from the first branch that has one without
+ * a branch. NULL if there is none. Cuts package_name at the ':'. */
+char* pkg_get_path(char* package_name);
+bool pkg_ask_confirm(const char* question);
+
+/*
+ * Install stages, run in this order by the transaction pipeline (txn.c).
+ * A package is staged either by pkg_unpack() from the archive pkg_prebuilt()
+ * found, or by pkg_prepare() and pkg_build() from source. Both leave the
+ * staged tree's manifest in pkg->files.
+ *
+ * Functions see DESTDIR, the staging tree, and PREFIX, the install prefix
+ * as seen from inside ROOT (PKG_PREFIX). ROOT never shows up in either:
+ * `make PREFIX=$PREFIX DESTDIR=$DESTDIR install` stages $DESTDIR/usr/...,
+ * which the commit moves to $ROOT/usr/... ROOT itself is exported too, for
+ * post_install() and uninstall(), which run against the installed tree.
+ *
+ * Functions run in a work directory of their own under the database. When
+ * a build fails there, the directory and a checkpoint after each function
+ * before install() that succeeded are kept. The next pkg_prepare() of an
+ * unchanged manifest resumes after the last one instead of starting over.
+ */
+char* pkg_prebuilt(struct pkg_ctx* pkg, bool use_binary);
+int pkg_unpack(struct pkg_ctx* pkg, const char* archive);
+int pkg_prepare(struct pkg_ctx* pkg);
+int pkg_build(struct pkg_ctx* pkg);
+int pkg_commit(struct pkg_ctx* pkg, struct pkg_db* pdb);
+void pkg_cleanup(struct pkg_ctx* pkg);
+
+/* Dependencies installed since pkg_parse() change the build key */
+int pkg_refresh_build_key(struct pkg_ctx* pkg);
+
+int pkg_build_binary(struct pkg_ctx* pkg);
+int pkg_uninstall(const char* package_name);
+
+/* Uninstall what was only installed as a dependency and isn't needed by
+ * anything explicitly installed anymore */
+int pkg_autoremove(void);
+
+int pkg_fetch(struct pkg_ctx** pkgs, size_t num_pkgs);
+int pkg_owns(const char* path);
+int pkg_search(char** terms, size_t num_terms);
+
+/* Queries that only read the installed database and the repository index */
+struct pkg_update
+{
+    const char* name;
+    const char* installed;
+    const char* available;
+    const char* branch;
+    char* spec; /* What to pass to install, name=version:branch */
+};
+
+int pkg_find_updates(struct pkg_update** updates, size_t* num_updates);
+int pkg_list(void);
+int pkg_info(char** names, size_t num_names);
+int pkg_outdated(void);
+
+/* Build times of every package built from source (or only of names), with
+ * the ones slower than their history flagged */
+int pkg_timings(char** names, size_t num_names);
 
 #endif /* PIRATPKG_PKG_H */
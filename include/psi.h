@@ -0,0 +1,30 @@
+/******************************************************************************
+ * psi.h - Pressure stall information of the host
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_PSI_H
+#define PIRATPKG_PSI_H
+
+/*
+ * The avg10 figures of /proc/pressure/{cpu,memory,io}: the percentage of
+ * the last ten seconds some (or all, "full") runnable tasks were stalled
+ * waiting for the resource.
+ */
+struct psi
+{
+    double cpu_some;
+    double memory_some;
+    double memory_full;
+    double io_some;
+};
+
+/* -1 when the kernel has no PSI, CONFIG_PSI off or psi=0 */
+int psi_read(struct psi* p);
+
+#endif /* PIRATPKG_PSI_H */
@@ -0,0 +1,64 @@
+/******************************************************************************
+ * rdeps.h - Reverse dependency index
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_RDEPS_H
+#define PIRATPKG_RDEPS_H
+
+#include <stddef.h>
+
+/*
+ * One "name<TAB>dependent" line per PACKAGE_DEPENDS entry of every installed
+ * package, sorted, in $ROOT/etc/piratpkg/rdeps.list. Constraints are
+ * dropped and virtual names are kept as written, so the dependents of a
+ * package are the lines of its own name and of whatever it provides.
+ * provides.list next to it holds a "virtual<TAB>provider" line per
+ * PACKAGE_PROVIDES entry, which answers who provides a name without reading
+ * every meta. Commits and uninstalls keep both current; databases from
+ * before them get both built from db/<name>/meta on first load.
+ */
+
+struct rdeps_edge
+{
+    char* name;      /* Dependency name */
+    char* dependent; /* Installed package depending on it */
+};
+
+struct rdeps
+{
+    struct rdeps_edge* edges; /* Sorted by name, then dependent */
+    size_t num_edges;
+    size_t cap;
+    struct rdeps_edge* provides; /* Sorted by virtual name, then provider */
+    size_t num_provides;
+    size_t provides_cap;
+};
+
+int rdeps_load(struct rdeps* idx);
+int rdeps_save(struct rdeps* idx);
+
+/* Record or forget the edges of pkg's PACKAGE_DEPENDS and PACKAGE_PROVIDES.
+ * Removing with either NULL drops every such edge of pkg. */
+int rdeps_add(struct rdeps* idx, const char* pkg, const char* depends,
+              const char* provides);
+void rdeps_remove(struct rdeps* idx, const char* pkg, const char* depends,
+                  const char* provides);
+
+/* Edges whose dependency is name, *first is the first of them */
+size_t rdeps_find(struct rdeps* idx, const char* name,
+                  struct rdeps_edge** first);
+
+/* Installed packages providing name, as edges with it as their name */
+size_t rdeps_providers(struct rdeps* idx, const char* name,
+                       struct rdeps_edge** first);
+
+/* Rebuild rdeps.list and provides.list from every recorded meta */
+int rdeps_rebuild(struct rdeps* idx);
+
+#endif /* PIRATPKG_RDEPS_H */
@@ -0,0 +1,67 @@
+/******************************************************************************
+ * repoidx.h - Searchable index of the repository branches
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_REPOIDX_H
+#define PIRATPKG_REPOIDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every manifest of every configured branch, stored in
+ * $ROOT/etc/piratpkg/repo.idx together with a trigram index over the
+ * lowercased PACKAGE_NAME and PACKAGE_DESCRIPTION. Dependency keys are kept
+ * as well, so resolving never has to open a manifest. Entries remember the
+ * mtime and size their manifest had when it was read, so a refresh only
+ * re-reads manifests that changed and only lists a branch directory again
+ * when the directory itself changed. Searches intersect posting lists in
+ * the mmap()ed file and never open a manifest.
+ */
+
+struct repoidx_disk;
+
+struct repo_index
+{
+    const struct repoidx_disk* disk;
+    size_t disk_size;
+    int owned; /* disk is a malloc()ed copy that could not be saved */
+};
+
+struct repoidx_entry
+{
+    const char* branch;
+    const char* file; /* Manifest file name inside the branch directory */
+    const char* name;
+    const char* version;
+    const char* description;
+    const char* depends;   /* "" when the manifest has none */
+    const char* provides;  /* "" when the manifest has none */
+    const char* conflicts; /* "" when the manifest has none */
+    const char* redirect;  /* Target of a REDIRECT manifest, NULL otherwise */
+};
+
+/* Map repo.idx, bringing it up to date with the branch directories first */
+int repoidx_load(struct repo_index* idx);
+void repoidx_close(struct repo_index* idx);
+
+size_t repoidx_count(struct repo_index* idx);
+int repoidx_get(struct repo_index* idx, size_t i, struct repoidx_entry* e);
+
+/* Entry for the package called name, preferring branch if it's not NULL and
+ * the earliest configured branch otherwise. -1 if there is none. */
+long repoidx_find(struct repo_index* idx, const char* name,
+                  const char* branch);
+
+/* Indices of the entries whose name or description contains term, ignoring
+ * case, in ascending order which is sorted by name. Allocated in g_arena. */
+int repoidx_search(struct repo_index* idx, const char* term, uint32_t** hits,
+                   size_t* num_hits);
+
+#endif /* PIRATPKG_REPOIDX_H */
@@ -15,9 +15,61 @@
 /* The name is a scam... */
 
 struct sandbox_ctx;
+struct repo_branch;
 
-struct sandbox_ctx* sandbox_create(char* const envp[]);
+/* sandbox_exec() failures that aren't a command's exit status */
+#define SANDBOX_ERR -1
+#define SANDBOX_ERR_TIMEOUT -2
+
+/* IDLE_TIMEOUT unless piratpkg.conf says otherwise, seconds */
+#define SANDBOX_DEFAULT_IDLE_TIMEOUT 1800
+
+/* What the shell of one function used, from wait4() */
+struct sandbox_usage
+{
+    double wall; /* Seconds */
+    double user;
+    double sys;
+    long max_rss;    /* KiB */
+    long in_blocks;  /* 512 byte blocks read from disk */
+    long out_blocks; /* 512 byte blocks written to disk */
+};
+
+/* Functions run under the build budget of branch, if it has one */
+struct sandbox_ctx* sandbox_create(char* const envp[],
+                                   const struct repo_branch* branch);
 void sandbox_destroy(struct sandbox_ctx* ctx);
+const char* sandbox_dir(struct sandbox_ctx* ctx);
+
+/* Like sandbox_create(), but in dir, which can outlive the sandbox. With
+ * resume, the first shell starts in the directory and with the variables
+ * of the last sandbox_save() in dir. Without, dir is cleared first. */
+struct sandbox_ctx* sandbox_open(const char* dir, bool resume,
+                                 char* const envp[],
+                                 const struct repo_branch* branch);
+
+/* Remember where the last finished shell left off, for resuming */
+int sandbox_save(struct sandbox_ctx* ctx);
+
+/* Leave the directory and saved state behind on sandbox_destroy() */
+void sandbox_keep(struct sandbox_ctx* ctx);
+
+/* Remove dir and everything sandboxes kept next to it */
+void sandbox_clear(const char* dir);
+
+/* Run command in the shell, starting one if needed. Returns its exit
+ * status, or SANDBOX_ERR_* after which the shell is gone. */
 int sandbox_exec(struct sandbox_ctx* ctx, const char* command, bool silent);
 
+/* Kill shells started from now on once they run for timeout seconds, or
+ * print nothing for idle_timeout seconds, together with everything they
+ * started. 0 for no limit. */
+void sandbox_timeout(struct sandbox_ctx* ctx, unsigned long timeout,
+                     unsigned long idle_timeout);
+
+/* End the shell the commands since the last call ran in, and account for
+ * it. The next sandbox_exec() starts a new one in the same directory and
+ * with the same variables. */
+int sandbox_finish(struct sandbox_ctx* ctx, struct sandbox_usage* usage);
+
 #endif /* PIRATPKG_SANDBOX_H */
@@ -0,0 +1,53 @@
+/******************************************************************************
+ * solver.h - Dependency resolution
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_SOLVER_H
+#define PIRATPKG_SOLVER_H
+
+#include <stddef.h>
+
+/*
+ * Picks one version of every package the requests need, working from the
+ * repository index and the installed database alone. Candidates are the
+ * installed version and every branch's manifest of a name, plus whatever
+ * PROVIDES it. Dependencies keep the installed version where it satisfies
+ * them, requests take the newest one. PACKAGE_CONFLICTS are checked both
+ * ways against everything that stays installed.
+ *
+ * The search backtracks over candidates, jumping straight back to the
+ * decisions a dead end blames, and remembers every set of choices that
+ * could not be completed, so no subproblem is explored twice. When nothing
+ * works, the requests are narrowed down to a smallest set that still fails
+ * and the conflict found there is explained.
+ *
+ * Requests are "name", optionally with a constraint and/or ":branch", such
+ * as "foo>=1.2:core".
+ */
+
+/* Give up after this many choices */
+#define SOLVER_MAX_STEPS 1000000
+
+struct solver_pkg
+{
+    const char* name;
+    const char* version;
+    char* spec;    /* "file:branch" as pkg_parse() takes it */
+    size_t* deps;  /* Plan indices of the packages this one needs */
+    size_t num_deps;
+    int requested; /* Asked for, not just pulled in as a dependency */
+};
+
+/* Fill plan with what has to be built, dependencies before dependents.
+ * Requests the installed version already satisfies are reported and left
+ * out; if that leaves nothing, ACTION_RET_PKG_ERR_ALREADY_INSTALLED. */
+int solver_solve(char** requests, size_t num_requests,
+                 struct solver_pkg** plan, size_t* num_plan);
+
+#endif /* PIRATPKG_SOLVER_H */
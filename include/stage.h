@@ -0,0 +1,30 @@
+/******************************************************************************
+ * stage.h - Staging tree handling
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_STAGE_H
+#define PIRATPKG_STAGE_H
+
+#include <stddef.h>
+#include <db.h>
+
+/* Walk a staged DESTDIR and record every entry (sorted by path, parents
+ * before children) with its size, mode and hash */
+int stage_scan(const char* staging_dir, struct db_file** files,
+               size_t* num_files);
+
+/* Move a scanned staging tree into ROOT. On failure the first *committed
+ * entries may have reached ROOT, the rest did not. */
+int stage_commit(const char* staging_dir, struct db_file* files,
+                 size_t num_files, size_t* committed);
+
+/* Unlink every recorded file from ROOT, directories only when empty */
+int stage_remove(struct db_file* files, size_t num_files);
+
+#endif /* PIRATPKG_STAGE_H */
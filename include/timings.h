@@ -0,0 +1,73 @@
+/******************************************************************************
+ * timings.h - Build durations of past installs
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_TIMINGS_H
+#define PIRATPKG_TIMINGS_H
+
+#include <stddef.h>
+
+/*
+ * One "name<TAB>version<TAB>function<TAB>seconds<TAB>runs<TAB>last<TAB>
+ * history" line per function of every package built from source, sorted,
+ * in $ROOT/etc/piratpkg/timings.list. seconds is a moving average over the
+ * runs, weighted towards recent builds, last is the latest run and history
+ * what the average was before it. A new version's history starts from the
+ * newest version built before it, so version bumps that slow a build down
+ * show up too.
+ */
+
+/* Weight of the newest run in the average */
+#define TIMINGS_WEIGHT 0.5
+
+/* Percent a build may slow down before it's flagged, TIMINGS_THRESHOLD */
+#define TIMINGS_DEFAULT_THRESHOLD 50
+
+/* Slowdowns of fewer seconds than this are noise */
+#define TIMINGS_MIN_REGRESSION 1.0
+
+struct timings_entry
+{
+    char* name;
+    char* version;
+    char* function;
+    double seconds;
+    unsigned long runs;
+    double last;
+    double history; /* 0 when there was none */
+};
+
+struct timings
+{
+    struct timings_entry* entries; /* Sorted by name, version, function */
+    size_t num_entries;
+    size_t cap;
+};
+
+int timings_load(struct timings* t);
+int timings_save(struct timings* t);
+
+/* Fold one run of a function into its average */
+int timings_record(struct timings* t, const char* name, const char* version,
+                   const char* function, double seconds);
+
+/* Expected seconds for building name-version, from its own history or
+ * else from the newest version of name that has one. -1 if there is none. */
+double timings_estimate(struct timings* t, const char* name,
+                        const char* version);
+
+/* Seconds the latest build of name-version took, and what its history
+ * predicted for the functions that had one. Both 0 if it was never built. */
+void timings_last(struct timings* t, const char* name, const char* version,
+                  double* last, double* history);
+
+/* Whether last is slower than history by more than the threshold */
+int timings_regressed(double last, double history);
+
+#endif /* PIRATPKG_TIMINGS_H */
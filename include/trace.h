@@ -0,0 +1,37 @@
+/******************************************************************************
+ * trace.h - Chrome trace output (--trace)
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_TRACE_H
+#define PIRATPKG_TRACE_H
+
+/*
+ * Spans are written as they happen in the Trace Event JSON array format,
+ * which chrome://tracing and ui.perfetto.dev both load, and which they still
+ * accept when a crash leaves the closing bracket out. Timestamps are
+ * CLOCK_MONOTONIC microseconds since trace_open(). Every thread gets its own
+ * track. All of these do nothing unless a trace is open.
+ */
+
+/* Start writing to path, with a span covering everything until
+ * trace_close(), which also runs at exit */
+int trace_open(const char* path);
+void trace_close(void);
+
+/* Spans nest per thread, detail is shown as an argument and may be NULL */
+void trace_begin(const char* name, const char* detail);
+void trace_end(const char* name);
+
+/* Name the calling thread's track */
+void trace_thread(const char* name);
+
+/* A value that changes over time, drawn as a counter track of its own */
+void trace_counter(const char* name, double value);
+
+#endif /* PIRATPKG_TRACE_H */
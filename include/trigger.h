@@ -0,0 +1,76 @@
+/******************************************************************************
+ * trigger.h - Work run once at the end of a transaction
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_TRIGGER_H
+#define PIRATPKG_TRIGGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct pkg_ctx;
+struct db_file;
+
+/* Triggers running at once, at most */
+#define TRIGGER_MAX_PARALLEL 8
+
+/*
+ * Triggers are $ROOT/etc/piratpkg/triggers/<name>.trigger files, usually
+ * installed by the package that owns the tool they run:
+ *
+ *   PATHS=usr/lib/lib*.so* lib/lib*.so*  fnmatch() patterns, leading '/'
+ *                                        is optional
+ *   RUN=ldconfig -r "$PREFIX"            one command per RUN line, in order
+ *   AFTER=other                          triggers that have to finish first
+ *
+ * A trigger fires when a transaction installs or removes a file matching
+ * one of its PATHS, or installs a package naming it in TRIGGERS. Each one
+ * that fired runs once after the last commit, in a sandbox of its own with
+ * PREFIX and TRIGGER_PACKAGES set. Triggers that don't wait for each other
+ * run in parallel.
+ */
+
+struct trigger
+{
+    char* name;
+    char** paths;
+    size_t num_paths;
+    char** run;
+    size_t num_run;
+    char** after;
+    size_t num_after;
+
+    bool fired;
+    char* packages; /* Space separated, what fired it */
+    bool started;
+    bool done;
+    int status; /* Of the first RUN line that failed */
+};
+
+struct triggers
+{
+    struct trigger* list;
+    size_t num;
+};
+
+/* Read every trigger under the database directory, none is not an error */
+int triggers_load(struct triggers* t);
+
+/* Fire what pkg's files and TRIGGERS ask for */
+void triggers_match(struct triggers* t, struct pkg_ctx* pkg);
+
+/* Fire what the files of the removed package name match */
+void triggers_match_files(struct triggers* t, const char* name,
+                          struct db_file* files, size_t num_files);
+
+/* Run everything that fired, up to jobs at once. Returns the number that
+ * failed. */
+size_t triggers_run(struct triggers* t, size_t jobs);
+
+#endif /* PIRATPKG_TRIGGER_H */
@@ -0,0 +1,123 @@
+/******************************************************************************
+ * txn.h - Install transactions
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_TXN_H
+#define PIRATPKG_TXN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <wal.h>
+
+struct pkg_ctx;
+
+/* Packages waiting between two pipeline stages */
+#define TXN_QUEUE_SIZE 4
+
+/* Upper bound for --jobs */
+#define TXN_MAX_JOBS 64
+
+/* Seconds between looks at the host's pressure, and at least between two
+ * changes of the number of builds, so avg10 can catch up */
+#define TXN_PSI_INTERVAL 1
+#define TXN_PSI_HOLD 10
+
+struct txn_item
+{
+    struct pkg_ctx* pkg;
+    struct txn_item** deps; /* Dependencies installed by this transaction */
+    size_t num_deps;
+    bool staged; /* Unpacked from an archive, nothing to build */
+    int status;  /* ACTION_RET_* of the first stage that failed */
+    bool retry;  /* It failed fetching or building, --resume can retry */
+    bool done;   /* Committed or failed, guarded by txn.lock */
+    double estimate; /* Seconds its build is expected to take */
+    double critical; /* Longest chain of estimates from here to the end */
+};
+
+/* The number of builds allowed at once changed */
+struct txn_jobs_change
+{
+    double at; /* Seconds since the builds started */
+    size_t from;
+    size_t to;
+    const char* reason;
+    double pressure; /* The avg10 that caused it */
+};
+
+struct txn_queue
+{
+    struct txn_item* items[TXN_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    size_t producers; /* Stages still pushing, popping ends at zero */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+/*
+ * An install runs as a pipeline: resolve (on the calling thread) feeds
+ * fetch, unpack, build and commit, each on its own thread(s) and connected
+ * by bounded queues. Downloading and unpacking the next packages overlaps
+ * with building the current one. Builds wait for their dependencies in the
+ * same transaction to be committed.
+ *
+ * Packages enter the pipeline in a dependency order that starts the longest
+ * chains of builds first, going by how long they took before (timings.h).
+ *
+ * --jobs is a ceiling. While builds run, a monitor thread watches the
+ * host's pressure (psi.h) and gives up build slots when CPU, memory or IO
+ * are contended, halving them when memory stalls fully, before the OOM
+ * killer has to step in. It hands them back once the host is quiet again.
+ *
+ * With --background, every stage but commit runs at idle CPU and IO
+ * priority, and so does everything the builds start.
+ *
+ * Triggers (trigger.h) that the committed packages fire run once at the end.
+ *
+ * The plan and every commit go to a write-ahead log (wal.h). With --resume,
+ * the plan of an install that didn't finish is loaded from there instead
+ * of solving again, less the packages it committed that are still
+ * installed at the planned version.
+ */
+struct txn
+{
+    struct txn_item* items; /* Dependencies before their dependents */
+    size_t num_items;
+    size_t cap;
+    struct txn_item** order; /* Items in the order they are built */
+    size_t jobs; /* Parallel build workers */
+    size_t limit;   /* Builds allowed to run now, guarded by lock */
+    size_t running; /* Builds running, guarded by lock */
+    struct txn_jobs_change* changes; /* Every change of limit */
+    size_t num_changes;
+    size_t cap_changes;
+    double started;
+    bool finished; /* The monitor stops, guarded by lock */
+    struct wal wal;
+    struct solver_pkg* resumed; /* Committed before --resume */
+    size_t num_resumed;
+
+    struct txn_queue fetch;
+    struct txn_queue unpack;
+    struct txn_queue build;
+    struct txn_queue commit;
+
+    pthread_mutex_t lock;
+    pthread_cond_t item_done;
+    pthread_cond_t slot_free;
+    pthread_cond_t wake_monitor;
+};
+
+/* Install the named packages and whatever they depend on that is missing */
+int txn_install(char** names, size_t num_names);
+
+#endif /* PIRATPKG_TXN_H */
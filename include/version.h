@@ -0,0 +1,56 @@
+/******************************************************************************
+ * version.h - Package version comparison
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_VERSION_H
+#define PIRATPKG_VERSION_H
+
+#include <stddef.h>
+
+/*
+ * Versions are an optional numeric "epoch:" followed by runs of digits and
+ * non-digits. Digit runs compare numerically and the rest byte by byte,
+ * where letters sort before other symbols and '~' sorts before anything,
+ * even the end of the string. So 1.2 < 1.10, 1.0~rc1 < 1.0 < 1.0a < 1.0.1
+ * and 1:0.9 > 2.0.
+ */
+
+/* Negative, zero or positive like strcmp() */
+int vercmp(const char* a, const char* b);
+
+/*
+ * Constraints as written in PACKAGE_DEPENDS, PACKAGE_PROVIDES and
+ * PACKAGE_CONFLICTS: a name, optionally followed by one of = == < <= > >=
+ * and a version, e.g. "foo>=1.2". Lists are whitespace separated.
+ */
+#define DEP_ANY 0
+#define DEP_EQ 1
+#define DEP_LT 2
+#define DEP_LE 3
+#define DEP_GT 4
+#define DEP_GE 5
+
+struct dep
+{
+    char* name;
+    int op;
+    char* version; /* NULL for DEP_ANY */
+};
+
+/* Both allocate in g_arena, dep_parse_list() accepts NULL as empty */
+int dep_parse(const char* text, struct dep* dep);
+int dep_parse_list(const char* text, struct dep** deps, size_t* num_deps);
+
+/* Whether version satisfies dep, a NULL version only satisfies DEP_ANY */
+int dep_match(const struct dep* dep, const char* version);
+
+/* "name>=version" again, allocated in g_arena */
+char* dep_format(const struct dep* dep);
+
+#endif /* PIRATPKG_VERSION_H */
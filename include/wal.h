@@ -0,0 +1,63 @@
+/******************************************************************************
+ * wal.h - Write-ahead log of install transactions
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#ifndef PIRATPKG_WAL_H
+#define PIRATPKG_WAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct solver_pkg;
+
+/*
+ * $ROOT/etc/piratpkg/txn.wal holds the plan of the install that is running,
+ * one line per package in plan order:
+ *
+ *   plan<TAB>name<TAB>version<TAB>spec<TAB>requested<TAB>deps
+ *
+ * deps are comma separated plan indices, "-" for none. The plan is written
+ * atomically before anything is built. Each package that gets committed
+ * then appends and syncs a "commit<TAB>index" line. A transaction that
+ * finishes removes the log, so one that is still there was interrupted,
+ * or had packages fail, and --resume picks it up. A torn last line is a
+ * commit that didn't make it, the package is simply done again.
+ *
+ * The log a resumed install writes starts with what was already committed,
+ * as plan lines with no deps each followed by its commit line, so their
+ * triggers are still owed if it gets interrupted again.
+ */
+
+struct wal
+{
+    struct solver_pkg* plan;
+    size_t num_plan;
+    bool* committed; /* Per plan entry */
+    size_t num_done; /* Entries logged ahead of plan, already committed */
+    int fd;          /* Appended to while the transaction runs, or -1 */
+};
+
+/* A log was left behind */
+bool wal_exists(void);
+
+/* Read the log left behind, num_plan is 0 when there is none */
+int wal_load(struct wal* w);
+
+/* Start the log of a new plan, replacing any old one. done are packages an
+ * earlier run committed, logged as such ahead of plan. */
+int wal_begin(struct wal* w, struct solver_pkg* done, size_t num_done,
+              struct solver_pkg* plan, size_t num_plan);
+
+/* Record that plan entry index is committed, synced before returning */
+int wal_commit(struct wal* w, size_t index);
+
+/* Stop logging; a complete transaction leaves no log behind */
+void wal_end(struct wal* w, bool complete);
+
+#endif /* PIRATPKG_WAL_H */
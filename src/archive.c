@@ -0,0 +1,811 @@
+/******************************************************************************
+ * archive.c - Binary package format
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <piratpkg.h>
+#include <archive.h>
+#include <fs.h>
+#include <copy.h>
+#include <strings.h>
+#include <log.h>
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+static void _put_u32(unsigned char* p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void _put_u64(unsigned char* p, uint64_t v)
+{
+    _put_u32(p, (uint32_t)v);
+    _put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t _get_u32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static uint64_t _get_u64(const unsigned char* p)
+{
+    return (uint64_t)_get_u32(p) | ((uint64_t)_get_u32(p + 4) << 32);
+}
+
+static void _hex_to_raw(const char* hex, unsigned char* raw)
+{
+    int i;
+
+    memset(raw, 0, SHA256_DIGEST_SIZE);
+    for (i = 0; i < SHA256_DIGEST_SIZE && hex[i * 2] && hex[i * 2 + 1]; i++)
+    {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+            return;
+        raw[i] = (unsigned char)byte;
+    }
+}
+
+static void _raw_to_hex(const unsigned char* raw, char* hex)
+{
+    int i;
+    for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+        sprintf(hex + i * 2, "%02x", raw[i]);
+}
+
+static int _write_all(int fd, const void* data, size_t len)
+{
+    const char* p = data;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Reads exactly len bytes, a short read means a truncated archive */
+static int _read_all(int fd, void* data, size_t len)
+{
+    char* p = data;
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+        {
+            errno = EPIPE;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Recorded paths must stay inside the tree they are extracted into */
+static int _path_safe(const char* path)
+{
+    const char* p = path;
+
+    if (path[0] != '/')
+        return 0;
+
+    while (*p != '\0')
+    {
+        while (*p == '/')
+            p++;
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+            return 0;
+        while (*p != '\0' && *p != '/')
+            p++;
+    }
+    return 1;
+}
+
+/* Whether the first len characters of path are one of the sorted links */
+static int _is_link(char** links, size_t num_links, const char* path,
+                    size_t len)
+{
+    size_t lo = 0, hi = num_links;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(links[mid], path, len);
+
+        if (cmp == 0 && links[mid][len] != '\0')
+            cmp = 1;
+        if (cmp == 0)
+            return 1;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+/* Writing below a symlink the archive created would follow it out of the
+ * tree, "usr/lib -> /etc" then "usr/lib/x" */
+static int _under_link(char** links, size_t num_links, const char* path)
+{
+    const char* p;
+
+    for (p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+        if (_is_link(links, num_links, path, (size_t)(p - path)))
+            return 1;
+    return 0;
+}
+
+/* =============================================================================
+ * Writing
+ * ========================================================================== */
+
+static int _write_record(struct archive_writer* w, char type, mode_t mode,
+                         uint64_t size, const char* path, const char* hash,
+                         const void* data)
+{
+    static const char zeros[ARCHIVE_ALIGN];
+    unsigned char rec[ARCHIVE_RECORD_SIZE];
+    size_t path_len = path ? strlen(path) : 0;
+    size_t pad = 0;
+
+    if (type == DB_FILE_REG && size >= ARCHIVE_ALIGN)
+    {
+        uint64_t end = w->offset + sizeof(rec) + path_len;
+        pad = (size_t)((ARCHIVE_ALIGN - end % ARCHIVE_ALIGN) % ARCHIVE_ALIGN);
+    }
+
+    memset(rec, 0, sizeof(rec));
+    rec[0] = (unsigned char)type;
+    _put_u32(rec + 4, (uint32_t)(mode & 07777));
+    _put_u64(rec + 8, size);
+    _put_u32(rec + 16, (uint32_t)path_len);
+    _put_u32(rec + 20, (uint32_t)pad);
+    if (hash != NULL)
+        _hex_to_raw(hash, rec + 24);
+
+    sha256_update(&w->ctx, rec, sizeof(rec));
+    if (_write_all(w->fd, rec, sizeof(rec)) != 0)
+        return -1;
+
+    if (path_len > 0)
+    {
+        sha256_update(&w->ctx, path, path_len);
+        if (_write_all(w->fd, path, path_len) != 0)
+            return -1;
+    }
+
+    if (pad > 0)
+    {
+        sha256_update(&w->ctx, zeros, pad);
+        if (_write_all(w->fd, zeros, pad) != 0)
+            return -1;
+    }
+
+    w->offset += sizeof(rec) + path_len + pad;
+    if (data != NULL && size > 0)
+    {
+        sha256_update(&w->ctx, data, (size_t)size);
+        if (_write_all(w->fd, data, (size_t)size) != 0)
+            return -1;
+        w->offset += size;
+    }
+
+    return 0;
+}
+
+int archive_write_open(struct archive_writer* w, const char* path,
+                       const char* meta)
+{
+    unsigned char header[ARCHIVE_HEADER_SIZE];
+    char meta_hash[SHA256_HEX_SIZE];
+    char* dir;
+
+    w->path = strdup_safe(path);
+    w->tmp_path = arena_alloc(&g_arena, strlen(path) + 5);
+    if (w->path == NULL || w->tmp_path == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    sprintf(w->tmp_path, "%s.tmp", path);
+
+    dir = strdup_safe(path);
+    if (strrchr(dir, '/') != NULL)
+    {
+        *strrchr(dir, '/') = '\0';
+        if (*dir != '\0' && fs_mkdir_p(dir, 0755) != 0)
+        {
+            ERROR("Failed to create '%s': %s\n", dir, strerror(errno));
+            return ACTION_RET_ERR_IO;
+        }
+    }
+
+    w->fd = open(w->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0)
+    {
+        ERROR("Failed to create '%s': %s\n", w->tmp_path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    sha256_init(&w->ctx);
+    w->offset = sizeof(header);
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, ARCHIVE_MAGIC, strlen(ARCHIVE_MAGIC));
+    _put_u32(header + 8, ARCHIVE_VERSION);
+    _put_u32(header + 12, 0);
+    sha256_update(&w->ctx, header, sizeof(header));
+
+    sha256_hex(meta, strlen(meta), meta_hash);
+    if (_write_all(w->fd, header, sizeof(header)) != 0 ||
+        _write_record(w, ARCHIVE_REC_META, 0, strlen(meta), NULL, meta_hash,
+                      meta) != 0)
+    {
+        ERROR("Failed to write '%s': %s\n", w->tmp_path, strerror(errno));
+        archive_write_abort(w);
+        return ACTION_RET_ERR_IO;
+    }
+
+    return ACTION_RET_OK;
+}
+
+int archive_write_file(struct archive_writer* w, const char* staging_dir,
+                       struct db_file* f)
+{
+    char buf[65536];
+    uint64_t left;
+    int fd;
+
+    if (f->type == DB_FILE_DIR)
+    {
+        if (_write_record(w, DB_FILE_DIR, f->mode, 0, f->path, NULL, NULL))
+            goto fail;
+        return ACTION_RET_OK;
+    }
+
+    if (f->type == DB_FILE_LNK)
+    {
+        if (_write_record(w, DB_FILE_LNK, f->mode, strlen(f->target),
+                          f->path, f->hash, f->target) != 0)
+            goto fail;
+        return ACTION_RET_OK;
+    }
+
+    fd = open(fs_join(staging_dir, f->path), O_RDONLY);
+    if (fd < 0)
+        goto fail;
+
+    if (_write_record(w, DB_FILE_REG, f->mode, (uint64_t)f->size, f->path,
+                      f->hash, NULL) != 0)
+    {
+        close(fd);
+        goto fail;
+    }
+
+    /* File contents are covered by their own hash, not the running one */
+    left = (uint64_t)f->size;
+    while (left > 0)
+    {
+        size_t chunk = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+        if (_read_all(fd, buf, chunk) != 0 ||
+            _write_all(w->fd, buf, chunk) != 0)
+        {
+            close(fd);
+            goto fail;
+        }
+        left -= chunk;
+    }
+
+    w->offset += (uint64_t)f->size;
+    close(fd);
+    return ACTION_RET_OK;
+
+fail:
+    ERROR("Failed to archive '%s': %s\n", f->path, strerror(errno));
+    return ACTION_RET_ERR_IO;
+}
+
+int archive_write_close(struct archive_writer* w)
+{
+    char hash[SHA256_HEX_SIZE];
+    struct sha256_ctx ctx = w->ctx;
+
+    sha256_final_hex(&ctx, hash);
+    if (_write_record(w, ARCHIVE_REC_END, 0, 0, NULL, hash, NULL) != 0 ||
+        fsync(w->fd) != 0)
+    {
+        ERROR("Failed to write '%s': %s\n", w->tmp_path, strerror(errno));
+        archive_write_abort(w);
+        return ACTION_RET_ERR_IO;
+    }
+
+    close(w->fd);
+    w->fd = -1;
+    if (rename(w->tmp_path, w->path) != 0)
+    {
+        ERROR("Failed to replace '%s': %s\n", w->path, strerror(errno));
+        unlink(w->tmp_path);
+        return ACTION_RET_ERR_IO;
+    }
+
+    return ACTION_RET_OK;
+}
+
+void archive_write_abort(struct archive_writer* w)
+{
+    if (w->fd >= 0)
+        close(w->fd);
+    w->fd = -1;
+    unlink(w->tmp_path);
+}
+
+/* =============================================================================
+ * Streaming reads
+ * ========================================================================== */
+
+int archive_read_open(struct archive_reader* r, const char* path)
+{
+    unsigned char header[ARCHIVE_HEADER_SIZE];
+
+    r->remaining = 0;
+    r->type = 0;
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0)
+    {
+        ERROR("Failed to open '%s': %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    if (_read_all(r->fd, header, sizeof(header)) != 0 ||
+        memcmp(header, ARCHIVE_MAGIC, strlen(ARCHIVE_MAGIC) + 1) != 0)
+    {
+        ERROR("'%s' is not a piratpkg binary package\n", path);
+        archive_read_close(r);
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+
+    if (_get_u32(header + 8) != ARCHIVE_VERSION)
+    {
+        ERROR("'%s' uses unsupported format version %u\n", path,
+              (unsigned int)_get_u32(header + 8));
+        archive_read_close(r);
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+
+    sha256_init(&r->ctx);
+    sha256_update(&r->ctx, header, sizeof(header));
+    return ACTION_RET_OK;
+}
+
+int archive_read_next(struct archive_reader* r, struct archive_entry* e)
+{
+    unsigned char rec[ARCHIVE_RECORD_SIZE];
+    char expected[SHA256_HEX_SIZE];
+    struct sha256_ctx ctx;
+    uint32_t path_len, pad;
+
+    if (r->remaining > 0 && archive_skip_data(r) != ACTION_RET_OK)
+        return ACTION_RET_ERR_IO;
+
+    /* The end record's hash covers everything up to (not including) it */
+    ctx = r->ctx;
+    sha256_final_hex(&ctx, expected);
+
+    if (_read_all(r->fd, rec, sizeof(rec)) != 0)
+    {
+        ERROR("Truncated binary package\n");
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+    sha256_update(&r->ctx, rec, sizeof(rec));
+
+    e->type = (char)rec[0];
+    e->mode = (mode_t)_get_u32(rec + 4);
+    e->size = _get_u64(rec + 8);
+    path_len = _get_u32(rec + 16);
+    pad = _get_u32(rec + 20);
+    _raw_to_hex(rec + 24, e->hash);
+    e->path = NULL;
+
+    if (e->type == ARCHIVE_REC_END)
+    {
+        char trailing;
+
+        if (e->size != 0 || path_len != 0 || pad != 0 ||
+            read(r->fd, &trailing, 1) != 0 || strcmp(expected, e->hash) != 0)
+        {
+            ERROR("Binary package checksum mismatch\n");
+            return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+        }
+        return 0;
+    }
+
+    if (path_len >= 4096 || pad >= 65536)
+    {
+        ERROR("Corrupt binary package record\n");
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+
+    e->path = arena_alloc(&g_arena, path_len + 1);
+    if (e->path == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    if (_read_all(r->fd, e->path, path_len) != 0)
+    {
+        ERROR("Truncated binary package\n");
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+    e->path[path_len] = '\0';
+    sha256_update(&r->ctx, e->path, path_len);
+
+    while (pad > 0)
+    {
+        char zeros[4096];
+        uint32_t chunk = pad < sizeof(zeros) ? pad : sizeof(zeros);
+        if (_read_all(r->fd, zeros, chunk) != 0)
+            return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+        sha256_update(&r->ctx, zeros, chunk);
+        pad -= chunk;
+    }
+
+    r->type = e->type;
+    r->remaining = e->size;
+    return 1;
+}
+
+long archive_read_data(struct archive_reader* r, void* buf, size_t len)
+{
+    if (len > r->remaining)
+        len = (size_t)r->remaining;
+    if (len == 0)
+        return 0;
+
+    if (_read_all(r->fd, buf, len) != 0)
+    {
+        ERROR("Truncated binary package\n");
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+
+    if (r->type != DB_FILE_REG)
+        sha256_update(&r->ctx, buf, len);
+    r->remaining -= len;
+    return (long)len;
+}
+
+int archive_skip_data(struct archive_reader* r)
+{
+    char buf[65536];
+
+    if (archive_seek_data(r) >= 0)
+        return ACTION_RET_OK;
+
+    while (r->remaining > 0)
+    {
+        if (archive_read_data(r, buf, sizeof(buf)) < 0)
+            return ACTION_RET_ERR_IO;
+    }
+    return ACTION_RET_OK;
+}
+
+off_t archive_seek_data(struct archive_reader* r)
+{
+    off_t off;
+
+    /* Everything but file contents feeds the running hash and must be read */
+    if (r->type != DB_FILE_REG)
+        return -1;
+
+    off = lseek(r->fd, 0, SEEK_CUR);
+    if (off < 0 || lseek(r->fd, (off_t)r->remaining, SEEK_CUR) < 0)
+        return -1;
+
+    r->remaining = 0;
+    return off;
+}
+
+void archive_read_close(struct archive_reader* r)
+{
+    if (r->fd >= 0)
+        close(r->fd);
+    r->fd = -1;
+}
+
+/* =============================================================================
+ * Whole archives
+ * ========================================================================== */
+
+int archive_create(const char* path, const char* meta, const char* staging_dir,
+                   struct db_file* files, size_t num_files)
+{
+    struct archive_writer w;
+    size_t i;
+    int ret;
+
+    ret = archive_write_open(&w, path, meta);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    for (i = 0; i < num_files; i++)
+    {
+        ret = archive_write_file(&w, staging_dir, &files[i]);
+        if (ret != ACTION_RET_OK)
+        {
+            archive_write_abort(&w);
+            return ret;
+        }
+    }
+
+    return archive_write_close(&w);
+}
+
+int archive_read_meta(const char* path, char** meta)
+{
+    struct archive_reader r;
+    struct archive_entry e;
+    int ret;
+
+    ret = archive_read_open(&r, path);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    ret = archive_read_next(&r, &e);
+    if (ret != 1 || e.type != ARCHIVE_REC_META || e.size > 65536)
+    {
+        archive_read_close(&r);
+        ERROR("'%s' has no metadata record\n", path);
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+
+    *meta = arena_alloc(&g_arena, (size_t)e.size + 1);
+    if (*meta == NULL ||
+        archive_read_data(&r, *meta, (size_t)e.size) != (long)e.size)
+    {
+        archive_read_close(&r);
+        return ACTION_RET_ERR_IO;
+    }
+    (*meta)[e.size] = '\0';
+
+    archive_read_close(&r);
+    return ACTION_RET_OK;
+}
+
+static int _extract_entry(struct archive_reader* r, struct archive_entry* e,
+                          const char* dest)
+{
+    char buf[65536];
+    struct sha256_ctx ctx;
+    char hash[SHA256_HEX_SIZE];
+    struct stat st;
+    long n;
+    int fd;
+
+    switch (e->type)
+    {
+        case DB_FILE_DIR:
+            if (lstat(dest, &st) == 0 && S_ISLNK(st.st_mode))
+            {
+                errno = ELOOP;
+                return -1;
+            }
+            return fs_mkdir_p(dest, 0755);
+
+        case DB_FILE_LNK:
+            if (e->size >= sizeof(buf) ||
+                archive_read_data(r, buf, (size_t)e->size) != (long)e->size)
+                return -1;
+            buf[e->size] = '\0';
+            unlink(dest);
+            return symlink(buf, dest);
+
+        case DB_FILE_REG:
+            fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+                      e->mode & 07777);
+            if (fd < 0)
+                return -1;
+
+            sha256_init(&ctx);
+            while ((n = archive_read_data(r, buf, sizeof(buf))) > 0)
+            {
+                sha256_update(&ctx, buf, (size_t)n);
+                if (_write_all(fd, buf, (size_t)n) != 0)
+                {
+                    close(fd);
+                    return -1;
+                }
+            }
+            if (n < 0 || fchmod(fd, e->mode & 07777) != 0)
+            {
+                close(fd);
+                return -1;
+            }
+            if (close(fd) != 0)
+                return -1;
+
+            sha256_final_hex(&ctx, hash);
+            if (strcmp(hash, e->hash) != 0)
+            {
+                ERROR("Checksum mismatch for '%s'\n", e->path);
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * Records are read front to back on this thread. Directories and symlinks are
+ * created in order, so parents always exist, while file contents are handed
+ * to copy workers that read them straight out of the archive at their offset.
+ * Archives that can't seek (pipes) are extracted inline instead.
+ *
+ * Binary packages are untrusted: nothing is written below a symlink the
+ * archive created, and files are never opened through a link.
+ */
+int archive_extract(const char* path, const char* dest_dir,
+                    struct db_file** files, size_t* num_files)
+{
+    struct archive_reader r;
+    struct archive_entry e;
+    struct copy_pool pool;
+    const char* prev = "";
+    char** links = NULL;
+    size_t num_links = 0, cap_links = 0;
+    size_t cap = 0;
+    int ret, copied;
+
+    *files = NULL;
+    *num_files = 0;
+
+    ret = archive_read_open(&r, path);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    copy_pool_start(&pool, 0);
+
+    while ((ret = archive_read_next(&r, &e)) == 1)
+    {
+        struct db_file* f;
+        char* dest;
+        off_t off;
+
+        if (e.type == ARCHIVE_REC_META)
+            continue;
+
+        /* Entries are sorted, parents first, and never leave dest_dir */
+        if (!_path_safe(e.path) || strcmp(prev, e.path) >= 0 ||
+            _under_link(links, num_links, e.path))
+        {
+            ERROR("Refusing unsafe or unordered path '%s' in '%s'\n", e.path,
+                  path);
+            ret = ACTION_RET_PKG_ERR_INVALID_FORMAT;
+            break;
+        }
+        prev = e.path;
+
+        /* Added in order, so links stays sorted */
+        if (e.type == DB_FILE_LNK)
+        {
+            if (num_links == cap_links)
+            {
+                char** grown;
+
+                cap_links = cap_links ? cap_links * 2 : 64;
+                grown = arena_alloc(&g_arena, cap_links * sizeof(char*));
+                if (grown == NULL)
+                {
+                    ret = ACTION_RET_ERR_UNKNOWN;
+                    break;
+                }
+                if (num_links > 0)
+                    memcpy(grown, links, num_links * sizeof(char*));
+                links = grown;
+            }
+            links[num_links++] = e.path;
+        }
+
+        dest = fs_join(dest_dir, e.path);
+        off = e.type == DB_FILE_REG ? archive_seek_data(&r) : -1;
+        if (off >= 0)
+        {
+            struct copy_job job;
+
+            job.src_fd = r.fd;
+            job.src_path = NULL;
+            job.src_off = off;
+            job.size = (off_t)e.size;
+            job.dst = dest;
+            job.rename_to = NULL;
+            job.mode = e.mode & 07777;
+            job.hash = strdup_safe(e.hash);
+            job.name = e.path;
+            if (job.hash == NULL)
+            {
+                ret = ACTION_RET_ERR_UNKNOWN;
+                break;
+            }
+            if (copy_pool_submit(&pool, &job) != ACTION_RET_OK)
+            {
+                ret = ACTION_RET_ERR_IO;
+                break;
+            }
+        }
+        else if (_extract_entry(&r, &e, dest) != 0)
+        {
+            ERROR("Failed to extract '%s': %s\n", e.path, strerror(errno));
+            ret = ACTION_RET_ERR_IO;
+            break;
+        }
+
+        if (*num_files == cap)
+        {
+            size_t new_cap = cap ? cap * 2 : 256;
+            struct db_file* grown =
+                arena_alloc(&g_arena, new_cap * sizeof(struct db_file));
+            if (grown == NULL)
+            {
+                ret = ACTION_RET_ERR_UNKNOWN;
+                break;
+            }
+            if (*num_files > 0)
+                memcpy(grown, *files, *num_files * sizeof(struct db_file));
+            *files = grown;
+            cap = new_cap;
+        }
+
+        f = &(*files)[(*num_files)++];
+        f->type = e.type;
+        f->mode = e.mode & 07777;
+        f->size = (off_t)e.size;
+        f->path = e.path;
+        f->target = NULL;
+        strcpy(f->hash, e.type == DB_FILE_DIR ? "-" : e.hash);
+        if (e.type == DB_FILE_LNK)
+        {
+            char target[4096];
+            ssize_t n = readlink(dest, target, sizeof(target) - 1);
+            target[n < 0 ? 0 : n] = '\0';
+            f->target = strdup_safe(target);
+        }
+    }
+
+    /* The workers still read from r.fd until they are done */
+    copied = copy_pool_finish(&pool);
+    if (ret == 0 && copied != ACTION_RET_OK)
+        ret = copied;
+
+    archive_read_close(&r);
+    return ret == 0 ? ACTION_RET_OK : ret;
+}
@@ -17,6 +17,41 @@
 #include <string.h>
 #include <log.h>
 #include <errno.h>
+#include <pthread.h>
+
+/* Every allocation is rounded up to this so structs handed out after odd
+ * sized strings stay properly aligned */
+#define ARENA_ALIGN 16
+#define ARENA_ALIGN_UP(x)                                                      \
+    (((x) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* Arenas are shared by the install pipeline's threads. fork() only copies
+ * the calling thread, so the lock is taken around it to keep the child's
+ * copy consistent. */
+static pthread_mutex_t s_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t s_arena_once = PTHREAD_ONCE_INIT;
+
+static void _arena_lock(void)
+{
+    pthread_mutex_lock(&s_arena_lock);
+}
+
+static void _arena_unlock(void)
+{
+    pthread_mutex_unlock(&s_arena_lock);
+}
+
+static void _arena_register_fork(void)
+{
+    pthread_atfork(_arena_lock, _arena_unlock, _arena_unlock);
+}
+
+/* Header placed at the start of every block retired by _arena_grow */
+struct arena_block
+{
+    struct arena_block* next;
+    size_t size;
+};
 
 /* Internal utility functions */
 static void* _arena_malloc(size_t size)
@@ -29,36 +64,57 @@ static void* _arena_malloc(size_t size)
     return ptr;
 }
 
-static void* _arena_realloc(void* ptr, size_t size)
-{
-    void* new_ptr = realloc(ptr, size);
-    if (new_ptr == NULL)
-    {
-        ERROR("Memory reallocation failed: %s", strerror(errno));
-    }
-    return new_ptr;
-}
-
+/* Retire the current block and start a fresh one. The old block is kept
+ * alive on arena->blocks, so pointers handed out earlier stay valid. */
 static int _arena_grow(struct arena* arena, size_t size_needed)
 {
-    size_t old_size = arena->size;
-    size_t new_size = old_size;
+    size_t new_size = DEFAULT_ARENA_SIZE;
+    struct arena_block* old = (struct arena_block*)arena->base;
 
     /* Grow arena in increments of DEFAULT_ARENA_SIZE until it is large enough
      */
-    while (new_size < arena->offset + size_needed)
+    while (new_size < ARENA_ALIGN_UP(sizeof(struct arena_block)) + size_needed)
     {
         new_size += DEFAULT_ARENA_SIZE;
     }
 
-    void* new_base = _arena_realloc(arena->base, new_size);
+    void* new_base = _arena_malloc(new_size);
     if (new_base == NULL)
     {
         return -1;
     }
 
+    old->next = arena->blocks;
+    old->size = arena->size;
+    arena->blocks = old;
+
     arena->base = new_base;
     arena->size = new_size;
+    arena->offset = ARENA_ALIGN_UP(sizeof(struct arena_block));
+    arena->last = NULL;
+    return 0;
+}
+
+/* Number of bytes that may be read from ptr without leaving its block */
+static size_t _arena_span(struct arena* arena, void* ptr)
+{
+    struct arena_block* block;
+
+    if ((char*)ptr >= (char*)arena->base &&
+        (char*)ptr < (char*)arena->base + arena->size)
+    {
+        return (char*)arena->base + arena->offset - (char*)ptr;
+    }
+
+    for (block = arena->blocks; block != NULL; block = block->next)
+    {
+        if ((char*)ptr >= (char*)block &&
+            (char*)ptr < (char*)block + block->size)
+        {
+            return (char*)block + block->size - (char*)ptr;
+        }
+    }
+
     return 0;
 }
 
@@ -72,6 +128,8 @@ int arena_init(struct arena* arena, size_t size)
         return -1;
     }
 
+    pthread_once(&s_arena_once, _arena_register_fork);
+
     arena->base = _arena_malloc(size);
     if (arena->base == NULL)
     {
@@ -79,18 +137,15 @@ int arena_init(struct arena* arena, size_t size)
     }
 
     arena->size = size;
-    arena->offset = 0;
+    arena->offset = ARENA_ALIGN_UP(sizeof(struct arena_block));
+    arena->blocks = NULL;
+    arena->last = NULL;
     return 0;
 }
 
-void* arena_alloc(struct arena* arena, size_t size)
+static void* _arena_alloc(struct arena* arena, size_t size)
 {
-    if (arena == NULL || arena->base == NULL)
-    {
-        ERROR("Arena not initialized properly\n");
-        return NULL;
-    }
-
+    size = ARENA_ALIGN_UP(size);
     if (arena->offset + size > arena->size)
     {
         if (_arena_grow(arena, size) != 0)
@@ -104,47 +159,77 @@ void* arena_alloc(struct arena* arena, size_t size)
     /* Memory allocation */
     void* ptr = (void*)((char*)arena->base + arena->offset);
     arena->offset += size;
+    arena->last = ptr;
+
+    return ptr;
+}
+
+void* arena_alloc(struct arena* arena, size_t size)
+{
+    void* ptr = NULL;
+
+    if (arena == NULL)
+    {
+        ERROR("Arena not initialized properly\n");
+        return NULL;
+    }
 
+    _arena_lock();
+    if (arena->base != NULL)
+        ptr = _arena_alloc(arena, size);
+    else
+        ERROR("Arena not initialized properly\n");
+    _arena_unlock();
     return ptr;
 }
 
 /* Reallocate a block of memory within the arena */
 void* arena_realloc(struct arena* arena, void* ptr, size_t new_size)
 {
-    if (arena == NULL || arena->base == NULL || ptr == NULL)
+    if (arena == NULL || ptr == NULL)
     {
         ERROR("Invalid parameters for arena_realloc\n");
         return NULL;
     }
 
-    /* Check if the requested size is within the current arena bounds */
-    size_t current_offset = (char*)ptr - (char*)arena->base;
-    if (current_offset + new_size <= arena->size)
-    {
-        /* If the new size fits within the arena, just adjust the offset */
-        arena->offset = current_offset + new_size;
-        return ptr;
-    }
-    else
+    _arena_lock();
+
+    /* The most recent allocation can simply be extended in place */
+    if (ptr == arena->last)
     {
-        /* If the new size doesn't fit, grow the arena */
-        if (_arena_grow(arena, new_size) != 0)
+        size_t current_offset = (char*)ptr - (char*)arena->base;
+        if (current_offset + ARENA_ALIGN_UP(new_size) <= arena->size)
         {
-            return NULL;
+            arena->offset = current_offset + ARENA_ALIGN_UP(new_size);
+            _arena_unlock();
+            return ptr;
         }
+    }
 
-        /* Memory allocation */
-        void* new_ptr = (char*)arena->base + current_offset;
-        arena->offset = current_offset + new_size;
-        return new_ptr;
+    /* Otherwise move it into a fresh allocation */
+    size_t span = _arena_span(arena, ptr);
+    void* new_ptr = _arena_alloc(arena, new_size);
+    if (new_ptr != NULL)
+    {
+        memcpy(new_ptr, ptr, span < new_size ? span : new_size);
     }
+
+    _arena_unlock();
+    return new_ptr;
 }
 
 void arena_reset(struct arena* arena)
 {
     if (arena != NULL)
     {
-        arena->offset = 0;
+        while (arena->blocks != NULL)
+        {
+            struct arena_block* next = arena->blocks->next;
+            free(arena->blocks);
+            arena->blocks = next;
+        }
+        arena->offset = ARENA_ALIGN_UP(sizeof(struct arena_block));
+        arena->last = NULL;
     }
 }
 
@@ -152,6 +237,7 @@ void arena_destroy(struct arena* arena)
 {
     if (arena != NULL)
     {
+        arena_reset(arena);
         if (arena->base != NULL)
         {
             free(arena->base);
@@ -0,0 +1,339 @@
+/******************************************************************************
+ * budget.c - CPU, memory and IO budgets of builds
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE /* For sched_setaffinity */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <piratpkg.h>
+#include <budget.h>
+#include <log.h>
+
+#define CGROUP_MOUNT "/sys/fs/cgroup"
+
+/* linux/ioprio.h, glibc has no wrapper */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+struct budget
+{
+    const struct repo_branch* branch;
+    char leaf[512]; /* Empty without a cgroup */
+    int procs_fd;   /* leaf's cgroup.procs */
+    bool pin;       /* Fallback, affinity and rlimit */
+    cpu_set_t cpus;
+    bool limit_memory;
+    struct rlimit memory;
+};
+
+/* Where the leaves are made, empty when cgroups can't be used */
+static char s_parent[512];
+static unsigned long s_num_leaves;
+static pthread_mutex_t s_budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t s_budget_once = PTHREAD_ONCE_INIT;
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+static bool _has_budget(const struct repo_branch* branch)
+{
+    return branch->cpus > 0 || branch->memory_max > 0 ||
+           branch->io_weight > 0;
+}
+
+static int _write_file(const char* dir, const char* name, const char* value)
+{
+    char path[600];
+    int fd, ret = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (write(fd, value, strlen(value)) < 0)
+        ret = -1;
+    close(fd);
+    return ret;
+}
+
+/* The cgroup v2 directory this process runs in */
+static int _own_cgroup(char* path, size_t size)
+{
+    char line[512];
+    FILE* file = fopen("/proc/self/cgroup", "r");
+    int ret = -1;
+
+    if (file == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (strncmp(line, "0::", 3) != 0)
+            continue;
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(path, size, "%s%s", CGROUP_MOUNT, line + 3);
+        ret = 0;
+        break;
+    }
+    fclose(file);
+    return ret;
+}
+
+/* Turn on the controllers root has for its children */
+static int _enable_controllers(const char* root)
+{
+    static const char* wanted[] = {"cpu", "memory", "io"};
+    char available[256], enable[64] = "";
+    char path[600];
+    FILE* file;
+    size_t i;
+
+    snprintf(path, sizeof(path), "%s/cgroup.controllers", root);
+    file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    if (fgets(available, sizeof(available), file) == NULL)
+        available[0] = '\0';
+    fclose(file);
+
+    for (i = 0; i < sizeof(wanted) / sizeof(wanted[0]); i++)
+    {
+        char* found = strstr(available, wanted[i]);
+        size_t len = strlen(wanted[i]);
+
+        /* Whole words only, "io" is not "ioprio" */
+        if (found == NULL || (found != available && found[-1] != ' ') ||
+            (found[len] != ' ' && found[len] != '\n' && found[len] != '\0'))
+            continue;
+        strcat(enable, enable[0] ? " +" : "+");
+        strcat(enable, wanted[i]);
+    }
+    if (enable[0] == '\0')
+        return -1;
+    return _write_file(root, "cgroup.subtree_control", enable);
+}
+
+static void _init(void)
+{
+    char root[512], self[600];
+    int i;
+    bool any = false;
+
+    for (i = 0; i < g_config.num_branches; i++)
+        any = any || _has_budget(&g_config.branches[i]);
+    if (!any)
+        return;
+
+    if (g_config.cgroup_root != NULL)
+        snprintf(root, sizeof(root), "%s", g_config.cgroup_root);
+    else if (_own_cgroup(root, sizeof(root)) == 0)
+    {
+        /* Only leaves may hold processes, so get out of the way */
+        snprintf(self, sizeof(self), "%s/piratpkg", root);
+        if ((mkdir(self, 0755) != 0 && errno != EEXIST) ||
+            _write_file(self, "cgroup.procs", "0") != 0)
+            root[0] = '\0';
+    }
+    else
+        root[0] = '\0';
+
+    if (root[0] != '\0' && _enable_controllers(root) == 0)
+    {
+        strcpy(s_parent, root);
+        MSG("Build budgets are enforced by cgroups in %s\n", root);
+        return;
+    }
+
+    MSG("No delegated cgroup v2, build budgets fall back to CPU affinity "
+        "and rlimits\n");
+}
+
+/* ceil(cpus) of the CPUs this process may use, after those of the
+ * budgeted branches before branch */
+static void _pick_cpus(struct budget* b)
+{
+    cpu_set_t allowed;
+    int ids[CPU_SETSIZE];
+    int num_ids = 0, offset = 0, want, i;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+    for (i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET(i, &allowed))
+            ids[num_ids++] = i;
+
+    want = (int)b->branch->cpus;
+    if (want < b->branch->cpus)
+        want++;
+    if (num_ids == 0 || want >= num_ids)
+        return;
+
+    for (i = 0; &g_config.branches[i] != b->branch; i++)
+    {
+        const struct repo_branch* other = &g_config.branches[i];
+        int n = (int)other->cpus;
+
+        offset += n < other->cpus ? n + 1 : n;
+    }
+
+    CPU_ZERO(&b->cpus);
+    for (i = 0; i < want; i++)
+        CPU_SET(ids[(offset + i) % num_ids], &b->cpus);
+    b->pin = true;
+}
+
+static int _make_leaf(struct budget* b)
+{
+    const struct repo_branch* branch = b->branch;
+    char value[64], path[600];
+    unsigned long n;
+
+    pthread_mutex_lock(&s_budget_lock);
+    n = s_num_leaves++;
+    pthread_mutex_unlock(&s_budget_lock);
+
+    snprintf(b->leaf, sizeof(b->leaf), "%s/build-%ld-%lu", s_parent,
+             (long)getpid(), n);
+    if (mkdir(b->leaf, 0755) != 0)
+    {
+        WARNING("Failed to create cgroup %s: %s\n", b->leaf, strerror(errno));
+        b->leaf[0] = '\0';
+        return -1;
+    }
+
+    if (branch->cpus > 0)
+    {
+        sprintf(value, "%ld %d", (long)(branch->cpus * BUDGET_CPU_PERIOD),
+                BUDGET_CPU_PERIOD);
+        if (_write_file(b->leaf, "cpu.max", value) != 0)
+            WARNING("Failed to set cpu.max of %s\n", b->leaf);
+    }
+    if (branch->memory_max > 0)
+    {
+        sprintf(value, "%lu", branch->memory_max);
+        if (_write_file(b->leaf, "memory.max", value) != 0)
+            WARNING("Failed to set memory.max of %s\n", b->leaf);
+    }
+    if (branch->io_weight > 0)
+    {
+        sprintf(value, "default %lu", branch->io_weight);
+        if (_write_file(b->leaf, "io.weight", value) != 0)
+            WARNING("Failed to set io.weight of %s\n", b->leaf);
+    }
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", b->leaf);
+    b->procs_fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (b->procs_fd < 0)
+    {
+        rmdir(b->leaf);
+        b->leaf[0] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+struct budget* budget_create(const struct repo_branch* branch)
+{
+    struct budget* b;
+
+    if (branch == NULL || !_has_budget(branch))
+        return NULL;
+    pthread_once(&s_budget_once, _init);
+
+    b = arena_alloc(&g_arena, sizeof(struct budget));
+    if (b == NULL)
+        return NULL;
+    memset(b, 0, sizeof(*b));
+    b->branch = branch;
+    b->procs_fd = -1;
+
+    if (s_parent[0] != '\0')
+        _make_leaf(b);
+
+    /* Also for when moving into the leaf fails */
+    if (branch->cpus > 0)
+        _pick_cpus(b);
+    if (branch->memory_max > 0)
+    {
+        b->memory.rlim_cur = b->memory.rlim_max = branch->memory_max;
+        b->limit_memory = true;
+    }
+    return b;
+}
+
+void budget_enter(const struct budget* b)
+{
+    if (b == NULL)
+        return;
+
+    if (b->procs_fd >= 0)
+    {
+        /* "0" is whoever writes it */
+        if (write(b->procs_fd, "0", 1) == 1)
+            return;
+    }
+    if (b->pin)
+        sched_setaffinity(0, sizeof(b->cpus), &b->cpus);
+    if (b->limit_memory)
+        setrlimit(RLIMIT_AS, &b->memory);
+}
+
+void budget_kill(const struct budget* b)
+{
+    /* cgroup.kill needs Linux 5.14, older kernels have the process group */
+    if (b != NULL && b->leaf[0] != '\0')
+        _write_file(b->leaf, "cgroup.kill", "1");
+}
+
+void budget_destroy(struct budget* b)
+{
+    if (b == NULL || b->leaf[0] == '\0')
+        return;
+
+    close(b->procs_fd);
+    b->procs_fd = -1;
+    if (rmdir(b->leaf) != 0)
+        WARNING("Failed to remove cgroup %s: %s\n", b->leaf, strerror(errno));
+    b->leaf[0] = '\0';
+}
+
+void budget_background(void)
+{
+    struct sched_param param;
+
+    if (!g_config.background)
+        return;
+
+    /* Both only change the calling thread when given 0 */
+    memset(&param, 0, sizeof(param));
+    if (sched_setscheduler(0, SCHED_IDLE, &param) != 0)
+    {
+        sched_setscheduler(0, SCHED_BATCH, &param);
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    }
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        MSG("Failed to lower IO priority: %s\n", strerror(errno));
+}
@@ -0,0 +1,352 @@
+/******************************************************************************
+ * config.c - Configuration file loading
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <piratpkg.h>
+#include <config.h>
+#include <parser.h>
+#include <strings.h>
+#include <db.h>
+#include <timings.h>
+#include <sandbox.h>
+#include <log.h>
+
+/* =============================================================================
+ * Path Handling
+ * ========================================================================== */
+
+char* get_full_path(const char* path)
+{
+    char* full_path =
+        arena_alloc(&g_arena, strlen(g_config.root) + strlen(path) + 2);
+    if (full_path == NULL)
+    {
+        ERROR("Memory allocation failed for path %s: %s", path,
+              strerror(errno));
+        return NULL;
+    }
+    sprintf(full_path, "%s/%s", g_config.root, path);
+    return full_path;
+}
+
+/* =============================================================================
+ * Configuration Validation
+ * ========================================================================== */
+
+static int _validate_config(void)
+{
+    int i, j = 0;
+    if (g_config.root == NULL)
+    {
+        g_config.root = "/";
+        WARNING("ROOT is not set in the config, defaulting to '/'\n");
+    }
+
+    if (g_config.default_branch == NULL)
+    {
+        ERROR("DEFAULT_BRANCH is not set in the config\n");
+        return 1;
+    }
+
+    if (g_config.binary_repo == NULL)
+    {
+        g_config.binary_repo = db_path("binaries");
+    }
+
+    if (g_config.build_cache == NULL)
+    {
+        g_config.build_cache = db_path("cache/build");
+    }
+
+    if (g_config.source_cache == NULL)
+    {
+        g_config.source_cache = db_path("cache/sources");
+    }
+
+    if (g_config.sandbox_shell == NULL)
+    {
+        g_config.sandbox_shell = "/bin/sh";
+    }
+
+    if (g_config.timings_threshold < 0)
+    {
+        g_config.timings_threshold = TIMINGS_DEFAULT_THRESHOLD;
+    }
+
+    if (g_config.idle_timeout < 0)
+    {
+        g_config.idle_timeout = SANDBOX_DEFAULT_IDLE_TIMEOUT;
+    }
+
+    if (g_config.num_branches == 0)
+    {
+        ERROR("REPO_BRANCHES is not set or empty\n");
+        return 1;
+    }
+
+    for (i = 0; i < g_config.num_branches; i++)
+    {
+        int found = 0;
+        for (j = 0; j < g_config.num_branches; j++)
+        {
+            if (g_config.branches[j].path != NULL)
+            {
+                if (strcasecmp(g_config.branches[i].name,
+                               g_config.branches[j].name) == 0)
+                {
+                    g_config.branches[i].path =
+                        get_full_path(g_config.branches[j].path);
+                    found = 1;
+                    break;
+                }
+            }
+        }
+
+        if (!found)
+        {
+            WARNING("Branch \"%s\" does not have a matching path "
+                    "definition\n",
+                    g_config.branches[i].name);
+        }
+    }
+
+    return 0;
+}
+
+/* =============================================================================
+ * Loading
+ * ========================================================================== */
+
+/* "512M" and the like, in bytes */
+static unsigned long _parse_size(const char* value)
+{
+    char* end;
+    double size = strtod(value, &end);
+
+    switch (*end)
+    {
+        case 'k':
+        case 'K':
+            size *= 1024;
+            break;
+        case 'm':
+        case 'M':
+            size *= 1024 * 1024;
+            break;
+        case 'g':
+        case 'G':
+            size *= 1024 * 1024 * 1024;
+            break;
+    }
+    return size > 0 ? (unsigned long)size : 0;
+}
+
+/* <BRANCH>_CPUS, <BRANCH>_MEMORY_MAX and <BRANCH>_IO_WEIGHT */
+static void _parse_budget(struct repo_branch* branch, const char* key,
+                          const char* value)
+{
+    char prefix[MAX_LINE_LENGTH];
+    size_t len = strlen(branch->name);
+
+    if (len >= sizeof(prefix) || strlen(key) <= len || key[len] != '_')
+        return;
+    memcpy(prefix, key, len);
+    prefix[len] = '\0';
+    if (strcasecmp(prefix, branch->name) != 0)
+        return;
+    key += len + 1;
+
+    if (strcmp(key, "CPUS") == 0)
+        branch->cpus = strtod(value, NULL);
+    else if (strcmp(key, "MEMORY_MAX") == 0)
+        branch->memory_max = _parse_size(value);
+    else if (strcmp(key, "IO_WEIGHT") == 0)
+    {
+        branch->io_weight = strtoul(value, NULL, 10);
+        if (branch->io_weight > 10000)
+            branch->io_weight = 10000;
+    }
+}
+
+int config_load(const char* path)
+{
+    int i;
+    FILE* file;
+    size_t len;
+    char line[MAX_LINE_LENGTH];
+    struct key_value_pair kv_pair;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        ERROR("Failed to open config file %s: %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_CONFIG_MISSING;
+    }
+
+    g_config.branches = NULL;
+    g_config.num_branches = 0;
+    g_config.timings_threshold = -1;
+    g_config.function_timeout = 0;
+    g_config.idle_timeout = -1;
+
+    /* Parse config */
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        len = strlen(line);
+        if (line[len - 1] == '\n')
+        {
+            line[len - 1] = '\0';
+        }
+
+        if (parse_single_key_value(line, &kv_pair) != 0)
+        {
+            continue;
+        }
+
+        /* Parsing ROOT key */
+        if (strcmp(kv_pair.key, "ROOT") == 0)
+        {
+            g_config.root = arena_alloc(&g_arena, strlen(kv_pair.value) + 1);
+            if (g_config.root)
+            {
+                strcpy(g_config.root, kv_pair.value);
+            }
+        }
+
+        /* Parsing REPO_BRANCHES key */
+        if (strcmp(kv_pair.key, "REPO_BRANCHES") == 0)
+        {
+            g_config.num_branches = count_words(kv_pair.value);
+            g_config.branches = arena_alloc(
+                &g_arena, sizeof(struct repo_branch) * g_config.num_branches);
+            memset(g_config.branches, 0,
+                   sizeof(struct repo_branch) * g_config.num_branches);
+
+            char* token = strtok(kv_pair.value, " ");
+            int idx = 0;
+
+            while (token != NULL)
+            {
+                g_config.branches[idx].name = token;
+                idx++;
+                token = strtok(NULL, " ");
+            }
+        }
+
+        /* Parsing BINARY_REPO key */
+        if (strcmp(kv_pair.key, "BINARY_REPO") == 0)
+        {
+            g_config.binary_repo = strdup_safe(kv_pair.value);
+        }
+
+        /* Parsing SOURCE_CACHE key */
+        if (strcmp(kv_pair.key, "SOURCE_CACHE") == 0)
+        {
+            g_config.source_cache = strdup_safe(kv_pair.value);
+        }
+
+        /* Parsing SOURCE_MIRROR key */
+        if (strcmp(kv_pair.key, "SOURCE_MIRROR") == 0)
+        {
+            g_config.source_mirror = strdup_safe(kv_pair.value);
+        }
+
+        /* Parsing SANDBOX_SHELL key */
+        if (strcmp(kv_pair.key, "SANDBOX_SHELL") == 0)
+        {
+            g_config.sandbox_shell = strdup_safe(kv_pair.value);
+        }
+
+        /* Parsing CGROUP_ROOT key */
+        if (strcmp(kv_pair.key, "CGROUP_ROOT") == 0)
+        {
+            g_config.cgroup_root = strdup_safe(kv_pair.value);
+        }
+
+        /* Parsing FUNCTION_TIMEOUT key */
+        if (strcmp(kv_pair.key, "FUNCTION_TIMEOUT") == 0)
+        {
+            g_config.function_timeout = atol(kv_pair.value);
+        }
+
+        /* Parsing IDLE_TIMEOUT key */
+        if (strcmp(kv_pair.key, "IDLE_TIMEOUT") == 0)
+        {
+            g_config.idle_timeout = atol(kv_pair.value);
+        }
+
+        /* Parsing TIMINGS_THRESHOLD key */
+        if (strcmp(kv_pair.key, "TIMINGS_THRESHOLD") == 0)
+        {
+            g_config.timings_threshold = atoi(kv_pair.value);
+        }
+
+        /* Parsing BUILD_CACHE key */
+        if (strcmp(kv_pair.key, "BUILD_CACHE") == 0)
+        {
+            g_config.build_cache = strdup_safe(kv_pair.value);
+        }
+
+        /* Parsing DEFAULT_BRANCH key */
+        if (strcmp(kv_pair.key, "DEFAULT_BRANCH") == 0)
+        {
+            g_config.default_branch =
+                arena_alloc(&g_arena, strlen(kv_pair.value) + 1);
+            strcpy(g_config.default_branch, kv_pair.value);
+        }
+    }
+
+    /* Second pass to extract branch paths from the config file */
+    fseek(file, 0, SEEK_SET);
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        len = strlen(line);
+        if (line[len - 1] == '\n')
+        {
+            line[len - 1] = '\0';
+        }
+
+        if (parse_single_key_value(line, &kv_pair) != 0)
+        {
+            continue;
+        }
+
+        /* Check for branch path definitions */
+        for (i = 0; i < g_config.num_branches; i++)
+        {
+            if (strcasecmp(kv_pair.key, g_config.branches[i].name) == 0)
+            {
+                g_config.branches[i].path =
+                    arena_alloc(&g_arena, strlen(kv_pair.value) + 1);
+                if (g_config.branches[i].path)
+                {
+                    strcpy(g_config.branches[i].path, kv_pair.value);
+                }
+            }
+            else
+            {
+                _parse_budget(&g_config.branches[i], kv_pair.key,
+                              kv_pair.value);
+            }
+        }
+    }
+
+    fclose(file);
+
+    if (_validate_config() != 0)
+    {
+        return ACTION_RET_ERR_CONFIG_MISSING;
+    }
+    return ACTION_RET_OK;
+}
@@ -0,0 +1,194 @@
+/******************************************************************************
+ * copy.c - Parallel file copy workers
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <piratpkg.h>
+#include <copy.h>
+#include <hash.h>
+#include <fs.h>
+#include <log.h>
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+static int _run_job(const struct copy_job* job)
+{
+    char hash[SHA256_HEX_SIZE];
+    int ret;
+
+    if (job->src_fd < 0)
+    {
+        ret = fs_copy_file(job->src_path, job->dst, job->mode);
+    }
+    else
+    {
+        /* Never through a link, archives are untrusted */
+        int out = open(job->dst, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+                       job->mode);
+        if (out < 0)
+            return -1;
+
+        ret = fs_copy_range(job->src_fd, job->src_off, out, job->size);
+        if (ret == 0)
+            ret = fchmod(out, job->mode);
+        if (close(out) != 0)
+            ret = -1;
+    }
+
+    if (ret == 0 && job->hash != NULL)
+    {
+        if (sha256_file(job->dst, hash) != 0)
+            return -1;
+        if (strcmp(hash, job->hash) != 0)
+        {
+            ERROR("Checksum mismatch for '%s'\n", job->name);
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    if (ret == 0 && job->rename_to != NULL)
+        ret = rename(job->dst, job->rename_to);
+
+    return ret;
+}
+
+static int _run_and_report(const struct copy_job* job)
+{
+    if (_run_job(job) == 0)
+        return ACTION_RET_OK;
+
+    ERROR("Failed to write '%s': %s\n", job->name, strerror(errno));
+    unlink(job->dst);
+    return ACTION_RET_ERR_IO;
+}
+
+static void* _worker(void* arg)
+{
+    struct copy_pool* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        struct copy_job job;
+        int ret;
+
+        while (pool->count == 0 && !pool->closing)
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        if (pool->count == 0)
+            break;
+
+        job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % COPY_QUEUE_SIZE;
+        pool->count--;
+        pthread_cond_signal(&pool->not_full);
+
+        /* Once something failed the remaining jobs are only drained */
+        if (pool->error != ACTION_RET_OK)
+            continue;
+
+        pthread_mutex_unlock(&pool->lock);
+        ret = _run_and_report(&job);
+        pthread_mutex_lock(&pool->lock);
+
+        if (ret != ACTION_RET_OK && pool->error == ACTION_RET_OK)
+            pool->error = ret;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int copy_pool_start(struct copy_pool* pool, size_t workers)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->error = ACTION_RET_OK;
+
+    if (workers == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (size_t)cpus : 1;
+    }
+    if (workers > COPY_MAX_WORKERS)
+        workers = COPY_MAX_WORKERS;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+
+    /* A single worker buys nothing over running jobs on submit */
+    while (workers > 1 && pool->num_threads < workers)
+    {
+        if (pthread_create(&pool->threads[pool->num_threads], NULL, _worker,
+                           pool) != 0)
+            break;
+        pool->num_threads++;
+    }
+
+    return ACTION_RET_OK;
+}
+
+int copy_pool_submit(struct copy_pool* pool, const struct copy_job* job)
+{
+    int ret;
+
+    if (pool->num_threads == 0)
+    {
+        if (pool->error == ACTION_RET_OK)
+            pool->error = _run_and_report(job);
+        return pool->error;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == COPY_QUEUE_SIZE && pool->error == ACTION_RET_OK)
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+
+    if (pool->error == ACTION_RET_OK)
+    {
+        pool->queue[(pool->head + pool->count) % COPY_QUEUE_SIZE] = *job;
+        pool->count++;
+        pthread_cond_signal(&pool->not_empty);
+    }
+
+    ret = pool->error;
+    pthread_mutex_unlock(&pool->lock);
+    return ret;
+}
+
+int copy_pool_finish(struct copy_pool* pool)
+{
+    size_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = true;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pool->num_threads = 0;
+
+    pthread_cond_destroy(&pool->not_full);
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_mutex_destroy(&pool->lock);
+
+    return pool->error;
+}
@@ -0,0 +1,474 @@
+/******************************************************************************
+ * db.c - Installed package database
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <piratpkg.h>
+#include <db.h>
+#include <fs.h>
+#include <pkg.h>
+#include <parser.h>
+#include <strings.h>
+#include <log.h>
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+/* Lists from before the version had a field of its own hold
+ * "name-version:branch", where both sides may contain '-'. The split whose
+ * recorded meta has that version wins, without one the version starts at
+ * the last '-' followed by a digit, so names like "lib-foo" survive. */
+static int _parse_legacy_line(char* line, struct db_entry* entry)
+{
+    char* colon = strrchr(line, ':');
+    char* meta_dash = NULL;
+    char* dash = NULL;
+    char* p;
+
+    if (colon == NULL)
+        return -1;
+    *colon = '\0';
+
+    for (p = line + 1; *p != '\0' && meta_dash == NULL; p++)
+    {
+        struct pkg_ctx meta;
+
+        if (*p != '-')
+            continue;
+
+        *p = '\0';
+        memset(&meta, 0, sizeof(meta));
+        if (db_read_meta(line, &meta) == ACTION_RET_OK &&
+            meta.version != NULL && strcmp(meta.version, p + 1) == 0)
+            meta_dash = p;
+        *p = '-';
+    }
+
+    for (p = line; *p != '\0' && meta_dash == NULL; p++)
+    {
+        if (*p == '-' && (dash == NULL || isdigit((unsigned char)p[1])))
+            dash = p;
+    }
+    if (meta_dash != NULL)
+        dash = meta_dash;
+
+    if (dash == NULL || dash == line)
+        return -1;
+    *dash = '\0';
+
+    entry->name = strdup_safe(line);
+    entry->version = strdup_safe(dash + 1);
+    entry->branch = strdup_safe(colon + 1);
+    return 0;
+}
+
+/* Split "name<TAB>version<TAB>branch" into its parts */
+static int _parse_installed_line(char* line, struct db_entry* entry)
+{
+    char* version = strchr(line, '\t');
+    char* branch;
+
+    if (version == NULL)
+        return _parse_legacy_line(line, entry);
+    *version++ = '\0';
+
+    branch = strchr(version, '\t');
+    if (branch == NULL || *line == '\0' || *version == '\0')
+        return -1;
+    *branch++ = '\0';
+
+    entry->name = strdup_safe(line);
+    entry->version = strdup_safe(version);
+    entry->branch = strdup_safe(branch);
+    return 0;
+}
+
+static int _cmp_entry(const void* a, const void* b)
+{
+    return strcmp(((const struct db_entry*)a)->name,
+                  ((const struct db_entry*)b)->name);
+}
+
+/* =============================================================================
+ * installed.list
+ * ========================================================================== */
+
+char* db_path(const char* rel)
+{
+    return fs_join(fs_join(g_config.root, DB_DIR), rel);
+}
+
+int db_load(struct db* db)
+{
+    char line[MAX_LINE_LENGTH];
+    char* path = db_path("installed.list");
+    FILE* file;
+
+    db->entries = NULL;
+    db->num_entries = 0;
+    db->cap = 0;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        /* No packages installed yet */
+        return errno == ENOENT ? ACTION_RET_OK : ACTION_RET_ERR_IO;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        struct db_entry entry;
+        size_t len = strlen(line);
+
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        if (_parse_installed_line(line, &entry) != 0)
+            continue;
+
+        if (db_add(db, entry.name, entry.version, entry.branch) != 0)
+        {
+            fclose(file);
+            return ACTION_RET_ERR_UNKNOWN;
+        }
+    }
+
+    fclose(file);
+    return ACTION_RET_OK;
+}
+
+int db_save(struct db* db)
+{
+    char* path = db_path("installed.list");
+    char* tmp_path;
+    FILE* file;
+    size_t i;
+
+    if (fs_mkdir_p(db_path(""), 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", db_path(""), strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return ACTION_RET_ERR_IO;
+
+    for (i = 0; i < db->num_entries; i++)
+    {
+        fprintf(file, "%s\t%s\t%s\n", db->entries[i].name,
+                db->entries[i].version, db->entries[i].branch);
+    }
+
+    return fs_close_atomic(file, tmp_path, path);
+}
+
+struct db_entry* db_find(struct db* db, const char* name)
+{
+    struct db_entry key;
+
+    if (db->num_entries == 0)
+        return NULL;
+
+    key.name = (char*)name;
+    return bsearch(&key, db->entries, db->num_entries, sizeof(struct db_entry),
+                   _cmp_entry);
+}
+
+int db_add(struct db* db, const char* name, const char* version,
+           const char* branch)
+{
+    struct db_entry* entry = db_find(db, name);
+    size_t i;
+
+    if (entry == NULL)
+    {
+        if (db->num_entries == db->cap)
+        {
+            size_t new_cap = db->cap ? db->cap * 2 : 64;
+            struct db_entry* entries =
+                arena_alloc(&g_arena, new_cap * sizeof(struct db_entry));
+            if (entries == NULL)
+                return ACTION_RET_ERR_UNKNOWN;
+            if (db->num_entries > 0)
+                memcpy(entries, db->entries,
+                       db->num_entries * sizeof(struct db_entry));
+            db->entries = entries;
+            db->cap = new_cap;
+        }
+
+        /* Keep the list sorted, installed.list is usually appended in order
+         * so this is almost always a plain append */
+        i = db->num_entries;
+        while (i > 0 && strcmp(db->entries[i - 1].name, name) > 0)
+        {
+            db->entries[i] = db->entries[i - 1];
+            i--;
+        }
+
+        entry = &db->entries[i];
+        entry->name = strdup_safe(name);
+        db->num_entries++;
+    }
+
+    entry->version = strdup_safe(version);
+    entry->branch = strdup_safe(branch);
+    return ACTION_RET_OK;
+}
+
+int db_remove(struct db* db, const char* name)
+{
+    struct db_entry* entry = db_find(db, name);
+    size_t idx;
+
+    if (entry == NULL)
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+
+    idx = entry - db->entries;
+    memmove(entry, entry + 1,
+            (db->num_entries - idx - 1) * sizeof(struct db_entry));
+    db->num_entries--;
+    return ACTION_RET_OK;
+}
+
+/* =============================================================================
+ * Per package records
+ * ========================================================================== */
+
+char* db_meta_text(struct pkg_ctx* pkg)
+{
+    const char* fmt = "PACKAGE_NAME=%s\n"
+                      "PACKAGE_VERSION=%s\n"
+                      "PACKAGE_DESCRIPTION=%s\n"
+                      "PACKAGE_MAINTAINERS=%s\n"
+                      "PACKAGE_DEPENDS=%s\n"
+                      "PACKAGE_PROVIDES=%s\n"
+                      "PACKAGE_CONFLICTS=%s\n"
+                      "BRANCH=%s\n"
+                      "BUILD_KEY=%s\n";
+    const char* depends = pkg->depends != NULL ? pkg->depends : "";
+    const char* provides = pkg->provides != NULL ? pkg->provides : "";
+    const char* conflicts = pkg->conflicts != NULL ? pkg->conflicts : "";
+    size_t len = strlen(fmt) + strlen(pkg->name) + strlen(pkg->version) +
+                 strlen(pkg->description) + strlen(pkg->maintainers) +
+                 strlen(depends) + strlen(provides) + strlen(conflicts) +
+                 strlen(pkg->branch) + strlen(pkg->build_key) + 1;
+    char* text = arena_alloc(&g_arena, len);
+
+    if (text == NULL)
+        return NULL;
+
+    sprintf(text, fmt, pkg->name, pkg->version, pkg->description,
+            pkg->maintainers, depends, provides, conflicts, pkg->branch,
+            pkg->build_key);
+    return text;
+}
+
+int db_parse_meta(const char* text, struct pkg_ctx* pkg)
+{
+    char* copy = strdup_safe(text);
+    char* save = NULL;
+    char* line;
+
+    if (copy == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (line = strtok_r(copy, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save))
+    {
+        struct key_value_pair kv_pair;
+
+        if (parse_single_key_value(line, &kv_pair) != 0)
+            continue;
+
+        if (strcmp(kv_pair.key, "PACKAGE_NAME") == 0)
+            pkg->name = kv_pair.value;
+        else if (strcmp(kv_pair.key, "PACKAGE_VERSION") == 0)
+            pkg->version = kv_pair.value;
+        else if (strcmp(kv_pair.key, "PACKAGE_DESCRIPTION") == 0)
+            pkg->description = kv_pair.value;
+        else if (strcmp(kv_pair.key, "PACKAGE_MAINTAINERS") == 0)
+            pkg->maintainers = kv_pair.value;
+        else if (strcmp(kv_pair.key, "PACKAGE_DEPENDS") == 0)
+            pkg->depends = kv_pair.value;
+        else if (strcmp(kv_pair.key, "PACKAGE_PROVIDES") == 0)
+            pkg->provides = kv_pair.value;
+        else if (strcmp(kv_pair.key, "PACKAGE_CONFLICTS") == 0)
+            pkg->conflicts = kv_pair.value;
+        else if (strcmp(kv_pair.key, "BRANCH") == 0)
+            pkg->branch = kv_pair.value;
+        else if (strcmp(kv_pair.key, "REASON") == 0)
+            pkg->reason = kv_pair.value;
+        else if (strcmp(kv_pair.key, "BUILD_KEY") == 0 &&
+                 strlen(kv_pair.value) == SHA256_HEX_SIZE - 1)
+            strcpy(pkg->build_key, kv_pair.value);
+    }
+
+    return ACTION_RET_OK;
+}
+
+int db_write_meta(struct pkg_ctx* pkg)
+{
+    char* dir = db_path(fs_join("db", pkg->name));
+    char* path = fs_join(dir, "meta");
+    char* text = db_meta_text(pkg);
+    char* tmp_path;
+    FILE* file;
+
+    if (text == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    if (fs_mkdir_p(dir, 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", dir, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return ACTION_RET_ERR_IO;
+
+    fputs(text, file);
+    if (pkg->reason != NULL)
+        fprintf(file, "REASON=%s\n", pkg->reason);
+    return fs_close_atomic(file, tmp_path, path);
+}
+
+int db_read_meta(const char* name, struct pkg_ctx* pkg)
+{
+    char text[8192];
+    char* path = db_path(fs_join(fs_join("db", name), "meta"));
+    FILE* file = fopen(path, "r");
+    size_t len;
+
+    if (file == NULL)
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+
+    len = fread(text, 1, sizeof(text) - 1, file);
+    text[len] = '\0';
+    fclose(file);
+
+    return db_parse_meta(text, pkg);
+}
+
+int db_write_files(const char* name, struct db_file* files, size_t num_files)
+{
+    char* dir = db_path(fs_join("db", name));
+    char* path = fs_join(dir, "files");
+    char* tmp_path;
+    FILE* file;
+    size_t i;
+
+    if (fs_mkdir_p(dir, 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", dir, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return ACTION_RET_ERR_IO;
+
+    /* type, mode, size, sha256, path[, symlink target] */
+    for (i = 0; i < num_files; i++)
+    {
+        struct db_file* f = &files[i];
+        fprintf(file, "%c\t%04o\t%lld\t%s\t%s", f->type,
+                (unsigned int)(f->mode & 07777), (long long)f->size,
+                f->type == DB_FILE_DIR ? "-" : f->hash, f->path);
+        if (f->type == DB_FILE_LNK)
+            fprintf(file, "\t%s", f->target);
+        fputc('\n', file);
+    }
+
+    return fs_close_atomic(file, tmp_path, path);
+}
+
+int db_read_files(const char* name, struct db_file** files, size_t* num_files)
+{
+    char* path = db_path(fs_join(fs_join("db", name), "files"));
+    FILE* file = fopen(path, "r");
+    char* line = NULL;
+    size_t line_cap = 0;
+    size_t cap = 0;
+    ssize_t len;
+
+    *files = NULL;
+    *num_files = 0;
+
+    if (file == NULL)
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+
+    while ((len = getline(&line, &line_cap, file)) > 0)
+    {
+        struct db_file f;
+        char* fields[6];
+        char* save = NULL;
+        int n = 0;
+
+        if (line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        fields[n] = strtok_r(line, "\t", &save);
+        while (fields[n] != NULL && n < 5)
+            fields[++n] = strtok_r(NULL, "\t", &save);
+
+        if (n < 5)
+            continue;
+
+        f.type = fields[0][0];
+        f.mode = (mode_t)strtoul(fields[1], NULL, 8);
+        f.size = (off_t)strtoll(fields[2], NULL, 10);
+        strncpy(f.hash, fields[3], SHA256_HEX_SIZE - 1);
+        f.hash[SHA256_HEX_SIZE - 1] = '\0';
+        f.path = strdup_safe(fields[4]);
+        f.target = fields[5] != NULL ? strdup_safe(fields[5]) : NULL;
+
+        if (*num_files == cap)
+        {
+            size_t new_cap = cap ? cap * 2 : 256;
+            struct db_file* grown =
+                arena_alloc(&g_arena, new_cap * sizeof(struct db_file));
+            if (grown == NULL)
+            {
+                free(line);
+                fclose(file);
+                return ACTION_RET_ERR_UNKNOWN;
+            }
+            if (*num_files > 0)
+                memcpy(grown, *files, *num_files * sizeof(struct db_file));
+            *files = grown;
+            cap = new_cap;
+        }
+        (*files)[(*num_files)++] = f;
+    }
+
+    free(line);
+    fclose(file);
+    return ACTION_RET_OK;
+}
+
+int db_remove_package(const char* name)
+{
+    if (fs_remove_tree(db_path(fs_join("db", name))) != 0)
+    {
+        ERROR("Failed to remove database entry for %s: %s\n", name,
+              strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+    return ACTION_RET_OK;
+}
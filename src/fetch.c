@@ -0,0 +1,268 @@
+/******************************************************************************
+ * fetch.c - Source downloads and the source cache
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <piratpkg.h>
+#include <fetch.h>
+#include <pkg.h>
+#include <hash.h>
+#include <fs.h>
+#include <log.h>
+
+struct fetch_job
+{
+    const char* url;
+    const char* sha256;
+    pid_t pid;
+};
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+/* File name part of a URL or path, the hash when there is none */
+static const char* _source_name(const char* url, const char* sha256)
+{
+    const char* slash = strrchr(url, '/');
+    const char* name = slash != NULL ? slash + 1 : url;
+    return *name != '\0' ? name : sha256;
+}
+
+/* file:// URLs and plain paths are local */
+static const char* _local_path(const char* url)
+{
+    if (strncmp(url, "file://", 7) == 0)
+        return url + 7;
+    if (url[0] == '/')
+        return url;
+    return NULL;
+}
+
+/* Runs in a forked child, only has to leave a file at tmp */
+static int _download(const char* url, const char* tmp)
+{
+    const char* local = _local_path(url);
+    pid_t pid;
+    int status;
+
+    if (local != NULL)
+        return access(local, R_OK) == 0 ? fs_copy_file(local, tmp, 0644) : -1;
+
+    pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+    {
+        execlp("curl", "curl", "-fsSL", "--retry", "2", "-o", tmp, url,
+               (char*)NULL);
+        execlp("wget", "wget", "-q", "-O", tmp, url, (char*)NULL);
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/* Try every candidate location, keeping the first one whose hash matches */
+static int _fetch_one(const struct fetch_job* job)
+{
+    const char* candidates[3];
+    char* dst = fetch_cache_path(job->sha256);
+    char* tmp = arena_alloc(&g_arena, strlen(dst) + 6);
+    char hash[SHA256_HEX_SIZE];
+    size_t i, n = 0;
+
+    if (tmp == NULL)
+        return -1;
+    sprintf(tmp, "%s.part", dst);
+
+    if (g_config.source_mirror != NULL)
+    {
+        candidates[n++] = fs_join(g_config.source_mirror, job->sha256);
+        candidates[n++] = fs_join(g_config.source_mirror,
+                                  _source_name(job->url, job->sha256));
+    }
+    candidates[n++] = job->url;
+
+    for (i = 0; i < n; i++)
+    {
+        if (candidates[i] == NULL || _download(candidates[i], tmp) != 0)
+            continue;
+
+        if (sha256_file(tmp, hash) == 0 && strcmp(hash, job->sha256) == 0)
+            return rename(tmp, dst);
+
+        WARNING("Checksum mismatch for '%s'\n", candidates[i]);
+    }
+
+    unlink(tmp);
+    return -1;
+}
+
+/* Keep up to FETCH_MAX_PARALLEL downloads going, one child each */
+static int _run_jobs(struct fetch_job* jobs, size_t num_jobs)
+{
+    size_t next = 0, running = 0, k;
+    int ret = 0;
+
+    while (next < num_jobs || running > 0)
+    {
+        int status;
+        pid_t pid;
+
+        if (next < num_jobs && running < FETCH_MAX_PARALLEL)
+        {
+            struct fetch_job* job = &jobs[next++];
+
+            STEP("%s\n", job->url);
+            fflush(NULL);
+            job->pid = fork();
+            if (job->pid < 0)
+            {
+                ERROR("fork: %s\n", strerror(errno));
+                ret = -1;
+                next = num_jobs;
+                continue;
+            }
+            if (job->pid == 0)
+                _exit(_fetch_one(job) == 0 ? 0 : 1);
+            running++;
+            continue;
+        }
+
+        pid = wait(&status);
+        if (pid < 0)
+            break;
+
+        for (k = 0; k < next; k++)
+        {
+            if (jobs[k].pid != pid)
+                continue;
+            running--;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                ERROR("Failed to fetch '%s'\n", jobs[k].url);
+                ret = -1;
+            }
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+char* fetch_cache_path(const char* sha256)
+{
+    return fs_join(g_config.source_cache, sha256);
+}
+
+int fetch_sources(struct pkg_ctx** pkgs, size_t num_pkgs)
+{
+    struct fetch_job* jobs;
+    size_t num_jobs = 0, total = 0;
+    size_t i, j, k;
+    int status;
+    pid_t pid;
+
+    for (i = 0; i < num_pkgs; i++)
+        total += pkgs[i]->num_sources;
+    if (total == 0)
+        return ACTION_RET_OK;
+
+    jobs = arena_alloc(&g_arena, total * sizeof(*jobs));
+    if (jobs == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    /* One job per missing hash, however many packages share it */
+    for (i = 0; i < num_pkgs; i++)
+    {
+        for (j = 0; j < pkgs[i]->num_sources; j++)
+        {
+            const char* sha256 = pkgs[i]->source_hashes[j];
+
+            if (access(fetch_cache_path(sha256), R_OK) == 0)
+                continue;
+            for (k = 0; k < num_jobs; k++)
+                if (strcmp(jobs[k].sha256, sha256) == 0)
+                    break;
+            if (k < num_jobs)
+                continue;
+
+            jobs[num_jobs].url = pkgs[i]->sources[j];
+            jobs[num_jobs].sha256 = sha256;
+            jobs[num_jobs].pid = -1;
+            num_jobs++;
+        }
+    }
+
+    if (num_jobs == 0)
+        return ACTION_RET_OK;
+
+    if (fs_mkdir_p(g_config.source_cache, 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", g_config.source_cache,
+              strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    INFO("Fetching %lu source(s)...\n", (unsigned long)num_jobs);
+
+    /* A coordinator process owns the downloads, so its wait() can't reap
+     * anything else this process has running */
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0)
+    {
+        ERROR("fork: %s\n", strerror(errno));
+        return ACTION_RET_ERR_UNKNOWN;
+    }
+    if (pid == 0)
+        _exit(_run_jobs(jobs, num_jobs) == 0 ? 0 : 1);
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+        return ACTION_RET_ERR_IO;
+
+    return ACTION_RET_OK;
+}
+
+int fetch_place(struct pkg_ctx* pkg, const char* dir)
+{
+    size_t i;
+
+    for (i = 0; i < pkg->num_sources; i++)
+    {
+        const char* sha256 = pkg->source_hashes[i];
+        char* dst = fs_join(dir, _source_name(pkg->sources[i], sha256));
+
+        /* Copies, so a build that edits its sources can't poison the cache */
+        if (fs_copy_file(fetch_cache_path(sha256), dst, 0644) != 0)
+        {
+            ERROR("Failed to place source '%s': %s\n", pkg->sources[i],
+                  strerror(errno));
+            return ACTION_RET_ERR_IO;
+        }
+    }
+
+    return ACTION_RET_OK;
+}
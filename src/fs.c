@@ -0,0 +1,238 @@
+/******************************************************************************
+ * fs.c - Filesystem helpers
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <fs.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <piratpkg.h>
+#include <log.h>
+
+char* fs_join(const char* a, const char* b)
+{
+    size_t a_len = strlen(a);
+    char* path;
+
+    while (a_len > 0 && a[a_len - 1] == '/')
+        a_len--;
+    while (*b == '/')
+        b++;
+
+    path = arena_alloc(&g_arena, a_len + strlen(b) + 2);
+    if (path == NULL)
+        return NULL;
+
+    memcpy(path, a, a_len);
+    path[a_len] = '/';
+    strcpy(path + a_len + 1, b);
+    return path;
+}
+
+int fs_mkdir_p(const char* path, mode_t mode)
+{
+    char buf[4096];
+    size_t len = strlen(path);
+    size_t i;
+
+    if (len == 0 || len >= sizeof(buf))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memcpy(buf, path, len + 1);
+    for (i = 1; i <= len; i++)
+    {
+        if (buf[i] == '/' || buf[i] == '\0')
+        {
+            char c = buf[i];
+            buf[i] = '\0';
+            if (mkdir(buf, mode) != 0 && errno != EEXIST)
+                return -1;
+            buf[i] = c;
+        }
+    }
+
+    return 0;
+}
+
+int fs_remove_tree(const char* path)
+{
+    struct stat st;
+    DIR* d;
+    struct dirent* p;
+    int r = 0;
+
+    if (lstat(path, &st) != 0)
+        return errno == ENOENT ? 0 : -1;
+
+    if (!S_ISDIR(st.st_mode))
+        return unlink(path);
+
+    d = opendir(path);
+    if (d == NULL)
+        return -1;
+
+    while ((p = readdir(d)) != NULL)
+    {
+        char buf[4096];
+
+        if (!strcmp(p->d_name, ".") || !strcmp(p->d_name, ".."))
+            continue;
+
+        snprintf(buf, sizeof(buf), "%s/%s", path, p->d_name);
+        if (fs_remove_tree(buf) != 0)
+            r = -1;
+    }
+    closedir(d);
+
+    if (rmdir(path) != 0)
+        r = -1;
+
+    return r;
+}
+
+int fs_copy_range(int in, off_t offset, int out, off_t len)
+{
+    char buf[65536];
+    loff_t off = offset;
+
+    /* Let the kernel move (or share) the data first, it skips the round trip
+     * through userspace and reflinks on filesystems that support it */
+    while (len > 0)
+    {
+        ssize_t n = copy_file_range(in, &off, out, NULL, (size_t)len, 0);
+        if (n > 0)
+        {
+            len -= n;
+            continue;
+        }
+        if (n == 0)
+        {
+            errno = EPIPE;
+            return -1;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EXDEV && errno != EINVAL && errno != ENOSYS &&
+            errno != EOPNOTSUPP && errno != EBADF)
+            return -1;
+        break;
+    }
+
+    while (len > 0)
+    {
+        size_t chunk = len < (off_t)sizeof(buf) ? (size_t)len : sizeof(buf);
+        ssize_t n = pread(in, buf, chunk, off);
+        char* p = buf;
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == 0)
+                errno = EPIPE;
+            return -1;
+        }
+
+        off += n;
+        len -= n;
+        while (n > 0)
+        {
+            ssize_t w = write(out, p, (size_t)n);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            p += w;
+            n -= w;
+        }
+    }
+
+    return 0;
+}
+
+int fs_copy_file(const char* src, const char* dst, mode_t mode)
+{
+    struct stat st;
+    int in, out, ret;
+
+    in = open(src, O_RDONLY);
+    if (in < 0)
+        return -1;
+
+    out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (out < 0 || fstat(in, &st) != 0)
+    {
+        close(in);
+        if (out >= 0)
+            close(out);
+        return -1;
+    }
+
+    /* A whole file clone shares every extent, fall back to copying */
+    ret = 0;
+    if (ioctl(out, FICLONE, in) != 0)
+        ret = fs_copy_range(in, 0, out, st.st_size);
+
+    close(in);
+    if (close(out) != 0 || ret != 0)
+        return -1;
+
+    /* open() honours the umask, the recorded mode must win */
+    return chmod(dst, mode);
+}
+
+FILE* fs_open_atomic(const char* path, char** tmp_path)
+{
+    FILE* file;
+
+    *tmp_path = arena_alloc(&g_arena, strlen(path) + 5);
+    if (*tmp_path == NULL)
+        return NULL;
+    sprintf(*tmp_path, "%s.tmp", path);
+
+    file = fopen(*tmp_path, "w");
+    if (file == NULL)
+    {
+        ERROR("Failed to open '%s' for writing: %s\n", *tmp_path,
+              strerror(errno));
+    }
+    return file;
+}
+
+int fs_close_atomic(FILE* file, const char* tmp_path, const char* path)
+{
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+    {
+        ERROR("Failed to write '%s': %s\n", tmp_path, strerror(errno));
+        fclose(file);
+        unlink(tmp_path);
+        return ACTION_RET_ERR_IO;
+    }
+    fclose(file);
+
+    if (rename(tmp_path, path) != 0)
+    {
+        ERROR("Failed to replace '%s': %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return ACTION_RET_ERR_IO;
+    }
+    return ACTION_RET_OK;
+}
@@ -0,0 +1,61 @@
+/******************************************************************************
+ * json.c - Minimal JSON output helpers
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <json.h>
+
+void json_string(FILE* out, const char* str)
+{
+    const unsigned char* c;
+
+    if (str == NULL)
+    {
+        fputs("null", out);
+        return;
+    }
+
+    fputc('"', out);
+    for (c = (const unsigned char*)str; *c != '\0'; c++)
+    {
+        switch (*c)
+        {
+            case '"':
+                fputs("\\\"", out);
+                break;
+            case '\\':
+                fputs("\\\\", out);
+                break;
+            case '\n':
+                fputs("\\n", out);
+                break;
+            case '\t':
+                fputs("\\t", out);
+                break;
+            case '\r':
+                fputs("\\r", out);
+                break;
+            default:
+                if (*c < 0x20)
+                    fprintf(out, "\\u%04x", *c);
+                else
+                    fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void json_field(FILE* out, const char* key, const char* value, int first)
+{
+    if (!first)
+        fputs(", ", out);
+    json_string(out, key);
+    fputs(": ", out);
+    json_string(out, value);
+}
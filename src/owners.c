@@ -0,0 +1,733 @@
+/******************************************************************************
+ * owners.c - Path ownership index
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <piratpkg.h>
+#include <owners.h>
+#include <fs.h>
+#include <strings.h>
+#include <log.h>
+
+#define OWNERS_MAGIC 0x574f5050 /* "PPOW" */
+#define OWNERS_VERSION 1
+#define OWNERS_NONE 0xffffffffu
+
+/*
+ * On-disk layout, all offsets are from the start of the file:
+ *   struct owners_disk         header
+ *   uint32_t[num_owners]       string offsets of the owning package names
+ *   struct owners_disk_node[]  trie nodes in BFS order, root first, so the
+ *                              children of a node are contiguous and sorted
+ *                              by the first byte of their label
+ *   char[strings_size]         edge labels and owner names
+ */
+struct owners_disk
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_owners;
+    uint32_t num_nodes;
+    uint32_t owners_off;
+    uint32_t nodes_off;
+    uint32_t strings_off;
+    uint32_t strings_size;
+};
+
+struct owners_disk_node
+{
+    uint32_t label_off;
+    uint32_t label_len;
+    uint32_t owner;
+    uint32_t first_child;
+    uint32_t num_children;
+};
+
+struct owners_node
+{
+    const char* label;
+    size_t label_len;
+    uint32_t owner;
+    struct owners_node** children; /* Sorted by label[0] */
+    size_t num_children;
+    size_t cap_children;
+};
+
+/* =============================================================================
+ * On-disk trie
+ * ========================================================================== */
+
+#define DISK_AT(idx, off) ((const char*)(idx)->disk + (off))
+#define DISK_NODES(idx)                                                        \
+    ((const struct owners_disk_node*)DISK_AT(idx, (idx)->disk->nodes_off))
+#define DISK_OWNERS(idx)                                                       \
+    ((const uint32_t*)DISK_AT(idx, (idx)->disk->owners_off))
+#define DISK_STRINGS(idx) DISK_AT(idx, (idx)->disk->strings_off)
+
+static int _disk_valid(const struct owners_disk* hdr, size_t size)
+{
+    uint64_t nodes_end, owners_end, strings_end;
+
+    if (size < sizeof(struct owners_disk) || hdr->magic != OWNERS_MAGIC ||
+        hdr->version != OWNERS_VERSION || hdr->num_nodes == 0)
+        return 0;
+
+    owners_end = (uint64_t)hdr->owners_off + hdr->num_owners * 4ull;
+    nodes_end = (uint64_t)hdr->nodes_off +
+                hdr->num_nodes * (uint64_t)sizeof(struct owners_disk_node);
+    strings_end = (uint64_t)hdr->strings_off + hdr->strings_size;
+
+    return owners_end <= size && nodes_end <= size && strings_end <= size;
+}
+
+static const char* _disk_find(struct owners_index* idx, const char* path)
+{
+    const struct owners_disk_node* nodes = DISK_NODES(idx);
+    const char* strings = DISK_STRINGS(idx);
+    const struct owners_disk_node* node = &nodes[0];
+
+    while (*path != '\0')
+    {
+        uint32_t lo = node->first_child;
+        uint32_t hi = node->first_child + node->num_children;
+        const struct owners_disk_node* child = NULL;
+
+        /* Never trust offsets read from disk */
+        if (lo > idx->disk->num_nodes ||
+            node->num_children > idx->disk->num_nodes - lo)
+            return NULL;
+
+        /* Siblings are sorted by their first byte and never share it */
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            unsigned char c;
+
+            if (nodes[mid].label_off >= idx->disk->strings_size)
+                return NULL;
+            c = strings[nodes[mid].label_off];
+            if (c == (unsigned char)*path)
+            {
+                child = &nodes[mid];
+                break;
+            }
+            if (c < (unsigned char)*path)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (child == NULL ||
+            child->label_off + (uint64_t)child->label_len >
+                idx->disk->strings_size ||
+            strncmp(strings + child->label_off, path, child->label_len) != 0)
+            return NULL;
+
+        path += child->label_len;
+        node = child;
+    }
+
+    if (node->owner >= idx->disk->num_owners)
+        return NULL;
+    return strings + DISK_OWNERS(idx)[node->owner];
+}
+
+/* =============================================================================
+ * In-memory trie
+ * ========================================================================== */
+
+static struct owners_node* _node_new(const char* label, size_t label_len)
+{
+    struct owners_node* node = arena_alloc(&g_arena, sizeof(*node));
+    if (node == NULL)
+        return NULL;
+
+    node->label = label;
+    node->label_len = label_len;
+    node->owner = OWNERS_NONE;
+    node->children = NULL;
+    node->num_children = 0;
+    node->cap_children = 0;
+    return node;
+}
+
+/* Index of the child starting with c, or where it would have to go */
+static size_t _child_slot(struct owners_node* node, unsigned char c,
+                          int* found)
+{
+    size_t lo = 0, hi = node->num_children;
+
+    *found = 0;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        unsigned char m = (unsigned char)node->children[mid]->label[0];
+        if (m == c)
+        {
+            *found = 1;
+            return mid;
+        }
+        if (m < c)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int _child_insert(struct owners_node* node, size_t slot,
+                         struct owners_node* child)
+{
+    if (node->num_children == node->cap_children)
+    {
+        size_t new_cap = node->cap_children ? node->cap_children * 2 : 4;
+        struct owners_node** children =
+            arena_alloc(&g_arena, new_cap * sizeof(*children));
+        if (children == NULL)
+            return -1;
+        if (node->num_children > 0)
+            memcpy(children, node->children,
+                   node->num_children * sizeof(*children));
+        node->children = children;
+        node->cap_children = new_cap;
+    }
+
+    memmove(&node->children[slot + 1], &node->children[slot],
+            (node->num_children - slot) * sizeof(*node->children));
+    node->children[slot] = child;
+    node->num_children++;
+    return 0;
+}
+
+static struct owners_node* _mem_lookup(struct owners_node* node,
+                                       const char* path)
+{
+    while (*path != '\0')
+    {
+        int found;
+        size_t slot = _child_slot(node, (unsigned char)*path, &found);
+        struct owners_node* child;
+
+        if (!found)
+            return NULL;
+
+        child = node->children[slot];
+        if (strncmp(child->label, path, child->label_len) != 0)
+            return NULL;
+
+        path += child->label_len;
+        node = child;
+    }
+
+    return node;
+}
+
+static int _mem_insert(struct owners_node* node, const char* path,
+                       uint32_t owner)
+{
+    while (*path != '\0')
+    {
+        int found;
+        size_t slot = _child_slot(node, (unsigned char)*path, &found);
+        struct owners_node* child;
+        size_t common = 0;
+
+        if (!found)
+        {
+            char* label = strdup_safe(path);
+            child = label ? _node_new(label, strlen(label)) : NULL;
+            if (child == NULL || _child_insert(node, slot, child) != 0)
+                return -1;
+            child->owner = owner;
+            return 0;
+        }
+
+        child = node->children[slot];
+        while (common < child->label_len && path[common] != '\0' &&
+               child->label[common] == path[common])
+            common++;
+
+        if (common < child->label_len)
+        {
+            /* Split the edge at the first differing byte */
+            struct owners_node* mid = _node_new(child->label, common);
+            if (mid == NULL || _child_insert(mid, 0, child) != 0)
+                return -1;
+            child->label += common;
+            child->label_len -= common;
+            node->children[slot] = mid;
+            child = mid;
+        }
+
+        path += common;
+        node = child;
+    }
+
+    node->owner = owner;
+    return 0;
+}
+
+/* Drop subtrees without owners and merge ownerless single-child chains, so
+ * removals leave the trie as compact as a fresh build */
+static int _mem_compact(struct owners_node* node, int is_root)
+{
+    size_t i, kept = 0;
+
+    for (i = 0; i < node->num_children; i++)
+    {
+        if (_mem_compact(node->children[i], 0))
+            node->children[kept++] = node->children[i];
+    }
+    node->num_children = kept;
+
+    if (!is_root && node->owner == OWNERS_NONE && node->num_children == 1)
+    {
+        struct owners_node* child = node->children[0];
+        char* label = arena_alloc(&g_arena,
+                                  node->label_len + child->label_len + 1);
+        if (label != NULL)
+        {
+            memcpy(label, node->label, node->label_len);
+            memcpy(label + node->label_len, child->label, child->label_len);
+            label[node->label_len + child->label_len] = '\0';
+
+            node->label = label;
+            node->label_len += child->label_len;
+            node->owner = child->owner;
+            node->children = child->children;
+            node->num_children = child->num_children;
+            node->cap_children = child->cap_children;
+        }
+    }
+
+    return node->owner != OWNERS_NONE || node->num_children > 0;
+}
+
+/* =============================================================================
+ * Thawing the on-disk trie for updates
+ * ========================================================================== */
+
+static struct owners_node* _thaw_node(struct owners_index* idx, uint32_t i,
+                                      const uint32_t* owner_map)
+{
+    const struct owners_disk_node* d = &DISK_NODES(idx)[i];
+    struct owners_node* node =
+        _node_new(DISK_STRINGS(idx) + d->label_off, d->label_len);
+    uint32_t c;
+
+    if (node == NULL)
+        return NULL;
+
+    node->owner = d->owner == OWNERS_NONE ? OWNERS_NONE : owner_map[d->owner];
+    if (d->num_children == 0)
+        return node;
+
+    node->children =
+        arena_alloc(&g_arena, d->num_children * sizeof(*node->children));
+    if (node->children == NULL)
+        return NULL;
+    node->cap_children = d->num_children;
+
+    for (c = 0; c < d->num_children; c++)
+    {
+        struct owners_node* child =
+            _thaw_node(idx, d->first_child + c, owner_map);
+        if (child == NULL)
+            return NULL;
+        node->children[node->num_children++] = child;
+    }
+
+    return node;
+}
+
+static uint32_t _intern_owner(struct owners_index* idx, const char* name)
+{
+    size_t i;
+
+    for (i = 0; i < idx->num_owners; i++)
+    {
+        if (strcmp(idx->owners[i], name) == 0)
+            return (uint32_t)i;
+    }
+
+    if (idx->num_owners == idx->cap_owners)
+    {
+        size_t new_cap = idx->cap_owners ? idx->cap_owners * 2 : 64;
+        char** owners = arena_alloc(&g_arena, new_cap * sizeof(char*));
+        if (owners == NULL)
+            return OWNERS_NONE;
+        if (idx->num_owners > 0)
+            memcpy(owners, idx->owners, idx->num_owners * sizeof(char*));
+        idx->owners = owners;
+        idx->cap_owners = new_cap;
+    }
+
+    idx->owners[idx->num_owners] = strdup_safe(name);
+    return (uint32_t)idx->num_owners++;
+}
+
+static int _thaw(struct owners_index* idx)
+{
+    uint32_t* owner_map = NULL;
+    uint32_t i;
+
+    if (idx->root != NULL)
+        return 0;
+
+    if (idx->disk == NULL)
+    {
+        idx->root = _node_new("", 0);
+        return idx->root ? 0 : -1;
+    }
+
+    if (idx->disk->num_owners > 0)
+    {
+        owner_map =
+            arena_alloc(&g_arena, idx->disk->num_owners * sizeof(uint32_t));
+        if (owner_map == NULL)
+            return -1;
+    }
+
+    for (i = 0; i < idx->disk->num_owners; i++)
+    {
+        owner_map[i] =
+            _intern_owner(idx, DISK_STRINGS(idx) + DISK_OWNERS(idx)[i]);
+    }
+
+    idx->root = _thaw_node(idx, 0, owner_map);
+    return idx->root ? 0 : -1;
+}
+
+/* =============================================================================
+ * Serialisation
+ * ========================================================================== */
+
+struct owners_buf
+{
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+static int _buf_append(struct owners_buf* buf, const void* data, size_t len)
+{
+    if (buf->len + len > buf->cap)
+    {
+        size_t new_cap = buf->cap ? buf->cap : 4096;
+        char* new_data;
+        while (new_cap < buf->len + len)
+            new_cap *= 2;
+        new_data = realloc(buf->data, new_cap);
+        if (new_data == NULL)
+            return -1;
+        buf->data = new_data;
+        buf->cap = new_cap;
+    }
+
+    if (len > 0)
+        memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+static size_t _count_nodes(struct owners_node* node)
+{
+    size_t i, n = 1;
+    for (i = 0; i < node->num_children; i++)
+        n += _count_nodes(node->children[i]);
+    return n;
+}
+
+static int _serialise(struct owners_index* idx, FILE* file)
+{
+    struct owners_disk hdr;
+    struct owners_node** order;
+    struct owners_disk_node* nodes;
+    struct owners_buf strings = {NULL, 0, 0};
+    uint32_t* owner_ids;
+    uint32_t* owner_offs;
+    uint32_t num_owners = 0;
+    size_t num_nodes, head, tail, i;
+    int ret = -1;
+
+    _mem_compact(idx->root, 1);
+    num_nodes = _count_nodes(idx->root);
+
+    order = malloc(num_nodes * sizeof(*order));
+    nodes = malloc(num_nodes * sizeof(*nodes));
+    owner_ids = malloc((idx->num_owners + 1) * sizeof(uint32_t));
+    owner_offs = malloc((idx->num_owners + 1) * sizeof(uint32_t));
+    if (order == NULL || nodes == NULL || owner_ids == NULL ||
+        owner_offs == NULL)
+        goto out;
+
+    /* Owners no longer referenced by any node are dropped */
+    for (i = 0; i < idx->num_owners; i++)
+        owner_ids[i] = OWNERS_NONE;
+
+    /* Breadth first, so every node's children land next to each other */
+    order[0] = idx->root;
+    head = 0;
+    tail = 1;
+    while (head < tail)
+    {
+        struct owners_node* node = order[head];
+        struct owners_disk_node* d = &nodes[head];
+
+        d->label_off = (uint32_t)strings.len;
+        d->label_len = (uint32_t)node->label_len;
+        if (_buf_append(&strings, node->label, node->label_len) != 0)
+            goto out;
+
+        d->owner = OWNERS_NONE;
+        if (node->owner != OWNERS_NONE)
+        {
+            if (owner_ids[node->owner] == OWNERS_NONE)
+            {
+                owner_offs[num_owners] = (uint32_t)strings.len;
+                if (_buf_append(&strings, idx->owners[node->owner],
+                                strlen(idx->owners[node->owner]) + 1) != 0)
+                    goto out;
+                owner_ids[node->owner] = num_owners++;
+            }
+            d->owner = owner_ids[node->owner];
+        }
+
+        d->first_child = (uint32_t)tail;
+        d->num_children = (uint32_t)node->num_children;
+        for (i = 0; i < node->num_children; i++)
+            order[tail++] = node->children[i];
+        head++;
+    }
+
+    hdr.magic = OWNERS_MAGIC;
+    hdr.version = OWNERS_VERSION;
+    hdr.num_owners = num_owners;
+    hdr.num_nodes = (uint32_t)num_nodes;
+    hdr.owners_off = sizeof(hdr);
+    hdr.nodes_off = hdr.owners_off + num_owners * sizeof(uint32_t);
+    hdr.strings_off = hdr.nodes_off + num_nodes * sizeof(*nodes);
+    hdr.strings_size = (uint32_t)strings.len;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+        (num_owners > 0 &&
+         fwrite(owner_offs, sizeof(uint32_t), num_owners, file) !=
+             num_owners) ||
+        fwrite(nodes, sizeof(*nodes), num_nodes, file) != num_nodes ||
+        (strings.len > 0 &&
+         fwrite(strings.data, 1, strings.len, file) != strings.len))
+        goto out;
+
+    ret = 0;
+
+out:
+    free(order);
+    free(nodes);
+    free(owner_ids);
+    free(owner_offs);
+    free(strings.data);
+    return ret;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int owners_load(struct owners_index* idx)
+{
+    char* path = db_path("owners.idx");
+    struct stat st;
+    void* map;
+    int fd;
+
+    memset(idx, 0, sizeof(*idx));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+        {
+            ERROR("Failed to open '%s': %s\n", path, strerror(errno));
+            return ACTION_RET_ERR_IO;
+        }
+
+        /* Databases from before the index existed get one built now */
+        return owners_rebuild(idx);
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return owners_rebuild(idx);
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        ERROR("Failed to map '%s': %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    if (!_disk_valid((const struct owners_disk*)map, (size_t)st.st_size))
+    {
+        WARNING("'%s' is corrupt, rebuilding it\n", path);
+        munmap(map, (size_t)st.st_size);
+        return owners_rebuild(idx);
+    }
+
+    idx->disk = (const struct owners_disk*)map;
+    idx->disk_size = (size_t)st.st_size;
+    return ACTION_RET_OK;
+}
+
+void owners_close(struct owners_index* idx)
+{
+    if (idx->disk != NULL)
+        munmap((void*)idx->disk, idx->disk_size);
+    memset(idx, 0, sizeof(*idx));
+}
+
+const char* owners_find(struct owners_index* idx, const char* path)
+{
+    if (idx->root != NULL)
+    {
+        struct owners_node* node = _mem_lookup(idx->root, path);
+        if (node == NULL || node->owner == OWNERS_NONE)
+            return NULL;
+        return idx->owners[node->owner];
+    }
+
+    if (idx->disk != NULL)
+        return _disk_find(idx, path);
+
+    return NULL;
+}
+
+int owners_add(struct owners_index* idx, const char* name,
+               struct db_file* files, size_t num_files)
+{
+    uint32_t owner;
+    size_t i;
+
+    if (_thaw(idx) != 0)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    owner = _intern_owner(idx, name);
+    if (owner == OWNERS_NONE)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < num_files; i++)
+    {
+        if (files[i].type == DB_FILE_DIR)
+            continue;
+        if (_mem_insert(idx->root, files[i].path, owner) != 0)
+            return ACTION_RET_ERR_UNKNOWN;
+    }
+
+    return ACTION_RET_OK;
+}
+
+int owners_remove(struct owners_index* idx, const char* name,
+                  struct db_file* files, size_t num_files)
+{
+    size_t i;
+
+    if (_thaw(idx) != 0)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < num_files; i++)
+    {
+        struct owners_node* node;
+
+        if (files[i].type == DB_FILE_DIR)
+            continue;
+
+        /* Paths taken over by another package keep their new owner */
+        node = _mem_lookup(idx->root, files[i].path);
+        if (node != NULL && node->owner != OWNERS_NONE &&
+            strcmp(idx->owners[node->owner], name) == 0)
+            node->owner = OWNERS_NONE;
+    }
+
+    return ACTION_RET_OK;
+}
+
+int owners_save(struct owners_index* idx)
+{
+    char* path = db_path("owners.idx");
+    char* tmp_path;
+    FILE* file;
+
+    /* Nothing was modified */
+    if (idx->root == NULL)
+        return ACTION_RET_OK;
+
+    if (fs_mkdir_p(db_path(""), 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", db_path(""), strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return ACTION_RET_ERR_IO;
+
+    if (_serialise(idx, file) != 0)
+    {
+        ERROR("Failed to write '%s': %s\n", tmp_path, strerror(errno));
+        fclose(file);
+        unlink(tmp_path);
+        return ACTION_RET_ERR_IO;
+    }
+
+    return fs_close_atomic(file, tmp_path, path);
+}
+
+int owners_rebuild(struct owners_index* idx)
+{
+    struct db db;
+    size_t i;
+
+    if (db_load(&db) != ACTION_RET_OK)
+        return ACTION_RET_ERR_IO;
+
+    /* Fresh install, an empty index is implied */
+    if (db.num_entries == 0)
+        return ACTION_RET_OK;
+
+    MSG("Rebuilding the file ownership index\n");
+    owners_close(idx);
+    if (_thaw(idx) != 0)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < db.num_entries; i++)
+    {
+        struct db_file* files;
+        size_t num_files;
+
+        if (db_read_files(db.entries[i].name, &files, &num_files) !=
+            ACTION_RET_OK)
+            continue;
+
+        if (owners_add(idx, db.entries[i].name, files, num_files) !=
+            ACTION_RET_OK)
+            return ACTION_RET_ERR_UNKNOWN;
+    }
+
+    return owners_save(idx);
+}
@@ -17,11 +17,18 @@
 #include <piratpkg.h>
 #include <args.h>
 #include <parser.h>
+#include <config.h>
 #include <arena.h>
 #include <strings.h>
 #include <pkg.h>
+#include <db.h>
+#include <txn.h>
+#include <trigger.h>
+#include <budget.h>
+#include <trace.h>
 #include <log.h>
 #include <errno.h>
+#include <unistd.h>
 
 /* Global State */
 struct arena g_arena;
@@ -34,10 +41,16 @@ struct arg arg_table[] = {
     {"--config", "-c", 0, DEFAULT_CONFIG_FILE, 1},
     {"--verbose", "-V", 0, NULL, 0},
     {"--yes", "-y", 0, NULL, 0},
+    {"--jobs", "-j", 0, NULL, 1},
+    {"--json", NULL, 0, NULL, 0},
+    {"--trace", NULL, 0, NULL, 1},
+    {"--dry-run", "-n", 0, NULL, 0},
+    {"--background", NULL, 0, NULL, 0},
+    {"--resume", NULL, 0, NULL, 0},
 };
 
 /* Action Definition */
-typedef int (*action_callback_t)(const char* arg);
+typedef int (*action_callback_t)(int argc, char** argv);
 
 struct action_entry
 {
@@ -63,10 +76,44 @@ void print_help()
         "  -c, --config <file>     use specified configuration file (default: "
         "%s)\n",
         DEFAULT_CONFIG_FILE);
+    printf("  -j, --jobs <n|auto>     build up to n packages (or one per CPU) "
+           "at once,\n"
+           "                          fewer while the host is under "
+           "pressure\n");
+    printf("      --json              print list, info, outdated, search, "
+           "timings and\n"
+           "                          install reports as JSON\n");
+    printf("      --trace <file>      write a Chrome trace of the run to "
+           "file\n");
+    printf("  -n, --dry-run           show the build order and estimated time "
+           "of an\n"
+           "                          install or upgrade without running it\n");
+    printf("      --background        fetch and build at idle CPU and IO "
+           "priority, only\n"
+           "                          committing into ROOT at normal "
+           "priority\n");
+    printf("      --resume            finish an install or upgrade that was "
+           "interrupted,\n"
+           "                          keeping the packages it committed\n");
 
     printf("\nActions:\n");
-    printf("  install   <package>       install a package\n");
-    printf("  uninstall <package>       uninstall a package\n");
+    printf("  install   <package>...    install packages\n");
+    printf("  uninstall <package>...    uninstall packages\n");
+    printf("  autoremove                uninstall dependencies nothing needs "
+           "anymore\n");
+    printf("  fetch     <package>...    download packages' sources\n");
+    printf("  owns      <path>...       show which package owns a file\n");
+    printf("  search    <term>...       search package names and "
+           "descriptions\n");
+    printf("  info      <package>...    show details of packages\n");
+    printf("  list                      list installed packages\n");
+    printf("  outdated                  list packages with a newer version "
+           "available\n");
+    printf("  upgrade                   rebuild every outdated package\n");
+    printf("  timings   [package]...    show build times, flagging "
+           "regressions\n");
+    printf("  build-binary <package>... build packages into the binary "
+           "repository\n");
 
     printf("\nReport bugs to: <contact@piraterna.org>\n");
     printf("Piraterna home page: <https://piraterna.org>\n");
@@ -87,92 +134,172 @@ void print_version()
  * Action Handlers
  * ========================================================================== */
 
-int action_install(const char* pkg)
+int action_install(int argc, char** argv)
 {
-    struct pkg_ctx* p = pkg_parse(pkg);
-    if (p == NULL)
+    /* The plan comes from the log with --resume */
+    if (argc < 1 && !g_config.resume)
+    {
+        ERROR("'install' expects an argument\n");
         return 1;
-    return pkg_install(p);
+    }
+    return txn_install(argv, (size_t)argc);
 }
 
-int action_uninstall(const char* pkg)
+int action_uninstall(int argc, char** argv)
 {
-    struct pkg_ctx* p = pkg_parse(pkg);
-    if (p == NULL)
-        return 1;
-    return pkg_uninstall(p);
-}
+    struct triggers triggers;
+    struct db_file* files;
+    size_t num_files;
+    struct db db;
+    int i, ret = 0;
 
-/* =============================================================================
- * Path Handling
- * ========================================================================== */
+    if (triggers_load(&triggers) != ACTION_RET_OK)
+        WARNING("Failed to read triggers.\n");
 
-char* get_full_path(const char* path)
-{
-    char* full_path =
-        arena_alloc(&g_arena, strlen(g_config.root) + strlen(path) + 2);
-    if (full_path == NULL)
+    for (i = 0; i < argc && ret == 0; i++)
     {
-        ERROR("Memory allocation failed for path %s: %s", path,
-              strerror(errno));
-        return NULL;
+        char* name = strdup_safe(argv[i]);
+
+        name[strcspn(name, ":")] = '\0';
+        if (db_read_files(name, &files, &num_files) != ACTION_RET_OK)
+            num_files = 0;
+
+        ret = pkg_uninstall(argv[i]);
+
+        /* Not when the user said no */
+        if (ret == 0 && num_files > 0 && db_load(&db) == ACTION_RET_OK &&
+            db_find(&db, name) == NULL)
+            triggers_match_files(&triggers, name, files, num_files);
     }
-    sprintf(full_path, "%s/%s", g_config.root, path);
-    return full_path;
+
+    /* Also after a failure, for what was removed before it */
+    triggers_run(&triggers, g_config.jobs);
+    return ret;
 }
 
-/* =============================================================================
- * Configuration Validation
- * ========================================================================== */
+int action_autoremove(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    return pkg_autoremove();
+}
 
-int validate_config()
+int action_build_binary(int argc, char** argv)
 {
-    int i, j = 0;
-    if (g_config.root == NULL)
+    int i, ret;
+
+    /* Nothing goes into ROOT, all of it can run in the background */
+    budget_background();
+    for (i = 0; i < argc; i++)
     {
-        g_config.root = "/";
-        WARNING("ROOT is not set in the config, defaulting to '/'\n");
+        struct pkg_ctx* p = pkg_parse(argv[i]);
+        if (p == NULL)
+            return 1;
+        ret = pkg_build_binary(p);
+        if (ret != 0)
+            return ret;
     }
+    return 0;
+}
 
-    if (g_config.default_branch == NULL)
-    {
-        ERROR("DEFAULT_BRANCH is not set in the config\n");
+int action_fetch(int argc, char** argv)
+{
+    struct pkg_ctx** pkgs = arena_alloc(&g_arena, argc * sizeof(*pkgs));
+    int i;
+
+    if (pkgs == NULL)
         return 1;
+
+    for (i = 0; i < argc; i++)
+    {
+        pkgs[i] = pkg_parse(argv[i]);
+        if (pkgs[i] == NULL)
+            return 1;
     }
 
-    if (g_config.num_branches == 0)
+    /* One batch, so every package's sources download in parallel */
+    return pkg_fetch(pkgs, (size_t)argc);
+}
+
+int action_owns(int argc, char** argv)
+{
+    int i, ret;
+
+    for (i = 0; i < argc; i++)
     {
-        ERROR("REPO_BRANCHES is not set or empty\n");
-        return 1;
+        ret = pkg_owns(argv[i]);
+        if (ret != 0)
+            return ret;
     }
+    return 0;
+}
+
+int action_search(int argc, char** argv)
+{
+    return pkg_search(argv, (size_t)argc);
+}
+
+int action_list(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    return pkg_list();
+}
 
-    for (i = 0; i < g_config.num_branches; i++)
+int action_info(int argc, char** argv)
+{
+    return pkg_info(argv, (size_t)argc);
+}
+
+int action_outdated(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    return pkg_outdated();
+}
+
+int action_timings(int argc, char** argv)
+{
+    return pkg_timings(argv, (size_t)argc);
+}
+
+int action_upgrade(int argc, char** argv)
+{
+    struct pkg_update* updates;
+    size_t num_updates, i;
+    char** specs;
+    int ret;
+
+    (void)argc;
+    (void)argv;
+
+    /* What is left of the upgrade is in the log */
+    if (g_config.resume)
+        return txn_install(NULL, 0);
+
+    ret = pkg_find_updates(&updates, &num_updates);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    if (num_updates == 0)
     {
-        int found = 0;
-        for (j = 0; j < g_config.num_branches; j++)
-        {
-            if (g_config.branches[j].path != NULL)
-            {
-                if (strcasecmp(g_config.branches[i].name,
-                               g_config.branches[j].name) == 0)
-                {
-                    g_config.branches[i].path =
-                        get_full_path(g_config.branches[j].path);
-                    found = 1;
-                    break;
-                }
-            }
-        }
+        INFO("All packages are up to date.\n");
+        return 0;
+    }
 
-        if (!found)
-        {
-            WARNING("Branch \"%s\" does not have a matching path "
-                    "definition\n",
-                    g_config.branches[i].name);
-        }
+    specs = arena_alloc(&g_arena, num_updates * sizeof(*specs));
+    if (specs == NULL)
+        return 1;
+
+    for (i = 0; i < num_updates; i++)
+    {
+        INFO("Upgrading %s %s -> %s\n", updates[i].name, updates[i].installed,
+             updates[i].available);
+        specs[i] = updates[i].spec;
     }
 
-    return 0;
+    /* One transaction, so the upgrades build in parallel under --jobs */
+    return txn_install(specs, num_updates);
 }
 
 /* =============================================================================
@@ -182,19 +309,23 @@ int validate_config()
 int main(int argc, char** argv)
 {
     int i, j, status = 0;
-    char* line_copy;
-    FILE* file;
-    size_t len;
-    char line[MAX_LINE_LENGTH];
-    struct key_value_pair kv_pair;
 
     const char* action;
-    const char* arg;
     int found;
     int num_actions;
     struct action_entry actions[] = {
-        {"install", 1, action_install},
+        {"install", 0, action_install},
         {"uninstall", 1, action_uninstall},
+        {"autoremove", 0, action_autoremove},
+        {"owns", 1, action_owns},
+        {"build-binary", 1, action_build_binary},
+        {"fetch", 1, action_fetch},
+        {"search", 1, action_search},
+        {"list", 0, action_list},
+        {"info", 1, action_info},
+        {"outdated", 0, action_outdated},
+        {"upgrade", 0, action_upgrade},
+        {"timings", 0, action_timings},
     };
 
     /* Initialize arena */
@@ -285,126 +416,52 @@ int main(int argc, char** argv)
         g_config.no_confirm = false;
     }
 
-    /* Open config file */
-    file = fopen(arg_table[2].value, "r");
-    if (file == NULL)
-    {
-        ERROR("Failed to open config file %s: %s\n", arg_table[2].value,
-              strerror(errno));
-        arena_destroy(&g_arena);
-        return 1;
-    }
-
-    g_config.branches = NULL;
-    g_config.num_branches = 0;
-
-    /* Parse config */
-    while (fgets(line, sizeof(line), file) != NULL)
-    {
-        len = strlen(line);
-        if (line[len - 1] == '\n')
-        {
-            line[len - 1] = '\0';
-        }
-
-        line_copy = arena_alloc(&g_arena, len + 1);
-        if (line_copy == NULL)
-        {
-            fclose(file);
-            arena_destroy(&g_arena);
-            return 1;
-        }
-
-        memcpy(line_copy, line, len + 1);
-
-        if (parse_single_key_value(line, &kv_pair) != 0)
-        {
-            continue;
-        }
-
-        /* Parsing ROOT key */
-        if (strcmp(kv_pair.key, "ROOT") == 0)
-        {
-            g_config.root = arena_alloc(&g_arena, strlen(kv_pair.value) + 1);
-            if (g_config.root)
-            {
-                strcpy(g_config.root, kv_pair.value);
-            }
-        }
+    /* Handle --json */
+    g_config.json = arg_table[6].value != NULL;
 
-        /* Parsing REPO_BRANCHES key */
-        if (strcmp(kv_pair.key, "REPO_BRANCHES") == 0)
-        {
-            g_config.num_branches = count_words(kv_pair.value);
-            g_config.branches = arena_alloc(
-                &g_arena, sizeof(struct repo_branch) * g_config.num_branches);
+    /* Handle --dry-run */
+    g_config.dry_run = arg_table[8].value != NULL;
 
-            char* token = strtok(kv_pair.value, " ");
-            int idx = 0;
+    /* Handle --background */
+    g_config.background = arg_table[9].value != NULL;
 
-            while (token != NULL)
-            {
-                g_config.branches[idx].name = token;
-                idx++;
-                token = strtok(NULL, " ");
-            }
-        }
+    /* Handle --resume */
+    g_config.resume = arg_table[10].value != NULL;
 
-        /* Parsing DEFAULT_BRANCH key */
-        if (strcmp(kv_pair.key, "DEFAULT_BRANCH") == 0)
-        {
-            g_config.default_branch =
-                arena_alloc(&g_arena, strlen(kv_pair.value) + 1);
-            strcpy(g_config.default_branch, kv_pair.value);
-        }
+    /* Handle --jobs */
+    g_config.jobs = 1;
+    if (arg_table[5].value != NULL &&
+        strcmp(arg_table[5].value, "auto") == 0)
+    {
+        /* A ceiling, builds back off when the host is under pressure */
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        g_config.jobs = cpus > 0 ? (size_t)cpus : 1;
     }
-
-    /* Second pass to extract branch paths from the config file */
-    fseek(file, 0, SEEK_SET);
-
-    while (fgets(line, sizeof(line), file) != NULL)
+    else if (arg_table[5].value != NULL)
     {
-        len = strlen(line);
-        if (line[len - 1] == '\n')
+        char* end;
+        long jobs = strtol(arg_table[5].value, &end, 10);
+        if (*end != '\0' || jobs < 1)
         {
-            line[len - 1] = '\0';
-        }
-
-        line_copy = arena_alloc(&g_arena, len + 1);
-        if (line_copy == NULL)
-        {
-            fclose(file);
+            ERROR("Invalid number of jobs '%s'\n", arg_table[5].value);
             arena_destroy(&g_arena);
             return 1;
         }
-
-        memcpy(line_copy, line, len + 1);
-
-        if (parse_single_key_value(line, &kv_pair) != 0)
-        {
-            continue;
-        }
-
-        /* Check for branch path definitions */
-        for (i = 0; i < g_config.num_branches; i++)
-        {
-            if (strcasecmp(kv_pair.key, g_config.branches[i].name) == 0)
-            {
-                g_config.branches[i].path =
-                    arena_alloc(&g_arena, strlen(kv_pair.value) + 1);
-                if (g_config.branches[i].path)
-                {
-                    strcpy(g_config.branches[i].path, kv_pair.value);
-                }
-            }
-        }
+        g_config.jobs = (size_t)jobs;
     }
 
-    fclose(file);
+    /* Handle --trace, closed at exit */
+    if (arg_table[7].value != NULL && trace_open(arg_table[7].value) != 0)
+    {
+        arena_destroy(&g_arena);
+        return 1;
+    }
 
-    /* Validate config */
-    status = validate_config();
-    if (status != 0)
+    /* Load and validate config */
+    trace_begin("config_load", arg_table[2].value);
+    status = config_load(arg_table[2].value);
+    trace_end("config_load");
+    if (status != ACTION_RET_OK)
     {
         arena_destroy(&g_arena);
         return 1;
@@ -426,7 +483,6 @@ int main(int argc, char** argv)
     {
         if (strcmp(action, actions[i].name) == 0)
         {
-            arg = NULL;
             if (actions[i].expects_arg)
             {
                 if (argc < 2)
@@ -435,11 +491,12 @@ int main(int argc, char** argv)
                     arena_destroy(&g_arena);
                     return 1;
                 }
-                arg = argv[2];
             }
 
             found = 1;
-            status = actions[i].callback(arg);
+            trace_begin(action, NULL);
+            status = actions[i].callback(argc - 1, argv + 2);
+            trace_end(action);
             if (status != 0)
             {
                 arena_destroy(&g_arena);
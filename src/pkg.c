@@ -29,6 +29,18 @@
 #include <log.h>
 #include <strings.h>
 #include <libgen.h>
+#include <db.h>
+#include <fs.h>
+#include <stage.h>
+#include <owners.h>
+#include <rdeps.h>
+#include <archive.h>
+#include <fetch.h>
+#include <repoidx.h>
+#include <json.h>
+#include <timings.h>
+#include <version.h>
+#include <trace.h>
 
 #define MAX_FUNCTIONS 10
 #define PATH_BUFFER_SIZE 512
@@ -83,11 +95,17 @@ static struct repo_branch* _find_branch_from_name(const char* branch_name)
     return NULL;
 }
 
+/* Branch pkg was built from, NULL if it is not configured anymore */
+static struct repo_branch* _pkg_branch(struct pkg_ctx* pkg)
+{
+    return pkg->branch != NULL ? _find_branch_from_name(pkg->branch) : NULL;
+}
+
 /* =============================================================================
  * Helper function to retrieve package path based on the package name
  * ========================================================================== */
 
-static char* _pkg_get_path(char* package_name)
+char* pkg_get_path(char* package_name)
 {
     char* group_name = NULL;
     char* pkg_name = NULL;
@@ -273,27 +291,63 @@ struct function_entry* _pkg_find_function(struct pkg_ctx* pkg, const char* name)
     return NULL;
 }
 
+/* <FUNCTION>_TIMEOUT of the manifest, else FUNCTION_TIMEOUT */
+static unsigned long _function_timeout(struct pkg_ctx* pkg,
+                                       struct function_entry* func)
+{
+    char key[64];
+    size_t i, len;
+
+    for (i = 0; func->name[i] != '\0' && i < sizeof(key) - 10; i++)
+        key[i] = toupper((unsigned char)func->name[i]);
+    strcpy(key + i, "_TIMEOUT=");
+    len = strlen(key);
+
+    for (i = 0; i < pkg->num_envp; i++)
+    {
+        if (strncmp(pkg->envp[i], key, len) == 0)
+            return strtoul(pkg->envp[i] + len, NULL, 10);
+    }
+    return (unsigned long)g_config.function_timeout;
+}
+
 static int _run_func(struct pkg_ctx* pkg, struct function_entry* func)
 {
     if (func == NULL || func->body == NULL)
         return ACTION_RET_ERR_UNKNOWN;
     size_t num_args = 0;
     char* args[MAX_LINE_LENGTH];
-    char* line_ptr = strtok(func->body, "\n");
+    char* body = strdup_safe(func->body);
+    char* save = NULL;
+
+    /* Split a copy, bodies are shared with whoever runs them next */
+    if (body == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    char* line_ptr = strtok_r(body, "\n", &save);
 
-    while (line_ptr != NULL)
+    while (line_ptr != NULL && num_args < MAX_LINE_LENGTH - 1)
     {
         args[num_args++] = line_ptr;
-        line_ptr = strtok(NULL, "\n");
+        line_ptr = strtok_r(NULL, "\n", &save);
     }
 
     args[num_args] = NULL;
 
-    bool old_v = g_config.verbose;
-    g_config.verbose = true;
-    MSG("Running %s()...\n", func->name);
-    g_config.verbose = old_v;
-    return func->callback(pkg, args);
+    STEP("Running %s()...\n", func->name);
+    trace_begin(func->name, pkg->name);
+    sandbox_timeout(pkg->sandbox, _function_timeout(pkg, func),
+                    (unsigned long)g_config.idle_timeout);
+    int ret = func->callback(pkg, args);
+
+    /* Each function's shell is accounted for on its own */
+    if (pkg->usage == NULL)
+        pkg->usage = arena_alloc(&g_arena,
+                                 MAX_FUNCTIONS * sizeof(struct pkg_usage));
+    if (pkg->usage != NULL && pkg->num_usage < MAX_FUNCTIONS &&
+        sandbox_finish(pkg->sandbox, &pkg->usage[pkg->num_usage].usage) == 0)
+        pkg->usage[pkg->num_usage++].function = func->name;
+    trace_end(func->name);
+    return ret;
 }
 
 /* =============================================================================
@@ -313,6 +367,7 @@ static int _parse_function_body(FILE* file, const char* func_name,
               strerror(errno));
         return ACTION_RET_ERR_UNKNOWN;
     }
+    body_buffer[0] = '\0';
 
     size_t body_len = 0;
     int brace_count = 1;
@@ -369,8 +424,16 @@ static int _parse_function_body(FILE* file, const char* func_name,
                     {
                         if (*num_callbacks < MAX_FUNCTIONS)
                         {
-                            func->body = body_buffer;
-                            callback_functions[*num_callbacks] = func;
+                            /* Each package gets its own copy of the entry,
+                             * function_table only holds the defaults */
+                            struct function_entry* entry = arena_alloc(
+                                &g_arena, sizeof(struct function_entry));
+                            if (entry == NULL)
+                                return ACTION_RET_ERR_UNKNOWN;
+
+                            *entry = *func;
+                            entry->body = body_buffer;
+                            callback_functions[*num_callbacks] = entry;
                             (*num_callbacks)++;
                         }
                         else
@@ -430,11 +493,147 @@ static int _add_env_var(struct pkg_ctx* pkg, const char* key, const char* value)
     return ACTION_RET_OK;
 }
 
+/* =============================================================================
+ * Sources
+ * ========================================================================== */
+
+/* Split a whitespace separated list into an arena allocated array */
+static size_t _split_words(const char* str, char*** words)
+{
+    char* copy = strdup_safe(str != NULL ? str : "");
+    char* save = NULL;
+    char* word;
+    size_t n = 0;
+
+    *words = arena_alloc(&g_arena, (strlen(copy) / 2 + 1) * sizeof(char*));
+    if (*words == NULL)
+        return 0;
+
+    for (word = strtok_r(copy, " \t", &save); word != NULL;
+         word = strtok_r(NULL, " \t", &save))
+        (*words)[n++] = word;
+    return n;
+}
+
+static bool _is_sha256(const char* hex)
+{
+    size_t i;
+
+    for (i = 0; hex[i] != '\0'; i++)
+        if (!isxdigit((unsigned char)hex[i]) || isupper((unsigned char)hex[i]))
+            return false;
+    return i == SHA256_HEX_SIZE - 1;
+}
+
+/* Every SOURCES entry needs a matching SOURCES_SHA256 entry */
+static int _pkg_parse_sources(struct pkg_ctx* pkg, const char* sources,
+                              const char* hashes)
+{
+    size_t num_hashes, i;
+
+    pkg->num_sources = _split_words(sources, &pkg->sources);
+    num_hashes = _split_words(hashes, &pkg->source_hashes);
+
+    if (pkg->num_sources != num_hashes)
+    {
+        ERROR("%s lists %lu SOURCES but %lu SOURCES_SHA256\n", pkg->name,
+              (unsigned long)pkg->num_sources, (unsigned long)num_hashes);
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+    }
+
+    for (i = 0; i < num_hashes; i++)
+    {
+        if (!_is_sha256(pkg->source_hashes[i]))
+        {
+            ERROR("Invalid sha256 '%s' for source '%s'\n",
+                  pkg->source_hashes[i], pkg->sources[i]);
+            return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+        }
+    }
+
+    return ACTION_RET_OK;
+}
+
+/* =============================================================================
+ * Build cache
+ * ========================================================================== */
+
+/* Metadata of an installed package whose PACKAGE_PROVIDES has name */
+static int _installed_provider(struct rdeps* rdeps, const char* name,
+                               struct pkg_ctx* out)
+{
+    struct rdeps_edge* edges;
+    size_t n, i;
+
+    n = rdeps_providers(rdeps, name, &edges);
+    for (i = 0; i < n; i++)
+    {
+        if (db_read_meta(edges[i].dependent, out) == ACTION_RET_OK)
+            return ACTION_RET_OK;
+    }
+
+    return ACTION_RET_PKG_ERR_NOT_FOUND;
+}
+
+/*
+ * The build key covers everything configure() through install() can see: the
+ * manifest text, the final envp (which includes DESTDIR and PREFIX) and the
+ * build key each dependency was installed with, so rebuilding a dependency
+ * from different inputs invalidates its dependents too.
+ */
+static int _pkg_build_key(struct pkg_ctx* pkg)
+{
+    char manifest[SHA256_HEX_SIZE];
+    struct sha256_ctx ctx;
+    struct rdeps rdeps;
+    bool have_rdeps = false;
+    struct dep* deps;
+    size_t i, num_deps;
+
+    if (sha256_file(pkg->path, manifest) != 0)
+        return ACTION_RET_ERR_IO;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, manifest, sizeof(manifest));
+
+    for (i = 0; i < pkg->num_envp; i++)
+        sha256_update(&ctx, pkg->envp[i], strlen(pkg->envp[i]) + 1);
+
+    if (dep_parse_list(pkg->depends, &deps, &num_deps) != 0)
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+
+    for (i = 0; i < num_deps; i++)
+    {
+        struct pkg_ctx installed;
+
+        memset(&installed, 0, sizeof(installed));
+        if (db_read_meta(deps[i].name, &installed) != ACTION_RET_OK)
+        {
+            /* Only virtual or missing dependencies need the index */
+            if (!have_rdeps)
+                have_rdeps = rdeps_load(&rdeps) == ACTION_RET_OK;
+            if (have_rdeps &&
+                _installed_provider(&rdeps, deps[i].name, &installed) !=
+                    ACTION_RET_OK)
+                memset(&installed, 0, sizeof(installed));
+        }
+
+        /* Missing dependencies and pre-cache installs hash as empty */
+        sha256_update(&ctx, deps[i].name, strlen(deps[i].name) + 1);
+        sha256_update(&ctx, installed.build_key,
+                      strlen(installed.build_key) + 1);
+    }
+
+    sha256_final_hex(&ctx, pkg->build_key);
+    memcpy(pkg->manifest_hash, manifest, sizeof(manifest));
+    return ACTION_RET_OK;
+}
+
 /* =============================================================================
  * Public functions
  * ========================================================================== */
 
-struct pkg_ctx* pkg_parse(const char* package_name)
+static struct pkg_ctx* _pkg_parse(const char* package_name)
 {
     MSG("Parsing package: %s\n", package_name);
     if (package_name == NULL)
@@ -449,6 +648,7 @@ struct pkg_ctx* pkg_parse(const char* package_name)
     struct pkg_ctx* pkg = arena_alloc(&g_arena, sizeof(struct pkg_ctx));
     if (pkg == NULL)
         return NULL;
+    memset(pkg, 0, sizeof(*pkg));
 
     if (strlen(package_name) == 0)
     {
@@ -456,7 +656,9 @@ struct pkg_ctx* pkg_parse(const char* package_name)
         return NULL;
     }
 
-    char* package_path = _pkg_get_path((char*)package_name);
+    trace_begin("pkg_get_path", package_name);
+    char* package_path = pkg_get_path((char*)package_name);
+    trace_end("pkg_get_path");
     if (package_path == NULL)
     {
         ERROR("Package or group '%s' not found.\n", package_name);
@@ -475,6 +677,8 @@ struct pkg_ctx* pkg_parse(const char* package_name)
     char line[MAX_LINE_LENGTH];
     struct function_entry* callback_functions[MAX_FUNCTIONS];
     size_t num_callbacks = 0;
+    char* sources = NULL;
+    char* source_hashes = NULL;
 
     /* Setup default values for package meta */
     pkg->name = strdup_safe("unkown");
@@ -511,6 +715,30 @@ struct pkg_ctx* pkg_parse(const char* package_name)
             {
                 pkg->maintainers = kv_pair.value;
             }
+            else if (strcmp(kv_pair.key, "PACKAGE_DEPENDS") == 0)
+            {
+                pkg->depends = kv_pair.value;
+            }
+            else if (strcmp(kv_pair.key, "PACKAGE_PROVIDES") == 0)
+            {
+                pkg->provides = kv_pair.value;
+            }
+            else if (strcmp(kv_pair.key, "PACKAGE_CONFLICTS") == 0)
+            {
+                pkg->conflicts = kv_pair.value;
+            }
+            else if (strcmp(kv_pair.key, "TRIGGERS") == 0)
+            {
+                pkg->triggers = kv_pair.value;
+            }
+            else if (strcmp(kv_pair.key, "SOURCES") == 0)
+            {
+                sources = kv_pair.value;
+            }
+            else if (strcmp(kv_pair.key, "SOURCES_SHA256") == 0)
+            {
+                source_hashes = kv_pair.value;
+            }
             else if (strcmp(kv_pair.key, "REDIRECT") == 0)
             {
                 /* Handle redirects */
@@ -545,19 +773,47 @@ struct pkg_ctx* pkg_parse(const char* package_name)
 
     fclose(file);
 
-    pkg->functions = callback_functions;
+    if (_pkg_parse_sources(pkg, sources, source_hashes) != ACTION_RET_OK)
+        return NULL;
+
+    pkg->functions =
+        arena_alloc(&g_arena, (num_callbacks + 1) * sizeof(*pkg->functions));
+    if (pkg->functions == NULL)
+        return NULL;
+    memcpy(pkg->functions, callback_functions,
+           num_callbacks * sizeof(*pkg->functions));
     pkg->num_functions = num_callbacks;
+    pkg->path = strdup_safe(package_path);
     pkg->branch = basename(dirname(package_path));
+    pkg->destdir = db_path(fs_join("staging", pkg->name));
+    pkg->sandbox = NULL;
 
     /* Add some other env vars to envp */
     _add_env_var(pkg, "PIRATPKG_VERSION", VERSION_STRING);
-    _add_env_var(pkg, "PREFIX", g_config.root);
+    _add_env_var(pkg, "ROOT", g_config.root);
+    _add_env_var(pkg, "PREFIX", PKG_PREFIX);
+    _add_env_var(pkg, "DESTDIR", pkg->destdir);
 
     /* Add NULL to the end of envp, as linux requires */
     pkg->envp[pkg->num_envp] = NULL;
 
-    /* Create sandbox */
-    pkg->sandbox = sandbox_create(pkg->envp);
+    if (_pkg_build_key(pkg) != ACTION_RET_OK)
+    {
+        ERROR("Failed to hash build inputs of %s.\n", pkg->name);
+        return NULL;
+    }
+
+    /* The sandbox is only created once something has to run in it */
+    return pkg;
+}
+
+struct pkg_ctx* pkg_parse(const char* package_name)
+{
+    struct pkg_ctx* pkg;
+
+    trace_begin("pkg_parse", package_name);
+    pkg = _pkg_parse(package_name);
+    trace_end("pkg_parse");
     return pkg;
 }
 
@@ -591,218 +847,1543 @@ int _pkg_install_clean(struct pkg_ctx* pkg)
     return 0;
 }
 
-/* Package actions */
-int pkg_install(struct pkg_ctx* pkg)
+/* =============================================================================
+ * Helper functions for committing staged files
+ * ========================================================================== */
+
+bool pkg_ask_confirm(const char* question)
 {
-    size_t i = 0;
-    if (pkg == NULL)
+    char user_input;
+
+    if (g_config.no_confirm)
     {
-        ERROR("Package not found. Installation aborted.\n");
-        return ACTION_RET_PKG_ERR_NOT_FOUND;
+        MSG("Automatic confirmation enabled. Proceeding...\n");
+        return true;
     }
 
-    INFO("Package: %s-%s\n", pkg->name, pkg->version);
-    INFO("Description: %s\n", pkg->description);
-    INFO("Maintainers: %s\n", pkg->maintainers);
+    printf(COLOR_INFO "%s [Y/n]: " COLOR_RESET, question);
+    user_input = getchar();
+    return user_input == 'Y' || user_input == 'y' || user_input == '\n';
+}
+
+/* Remove files the previously installed version had but the new one lacks.
+ * Both lists are sorted by path, so a single merge pass finds them. What
+ * could not be removed is left in *left. */
+static int _remove_stale_files(struct db_file* old_files, size_t num_old,
+                               struct db_file* new_files, size_t num_new,
+                               struct db_file** left, size_t* num_left)
+{
+    struct db_file* stale;
+    size_t num_stale = 0;
+    size_t i = 0, j = 0;
 
-    /* Check if package is already installed */
-    char installed_list_path[512];
-    snprintf(installed_list_path, sizeof(installed_list_path),
-             "%s/etc/piratpkg/installed.list", g_config.root);
+    *left = NULL;
+    *num_left = 0;
+    if (num_old == 0)
+        return ACTION_RET_OK;
+
+    stale = arena_alloc(&g_arena, num_old * sizeof(struct db_file));
+    if (stale == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
 
-    FILE* installed_file = fopen(installed_list_path, "r");
-    if (installed_file != NULL)
+    while (i < num_old)
     {
-        char line[512];
-        while (fgets(line, sizeof(line), installed_file))
+        int cmp = j < num_new ? strcmp(old_files[i].path, new_files[j].path)
+                              : -1;
+        if (cmp < 0)
+            stale[num_stale++] = old_files[i++];
+        else if (cmp > 0)
+            j++;
+        else
         {
-            if (strstr(line, pkg->name) && strstr(line, pkg->version))
-            {
-                ERROR("Package %s-%s is already installed.\n", pkg->name,
-                      pkg->version);
-                fclose(installed_file);
-                return ACTION_RET_PKG_ERR_ALREADY_INSTALLED;
-            }
+            i++;
+            j++;
         }
-        fclose(installed_file);
     }
 
-    if (g_config.no_confirm == false)
-    {
-        char user_input;
-        printf(COLOR_INFO
-               "Do you want to continue installing? [Y/n]: " COLOR_RESET);
-        user_input = getchar();
+    if (stage_remove(stale, num_stale) == ACTION_RET_OK)
+        return ACTION_RET_OK;
 
-        if (user_input != 'Y' && user_input != 'y' && user_input != '\n')
-        {
-            INFO("Installation aborted by user.\n");
-            return ACTION_RET_OK;
-        }
-    }
-    else
+    /* Compacted in place, still sorted */
+    for (i = 0; i < num_stale; i++)
     {
-        MSG("Automatic confirmation enabled. Proceeding with "
-            "installation...\n");
+        struct stat st;
+
+        if (stale[i].type != DB_FILE_DIR &&
+            lstat(fs_join(g_config.root, stale[i].path), &st) == 0)
+            stale[(*num_left)++] = stale[i];
     }
+    *left = stale;
+    return ACTION_RET_ERR_IO;
+}
+
+/* Union of two manifests sorted by path, b wins where both have a path */
+static struct db_file* _merge_files(struct db_file* a, size_t num_a,
+                                    struct db_file* b, size_t num_b,
+                                    size_t* num_out)
+{
+    struct db_file* out =
+        arena_alloc(&g_arena, (num_a + num_b + 1) * sizeof(struct db_file));
+    size_t i = 0, j = 0, n = 0;
 
-    INFO("Starting installation...\n");
+    if (out == NULL)
+        return NULL;
 
-    /* Run all present functions, except uninstall */
-    for (i = 0; i < pkg->num_functions; i++)
+    while (i < num_a || j < num_b)
     {
-        struct function_entry* func = pkg->functions[i];
-        if (strcmp(func->name, "uninstall") != 0)
+        int cmp;
+
+        if (i == num_a)
+            cmp = 1;
+        else if (j == num_b)
+            cmp = -1;
+        else
+            cmp = strcmp(a[i].path, b[j].path);
+
+        if (cmp < 0)
+            out[n++] = a[i++];
+        else
         {
-            if (_run_func(pkg, func) != ACTION_RET_OK)
-            {
-                ERROR("Function '%s' failed. Installation aborted.\n",
-                      func->name);
-                return ACTION_RET_ERR_UNKNOWN;
-            }
+            if (cmp == 0)
+                i++;
+            out[n++] = b[j++];
         }
     }
 
-    /* Append the package to installed.list */
-    snprintf(installed_list_path, sizeof(installed_list_path),
-             "%s/etc/piratpkg/installed.list", g_config.root);
+    *num_out = n;
+    return out;
+}
+
+/* stage_commit() failed partway. A fresh install is taken back out; an
+ * upgrade already overwrote part of the old version, so what landed is
+ * recorded along with it and conflict checks keep seeing it. */
+static void _pkg_commit_failed(struct pkg_ctx* pkg, struct db* db,
+                               struct owners_index* owners,
+                               struct db_file* old_files, size_t num_old,
+                               struct db_file* files, size_t committed)
+{
+    struct db_file* recorded;
+    size_t num_recorded;
 
-    FILE* installed_file_write = fopen(installed_list_path, "a");
-    if (installed_file_write == NULL)
+    if (db_find(db, pkg->name) == NULL)
     {
-        ERROR("Failed to open '%s' for appending.\n", installed_list_path);
-        return ACTION_RET_ERR_UNKNOWN;
+        stage_remove(files, committed);
+        return;
     }
 
-    /* Append the package information to the file */
-    fprintf(installed_file_write, "%s-%s:%s\n", pkg->name, pkg->version,
-            pkg->branch);
-    fclose(installed_file_write);
-
-    sandbox_destroy(pkg->sandbox);
-
-    INFO("Installation of %s-%s completed successfully.\n", pkg->name,
-         pkg->version);
-    return ACTION_RET_OK;
+    recorded = _merge_files(old_files, num_old, files, committed,
+                            &num_recorded);
+    if (recorded == NULL ||
+        db_write_files(pkg->name, recorded, num_recorded) != ACTION_RET_OK ||
+        owners_add(owners, pkg->name, files, committed) != ACTION_RET_OK ||
+        owners_save(owners) != ACTION_RET_OK)
+        WARNING("Failed to record what of %s was installed.\n", pkg->name);
 }
 
-int pkg_uninstall(struct pkg_ctx* pkg)
+/* Refuse to overwrite files another package owns */
+static int _check_conflicts(struct pkg_ctx* pkg, struct owners_index* owners,
+                            struct db_file* files, size_t num_files)
 {
-    if (pkg == NULL)
-    {
-        ERROR("Package not found. Uninstallation aborted.\n");
-        return ACTION_RET_PKG_ERR_NOT_FOUND;
-    }
-
-    INFO("Uninstalling: %s-%s\n", pkg->name, pkg->version);
-    INFO("Description: %s\n", pkg->description);
-    INFO("Maintainers: %s\n", pkg->maintainers);
+    size_t num_conflicts = 0;
+    size_t i;
 
-    if (g_config.no_confirm == false)
+    for (i = 0; i < num_files; i++)
     {
-        char user_input;
-        printf(COLOR_INFO
-               "Do you want to continue uninstalling? [Y/n]: " COLOR_RESET);
-        user_input = getchar();
+        const char* owner;
+
+        if (files[i].type == DB_FILE_DIR)
+            continue;
 
-        if (user_input != 'Y' && user_input != 'y' && user_input != '\n')
+        owner = owners_find(owners, files[i].path);
+        if (owner != NULL && strcmp(owner, pkg->name) != 0)
         {
-            INFO("Uninstallation aborted by user.\n");
-            return ACTION_RET_OK;
+            ERROR("%s: '%s' is already owned by %s\n", pkg->name,
+                  files[i].path, owner);
+            num_conflicts++;
         }
     }
-    else
+
+    return num_conflicts ? ACTION_RET_PKG_ERR_CONFLICT : ACTION_RET_OK;
+}
+
+/* Move the staged tree, described by files, into ROOT and update the
+ * database */
+static int _pkg_commit(struct pkg_ctx* pkg, struct db* db,
+                       struct owners_index* owners, struct rdeps* rdeps,
+                       struct db_file* files, size_t num_files)
+{
+    struct db_file* old_files = NULL;
+    struct db_file* left;
+    struct pkg_ctx old;
+    size_t num_old = 0, num_left, committed;
+    int ret, stale_ret = ACTION_RET_OK;
+
+    if (num_files == 0)
     {
-        MSG("Automatic confirmation enabled. Proceeding with "
-            "uninstallation...\n");
+        WARNING("install() staged nothing into $DESTDIR, files of %s will "
+                "not be tracked\n",
+                pkg->name);
     }
 
-    INFO("Starting uninstallation...\n");
+    ret = _check_conflicts(pkg, owners, files, num_files);
+    if (ret != ACTION_RET_OK)
+        return ret;
 
-    struct function_entry* uninstall_func =
-        _pkg_find_function(pkg, "uninstall");
-    if (uninstall_func == NULL)
+    if (db_find(db, pkg->name) != NULL &&
+        db_read_files(pkg->name, &old_files, &num_old) != ACTION_RET_OK)
+        num_old = 0;
+
+    MSG("Committing %lu staged entries into %s\n", (unsigned long)num_files,
+        g_config.root);
+    ret = stage_commit(pkg->destdir, files, num_files, &committed);
+    if (ret != ACTION_RET_OK)
     {
-        WARNING("No uninstall() function defined for this package.\n");
-        sandbox_destroy(pkg->sandbox);
-        return ACTION_RET_OK;
+        _pkg_commit_failed(pkg, db, owners, old_files, num_old, files,
+                           committed);
+        return ret;
     }
 
-    if (_run_func(pkg, uninstall_func) != ACTION_RET_OK)
+    if (num_old > 0)
     {
-        ERROR("Function 'uninstall' failed. Uninstallation may be "
-              "incomplete.\n");
-        sandbox_destroy(pkg->sandbox);
-        return ACTION_RET_ERR_UNKNOWN;
+        /* Leftovers stay recorded, so the next upgrade or uninstall tries
+         * them again */
+        stale_ret = _remove_stale_files(old_files, num_old, files, num_files,
+                                        &left, &num_left);
+        if (num_left > 0)
+            files = _merge_files(files, num_files, left, num_left, &num_files);
+        if (files == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        owners_remove(owners, pkg->name, old_files, num_old);
     }
 
-    INFO("Uninstallation of %s-%s completed successfully.\n", pkg->name,
-         pkg->version);
-
-    /* Remove the package entry from installed.list */
-    char installed_list_path[512];
-    snprintf(installed_list_path, sizeof(installed_list_path),
-             "%s/etc/piratpkg/installed.list", g_config.root);
-
-    FILE* installed_file = fopen(installed_list_path, "r+");
-    if (installed_file == NULL)
+    /* An upgrade keeps the reason the package was first installed for */
+    memset(&old, 0, sizeof(old));
+    if (db_find(db, pkg->name) != NULL &&
+        db_read_meta(pkg->name, &old) == ACTION_RET_OK)
     {
-        ERROR("Failed to open '%s' for reading.\n", installed_list_path);
-        sandbox_destroy(pkg->sandbox);
-        return ACTION_RET_ERR_UNKNOWN;
+        rdeps_remove(rdeps, pkg->name, old.depends, old.provides);
+        if (old.reason != NULL)
+            pkg->reason = old.reason;
     }
+    if (pkg->reason == NULL)
+        pkg->reason = PKG_REASON_EXPLICIT;
+
+    ret = owners_add(owners, pkg->name, files, num_files);
+    if (ret == ACTION_RET_OK)
+        ret = owners_save(owners);
+    if (ret == ACTION_RET_OK)
+        ret = db_write_files(pkg->name, files, num_files);
+    if (ret == ACTION_RET_OK)
+        ret = db_write_meta(pkg);
+    if (ret == ACTION_RET_OK)
+        ret = rdeps_add(rdeps, pkg->name, pkg->depends, pkg->provides);
+    if (ret == ACTION_RET_OK)
+        ret = rdeps_save(rdeps);
+    if (ret == ACTION_RET_OK)
+        ret = db_add(db, pkg->name, pkg->version, pkg->branch);
+    if (ret == ACTION_RET_OK)
+        ret = db_save(db);
+
+    return ret != ACTION_RET_OK ? ret : stale_ret;
+}
+
+/* =============================================================================
+ * Checkpoints
+ * ========================================================================== */
+
+/* Where configure() through install() run */
+static char* _pkg_workdir(struct pkg_ctx* pkg)
+{
+    return db_path(fs_join("work", pkg->name));
+}
 
-    char line[512];
-    bool found = false;
-    while (fgets(line, sizeof(line), installed_file))
+/* The manifest hash, then each function that got through, in order */
+static char* _pkg_checkpoint_path(struct pkg_ctx* pkg)
+{
+    char* dir = _pkg_workdir(pkg);
+    char* path = arena_alloc(&g_arena, strlen(dir) + sizeof(".checkpoint"));
+
+    if (path != NULL)
+        sprintf(path, "%s.checkpoint", dir);
+    return path;
+}
+
+/* pkg_build() runs everything else, in manifest order */
+static bool _pkg_builds(struct function_entry* func)
+{
+    return strcmp(func->name, "uninstall") != 0 &&
+           strcmp(func->name, "post_install") != 0;
+}
+
+/* How many of pkg_build()'s functions can be skipped. install() always
+ * runs again, the staging tree it wrote is not kept. */
+static size_t _pkg_load_checkpoint(struct pkg_ctx* pkg)
+{
+    char line[MAX_LINE_LENGTH];
+    char* path = _pkg_checkpoint_path(pkg);
+    FILE* file;
+    size_t i, done = 0;
+
+    if (path == NULL)
+        return 0;
+    file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    if (fgets(line, sizeof(line), file) == NULL ||
+        strncmp(line, pkg->manifest_hash, SHA256_HEX_SIZE - 1) != 0)
+        MSG("The manifest of %s changed, its build starts over\n",
+            pkg->name);
+    else if (access(_pkg_workdir(pkg), F_OK) == 0)
     {
-        ftell(installed_file);
-        if (strstr(line, pkg->name) && strstr(line, pkg->version))
+        for (i = 0; i < pkg->num_functions; i++)
         {
-            found = true;
-            break;
+            struct function_entry* func = pkg->functions[i];
+
+            if (!_pkg_builds(func))
+                continue;
+            if (strcmp(func->name, "install") == 0 ||
+                fgets(line, sizeof(line), file) == NULL)
+                break;
+            line[strcspn(line, "\n")] = '\0';
+            if (strcmp(line, func->name) != 0)
+                break;
+            done++;
         }
     }
 
-    if (!found)
+    fclose(file);
+    if (done == 0)
+        unlink(path);
+    return done;
+}
+
+/* The first done functions of pkg_build() got through */
+static void _pkg_save_checkpoint(struct pkg_ctx* pkg, size_t done)
+{
+    char* path = _pkg_checkpoint_path(pkg);
+    char* tmp_path;
+    FILE* file = NULL;
+    size_t i, n = 0;
+
+    /* The shell's state first, the checkpoint may never be ahead of it */
+    if (path != NULL && sandbox_save(pkg->sandbox) == 0)
+        file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
     {
-        WARNING("Package %s-%s not found in installed.list.\n", pkg->name,
-                pkg->version);
-        fclose(installed_file);
-        sandbox_destroy(pkg->sandbox);
-        return ACTION_RET_OK;
+        WARNING("Failed to checkpoint the build of %s.\n", pkg->name);
+        return;
     }
 
-    FILE* temp_file = tmpfile();
-    rewind(installed_file);
-
-    while (fgets(line, sizeof(line), installed_file))
+    fprintf(file, "%s\n", pkg->manifest_hash);
+    for (i = 0; i < pkg->num_functions && n < done; i++)
     {
-        if (strstr(line, pkg->name) && strstr(line, pkg->version))
-            continue;
-        fputs(line, temp_file);
+        if (_pkg_builds(pkg->functions[i]))
+        {
+            fprintf(file, "%s\n", pkg->functions[i]->name);
+            n++;
+        }
     }
+    if (fs_close_atomic(file, tmp_path, path) == ACTION_RET_OK)
+        pkg->num_done = done;
+}
+
+/* Finished or taken from the cache, there is nothing left to resume */
+static void _pkg_drop_checkpoint(struct pkg_ctx* pkg)
+{
+    char* path = _pkg_checkpoint_path(pkg);
 
-    fclose(installed_file);
-    rewind(temp_file);
+    pkg->num_done = 0;
+
+    /* An open sandbox clears the work directory when it is destroyed */
+    if (path != NULL && unlink(path) == 0 && pkg->sandbox == NULL)
+        sandbox_clear(_pkg_workdir(pkg));
+}
+
+/* =============================================================================
+ * Staging
+ * ========================================================================== */
 
-    installed_file = fopen(installed_list_path, "w");
-    if (installed_file == NULL)
+/* install() writes into a fresh staging tree, never straight into ROOT */
+static int _pkg_reset_staging(struct pkg_ctx* pkg)
+{
+    fs_remove_tree(pkg->destdir);
+    if (fs_mkdir_p(pkg->destdir, 0755) != 0)
     {
-        ERROR("Failed to open '%s' for writing.\n", installed_list_path);
-        fclose(temp_file);
-        sandbox_destroy(pkg->sandbox);
-        return ACTION_RET_ERR_UNKNOWN;
+        ERROR("Failed to create staging directory '%s': %s\n", pkg->destdir,
+              strerror(errno));
+        return ACTION_RET_ERR_IO;
     }
+    return ACTION_RET_OK;
+}
+
+/* Where build-binary puts, and install looks for, a package's archive */
+static char* _pkg_binary_path(struct pkg_ctx* pkg)
+{
+    char* file = arena_alloc(&g_arena, strlen(pkg->name) +
+                                           strlen(pkg->version) +
+                                           sizeof(ARCHIVE_EXT) + 1);
+    if (file == NULL)
+        return NULL;
+
+    sprintf(file, "%s-%s%s", pkg->name, pkg->version, ARCHIVE_EXT);
+    return fs_join(g_config.binary_repo, file);
+}
+
+/* Cached build output, named by build key rather than version */
+static char* _pkg_cache_path(struct pkg_ctx* pkg)
+{
+    char file[SHA256_HEX_SIZE + sizeof(ARCHIVE_EXT)];
+
+    sprintf(file, "%s%s", pkg->build_key, ARCHIVE_EXT);
+    return fs_join(g_config.build_cache, file);
+}
+
+char* pkg_prebuilt(struct pkg_ctx* pkg, bool use_binary)
+{
+    char* binary = _pkg_binary_path(pkg);
+    char* cached = _pkg_cache_path(pkg);
+
+    if (use_binary && binary != NULL && access(binary, R_OK) == 0)
+        return binary;
+    if (cached != NULL && access(cached, R_OK) == 0)
+        return cached;
+    return NULL;
+}
+
+int pkg_unpack(struct pkg_ctx* pkg, const char* archive)
+{
+    bool cached = strcmp(archive, _pkg_cache_path(pkg)) == 0;
+    struct pkg_ctx meta;
+    char* text;
+    int ret;
 
-    while (fgets(line, sizeof(line), temp_file))
+    if (cached)
+        INFO("Reusing cached build %.12s of %s\n", pkg->build_key, pkg->name);
+    else
+        INFO("Installing from binary package %s\n", archive);
+
+    ret = archive_read_meta(archive, &text);
+    if (ret == ACTION_RET_OK)
     {
-        fputs(line, installed_file);
+        memset(&meta, 0, sizeof(meta));
+        db_parse_meta(text, &meta);
+        if (meta.name == NULL || meta.version == NULL ||
+            strcmp(meta.name, pkg->name) != 0 ||
+            strcmp(meta.version, pkg->version) != 0)
+        {
+            ERROR("'%s' does not contain %s-%s\n", archive, pkg->name,
+                  pkg->version);
+            ret = ACTION_RET_PKG_ERR_INVALID_FORMAT;
+        }
     }
 
-    fclose(installed_file);
-    fclose(temp_file);
+    if (ret == ACTION_RET_OK)
+        ret = _pkg_reset_staging(pkg);
+    if (ret == ACTION_RET_OK)
+        ret = archive_extract(archive, pkg->destdir, &pkg->files,
+                              &pkg->num_files);
 
-    sandbox_destroy(pkg->sandbox);
-    return ACTION_RET_OK;
-}
\ No newline at end of file
+    if (ret == ACTION_RET_OK)
+        _pkg_drop_checkpoint(pkg);
+    else
+    {
+        if (cached)
+        {
+            WARNING("Dropping unusable cache entry '%s'.\n", archive);
+            unlink(archive);
+        }
+        else
+        {
+            WARNING("Unusable binary package '%s'.\n", archive);
+        }
+    }
+
+    return ret;
+}
+
+int pkg_prepare(struct pkg_ctx* pkg)
+{
+    int ret = _pkg_reset_staging(pkg);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    pkg->num_done = _pkg_load_checkpoint(pkg);
+    if (pkg->sandbox == NULL)
+        pkg->sandbox = sandbox_open(_pkg_workdir(pkg), pkg->num_done > 0,
+                                    pkg->envp, _pkg_branch(pkg));
+    if (pkg->sandbox == NULL)
+    {
+        ERROR("Failed to create sandbox.\n");
+        return ACTION_RET_ERR_UNKNOWN;
+    }
+
+    /* The sources are there already, maybe configured and half built */
+    if (pkg->num_done > 0)
+    {
+        INFO("Resuming the build of %s, skipping %lu finished function%s\n",
+             pkg->name, (unsigned long)pkg->num_done,
+             pkg->num_done == 1 ? "" : "s");
+        return ACTION_RET_OK;
+    }
+
+    /* Functions start out next to their sources */
+    return fetch_place(pkg, sandbox_dir(pkg->sandbox));
+}
+
+int pkg_build(struct pkg_ctx* pkg)
+{
+    bool installed = false;
+    char* meta;
+    size_t i, n = 0;
+    int ret;
+
+    /* Run everything up to install(), post_install() waits for the commit */
+    for (i = 0; i < pkg->num_functions; i++)
+    {
+        struct function_entry* func = pkg->functions[i];
+        if (!_pkg_builds(func) || n++ < pkg->num_done)
+            continue;
+
+        installed = installed || strcmp(func->name, "install") == 0;
+        if (_run_func(pkg, func) != ACTION_RET_OK)
+        {
+            ERROR("Function '%s' of %s failed.\n", func->name, pkg->name);
+            return ACTION_RET_ERR_UNKNOWN;
+        }
+        if (!installed)
+            _pkg_save_checkpoint(pkg, n);
+    }
+    _pkg_drop_checkpoint(pkg);
+
+    ret = stage_scan(pkg->destdir, &pkg->files, &pkg->num_files);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    /* A cache that can't be written only costs the next build */
+    meta = db_meta_text(pkg);
+    if (meta == NULL ||
+        archive_create(_pkg_cache_path(pkg), meta, pkg->destdir, pkg->files,
+                       pkg->num_files) != ACTION_RET_OK)
+        WARNING("Failed to cache the build of %s.\n", pkg->name);
+
+    return ACTION_RET_OK;
+}
+
+int pkg_db_open(struct pkg_db* pdb)
+{
+    int ret;
+
+    memset(pdb, 0, sizeof(*pdb));
+    ret = db_load(&pdb->db);
+    if (ret == ACTION_RET_OK)
+        ret = rdeps_load(&pdb->rdeps);
+    if (ret == ACTION_RET_OK)
+        ret = owners_load(&pdb->owners);
+    return ret;
+}
+
+void pkg_db_close(struct pkg_db* pdb)
+{
+    owners_close(&pdb->owners);
+}
+
+int pkg_commit(struct pkg_ctx* pkg, struct pkg_db* pdb)
+{
+    struct function_entry* post_install;
+    int ret;
+
+    ret = _pkg_commit(pkg, &pdb->db, &pdb->owners, &pdb->rdeps, pkg->files,
+                      pkg->num_files);
+
+    fs_remove_tree(pkg->destdir);
+    if (ret != ACTION_RET_OK)
+    {
+        ERROR("Installation of %s-%s aborted.\n", pkg->name, pkg->version);
+        return ret;
+    }
+
+    post_install = _pkg_find_function(pkg, "post_install");
+    if (post_install != NULL)
+    {
+        if (pkg->sandbox == NULL)
+            pkg->sandbox = sandbox_create(pkg->envp, _pkg_branch(pkg));
+        if (pkg->sandbox == NULL || _run_func(pkg, post_install) != 0)
+            WARNING("Function 'post_install' of %s failed.\n", pkg->name);
+    }
+
+    INFO("Installation of %s-%s completed successfully.\n", pkg->name,
+         pkg->version);
+    return ACTION_RET_OK;
+}
+
+void pkg_cleanup(struct pkg_ctx* pkg)
+{
+    /* Failed after a checkpoint, the next attempt resumes from it */
+    if (pkg->sandbox != NULL && pkg->num_done > 0)
+        sandbox_keep(pkg->sandbox);
+    sandbox_destroy(pkg->sandbox);
+    pkg->sandbox = NULL;
+    fs_remove_tree(pkg->destdir);
+}
+
+int pkg_refresh_build_key(struct pkg_ctx* pkg)
+{
+    return _pkg_build_key(pkg);
+}
+
+/* =============================================================================
+ * Package actions
+ * ========================================================================== */
+
+int pkg_build_binary(struct pkg_ctx* pkg)
+{
+    char* prebuilt;
+    char* binary;
+    char* meta;
+    int ret = ACTION_RET_PKG_ERR_NOT_FOUND;
+
+    if (pkg == NULL)
+    {
+        ERROR("Package not found. Build aborted.\n");
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+    }
+
+    INFO("Package: %s-%s\n", pkg->name, pkg->version);
+    INFO("Description: %s\n", pkg->description);
+    INFO("Maintainers: %s\n", pkg->maintainers);
+    INFO("Building binary package...\n");
+
+    binary = _pkg_binary_path(pkg);
+    meta = db_meta_text(pkg);
+    if (binary == NULL || meta == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    /* The binary repository is what's being rebuilt, only trust the cache */
+    prebuilt = pkg_prebuilt(pkg, false);
+    if (prebuilt != NULL)
+        ret = pkg_unpack(pkg, prebuilt);
+    if (ret != ACTION_RET_OK)
+    {
+        ret = fetch_sources(&pkg, 1);
+        if (ret == ACTION_RET_OK)
+            ret = pkg_prepare(pkg);
+        if (ret == ACTION_RET_OK)
+            ret = pkg_build(pkg);
+    }
+    if (ret == ACTION_RET_OK)
+        ret = archive_create(binary, meta, pkg->destdir, pkg->files,
+                             pkg->num_files);
+
+    pkg_cleanup(pkg);
+
+    if (ret != ACTION_RET_OK)
+    {
+        ERROR("Building %s-%s failed.\n", pkg->name, pkg->version);
+        return ret;
+    }
+
+    INFO("Wrote %s (%lu entries)\n", binary, (unsigned long)pkg->num_files);
+    return ACTION_RET_OK;
+}
+
+/* Packages installed before file manifests existed still rely on their
+ * manifest's uninstall() */
+static int _pkg_uninstall_legacy(const char* package_name, struct db* db)
+{
+    struct pkg_ctx* pkg = pkg_parse(package_name);
+    if (pkg == NULL)
+    {
+        ERROR("Package not found. Uninstallation aborted.\n");
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+    }
+
+    INFO("Uninstalling: %s-%s\n", pkg->name, pkg->version);
+    INFO("Description: %s\n", pkg->description);
+    INFO("Maintainers: %s\n", pkg->maintainers);
+
+    if (!pkg_ask_confirm("Do you want to continue uninstalling?"))
+    {
+        INFO("Uninstallation aborted by user.\n");
+        return ACTION_RET_OK;
+    }
+
+    INFO("Starting uninstallation...\n");
+
+    struct function_entry* uninstall_func =
+        _pkg_find_function(pkg, "uninstall");
+    if (uninstall_func == NULL)
+    {
+        WARNING("No uninstall() function defined for this package.\n");
+        return ACTION_RET_OK;
+    }
+
+    pkg->sandbox = sandbox_create(pkg->envp, _pkg_branch(pkg));
+    if (pkg->sandbox == NULL)
+    {
+        ERROR("Failed to create sandbox. Uninstallation aborted.\n");
+        return ACTION_RET_ERR_UNKNOWN;
+    }
+
+    if (_run_func(pkg, uninstall_func) != ACTION_RET_OK)
+    {
+        ERROR("Function 'uninstall' failed. Uninstallation may be "
+              "incomplete.\n");
+        sandbox_destroy(pkg->sandbox);
+        return ACTION_RET_ERR_UNKNOWN;
+    }
+    sandbox_destroy(pkg->sandbox);
+
+    /* Remove the package entry from installed.list */
+    if (db_remove(db, pkg->name) != ACTION_RET_OK)
+    {
+        WARNING("Package %s-%s not found in installed.list.\n", pkg->name,
+                pkg->version);
+        return ACTION_RET_OK;
+    }
+
+    if (db_save(db) != ACTION_RET_OK)
+        return ACTION_RET_ERR_IO;
+
+    INFO("Uninstallation of %s-%s completed successfully.\n", pkg->name,
+         pkg->version);
+    return ACTION_RET_OK;
+}
+
+/* Installed packages that would lose a dependency without name, as a space
+ * separated list, or NULL if there are none. Dependencies on what name
+ * provides count too, unless another installed package provides it. */
+static char* _pkg_dependents(struct rdeps* rdeps, const char* name,
+                             const char* provides)
+{
+    struct rdeps_edge* edges;
+    struct dep* virt;
+    size_t num_virt, n, i, j;
+    char* list = NULL;
+
+    if (dep_parse_list(provides, &virt, &num_virt) != 0)
+        num_virt = 0;
+
+    for (i = 0; i <= num_virt; i++)
+    {
+        if (i > 0)
+        {
+            /* Edges are unique, so more than one means another provider */
+            n = rdeps_providers(rdeps, virt[i - 1].name, &edges);
+            if (n > 1 || (n == 1 && strcmp(edges[0].dependent, name) != 0))
+                continue;
+        }
+
+        n = rdeps_find(rdeps, i == 0 ? name : virt[i - 1].name, &edges);
+        for (j = 0; j < n; j++)
+        {
+            char* grown;
+
+            if (strcmp(edges[j].dependent, name) == 0)
+                continue;
+
+            grown = arena_alloc(&g_arena, (list ? strlen(list) : 0) +
+                                              strlen(edges[j].dependent) + 2);
+            if (grown == NULL)
+                return list;
+            sprintf(grown, "%s%s%s", list ? list : "", list ? " " : "",
+                    edges[j].dependent);
+            list = grown;
+        }
+    }
+
+    return list;
+}
+
+/* Unlink what pkg installed and drop it from every index */
+static int _pkg_remove(struct pkg_ctx* pkg, struct db* db,
+                       struct rdeps* rdeps, struct db_file* files,
+                       size_t num_files)
+{
+    struct owners_index owners;
+
+    /* Script-free: the recorded manifest says exactly what to unlink */
+    MSG("Removing %lu recorded entries\n", (unsigned long)num_files);
+    if (stage_remove(files, num_files) != ACTION_RET_OK)
+    {
+        WARNING("Some files of %s could not be removed.\n", pkg->name);
+    }
+
+    if (owners_load(&owners) == ACTION_RET_OK)
+    {
+        owners_remove(&owners, pkg->name, files, num_files);
+        owners_save(&owners);
+        owners_close(&owners);
+    }
+
+    rdeps_remove(rdeps, pkg->name, pkg->depends, pkg->provides);
+    db_remove(db, pkg->name);
+    if (rdeps_save(rdeps) != ACTION_RET_OK || db_save(db) != ACTION_RET_OK ||
+        db_remove_package(pkg->name) != 0)
+        return ACTION_RET_ERR_IO;
+
+    INFO("Uninstallation of %s-%s completed successfully.\n", pkg->name,
+         pkg->version);
+    return ACTION_RET_OK;
+}
+
+int pkg_uninstall(const char* package_name)
+{
+    struct pkg_ctx* pkg;
+    struct db_file* files;
+    size_t num_files;
+    struct rdeps rdeps;
+    struct db db;
+    char* dependents;
+    char* name;
+    char* colon;
+
+    if (package_name == NULL || strlen(package_name) == 0)
+    {
+        ERROR("Invalid package name.\n");
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+    }
+
+    if (db_load(&db) != ACTION_RET_OK || rdeps_load(&rdeps) != ACTION_RET_OK)
+    {
+        ERROR("Failed to read the installed package list.\n");
+        return ACTION_RET_ERR_IO;
+    }
+
+    /* The branch does not matter once a package is installed */
+    name = strdup_safe(package_name);
+    colon = strchr(name, ':');
+    if (colon != NULL)
+        *colon = '\0';
+
+    pkg = arena_alloc(&g_arena, sizeof(struct pkg_ctx));
+    if (pkg == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    memset(pkg, 0, sizeof(struct pkg_ctx));
+    db_read_meta(name, pkg);
+
+    if (db_find(&db, name) != NULL)
+    {
+        dependents = _pkg_dependents(&rdeps, name, pkg->provides);
+        if (dependents != NULL)
+        {
+            ERROR("Can't uninstall %s, it is needed by: %s\n", name,
+                  dependents);
+            return ACTION_RET_PKG_ERR_DEPENDENCY;
+        }
+    }
+
+    if (db_find(&db, name) == NULL ||
+        db_read_files(name, &files, &num_files) != ACTION_RET_OK)
+    {
+        return _pkg_uninstall_legacy(package_name, &db);
+    }
+
+    pkg->name = name;
+    pkg->version = db_find(&db, name)->version;
+    if (pkg->description == NULL)
+        pkg->description = strdup_safe("unkown");
+    if (pkg->maintainers == NULL)
+        pkg->maintainers = strdup_safe("unkown");
+
+    INFO("Uninstalling: %s-%s\n", pkg->name, pkg->version);
+    INFO("Description: %s\n", pkg->description);
+    INFO("Maintainers: %s\n", pkg->maintainers);
+
+    if (!pkg_ask_confirm("Do you want to continue uninstalling?"))
+    {
+        INFO("Uninstallation aborted by user.\n");
+        return ACTION_RET_OK;
+    }
+
+    INFO("Starting uninstallation...\n");
+    return _pkg_remove(pkg, &db, &rdeps, files, num_files);
+}
+
+static int _cmp_edge_dependent(const void* a, const void* b)
+{
+    return strcmp((*(const struct rdeps_edge* const*)a)->dependent,
+                  (*(const struct rdeps_edge* const*)b)->dependent);
+}
+
+/*
+ * Orphans are packages installed as a dependency that no explicitly
+ * installed package reaches anymore. One pass marks everything reachable
+ * from the explicit packages along the forward edges, which are the
+ * reverse dependency edges grouped by dependent; what stays unmarked,
+ * cycles of orphans included, goes.
+ */
+int pkg_autoremove(void)
+{
+    struct rdeps rdeps;
+    struct db db;
+    struct pkg_ctx* metas;
+    struct rdeps_edge** by_dependent;
+    size_t* stack;
+    size_t num_stack = 0, num_orphans = 0, i, j;
+    char* keep;
+    int ret = ACTION_RET_OK;
+
+    if (db_load(&db) != ACTION_RET_OK || rdeps_load(&rdeps) != ACTION_RET_OK)
+    {
+        ERROR("Failed to read the installed package list.\n");
+        return ACTION_RET_ERR_IO;
+    }
+
+    metas = arena_alloc(&g_arena, (db.num_entries + 1) * sizeof(*metas));
+    keep = arena_alloc(&g_arena, db.num_entries + 1);
+    stack = arena_alloc(&g_arena, (db.num_entries + 1) * sizeof(*stack));
+    by_dependent = arena_alloc(&g_arena, (rdeps.num_edges + 1) *
+                                             sizeof(*by_dependent));
+    if (metas == NULL || keep == NULL || stack == NULL ||
+        by_dependent == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    memset(keep, 0, db.num_entries + 1);
+
+    for (i = 0; i < rdeps.num_edges; i++)
+        by_dependent[i] = &rdeps.edges[i];
+    qsort(by_dependent, rdeps.num_edges, sizeof(*by_dependent),
+          _cmp_edge_dependent);
+
+    /* Roots are everything not known to be a dependency, so packages from
+     * before REASON was recorded are never removed */
+    for (i = 0; i < db.num_entries; i++)
+    {
+        memset(&metas[i], 0, sizeof(metas[i]));
+        db_read_meta(db.entries[i].name, &metas[i]);
+        if (metas[i].reason == NULL ||
+            strcmp(metas[i].reason, PKG_REASON_DEPENDENCY) != 0)
+        {
+            keep[i] = 1;
+            stack[num_stack++] = i;
+        }
+    }
+
+    while (num_stack > 0)
+    {
+        struct rdeps_edge key;
+        struct rdeps_edge* keyp = &key;
+        struct rdeps_edge** edge;
+
+        /* First edge of the package, edges of one dependent are adjacent */
+        key.dependent = db.entries[stack[--num_stack]].name;
+        edge = bsearch(&keyp, by_dependent, rdeps.num_edges,
+                       sizeof(*by_dependent), _cmp_edge_dependent);
+        if (edge == NULL)
+            continue;
+        while (edge > by_dependent &&
+               strcmp(edge[-1]->dependent, key.dependent) == 0)
+            edge--;
+
+        for (; edge < by_dependent + rdeps.num_edges &&
+               strcmp((*edge)->dependent, key.dependent) == 0;
+             edge++)
+        {
+            struct db_entry* target = db_find(&db, (*edge)->name);
+            struct rdeps_edge* p;
+            size_t n;
+
+            if (target != NULL)
+            {
+                size_t t = (size_t)(target - db.entries);
+                if (!keep[t])
+                {
+                    keep[t] = 1;
+                    stack[num_stack++] = t;
+                }
+                continue;
+            }
+
+            /* A virtual name keeps every installed provider */
+            n = rdeps_providers(&rdeps, (*edge)->name, &p);
+            for (j = 0; j < n; j++)
+            {
+                size_t t;
+
+                target = db_find(&db, p[j].dependent);
+                if (target == NULL)
+                    continue;
+                t = (size_t)(target - db.entries);
+                if (!keep[t])
+                {
+                    keep[t] = 1;
+                    stack[num_stack++] = t;
+                }
+            }
+        }
+    }
+
+    /* stack is free again, collect the orphans in it */
+    for (i = 0; i < db.num_entries; i++)
+    {
+        if (keep[i])
+            continue;
+        INFO("Orphaned: %s-%s\n", db.entries[i].name, db.entries[i].version);
+        metas[i].name = db.entries[i].name;
+        metas[i].version = db.entries[i].version;
+        stack[num_orphans++] = i;
+    }
+
+    if (num_orphans == 0)
+    {
+        INFO("No orphaned packages.\n");
+        return ACTION_RET_OK;
+    }
+
+    if (!pkg_ask_confirm("Do you want to remove them?"))
+    {
+        INFO("Removal aborted by user.\n");
+        return ACTION_RET_OK;
+    }
+
+    for (i = 0; i < num_orphans; i++)
+    {
+        struct pkg_ctx* pkg = &metas[stack[i]];
+        struct db_file* files;
+        size_t num_files;
+
+        if (db_read_files(pkg->name, &files, &num_files) != ACTION_RET_OK)
+        {
+            WARNING("%s has no file manifest, uninstall it by name\n",
+                    pkg->name);
+            continue;
+        }
+
+        INFO("Removing %s-%s\n", pkg->name, pkg->version);
+        if (_pkg_remove(pkg, &db, &rdeps, files, num_files) != ACTION_RET_OK)
+            ret = ACTION_RET_ERR_IO;
+    }
+
+    return ret;
+}
+
+int pkg_fetch(struct pkg_ctx** pkgs, size_t num_pkgs)
+{
+    if (fetch_sources(pkgs, num_pkgs) != ACTION_RET_OK)
+    {
+        ERROR("Fetching sources failed.\n");
+        return ACTION_RET_ERR_IO;
+    }
+
+    INFO("All sources are cached.\n");
+    return ACTION_RET_OK;
+}
+
+int pkg_owns(const char* path)
+{
+    struct owners_index owners;
+    struct db_entry* entry;
+    const char* owner;
+    struct db db;
+    size_t root_len = strlen(g_config.root);
+    char* rel;
+
+    if (path == NULL || strlen(path) == 0)
+    {
+        ERROR("Invalid path.\n");
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+    }
+
+    /* Accept paths with ROOT in front as well as ROOT relative ones */
+    while (root_len > 0 && g_config.root[root_len - 1] == '/')
+        root_len--;
+    if (root_len > 0 && strncmp(path, g_config.root, root_len) == 0 &&
+        path[root_len] == '/')
+        path += root_len;
+
+    rel = fs_join("/", path);
+    while (strlen(rel) > 1 && rel[strlen(rel) - 1] == '/')
+        rel[strlen(rel) - 1] = '\0';
+
+    if (owners_load(&owners) != ACTION_RET_OK)
+        return ACTION_RET_ERR_IO;
+
+    owner = owners_find(&owners, rel);
+    if (owner == NULL)
+    {
+        ERROR("No package owns '%s'\n", rel);
+        owners_close(&owners);
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+    }
+
+    if (db_load(&db) == ACTION_RET_OK && (entry = db_find(&db, owner)))
+        printf("%s is owned by %s-%s\n", rel, entry->name, entry->version);
+    else
+        printf("%s is owned by %s\n", rel, owner);
+
+    owners_close(&owners);
+    return ACTION_RET_OK;
+}
+
+int pkg_search(char** terms, size_t num_terms)
+{
+    struct repo_index idx;
+    struct db db;
+    uint32_t* hits = NULL;
+    size_t num_hits = 0, i, t;
+    int have_db, ret;
+
+    ret = repoidx_load(&idx);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    /* Every term has to match, hits stay sorted so intersecting is a merge */
+    for (t = 0; t < num_terms; t++)
+    {
+        uint32_t* term_hits;
+        size_t num_term_hits, kept = 0, j = 0;
+
+        ret = repoidx_search(&idx, terms[t], &term_hits, &num_term_hits);
+        if (ret != ACTION_RET_OK)
+        {
+            repoidx_close(&idx);
+            return ret;
+        }
+
+        if (t == 0)
+        {
+            hits = term_hits;
+            num_hits = num_term_hits;
+            continue;
+        }
+
+        for (i = 0; i < num_hits; i++)
+        {
+            while (j < num_term_hits && term_hits[j] < hits[i])
+                j++;
+            if (j < num_term_hits && term_hits[j] == hits[i])
+                hits[kept++] = hits[i];
+        }
+        num_hits = kept;
+    }
+
+    have_db = db_load(&db) == ACTION_RET_OK;
+    if (g_config.json)
+        printf("[");
+    for (i = 0; i < num_hits; i++)
+    {
+        struct repoidx_entry e;
+        struct db_entry* installed;
+
+        repoidx_get(&idx, hits[i], &e);
+        installed = have_db ? db_find(&db, e.name) : NULL;
+        if (g_config.json)
+        {
+            printf("%s\n  {", i ? "," : "");
+            json_field(stdout, "name", e.name, 1);
+            json_field(stdout, "version", e.version, 0);
+            json_field(stdout, "branch", e.branch, 0);
+            json_field(stdout, "description", e.description, 0);
+            printf(", \"installed\": %s}", installed ? "true" : "false");
+            continue;
+        }
+        printf("%s-%s (%s)%s\n    %s\n", e.name, e.version, e.branch,
+               installed ? " [installed]" : "", e.description);
+    }
+    if (g_config.json)
+        printf("%s]\n", num_hits ? "\n" : "");
+
+    repoidx_close(&idx);
+    return num_hits > 0 ? ACTION_RET_OK : ACTION_RET_PKG_ERR_NOT_FOUND;
+}
+
+/* =============================================================================
+ * Queries, answered from the installed database and the repository index
+ * without opening a manifest
+ * ========================================================================== */
+
+static const char* _format_size(uint64_t size)
+{
+    static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    char* buf = arena_alloc(&g_arena, 32);
+    double value = (double)size;
+    size_t unit = 0;
+
+    if (buf == NULL)
+        return "?";
+
+    while (value >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0]))
+    {
+        value /= 1024;
+        unit++;
+    }
+
+    if (unit == 0)
+        sprintf(buf, "%lu B", (unsigned long)size);
+    else
+        sprintf(buf, "%.1f %s", value, units[unit]);
+    return buf;
+}
+
+static void _info_line(const char* label, const char* value)
+{
+    printf("%-14s: %s\n", label, value != NULL && *value ? value : "None");
+}
+
+int pkg_list(void)
+{
+    struct db db;
+    size_t i;
+    int ret;
+
+    ret = db_load(&db);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    if (g_config.json)
+        printf("[");
+    for (i = 0; i < db.num_entries; i++)
+    {
+        struct db_entry* e = &db.entries[i];
+
+        if (!g_config.json)
+        {
+            printf("%s %s (%s)\n", e->name, e->version, e->branch);
+            continue;
+        }
+
+        printf("%s\n  {", i ? "," : "");
+        json_field(stdout, "name", e->name, 1);
+        json_field(stdout, "version", e->version, 0);
+        json_field(stdout, "branch", e->branch, 0);
+        printf("}");
+    }
+    if (g_config.json)
+        printf("%s]\n", db.num_entries ? "\n" : "");
+
+    return ACTION_RET_OK;
+}
+
+int pkg_info(char** names, size_t num_names)
+{
+    struct repo_index idx;
+    struct db db;
+    size_t i, shown = 0;
+    int ret = ACTION_RET_OK;
+
+    if (db_load(&db) != ACTION_RET_OK || repoidx_load(&idx) != ACTION_RET_OK)
+        return ACTION_RET_ERR_IO;
+
+    if (g_config.json)
+        printf("[");
+    for (i = 0; i < num_names; i++)
+    {
+        struct db_entry* installed = db_find(&db, names[i]);
+        struct repoidx_entry avail;
+        struct pkg_ctx pkg;
+        struct db_file* files = NULL;
+        size_t num_files = 0, f;
+        uint64_t size = 0;
+        char* avail_text = NULL;
+        long found;
+
+        memset(&pkg, 0, sizeof(pkg));
+        found = repoidx_find(&idx, names[i],
+                             installed ? installed->branch : NULL);
+        if (found >= 0)
+            repoidx_get(&idx, (size_t)found, &avail);
+
+        if (installed != NULL)
+        {
+            db_read_meta(installed->name, &pkg);
+            db_read_files(installed->name, &files, &num_files);
+            for (f = 0; f < num_files; f++)
+            {
+                if (files[f].type == DB_FILE_REG)
+                    size += (uint64_t)files[f].size;
+            }
+
+            /* Records from before meta was written only have the list */
+            pkg.name = installed->name;
+            pkg.version = installed->version;
+            pkg.branch = installed->branch;
+        }
+        else if (found >= 0)
+        {
+            pkg.name = (char*)avail.name;
+            pkg.version = (char*)avail.version;
+            pkg.description = (char*)avail.description;
+            pkg.depends = (char*)avail.depends;
+            pkg.provides = (char*)avail.provides;
+            pkg.conflicts = (char*)avail.conflicts;
+            pkg.branch = (char*)avail.branch;
+        }
+        else
+        {
+            ERROR("Package '%s' not found.\n", names[i]);
+            ret = ACTION_RET_PKG_ERR_NOT_FOUND;
+            continue;
+        }
+
+        if (g_config.json)
+        {
+            printf("%s\n  {", shown++ ? "," : "");
+            json_field(stdout, "name", pkg.name, 1);
+            json_field(stdout, "version", pkg.version, 0);
+            json_field(stdout, "description", pkg.description, 0);
+            json_field(stdout, "maintainers", pkg.maintainers, 0);
+            json_field(stdout, "depends", pkg.depends, 0);
+            json_field(stdout, "provides", pkg.provides, 0);
+            json_field(stdout, "conflicts", pkg.conflicts, 0);
+            json_field(stdout, "branch", pkg.branch, 0);
+            json_field(stdout, "build_key",
+                       pkg.build_key[0] ? pkg.build_key : NULL, 0);
+            printf(", \"installed\": %s", installed ? "true" : "false");
+            if (installed != NULL)
+                printf(", \"files\": %lu, \"size\": %lu",
+                       (unsigned long)num_files, (unsigned long)size);
+            json_field(stdout, "available", found >= 0 ? avail.version : NULL,
+                       0);
+            printf("}");
+            continue;
+        }
+
+        if (found >= 0)
+        {
+            avail_text = arena_alloc(&g_arena, strlen(avail.version) +
+                                                   strlen(avail.branch) + 4);
+            if (avail_text != NULL)
+                sprintf(avail_text, "%s (%s)", avail.version, avail.branch);
+        }
+
+        if (shown++ > 0)
+            printf("\n");
+        _info_line("Name", pkg.name);
+        _info_line("Version", pkg.version);
+        _info_line("Description", pkg.description);
+        _info_line("Maintainers", pkg.maintainers);
+        _info_line("Depends", pkg.depends);
+        _info_line("Provides", pkg.provides);
+        _info_line("Conflicts", pkg.conflicts);
+        _info_line("Branch", pkg.branch);
+        if (installed != NULL)
+        {
+            printf("%-14s: yes, %lu files, %s\n", "Installed",
+                   (unsigned long)num_files, _format_size(size));
+            _info_line("Build key", pkg.build_key);
+        }
+        else
+        {
+            _info_line("Installed", "no");
+        }
+        _info_line("Available", avail_text);
+    }
+    if (g_config.json)
+        printf("%s]\n", shown ? "\n" : "");
+
+    repoidx_close(&idx);
+    return ret;
+}
+
+/* One pass over installed.list and the repository index, both sorted by
+ * name, instead of a lookup per installed package */
+int pkg_find_updates(struct pkg_update** updates, size_t* num_updates)
+{
+    struct repo_index idx;
+    struct db db;
+    size_t i, j = 0, n, cap = 0;
+    int ret;
+
+    *updates = NULL;
+    *num_updates = 0;
+
+    if ((ret = db_load(&db)) != ACTION_RET_OK ||
+        (ret = repoidx_load(&idx)) != ACTION_RET_OK)
+        return ret;
+
+    n = repoidx_count(&idx);
+    for (i = 0; i < db.num_entries; i++)
+    {
+        struct db_entry* e = &db.entries[i];
+        struct repoidx_entry avail, r;
+        int found = 0;
+        char* spec;
+
+        memset(&avail, 0, sizeof(avail));
+
+        while (j < n && repoidx_get(&idx, j, &r) == ACTION_RET_OK &&
+               strcmp(r.name, e->name) < 0)
+            j++;
+
+        /* Entries of one name are in branch order, stay on the installed
+         * branch and fall back to the first one offering the package. A
+         * branch can carry several versions, take its newest. */
+        for (; j < n && repoidx_get(&idx, j, &r) == ACTION_RET_OK &&
+               strcmp(r.name, e->name) == 0;
+             j++)
+        {
+            int same = strcmp(r.branch, e->branch) == 0;
+
+            if (r.redirect != NULL || (found == 2 && !same))
+                continue;
+            if (found == 1 && !same && strcmp(r.branch, avail.branch) != 0)
+                continue;
+            if (found == (same ? 2 : 1) &&
+                vercmp(r.version, avail.version) <= 0)
+                continue;
+            found = same ? 2 : 1;
+            avail = r;
+        }
+
+        if (!found)
+        {
+            MSG("%s is no longer in any branch\n", e->name);
+            continue;
+        }
+        if (vercmp(avail.version, e->version) <= 0)
+            continue;
+
+        if (*num_updates == cap)
+        {
+            size_t new_cap = cap ? cap * 2 : 32;
+            struct pkg_update* grown =
+                arena_alloc(&g_arena, new_cap * sizeof(*grown));
+            if (grown == NULL)
+            {
+                repoidx_close(&idx);
+                return ACTION_RET_ERR_UNKNOWN;
+            }
+            if (*num_updates > 0)
+                memcpy(grown, *updates, *num_updates * sizeof(*grown));
+            *updates = grown;
+            cap = new_cap;
+        }
+
+        /* Ask the solver for exactly this version on this branch */
+        spec = arena_alloc(&g_arena, strlen(e->name) +
+                                         strlen(avail.version) +
+                                         strlen(avail.branch) + 3);
+        if (spec == NULL)
+        {
+            repoidx_close(&idx);
+            return ACTION_RET_ERR_UNKNOWN;
+        }
+        sprintf(spec, "%s=%s:%s", e->name, avail.version, avail.branch);
+
+        (*updates)[*num_updates].name = e->name;
+        (*updates)[*num_updates].installed = e->version;
+        (*updates)[*num_updates].available = strdup_safe(avail.version);
+        (*updates)[*num_updates].branch = strdup_safe(avail.branch);
+        (*updates)[*num_updates].spec = spec;
+        (*num_updates)++;
+    }
+
+    repoidx_close(&idx);
+    return ACTION_RET_OK;
+}
+
+int pkg_outdated(void)
+{
+    struct pkg_update* updates;
+    size_t num_updates, i;
+    int ret;
+
+    ret = pkg_find_updates(&updates, &num_updates);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    if (g_config.json)
+        printf("[");
+    for (i = 0; i < num_updates; i++)
+    {
+        struct pkg_update* u = &updates[i];
+
+        if (!g_config.json)
+        {
+            printf("%s %s -> %s (%s)\n", u->name, u->installed, u->available,
+                   u->branch);
+            continue;
+        }
+
+        printf("%s\n  {", i ? "," : "");
+        json_field(stdout, "name", u->name, 1);
+        json_field(stdout, "installed", u->installed, 0);
+        json_field(stdout, "available", u->available, 0);
+        json_field(stdout, "branch", u->branch, 0);
+        printf("}");
+    }
+    if (g_config.json)
+        printf("%s]\n", num_updates ? "\n" : "");
+
+    return ACTION_RET_OK;
+}
+
+static bool _timings_wanted(const char* name, char** names, size_t num_names)
+{
+    size_t i;
+
+    if (num_names == 0)
+        return true;
+    for (i = 0; i < num_names; i++)
+        if (strcmp(names[i], name) == 0)
+            return true;
+    return false;
+}
+
+int pkg_timings(char** names, size_t num_names)
+{
+    struct timings t;
+    size_t i, j, shown = 0;
+    int ret;
+
+    ret = timings_load(&t);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    if (g_config.json)
+        printf("[");
+    else if (t.num_entries > 0)
+        printf("%-24s %-14s %9s %9s %5s\n", "Package", "Version", "Last",
+               "Average", "Runs");
+
+    /* Entries are sorted, one group of functions per name-version */
+    for (i = 0; i < t.num_entries; i = j)
+    {
+        struct timings_entry* e = &t.entries[i];
+        double seconds = 0, last, history;
+        unsigned long runs = 0;
+        int regressed;
+
+        for (j = i; j < t.num_entries &&
+                    strcmp(t.entries[j].name, e->name) == 0 &&
+                    strcmp(t.entries[j].version, e->version) == 0;
+             j++)
+        {
+            seconds += t.entries[j].seconds;
+            if (t.entries[j].runs > runs)
+                runs = t.entries[j].runs;
+        }
+        if (!_timings_wanted(e->name, names, num_names))
+            continue;
+
+        timings_last(&t, e->name, e->version, &last, &history);
+        regressed = timings_regressed(last, history);
+        if (last <= 0)
+            last = seconds; /* Nothing to compare, show the average */
+
+        if (!g_config.json)
+        {
+            printf("%-24s %-14s %8.1fs %8.1fs %5lu", e->name, e->version,
+                   last, seconds, runs);
+            if (regressed)
+                printf("  REGRESSED +%.0f%%",
+                       (last - history) * 100 / history);
+            printf("\n");
+            shown++;
+            continue;
+        }
+
+        printf("%s\n  {", shown++ ? "," : "");
+        json_field(stdout, "name", e->name, 1);
+        json_field(stdout, "version", e->version, 0);
+        printf(", \"last\": %.3f, \"average\": %.3f, \"runs\": %lu", last,
+               seconds, runs);
+        if (history > 0)
+            printf(", \"previous\": %.3f", history);
+        printf(", \"regressed\": %s}", regressed ? "true" : "false");
+    }
+    if (g_config.json)
+        printf("%s]\n", shown ? "\n" : "");
+
+    return ACTION_RET_OK;
+}
@@ -0,0 +1,52 @@
+/******************************************************************************
+ * psi.c - Pressure stall information of the host
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <psi.h>
+
+/* avg10 of the "some" and "full" lines of one resource */
+static int _read_avg10(const char* path, double* some, double* full)
+{
+    char line[256];
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL)
+        return -1;
+
+    *some = 0;
+    if (full != NULL)
+        *full = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char* avg = strstr(line, "avg10=");
+
+        if (avg == NULL)
+            continue;
+        if (strncmp(line, "some", 4) == 0)
+            *some = strtod(avg + 6, NULL);
+        else if (strncmp(line, "full", 4) == 0 && full != NULL)
+            *full = strtod(avg + 6, NULL);
+    }
+    fclose(file);
+    return 0;
+}
+
+int psi_read(struct psi* p)
+{
+    memset(p, 0, sizeof(*p));
+    if (_read_avg10("/proc/pressure/cpu", &p->cpu_some, NULL) != 0 ||
+        _read_avg10("/proc/pressure/memory", &p->memory_some,
+                    &p->memory_full) != 0 ||
+        _read_avg10("/proc/pressure/io", &p->io_some, NULL) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,326 @@
+/******************************************************************************
+ * rdeps.c - Reverse dependency index
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <piratpkg.h>
+#include <rdeps.h>
+#include <version.h>
+#include <db.h>
+#include <fs.h>
+#include <pkg.h>
+#include <strings.h>
+#include <log.h>
+
+#define RDEPS_FILE "rdeps.list"
+#define PROVIDES_FILE "provides.list"
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+/* One sorted edge list, the dependency edges or the provides edges */
+struct edge_list
+{
+    struct rdeps_edge** edges;
+    size_t* num_edges;
+    size_t* cap;
+};
+
+static struct edge_list _deps(struct rdeps* idx)
+{
+    struct edge_list l;
+    l.edges = &idx->edges;
+    l.num_edges = &idx->num_edges;
+    l.cap = &idx->cap;
+    return l;
+}
+
+static struct edge_list _provides(struct rdeps* idx)
+{
+    struct edge_list l;
+    l.edges = &idx->provides;
+    l.num_edges = &idx->num_provides;
+    l.cap = &idx->provides_cap;
+    return l;
+}
+
+static int _cmp_edge(const struct rdeps_edge* a, const char* name,
+                     const char* dependent)
+{
+    int cmp = strcmp(a->name, name);
+    return cmp != 0 ? cmp : strcmp(a->dependent, dependent);
+}
+
+/* Index of the first edge not before (name, dependent) */
+static size_t _lower_bound(struct edge_list l, const char* name,
+                           const char* dependent)
+{
+    size_t lo = 0, hi = *l.num_edges;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_cmp_edge(&(*l.edges)[mid], name, dependent) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int _insert(struct edge_list l, const char* name, const char* dependent)
+{
+    size_t i = _lower_bound(l, name, dependent);
+    struct rdeps_edge* at;
+
+    if (i < *l.num_edges && _cmp_edge(&(*l.edges)[i], name, dependent) == 0)
+        return ACTION_RET_OK;
+
+    if (*l.num_edges == *l.cap)
+    {
+        size_t new_cap = *l.cap ? *l.cap * 2 : 64;
+        struct rdeps_edge* edges =
+            arena_alloc(&g_arena, new_cap * sizeof(struct rdeps_edge));
+        if (edges == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        if (*l.num_edges > 0)
+            memcpy(edges, *l.edges, *l.num_edges * sizeof(struct rdeps_edge));
+        *l.edges = edges;
+        *l.cap = new_cap;
+    }
+
+    at = &(*l.edges)[i];
+    memmove(at + 1, at, (*l.num_edges - i) * sizeof(struct rdeps_edge));
+    at->name = strdup_safe(name);
+    at->dependent = strdup_safe(dependent);
+    (*l.num_edges)++;
+    return at->name != NULL && at->dependent != NULL ? ACTION_RET_OK
+                                                     : ACTION_RET_ERR_UNKNOWN;
+}
+
+static void _erase(struct edge_list l, size_t i)
+{
+    memmove(&(*l.edges)[i], &(*l.edges)[i + 1],
+            (*l.num_edges - i - 1) * sizeof(struct rdeps_edge));
+    (*l.num_edges)--;
+}
+
+static size_t _find(struct edge_list l, const char* name,
+                    struct rdeps_edge** first)
+{
+    size_t i, n = 0;
+
+    if (*l.num_edges == 0)
+    {
+        *first = NULL;
+        return 0;
+    }
+
+    i = _lower_bound(l, name, "");
+    *first = &(*l.edges)[i];
+    while (i + n < *l.num_edges && strcmp((*l.edges)[i + n].name, name) == 0)
+        n++;
+    return n;
+}
+
+static int _add(struct edge_list l, const char* pkg, const char* names)
+{
+    struct dep* deps;
+    size_t num_deps, i;
+
+    if (dep_parse_list(names, &deps, &num_deps) != 0)
+        return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+
+    for (i = 0; i < num_deps; i++)
+    {
+        if (_insert(l, deps[i].name, pkg) != ACTION_RET_OK)
+            return ACTION_RET_ERR_UNKNOWN;
+    }
+    return ACTION_RET_OK;
+}
+
+static void _remove(struct edge_list l, const char* pkg, const char* names)
+{
+    struct dep* deps;
+    size_t num_deps, i;
+
+    if (names == NULL || dep_parse_list(names, &deps, &num_deps) != 0)
+    {
+        for (i = *l.num_edges; i > 0; i--)
+        {
+            if (strcmp((*l.edges)[i - 1].dependent, pkg) == 0)
+                _erase(l, i - 1);
+        }
+        return;
+    }
+
+    for (i = 0; i < num_deps; i++)
+    {
+        size_t at = _lower_bound(l, deps[i].name, pkg);
+        if (at < *l.num_edges &&
+            _cmp_edge(&(*l.edges)[at], deps[i].name, pkg) == 0)
+            _erase(l, at);
+    }
+}
+
+/* ACTION_RET_PKG_ERR_NOT_FOUND if the file does not exist yet */
+static int _load(struct edge_list l, const char* file)
+{
+    char line[MAX_LINE_LENGTH];
+    char* path = db_path(file);
+    FILE* f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        if (errno == ENOENT)
+            return ACTION_RET_PKG_ERR_NOT_FOUND;
+        ERROR("Failed to open '%s': %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        size_t len = strlen(line);
+        char* tab;
+
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        tab = strchr(line, '\t');
+        if (tab == NULL)
+            continue;
+        *tab = '\0';
+
+        /* Written sorted, so this appends */
+        if (_insert(l, line, tab + 1) != ACTION_RET_OK)
+        {
+            fclose(f);
+            return ACTION_RET_ERR_UNKNOWN;
+        }
+    }
+
+    fclose(f);
+    return ACTION_RET_OK;
+}
+
+static int _save(struct edge_list l, const char* file)
+{
+    char* path = db_path(file);
+    char* tmp_path;
+    FILE* f;
+    size_t i;
+
+    f = fs_open_atomic(path, &tmp_path);
+    if (f == NULL)
+        return ACTION_RET_ERR_IO;
+
+    for (i = 0; i < *l.num_edges; i++)
+        fprintf(f, "%s\t%s\n", (*l.edges)[i].name, (*l.edges)[i].dependent);
+
+    return fs_close_atomic(f, tmp_path, path);
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int rdeps_load(struct rdeps* idx)
+{
+    int ret;
+
+    memset(idx, 0, sizeof(*idx));
+
+    ret = _load(_deps(idx), RDEPS_FILE);
+    if (ret == ACTION_RET_OK)
+        ret = _load(_provides(idx), PROVIDES_FILE);
+
+    /* Databases from before either index existed get both built now */
+    if (ret == ACTION_RET_PKG_ERR_NOT_FOUND)
+        return rdeps_rebuild(idx);
+    return ret;
+}
+
+int rdeps_save(struct rdeps* idx)
+{
+    int ret;
+
+    if (fs_mkdir_p(db_path(""), 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", db_path(""), strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    ret = _save(_deps(idx), RDEPS_FILE);
+    if (ret == ACTION_RET_OK)
+        ret = _save(_provides(idx), PROVIDES_FILE);
+    return ret;
+}
+
+int rdeps_add(struct rdeps* idx, const char* pkg, const char* depends,
+              const char* provides)
+{
+    int ret = _add(_deps(idx), pkg, depends);
+    return ret == ACTION_RET_OK ? _add(_provides(idx), pkg, provides) : ret;
+}
+
+void rdeps_remove(struct rdeps* idx, const char* pkg, const char* depends,
+                  const char* provides)
+{
+    _remove(_deps(idx), pkg, depends);
+    _remove(_provides(idx), pkg, provides);
+}
+
+size_t rdeps_find(struct rdeps* idx, const char* name,
+                  struct rdeps_edge** first)
+{
+    return _find(_deps(idx), name, first);
+}
+
+size_t rdeps_providers(struct rdeps* idx, const char* name,
+                       struct rdeps_edge** first)
+{
+    return _find(_provides(idx), name, first);
+}
+
+int rdeps_rebuild(struct rdeps* idx)
+{
+    struct db db;
+    size_t i;
+
+    memset(idx, 0, sizeof(*idx));
+    if (db_load(&db) != ACTION_RET_OK)
+        return ACTION_RET_ERR_IO;
+
+    /* Fresh install, an empty index is implied */
+    if (db.num_entries == 0)
+        return ACTION_RET_OK;
+
+    MSG("Rebuilding the reverse dependency index\n");
+
+    for (i = 0; i < db.num_entries; i++)
+    {
+        struct pkg_ctx meta;
+
+        memset(&meta, 0, sizeof(meta));
+        if (db_read_meta(db.entries[i].name, &meta) != ACTION_RET_OK)
+            continue;
+
+        if (rdeps_add(idx, db.entries[i].name, meta.depends, meta.provides) !=
+            ACTION_RET_OK)
+            WARNING("Ignoring malformed dependencies of %s\n",
+                    db.entries[i].name);
+    }
+
+    return rdeps_save(idx);
+}
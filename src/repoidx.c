@@ -0,0 +1,1106 @@
+/******************************************************************************
+ * repoidx.c - Searchable index of the repository branches
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <piratpkg.h>
+#include <repoidx.h>
+#include <parser.h>
+#include <db.h>
+#include <fs.h>
+#include <strings.h>
+#include <log.h>
+
+#define REPOIDX_MAGIC 0x49525050 /* "PPRI" */
+#define REPOIDX_VERSION 2
+
+/* Timestamps this close to the refresh are recorded as 0, so a manifest
+ * rewritten within the same tick is read again next time */
+#define REPOIDX_RACY_NS 1000000000ull
+
+/*
+ * On-disk layout, all offsets are from the start of the file:
+ *   struct repoidx_disk          header
+ *   struct repoidx_disk_branch[] one per configured branch, in config order
+ *   struct repoidx_disk_entry[]  sorted by name, then branch
+ *   struct repoidx_disk_gram[]   sorted by trigram
+ *   uint32_t[num_postings]       entry indices, ascending within each gram
+ *   char[strings_size]           NUL terminated strings, the first is ""
+ */
+struct repoidx_disk
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_branches;
+    uint32_t num_entries;
+    uint32_t num_grams;
+    uint32_t num_postings;
+    uint32_t branches_off;
+    uint32_t entries_off;
+    uint32_t grams_off;
+    uint32_t postings_off;
+    uint32_t strings_off;
+    uint32_t strings_size;
+};
+
+struct repoidx_disk_branch
+{
+    uint32_t name;
+    uint32_t path;
+    uint64_t mtime; /* Of the directory, in nanoseconds */
+};
+
+struct repoidx_disk_entry
+{
+    uint32_t branch;
+    uint32_t file;
+    uint32_t name;
+    uint32_t version;
+    uint32_t description;
+    uint32_t depends;
+    uint32_t provides;
+    uint32_t conflicts;
+    uint32_t redirect; /* Set for REDIRECT manifests, never search results */
+    uint32_t reserved;
+    uint64_t mtime;
+    uint64_t size;
+};
+
+struct repoidx_disk_gram
+{
+    uint32_t gram;
+    uint32_t first;
+    uint32_t count;
+};
+
+/* An entry while refreshing, strings point into the old index or g_arena */
+struct repoidx_item
+{
+    uint32_t branch;
+    const char* file;
+    const char* name;
+    const char* version;
+    const char* description;
+    const char* depends;
+    const char* provides;
+    const char* conflicts;
+    const char* redirect;
+    uint64_t mtime;
+    uint64_t size;
+};
+
+struct repoidx_build
+{
+    struct repoidx_item* items;
+    size_t num_items;
+    size_t cap_items;
+    uint64_t* branch_mtimes;
+    uint64_t now;
+    int changed;
+};
+
+struct repoidx_buf
+{
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+#define DISK_AT(idx, off) ((const char*)(idx)->disk + (off))
+#define DISK_BRANCHES(idx)                                                     \
+    ((const struct repoidx_disk_branch*)DISK_AT(idx,                           \
+                                                (idx)->disk->branches_off))
+#define DISK_ENTRIES(idx)                                                      \
+    ((const struct repoidx_disk_entry*)DISK_AT(idx, (idx)->disk->entries_off))
+#define DISK_GRAMS(idx)                                                        \
+    ((const struct repoidx_disk_gram*)DISK_AT(idx, (idx)->disk->grams_off))
+#define DISK_POSTINGS(idx)                                                     \
+    ((const uint32_t*)DISK_AT(idx, (idx)->disk->postings_off))
+#define DISK_STR(idx, off) (DISK_AT(idx, (idx)->disk->strings_off) + (off))
+
+#define GRAM(a, b, c)                                                          \
+    (((uint32_t)(unsigned char)tolower((unsigned char)(a)) << 16) |            \
+     ((uint32_t)(unsigned char)tolower((unsigned char)(b)) << 8) |             \
+     (uint32_t)(unsigned char)tolower((unsigned char)(c)))
+
+/* =============================================================================
+ * On-disk index
+ * ========================================================================== */
+
+static int _disk_valid(const struct repoidx_disk* hdr, size_t size)
+{
+    const char* base = (const char*)hdr;
+    const struct repoidx_disk_branch* branches;
+    const struct repoidx_disk_entry* entries;
+    const struct repoidx_disk_gram* grams;
+    const uint32_t* postings;
+    uint32_t i;
+
+    if (size < sizeof(*hdr) || hdr->magic != REPOIDX_MAGIC ||
+        hdr->version != REPOIDX_VERSION || hdr->strings_size == 0)
+        return 0;
+
+    if ((hdr->branches_off | hdr->entries_off | hdr->grams_off |
+         hdr->postings_off) % 4 != 0 ||
+        hdr->branches_off % 8 != 0 || hdr->entries_off % 8 != 0 ||
+        hdr->branches_off + (uint64_t)hdr->num_branches * sizeof(*branches) >
+            size ||
+        hdr->entries_off + (uint64_t)hdr->num_entries * sizeof(*entries) >
+            size ||
+        hdr->grams_off + (uint64_t)hdr->num_grams * sizeof(*grams) > size ||
+        hdr->postings_off + (uint64_t)hdr->num_postings * 4 > size ||
+        hdr->strings_off + (uint64_t)hdr->strings_size > size ||
+        base[hdr->strings_off + hdr->strings_size - 1] != '\0')
+        return 0;
+
+    /* Checked once here so lookups can trust every offset */
+    branches = (const void*)(base + hdr->branches_off);
+    for (i = 0; i < hdr->num_branches; i++)
+    {
+        if (branches[i].name >= hdr->strings_size ||
+            branches[i].path >= hdr->strings_size)
+            return 0;
+    }
+
+    entries = (const void*)(base + hdr->entries_off);
+    for (i = 0; i < hdr->num_entries; i++)
+    {
+        if (entries[i].branch >= hdr->num_branches ||
+            entries[i].file >= hdr->strings_size ||
+            entries[i].name >= hdr->strings_size ||
+            entries[i].version >= hdr->strings_size ||
+            entries[i].description >= hdr->strings_size ||
+            entries[i].depends >= hdr->strings_size ||
+            entries[i].provides >= hdr->strings_size ||
+            entries[i].conflicts >= hdr->strings_size ||
+            entries[i].redirect >= hdr->strings_size)
+            return 0;
+    }
+
+    grams = (const void*)(base + hdr->grams_off);
+    for (i = 0; i < hdr->num_grams; i++)
+    {
+        if (grams[i].first > hdr->num_postings ||
+            grams[i].count > hdr->num_postings - grams[i].first ||
+            (i > 0 && grams[i].gram <= grams[i - 1].gram))
+            return 0;
+    }
+
+    postings = (const void*)(base + hdr->postings_off);
+    for (i = 0; i < hdr->num_postings; i++)
+    {
+        if (postings[i] >= hdr->num_entries)
+            return 0;
+    }
+
+    return 1;
+}
+
+static const struct repoidx_disk_gram* _disk_gram(struct repo_index* idx,
+                                                  uint32_t gram)
+{
+    const struct repoidx_disk_gram* grams = DISK_GRAMS(idx);
+    uint32_t lo = 0, hi = idx->disk->num_grams;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (grams[mid].gram == gram)
+            return &grams[mid];
+        if (grams[mid].gram < gram)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static int _postings_have(struct repo_index* idx,
+                          const struct repoidx_disk_gram* g, uint32_t entry)
+{
+    const uint32_t* postings = DISK_POSTINGS(idx) + g->first;
+    uint32_t lo = 0, hi = g->count;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (postings[mid] == entry)
+            return 1;
+        if (postings[mid] < entry)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+static int _map(struct repo_index* idx, const char* path)
+{
+    struct stat st;
+    void* map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return 0;
+        ERROR("Failed to open '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        ERROR("Failed to map '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (st.st_size >= (off_t)sizeof(struct repoidx_disk) &&
+        ((const struct repoidx_disk*)map)->magic == REPOIDX_MAGIC &&
+        ((const struct repoidx_disk*)map)->version != REPOIDX_VERSION)
+    {
+        MSG("'%s' has an old format, rebuilding it\n", path);
+        munmap(map, (size_t)st.st_size);
+        return 0;
+    }
+
+    if (!_disk_valid((const struct repoidx_disk*)map, (size_t)st.st_size))
+    {
+        WARNING("'%s' is corrupt, rebuilding it\n", path);
+        munmap(map, (size_t)st.st_size);
+        return 0;
+    }
+
+    idx->disk = (const struct repoidx_disk*)map;
+    idx->disk_size = (size_t)st.st_size;
+    return 0;
+}
+
+/* =============================================================================
+ * Reading manifests
+ * ========================================================================== */
+
+static uint64_t _stamp(const struct stat* st, uint64_t now)
+{
+    uint64_t ns = (uint64_t)st->st_mtim.tv_sec * 1000000000ull +
+                  (uint64_t)st->st_mtim.tv_nsec;
+    return ns + REPOIDX_RACY_NS >= now ? 0 : ns;
+}
+
+/* Only the header keys are needed, function bodies are skipped unparsed */
+static int _read_manifest(int dirfd, struct repoidx_item* item)
+{
+    char line[MAX_LINE_LENGTH];
+    int depth = 0;
+    FILE* file;
+    int fd;
+
+    fd = openat(dirfd, item->file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || (file = fdopen(fd, "r")) == NULL)
+    {
+        WARNING("Failed to read manifest '%s': %s\n", item->file,
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    item->name = NULL;
+    item->version = "unknown";
+    item->description = "";
+    item->depends = "";
+    item->provides = "";
+    item->conflicts = "";
+    item->redirect = "";
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        struct key_value_pair kv_pair;
+        size_t len = strlen(line);
+        char* c;
+
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        if (depth == 0 && parse_single_key_value(line, &kv_pair) == 0)
+        {
+            if (strcmp(kv_pair.key, "PACKAGE_NAME") == 0)
+                item->name = kv_pair.value;
+            else if (strcmp(kv_pair.key, "PACKAGE_VERSION") == 0)
+                item->version = kv_pair.value;
+            else if (strcmp(kv_pair.key, "PACKAGE_DESCRIPTION") == 0)
+                item->description = kv_pair.value;
+            else if (strcmp(kv_pair.key, "PACKAGE_DEPENDS") == 0)
+                item->depends = kv_pair.value;
+            else if (strcmp(kv_pair.key, "PACKAGE_PROVIDES") == 0)
+                item->provides = kv_pair.value;
+            else if (strcmp(kv_pair.key, "PACKAGE_CONFLICTS") == 0)
+                item->conflicts = kv_pair.value;
+            else if (strcmp(kv_pair.key, "REDIRECT") == 0)
+                item->redirect = kv_pair.value;
+            continue;
+        }
+
+        for (c = line; *c != '\0'; c++)
+        {
+            if (*c == '{')
+                depth++;
+            else if (*c == '}' && depth > 0)
+                depth--;
+        }
+    }
+
+    fclose(file);
+
+    /* Same fallback as installing by file name */
+    if (item->name == NULL)
+    {
+        char* name = strdup_safe(item->file);
+        if (name == NULL)
+            return -1;
+        name[strlen(name) - strlen(".pkg")] = '\0';
+        item->name = name;
+    }
+    return 0;
+}
+
+static int _push(struct repoidx_build* b, const struct repoidx_item* item)
+{
+    if (b->num_items == b->cap_items)
+    {
+        size_t new_cap = b->cap_items ? b->cap_items * 2 : 256;
+        struct repoidx_item* items =
+            arena_alloc(&g_arena, new_cap * sizeof(*items));
+        if (items == NULL)
+            return -1;
+        if (b->num_items > 0)
+            memcpy(items, b->items, b->num_items * sizeof(*items));
+        b->items = items;
+        b->cap_items = new_cap;
+    }
+
+    b->items[b->num_items++] = *item;
+    return 0;
+}
+
+/* Reuse the recorded entry when the manifest is unchanged, read it
+ * otherwise. Manifests that can't be read are left out. Returns 1 if file
+ * is no longer a regular file. */
+static int _add_file(struct repo_index* idx, struct repoidx_build* b,
+                     int dirfd, uint32_t branch, const char* file,
+                     const struct repoidx_disk_entry* old)
+{
+    struct repoidx_item item;
+    struct stat st;
+
+    if (fstatat(dirfd, file, &st, 0) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (old != NULL)
+            b->changed = 1;
+        return 1;
+    }
+
+    item.branch = branch;
+    item.mtime = _stamp(&st, b->now);
+    item.size = (uint64_t)st.st_size;
+
+    if (old != NULL && old->mtime != 0 && old->mtime == item.mtime &&
+        old->size == item.size)
+    {
+        item.file = DISK_STR(idx, old->file);
+        item.name = DISK_STR(idx, old->name);
+        item.version = DISK_STR(idx, old->version);
+        item.description = DISK_STR(idx, old->description);
+        item.depends = DISK_STR(idx, old->depends);
+        item.provides = DISK_STR(idx, old->provides);
+        item.conflicts = DISK_STR(idx, old->conflicts);
+        item.redirect = DISK_STR(idx, old->redirect);
+        return _push(b, &item);
+    }
+
+    b->changed = 1;
+    item.file = old != NULL ? DISK_STR(idx, old->file) : strdup_safe(file);
+    if (item.file == NULL)
+        return -1;
+    if (_read_manifest(dirfd, &item) != 0)
+        return 0;
+    return _push(b, &item);
+}
+
+/* =============================================================================
+ * Refreshing
+ * ========================================================================== */
+
+static int _cmp_str(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int _cmp_old(const void* a, const void* b, void* arg)
+{
+    struct repo_index* idx = arg;
+    const struct repoidx_disk_entry* ea = &DISK_ENTRIES(idx)[*(uint32_t*)a];
+    const struct repoidx_disk_entry* eb = &DISK_ENTRIES(idx)[*(uint32_t*)b];
+    return strcmp(DISK_STR(idx, ea->file), DISK_STR(idx, eb->file));
+}
+
+/* Recorded entries of a branch, in index order */
+static uint32_t* _old_entries(struct repo_index* idx, uint32_t old_branch,
+                              size_t* num)
+{
+    const struct repoidx_disk_entry* entries = DISK_ENTRIES(idx);
+    uint32_t* olds;
+    uint32_t i;
+
+    *num = 0;
+    olds = arena_alloc(&g_arena, (idx->disk->num_entries + 1) * 4);
+    if (olds == NULL)
+        return NULL;
+
+    for (i = 0; i < idx->disk->num_entries; i++)
+    {
+        if (entries[i].branch == old_branch)
+            olds[(*num)++] = i;
+    }
+
+    return olds;
+}
+
+static const struct repoidx_disk_entry*
+_find_old(struct repo_index* idx, uint32_t* olds, size_t num_olds,
+          const char* file)
+{
+    const struct repoidx_disk_entry* entries = DISK_ENTRIES(idx);
+    size_t lo = 0, hi = num_olds;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(DISK_STR(idx, entries[olds[mid]].file), file);
+        if (cmp == 0)
+            return &entries[olds[mid]];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+/* List the directory and merge it with what was recorded */
+static int _rescan_branch(struct repo_index* idx, struct repoidx_build* b,
+                          int dirfd, uint32_t branch, uint32_t* olds,
+                          size_t num_olds)
+{
+    char** files = NULL;
+    size_t num_files = 0, cap_files = 0, matched = 0, i;
+    struct dirent* de;
+    DIR* dir;
+
+    dir = fdopendir(dup(dirfd));
+    if (dir == NULL)
+        return -1;
+
+    while ((de = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(de->d_name);
+
+        if (len <= strlen(".pkg") ||
+            strcmp(de->d_name + len - strlen(".pkg"), ".pkg") != 0)
+            continue;
+
+        if (num_files == cap_files)
+        {
+            size_t new_cap = cap_files ? cap_files * 2 : 256;
+            char** new_files = arena_alloc(&g_arena, new_cap * sizeof(char*));
+            if (new_files == NULL)
+                break;
+            if (num_files > 0)
+                memcpy(new_files, files, num_files * sizeof(char*));
+            files = new_files;
+            cap_files = new_cap;
+        }
+        files[num_files] = strdup_safe(de->d_name);
+        if (files[num_files] == NULL)
+            break;
+        num_files++;
+    }
+
+    if (de != NULL)
+    {
+        closedir(dir);
+        return -1;
+    }
+    closedir(dir);
+
+    qsort(files, num_files, sizeof(char*), _cmp_str);
+    if (olds != NULL)
+        qsort_r(olds, num_olds, sizeof(*olds), _cmp_old, idx);
+
+    for (i = 0; i < num_files; i++)
+    {
+        const struct repoidx_disk_entry* old =
+            olds ? _find_old(idx, olds, num_olds, files[i]) : NULL;
+
+        if (old != NULL)
+            matched++;
+        if (_add_file(idx, b, dirfd, branch, files[i], old) < 0)
+            return -1;
+    }
+
+    /* Manifests that were removed */
+    if (matched != num_olds)
+        b->changed = 1;
+    return 0;
+}
+
+static int _refresh_branch(struct repo_index* idx, struct repoidx_build* b,
+                           uint32_t branch)
+{
+    struct repo_branch* rb = &g_config.branches[branch];
+    const struct repoidx_disk_branch* old = NULL;
+    uint32_t* olds = NULL;
+    size_t num_olds = 0, mark, i;
+    struct stat st;
+    int dirfd, ret;
+
+    if (idx->disk != NULL)
+    {
+        const struct repoidx_disk_branch* branches = DISK_BRANCHES(idx);
+        uint32_t j;
+        for (j = 0; j < idx->disk->num_branches; j++)
+        {
+            if (strcmp(DISK_STR(idx, branches[j].name), rb->name) == 0 &&
+                strcmp(DISK_STR(idx, branches[j].path), rb->path) == 0)
+            {
+                old = &branches[j];
+                olds = _old_entries(idx, j, &num_olds);
+                if (olds == NULL)
+                    return -1;
+                break;
+            }
+        }
+    }
+
+    dirfd = open(rb->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0 || fstat(dirfd, &st) != 0)
+    {
+        WARNING("Failed to open branch \"%s\" (%s): %s\n", rb->name,
+                rb->path, strerror(errno));
+        if (dirfd >= 0)
+            close(dirfd);
+        if (num_olds > 0)
+            b->changed = 1;
+        return 0;
+    }
+
+    b->branch_mtimes[branch] = _stamp(&st, b->now);
+
+    /* No manifest was added or removed, so only stat the known ones */
+    if (old != NULL && old->mtime != 0 &&
+        old->mtime == b->branch_mtimes[branch])
+    {
+        int changed = b->changed;
+
+        mark = b->num_items;
+        for (i = 0; i < num_olds; i++)
+        {
+            const struct repoidx_disk_entry* e = &DISK_ENTRIES(idx)[olds[i]];
+            ret = _add_file(idx, b, dirfd, branch, DISK_STR(idx, e->file), e);
+            if (ret < 0)
+            {
+                close(dirfd);
+                return -1;
+            }
+            if (ret > 0)
+                break;
+        }
+
+        if (i == num_olds)
+        {
+            close(dirfd);
+            return 0;
+        }
+
+        /* A manifest vanished without the directory noticing */
+        b->num_items = mark;
+        b->changed = changed;
+    }
+
+    b->changed |= old == NULL || old->mtime != b->branch_mtimes[branch];
+    ret = _rescan_branch(idx, b, dirfd, branch, olds, num_olds);
+    close(dirfd);
+    return ret;
+}
+
+/* =============================================================================
+ * Serialisation
+ * ========================================================================== */
+
+static int _buf_append(struct repoidx_buf* buf, const void* data, size_t len)
+{
+    if (buf->len + len > buf->cap)
+    {
+        size_t new_cap = buf->cap ? buf->cap : 4096;
+        char* new_data;
+        while (new_cap < buf->len + len)
+            new_cap *= 2;
+        new_data = realloc(buf->data, new_cap);
+        if (new_data == NULL)
+            return -1;
+        buf->data = new_data;
+        buf->cap = new_cap;
+    }
+
+    if (len > 0)
+        memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+static uint32_t _buf_string(struct repoidx_buf* buf, const char* str)
+{
+    uint32_t off = (uint32_t)buf->len;
+    if (*str == '\0')
+        return 0;
+    return _buf_append(buf, str, strlen(str) + 1) == 0 ? off : 0;
+}
+
+static int _cmp_item(const void* a, const void* b)
+{
+    const struct repoidx_item* ia = a;
+    const struct repoidx_item* ib = b;
+    int cmp = strcmp(ia->name, ib->name);
+    if (cmp != 0)
+        return cmp;
+    return ia->branch < ib->branch ? -1 : ia->branch > ib->branch;
+}
+
+static int _cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Add (trigram, entry) pairs for every window of str */
+static int _grams(struct repoidx_buf* pairs, const char* str, uint32_t entry)
+{
+    size_t i, len = strlen(str);
+
+    for (i = 0; i + 3 <= len; i++)
+    {
+        uint64_t pair = (uint64_t)GRAM(str[i], str[i + 1], str[i + 2]) << 32 |
+                        entry;
+        if (_buf_append(pairs, &pair, sizeof(pair)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int _serialise(struct repoidx_build* b, struct repoidx_buf* out)
+{
+    struct repoidx_disk hdr;
+    struct repoidx_buf strings = {NULL, 0, 0};
+    struct repoidx_buf branches = {NULL, 0, 0};
+    struct repoidx_buf entries = {NULL, 0, 0};
+    struct repoidx_buf grams = {NULL, 0, 0};
+    struct repoidx_buf postings = {NULL, 0, 0};
+    struct repoidx_buf pairs = {NULL, 0, 0};
+    const uint64_t* p;
+    size_t num_pairs, i;
+    int ret = -1;
+
+    qsort(b->items, b->num_items, sizeof(*b->items), _cmp_item);
+
+    if (_buf_append(&strings, "", 1) != 0)
+        goto out;
+
+    for (i = 0; i < (size_t)g_config.num_branches; i++)
+    {
+        struct repo_branch* rb = &g_config.branches[i];
+        struct repoidx_disk_branch d;
+
+        memset(&d, 0, sizeof(d));
+        d.name = _buf_string(&strings, rb->name);
+        d.path = _buf_string(&strings, rb->path ? rb->path : "");
+        d.mtime = b->branch_mtimes[i];
+        if (_buf_append(&branches, &d, sizeof(d)) != 0)
+            goto out;
+    }
+
+    for (i = 0; i < b->num_items; i++)
+    {
+        struct repoidx_item* item = &b->items[i];
+        struct repoidx_disk_entry d;
+
+        memset(&d, 0, sizeof(d));
+        d.branch = item->branch;
+        d.file = _buf_string(&strings, item->file);
+        d.name = _buf_string(&strings, item->name);
+        d.version = _buf_string(&strings, item->version);
+        d.description = _buf_string(&strings, item->description);
+        d.depends = _buf_string(&strings, item->depends);
+        d.provides = _buf_string(&strings, item->provides);
+        d.conflicts = _buf_string(&strings, item->conflicts);
+        d.redirect = _buf_string(&strings, item->redirect);
+        d.mtime = item->mtime;
+        d.size = item->size;
+        if (_buf_append(&entries, &d, sizeof(d)) != 0)
+            goto out;
+
+        if (*item->redirect == '\0' &&
+            (_grams(&pairs, item->name, (uint32_t)i) != 0 ||
+             _grams(&pairs, item->description, (uint32_t)i) != 0))
+            goto out;
+    }
+
+    /* Sorting the pairs groups them by trigram with ascending entries */
+    num_pairs = pairs.len / sizeof(uint64_t);
+    p = (const uint64_t*)pairs.data;
+    qsort(pairs.data, num_pairs, sizeof(uint64_t), _cmp_u64);
+
+    for (i = 0; i < num_pairs; i++)
+    {
+        uint32_t entry = (uint32_t)p[i];
+        struct repoidx_disk_gram* last =
+            grams.len ? (struct repoidx_disk_gram*)(grams.data + grams.len) - 1
+                      : NULL;
+
+        if (i > 0 && p[i] == p[i - 1])
+            continue;
+
+        if (last == NULL || last->gram != (uint32_t)(p[i] >> 32))
+        {
+            struct repoidx_disk_gram g;
+            g.gram = (uint32_t)(p[i] >> 32);
+            g.first = (uint32_t)(postings.len / 4);
+            g.count = 0;
+            if (_buf_append(&grams, &g, sizeof(g)) != 0)
+                goto out;
+            last = (struct repoidx_disk_gram*)(grams.data + grams.len) - 1;
+        }
+
+        last->count++;
+        if (_buf_append(&postings, &entry, sizeof(entry)) != 0)
+            goto out;
+    }
+
+    hdr.magic = REPOIDX_MAGIC;
+    hdr.version = REPOIDX_VERSION;
+    hdr.num_branches = (uint32_t)g_config.num_branches;
+    hdr.num_entries = (uint32_t)b->num_items;
+    hdr.num_grams = (uint32_t)(grams.len / sizeof(struct repoidx_disk_gram));
+    hdr.num_postings = (uint32_t)(postings.len / 4);
+    hdr.branches_off = sizeof(hdr);
+    hdr.entries_off = hdr.branches_off + (uint32_t)branches.len;
+    hdr.grams_off = hdr.entries_off + (uint32_t)entries.len;
+    hdr.postings_off = hdr.grams_off + (uint32_t)grams.len;
+    hdr.strings_off = hdr.postings_off + (uint32_t)postings.len;
+    hdr.strings_size = (uint32_t)strings.len;
+
+    if (_buf_append(out, &hdr, sizeof(hdr)) != 0 ||
+        _buf_append(out, branches.data, branches.len) != 0 ||
+        _buf_append(out, entries.data, entries.len) != 0 ||
+        _buf_append(out, grams.data, grams.len) != 0 ||
+        _buf_append(out, postings.data, postings.len) != 0 ||
+        _buf_append(out, strings.data, strings.len) != 0)
+        goto out;
+
+    ret = 0;
+
+out:
+    free(strings.data);
+    free(branches.data);
+    free(entries.data);
+    free(grams.data);
+    free(postings.data);
+    free(pairs.data);
+    return ret;
+}
+
+/* Write the new index, or keep it in memory only if ROOT is read-only to
+ * us, so searching never needs to run as root */
+static int _save(struct repo_index* idx, struct repoidx_buf* buf)
+{
+    char* path = db_path("repo.idx");
+    char* tmp_path;
+    FILE* file;
+
+    if (idx->owned)
+        free((void*)idx->disk);
+    else if (idx->disk != NULL)
+        munmap((void*)idx->disk, idx->disk_size);
+
+    idx->disk = (const struct repoidx_disk*)buf->data;
+    idx->disk_size = buf->len;
+    idx->owned = 1;
+
+    if (fs_mkdir_p(db_path(""), 0755) != 0 || access(db_path(""), W_OK) != 0)
+    {
+        MSG("Not saving '%s': %s\n", path, strerror(errno));
+        return ACTION_RET_OK;
+    }
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return ACTION_RET_ERR_IO;
+
+    if (fwrite(buf->data, 1, buf->len, file) != buf->len)
+    {
+        ERROR("Failed to write '%s': %s\n", tmp_path, strerror(errno));
+        fclose(file);
+        unlink(tmp_path);
+        return ACTION_RET_ERR_IO;
+    }
+
+    return fs_close_atomic(file, tmp_path, path);
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int repoidx_load(struct repo_index* idx)
+{
+    struct repoidx_build b;
+    struct repoidx_buf buf = {NULL, 0, 0};
+    struct timespec ts;
+    uint32_t i;
+
+    memset(idx, 0, sizeof(*idx));
+    memset(&b, 0, sizeof(b));
+
+    if (_map(idx, db_path("repo.idx")) != 0)
+        return ACTION_RET_ERR_IO;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    b.now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    b.branch_mtimes =
+        arena_alloc(&g_arena, (g_config.num_branches + 1) * sizeof(uint64_t));
+    if (b.branch_mtimes == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < (uint32_t)g_config.num_branches; i++)
+    {
+        b.branch_mtimes[i] = 0;
+        if (g_config.branches[i].path == NULL)
+            continue;
+        if (_refresh_branch(idx, &b, i) != 0)
+        {
+            ERROR("Failed to index branch \"%s\"\n",
+                  g_config.branches[i].name);
+            repoidx_close(idx);
+            return ACTION_RET_ERR_IO;
+        }
+    }
+
+    /* Branches added, removed or reordered in the config */
+    if (!b.changed && idx->disk != NULL &&
+        idx->disk->num_branches == (uint32_t)g_config.num_branches)
+    {
+        const struct repoidx_disk_branch* branches = DISK_BRANCHES(idx);
+        for (i = 0; i < idx->disk->num_branches && !b.changed; i++)
+        {
+            const char* path = g_config.branches[i].path;
+            b.changed =
+                strcmp(DISK_STR(idx, branches[i].name),
+                       g_config.branches[i].name) != 0 ||
+                strcmp(DISK_STR(idx, branches[i].path), path ? path : "") !=
+                    0 ||
+                branches[i].mtime != b.branch_mtimes[i];
+        }
+    }
+    else
+    {
+        b.changed = 1;
+    }
+
+    if (!b.changed)
+        return ACTION_RET_OK;
+
+    MSG("Updating repository index (%lu packages)\n",
+        (unsigned long)b.num_items);
+    if (_serialise(&b, &buf) != 0)
+    {
+        ERROR("Failed to build the repository index\n");
+        free(buf.data);
+        repoidx_close(idx);
+        return ACTION_RET_ERR_UNKNOWN;
+    }
+
+    return _save(idx, &buf);
+}
+
+void repoidx_close(struct repo_index* idx)
+{
+    if (idx->owned)
+        free((void*)idx->disk);
+    else if (idx->disk != NULL)
+        munmap((void*)idx->disk, idx->disk_size);
+    memset(idx, 0, sizeof(*idx));
+}
+
+size_t repoidx_count(struct repo_index* idx)
+{
+    return idx->disk ? idx->disk->num_entries : 0;
+}
+
+int repoidx_get(struct repo_index* idx, size_t i, struct repoidx_entry* e)
+{
+    const struct repoidx_disk_entry* d;
+
+    if (i >= repoidx_count(idx))
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+
+    d = &DISK_ENTRIES(idx)[i];
+    e->branch = DISK_STR(idx, DISK_BRANCHES(idx)[d->branch].name);
+    e->file = DISK_STR(idx, d->file);
+    e->name = DISK_STR(idx, d->name);
+    e->version = DISK_STR(idx, d->version);
+    e->description = DISK_STR(idx, d->description);
+    e->depends = DISK_STR(idx, d->depends);
+    e->provides = DISK_STR(idx, d->provides);
+    e->conflicts = DISK_STR(idx, d->conflicts);
+    e->redirect = d->redirect != 0 ? DISK_STR(idx, d->redirect) : NULL;
+    return ACTION_RET_OK;
+}
+
+long repoidx_find(struct repo_index* idx, const char* name,
+                  const char* branch)
+{
+    const struct repoidx_disk_entry* entries;
+    uint32_t lo = 0, hi, i;
+    long found = -1;
+
+    if (idx->disk == NULL)
+        return -1;
+
+    entries = DISK_ENTRIES(idx);
+    hi = idx->disk->num_entries;
+
+    /* First entry with this name, the rest follow in branch order */
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strcmp(DISK_STR(idx, entries[mid].name), name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (i = lo; i < idx->disk->num_entries &&
+                 strcmp(DISK_STR(idx, entries[i].name), name) == 0;
+         i++)
+    {
+        const char* b =
+            DISK_STR(idx, DISK_BRANCHES(idx)[entries[i].branch].name);
+
+        if (entries[i].redirect != 0)
+            continue;
+        if (branch == NULL || strcmp(b, branch) == 0)
+            return (long)i;
+        if (found < 0)
+            found = (long)i;
+    }
+
+    return found;
+}
+
+int repoidx_search(struct repo_index* idx, const char* term, uint32_t** hits,
+                   size_t* num_hits)
+{
+    const struct repoidx_disk_gram* shortest = NULL;
+    const struct repoidx_disk_gram** grams;
+    const struct repoidx_disk_entry* entries;
+    size_t len = strlen(term), num_grams = 0, i, j;
+    uint32_t first, count;
+
+    *hits = NULL;
+    *num_hits = 0;
+    if (idx->disk == NULL)
+        return ACTION_RET_OK;
+
+    entries = DISK_ENTRIES(idx);
+    first = 0;
+    count = idx->disk->num_entries;
+
+    /* Every trigram of the term has to be indexed for the entry, scanning
+     * the shortest posting list and probing the others. Shorter terms fall
+     * back to checking every entry. */
+    grams = arena_alloc(&g_arena, (len + 1) * sizeof(*grams));
+    if (grams == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i + 3 <= len; i++)
+    {
+        const struct repoidx_disk_gram* g =
+            _disk_gram(idx, GRAM(term[i], term[i + 1], term[i + 2]));
+        if (g == NULL)
+            return ACTION_RET_OK;
+        if (shortest == NULL || g->count < shortest->count)
+            shortest = g;
+        grams[num_grams++] = g;
+    }
+
+    if (shortest != NULL)
+    {
+        first = shortest->first;
+        count = shortest->count;
+    }
+
+    *hits = arena_alloc(&g_arena, (count + 1) * sizeof(uint32_t));
+    if (*hits == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < count; i++)
+    {
+        uint32_t entry =
+            shortest ? DISK_POSTINGS(idx)[first + i] : (uint32_t)i;
+        const struct repoidx_disk_entry* e = &entries[entry];
+
+        if (e->redirect != 0)
+            continue;
+
+        for (j = 0; j < num_grams; j++)
+        {
+            if (grams[j] != shortest && !_postings_have(idx, grams[j], entry))
+                break;
+        }
+        if (j < num_grams)
+            continue;
+
+        /* Trigrams only prove the pieces exist, not that they're adjacent */
+        if (strcasestr(DISK_STR(idx, e->name), term) == NULL &&
+            strcasestr(DISK_STR(idx, e->description), term) == NULL)
+            continue;
+
+        (*hits)[(*num_hits)++] = entry;
+    }
+
+    return ACTION_RET_OK;
+}
@@ -8,94 +8,130 @@
  * All rights reserved.
  *****************************************************************************/
 
-#define _GNU_SOURCE /* For dprintf */
+#define _GNU_SOURCE /* For dprintf, memmem and wait4 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <log.h>
 #include <piratpkg.h>
+#include <fs.h>
 #include <string.h>
-#include <time.h>
 #include <errno.h>
-#include <dirent.h>
 #include <fcntl.h>
+#include <trace.h>
+#include <stdbool.h>
+#include <sandbox.h>
+#include <budget.h>
+
+#define TEMP_DIR_TEMPLATE "/tmp/sandbox_XXXXXX"
+
+/* Printed with $? after every command */
+#define END_MARKER "__PIRATPKG_END__"
+#define END_MARKER_LEN (sizeof(END_MARKER) - 1)
+
+/* Seconds a killed shell gets between SIGTERM and SIGKILL */
+#define KILL_GRACE 2
 
-#define TEMP_DIR_BASE "/tmp/sandbox_"
+/*
+ * Every function gets a shell of its own, so wait4() can tell what each one
+ * used. Finishing a function makes its shell write out its working directory
+ * and variables, and the next shell starts there with them. Shells run with
+ * set -a, so plain assignments are exported and carry over as well.
+ *
+ * Each shell leads a session of its own, without a controlling terminal,
+ * so whatever it leaves running can be killed with it and nothing can wait
+ * for a prompt on the terminal. A shell is killed when a command runs past
+ * the function's timeout or prints nothing for the idle timeout.
+ *
+ * Sandboxes opened in a directory of their own can be kept when they are
+ * destroyed. sandbox_save() copies the state of the last shell aside, and
+ * the next sandbox resumed in that directory starts from that copy rather
+ * than from whatever a failed function left behind.
+ */
 
 struct sandbox_ctx
 {
     char temp_dir[256];
-    pid_t pid;
+    char state[272]; /* export -p of the last shell, its cwd in state.cwd */
+    char cwd[4096];
+    char** envp;
+    pid_t pid; /* 0 until a command needs a shell */
+    struct timespec started;
+    unsigned long timeout;      /* Seconds per shell, 0 for none */
+    unsigned long idle_timeout; /* Seconds without output, 0 for none */
+    bool killed;                /* usage holds what the killed shell used */
+    struct sandbox_usage usage;
+    struct budget* budget; /* Of the package's branch, NULL for none */
+    bool keep;             /* temp_dir outlives the sandbox */
     int shell_stdin;
     int shell_stdout;
     int shell_stderr;
 };
 
+/* Unique per sandbox, several packages may be building at once */
 static int _generate_temp_dir(char* dir_name)
 {
-    time_t t = time(NULL);
-    struct tm* tm_info = localtime(&t);
+    strcpy(dir_name, TEMP_DIR_TEMPLATE);
+    return mkdtemp(dir_name) != NULL ? 0 : -1;
+}
 
-    sprintf(dir_name, "%s%04d%02d%02d%02d%02d%02d", TEMP_DIR_BASE,
-            tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
-            tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
+/* A copy of src replacing dst in one go, none when there is no src */
+static int _copy_state(const char* src, const char* dst)
+{
+    char tmp[300];
 
+    if (access(src, R_OK) != 0)
+        return errno == ENOENT ? 0 : -1;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    if (fs_copy_file(src, tmp, 0600) != 0 || rename(tmp, dst) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
     return 0;
 }
 
-struct sandbox_ctx* sandbox_create(char* const envp[])
+static double _elapsed(const struct timespec* since)
 {
-    struct sandbox_ctx* ctx = arena_alloc(&g_arena, sizeof(struct sandbox_ctx));
-    int stdin_pipe[2], stdout_pipe[2], stderr_pipe[2];
+    struct timespec now;
 
-    if (_generate_temp_dir(ctx->temp_dir) != 0)
-        return NULL;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) +
+           (now.tv_nsec - since->tv_nsec) / 1e9;
+}
 
-    mkdir(ctx->temp_dir, 0700);
-    if (pipe(stdin_pipe) != 0 || pipe(stdout_pipe) != 0 ||
-        pipe(stderr_pipe) != 0)
+static int _spawn(struct sandbox_ctx* ctx)
+{
+    int stdin_pipe[2], stdout_pipe[2], stderr_pipe[2];
+
+    trace_begin("sandbox_spawn", NULL);
+    if (pipe2(stdin_pipe, O_CLOEXEC) != 0 ||
+        pipe2(stdout_pipe, O_CLOEXEC) != 0 ||
+        pipe2(stderr_pipe, O_CLOEXEC) != 0)
     {
         perror("pipe");
-        return NULL;
+        trace_end("sandbox_spawn");
+        return -1;
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &ctx->started);
     pid_t pid = fork();
     if (pid < 0)
     {
         perror("fork");
-        return NULL;
+        trace_end("sandbox_spawn");
+        return -1;
     }
     else if (pid == 0)
     {
-        char** new_envp;
-        size_t envp_len = 0;
-        size_t i;
-
-        while (environ[envp_len] != NULL)
-        {
-            envp_len++;
-        }
-
-        new_envp = arena_alloc(&g_arena, (envp_len + 1 + 1) * sizeof(char*));
-
-        for (i = 0; i < envp_len; i++)
-        {
-            new_envp[i] = environ[i];
-        }
-
-        i = 0;
-        while (envp[i] != NULL)
-        {
-            new_envp[envp_len + i] = envp[i];
-            i++;
-        }
-
-        new_envp[envp_len + i] = NULL;
-
         dup2(stdin_pipe[0], STDIN_FILENO);
         dup2(stdout_pipe[1], STDOUT_FILENO);
         dup2(stderr_pipe[1], STDERR_FILENO);
@@ -104,13 +140,17 @@ struct sandbox_ctx* sandbox_create(char* const envp[])
         close(stdout_pipe[0]);
         close(stderr_pipe[0]);
 
-        if (chdir(ctx->temp_dir) < 0)
+        /* Its own process group, and no terminal to prompt on */
+        setsid();
+
+        if (chdir(ctx->cwd) < 0 && chdir(ctx->temp_dir) < 0)
         {
             perror("chdir");
-            return NULL;
+            _exit(1);
         }
 
-        execle("/bin/sh", "sh", NULL, new_envp);
+        budget_enter(ctx->budget);
+        execle(g_config.sandbox_shell, "sh", NULL, ctx->envp);
         perror("execle");
         _exit(1);
     }
@@ -124,54 +164,275 @@ struct sandbox_ctx* sandbox_create(char* const envp[])
     ctx->shell_stdout = stdout_pipe[0];
     ctx->shell_stderr = stderr_pipe[0];
 
-    return ctx;
+    /* Pick up where the previous function left off */
+    dprintf(ctx->shell_stdin, "set -a\n");
+    if (access(ctx->state, R_OK) == 0)
+        dprintf(ctx->shell_stdin, ". '%s'\n", ctx->state);
+
+    trace_end("sandbox_spawn");
+    return 0;
 }
 
-int _remove_directory(const char* path)
+/* Whatever the shell printed before exiting. Doesn't block, something
+ * that left the process group may still hold the pipe open. */
+static void _drain(int fd)
 {
-    DIR* d = opendir(path);
-    size_t path_len = strlen(path);
-    int r = -1;
+    char buf[256];
+    ssize_t n;
 
-    if (d)
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        fwrite(buf, 1, n, stdout);
+}
+
+/* Wait for the shell and account for it */
+static int _reap(struct sandbox_ctx* ctx, struct sandbox_usage* usage)
+{
+    struct rusage ru;
+    int status;
+
+    if (wait4(ctx->pid, &status, 0, &ru) < 0)
     {
-        struct dirent* p;
-        r = 0;
+        perror("wait4");
+        ctx->pid = 0;
+        return -1;
+    }
 
-        while (!r && (p = readdir(d)))
-        {
-            int r2 = -1;
-            char* buf;
-            size_t len;
+    /* Whatever it left running in the background goes with it */
+    kill(-ctx->pid, SIGKILL);
+    budget_kill(ctx->budget);
+    ctx->pid = 0;
+
+    usage->wall = _elapsed(&ctx->started);
+    usage->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    usage->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    usage->max_rss = ru.ru_maxrss;
+    usage->in_blocks = ru.ru_inblock;
+    usage->out_blocks = ru.ru_oublock;
+    return 0;
+}
 
-            if (!strcmp(p->d_name, ".") || !strcmp(p->d_name, ".."))
-                continue;
+static void _close_pipes(struct sandbox_ctx* ctx)
+{
+    if (ctx->shell_stdin != -1)
+        close(ctx->shell_stdin);
+    _drain(ctx->shell_stdout);
+    _drain(ctx->shell_stderr);
+    close(ctx->shell_stdout);
+    close(ctx->shell_stderr);
+    ctx->shell_stdin = ctx->shell_stdout = ctx->shell_stderr = -1;
+}
 
-            len = path_len + strlen(p->d_name) + 2;
-            buf = arena_alloc(&g_arena, len);
+/* Kill the shell's whole process group, politely first */
+static void _kill(struct sandbox_ctx* ctx)
+{
+    siginfo_t info;
+    int waited;
 
-            if (buf)
-            {
-                struct stat statbuf;
-                sprintf(buf, "%s/%s", path, p->d_name);
-                if (!stat(buf, &statbuf))
-                {
-                    if (S_ISDIR(statbuf.st_mode))
-                        r2 = _remove_directory(buf);
-                    else
-                        r2 = unlink(buf);
-                }
-            }
+    close(ctx->shell_stdin);
+    ctx->shell_stdin = -1;
+    kill(-ctx->pid, SIGTERM);
+    for (waited = 0; waited < KILL_GRACE * 20; waited++)
+    {
+        /* Leaves it to be reaped with its usage */
+        info.si_pid = 0;
+        if (waitid(P_PID, ctx->pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 ||
+            info.si_pid != 0)
+            break;
+        usleep(50000);
+    }
+    kill(-ctx->pid, SIGKILL);
+
+    memset(&ctx->usage, 0, sizeof(ctx->usage));
+    ctx->killed = _reap(ctx, &ctx->usage) == 0;
+    _close_pipes(ctx);
+}
 
-            r = r2;
+static void _read_cwd(struct sandbox_ctx* ctx)
+{
+    char path[288];
+    FILE* file;
+
+    snprintf(path, sizeof(path), "%s.cwd", ctx->state);
+    file = fopen(path, "r");
+    if (file == NULL)
+        return;
+    if (fgets(ctx->cwd, sizeof(ctx->cwd), file) != NULL)
+        ctx->cwd[strcspn(ctx->cwd, "\n")] = '\0';
+    fclose(file);
+}
+
+static struct sandbox_ctx* _sandbox_create(const char* dir, bool resume,
+                                           char* const envp[],
+                                           const struct repo_branch* branch)
+{
+    struct sandbox_ctx* ctx = arena_alloc(&g_arena, sizeof(struct sandbox_ctx));
+    char saved[288], path[288];
+    char** new_envp;
+    size_t envp_len = 0;
+    size_t num_envp = 0;
+    size_t i;
+
+    if (ctx == NULL)
+        return NULL;
+    memset(ctx, 0, sizeof(*ctx));
+    if (dir == NULL)
+    {
+        if (_generate_temp_dir(ctx->temp_dir) != 0)
+            return NULL;
+    }
+    else
+    {
+        if (strlen(dir) >= sizeof(ctx->temp_dir))
+            return NULL;
+        if (!resume)
+            sandbox_clear(dir);
+        if (fs_mkdir_p(dir, 0755) != 0)
+        {
+            ERROR("Failed to create '%s': %s\n", dir, strerror(errno));
+            return NULL;
         }
-        closedir(d);
+        strcpy(ctx->temp_dir, dir);
+    }
+    sprintf(ctx->state, "%s.state", ctx->temp_dir);
+    strcpy(ctx->cwd, ctx->temp_dir);
+    ctx->shell_stdin = ctx->shell_stdout = ctx->shell_stderr = -1;
+
+    /* Not what the function that failed left, but what the last one to
+     * succeed did */
+    if (dir != NULL && resume)
+    {
+        snprintf(saved, sizeof(saved), "%s.saved", dir);
+        snprintf(path, sizeof(path), "%s.cwd", ctx->state);
+        unlink(ctx->state);
+        unlink(path);
+        if (_copy_state(saved, ctx->state) != 0)
+            return NULL;
+        snprintf(saved, sizeof(saved), "%s.saved.cwd", dir);
+        if (_copy_state(saved, path) != 0)
+            return NULL;
+        _read_cwd(ctx);
+    }
+
+    /* Built before fork(), the child of a threaded process should only
+     * exec */
+    while (environ[envp_len] != NULL)
+    {
+        envp_len++;
+    }
+    while (envp[num_envp] != NULL)
+    {
+        num_envp++;
     }
 
-    if (!r)
-        r = rmdir(path);
+    new_envp = arena_alloc(&g_arena, (envp_len + num_envp + 1) * sizeof(char*));
+    if (new_envp == NULL)
+        return NULL;
+
+    for (i = 0; i < envp_len; i++)
+    {
+        new_envp[i] = environ[i];
+    }
+
+    for (i = 0; i < num_envp; i++)
+    {
+        new_envp[envp_len + i] = envp[i];
+    }
+
+    new_envp[envp_len + num_envp] = NULL;
+    ctx->envp = new_envp;
+    ctx->budget = budget_create(branch);
+
+    return ctx;
+}
+
+struct sandbox_ctx* sandbox_create(char* const envp[],
+                                   const struct repo_branch* branch)
+{
+    struct sandbox_ctx* ctx;
+
+    trace_begin("sandbox_create", NULL);
+    ctx = _sandbox_create(NULL, false, envp, branch);
+    trace_end("sandbox_create");
+    return ctx;
+}
+
+struct sandbox_ctx* sandbox_open(const char* dir, bool resume,
+                                 char* const envp[],
+                                 const struct repo_branch* branch)
+{
+    struct sandbox_ctx* ctx;
+
+    trace_begin("sandbox_create", dir);
+    ctx = _sandbox_create(dir, resume, envp, branch);
+    trace_end("sandbox_create");
+    return ctx;
+}
+
+int sandbox_save(struct sandbox_ctx* ctx)
+{
+    char saved[288], path[288];
+
+    snprintf(saved, sizeof(saved), "%s.saved", ctx->temp_dir);
+    if (_copy_state(ctx->state, saved) != 0)
+        return -1;
+    snprintf(saved, sizeof(saved), "%s.saved.cwd", ctx->temp_dir);
+    snprintf(path, sizeof(path), "%s.cwd", ctx->state);
+    return _copy_state(path, saved);
+}
+
+void sandbox_keep(struct sandbox_ctx* ctx)
+{
+    ctx->keep = true;
+}
+
+void sandbox_clear(const char* dir)
+{
+    static const char* suffixes[] = {".state", ".state.cwd", ".saved",
+                                     ".saved.cwd"};
+    char path[300];
+    size_t i;
+
+    fs_remove_tree(dir);
+    for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", dir, suffixes[i]);
+        unlink(path);
+    }
+}
 
-    return r;
+void sandbox_timeout(struct sandbox_ctx* ctx, unsigned long timeout,
+                     unsigned long idle_timeout)
+{
+    ctx->timeout = timeout;
+    ctx->idle_timeout = idle_timeout;
+}
+
+int sandbox_finish(struct sandbox_ctx* ctx, struct sandbox_usage* usage)
+{
+    memset(usage, 0, sizeof(*usage));
+    if (ctx != NULL && ctx->killed)
+    {
+        *usage = ctx->usage;
+        ctx->killed = false;
+        return 0;
+    }
+    if (ctx == NULL || ctx->pid == 0)
+        return 0;
+
+    dprintf(ctx->shell_stdin, "export -p > '%s'\npwd > '%s.cwd'\nexit\n",
+            ctx->state, ctx->state);
+    close(ctx->shell_stdin);
+    ctx->shell_stdin = -1;
+
+    if (_reap(ctx, usage) != 0)
+    {
+        _close_pipes(ctx);
+        return -1;
+    }
+    _close_pipes(ctx);
+    _read_cwd(ctx);
+    return 0;
 }
 
 void sandbox_destroy(struct sandbox_ctx* ctx)
@@ -179,82 +440,180 @@ void sandbox_destroy(struct sandbox_ctx* ctx)
     if (ctx != NULL)
     {
         MSG("Destroying sandbox\n");
-        close(ctx->shell_stdin);
-        close(ctx->shell_stdout);
-        close(ctx->shell_stderr);
-        kill(ctx->pid, SIGTERM);
-        waitpid(ctx->pid, NULL, 0);
-        _remove_directory(ctx->temp_dir);
+        trace_begin("sandbox_destroy", ctx->temp_dir);
+        if (ctx->pid != 0)
+            _kill(ctx);
+        budget_destroy(ctx->budget);
+        if (ctx->keep)
+            MSG("Keeping %s for the next attempt\n", ctx->temp_dir);
+        else
+            sandbox_clear(ctx->temp_dir);
+        trace_end("sandbox_destroy");
+    }
+}
+
+const char* sandbox_dir(struct sandbox_ctx* ctx)
+{
+    return ctx->temp_dir;
+}
+
+/* Seconds until the shell has to be killed, false if it never has to */
+static bool _time_left(struct sandbox_ctx* ctx, double last_output,
+                       double* left)
+{
+    double now = _elapsed(&ctx->started);
+    bool limited = false;
+
+    *left = 0;
+    if (ctx->timeout > 0)
+    {
+        *left = ctx->timeout - now;
+        limited = true;
+    }
+    if (ctx->idle_timeout > 0 &&
+        (!limited || ctx->idle_timeout - (now - last_output) < *left))
+    {
+        *left = ctx->idle_timeout - (now - last_output);
+        limited = true;
     }
+    return limited;
+}
+
+/*
+ * Print what came before the end marker and take the exit status after
+ * it. The marker can arrive split over reads, so a tail that could be the
+ * start of one is kept back. Returns the status once the marker's line is
+ * complete, -1 before.
+ */
+static int _scan_output(char* buf, size_t* len, bool silent)
+{
+    char* marker = memmem(buf, *len, END_MARKER, END_MARKER_LEN);
+    size_t keep;
+
+    if (marker != NULL)
+    {
+        char* eol = memchr(marker, '\n', *len - (marker - buf));
+
+        if (!silent)
+            fwrite(buf, 1, marker - buf, stdout);
+        memmove(buf, marker, *len - (marker - buf));
+        *len -= marker - buf;
+        if (eol == NULL)
+            return -1;
+        return atoi(buf + END_MARKER_LEN);
+    }
+
+    keep = *len < END_MARKER_LEN - 1 ? *len : END_MARKER_LEN - 1;
+    while (keep > 0 && memcmp(buf + *len - keep, END_MARKER, keep) != 0)
+        keep--;
+    if (!silent)
+        fwrite(buf, 1, *len - keep, stdout);
+    memmove(buf, buf + *len - keep, keep);
+    *len = keep;
+    return -1;
 }
 
 int sandbox_exec(struct sandbox_ctx* ctx, const char* command, bool silent)
 {
+    char stdout_buf[4096];
+    char stderr_buf[256];
+    size_t stdout_len = 0;
+    double last_output;
+    bool stderr_open = true; /* Until the shell closes it, exec 2>&- say */
+    int exit_code = -1;
+
+    if (ctx != NULL && ctx->pid == 0 && _spawn(ctx) != 0)
+        return SANDBOX_ERR;
+
     if (!ctx || ctx->shell_stdin == -1 || ctx->shell_stdout == -1 ||
         ctx->shell_stderr == -1)
     {
         ERROR("Invalid sandbox context\n");
-        return 1;
+        return SANDBOX_ERR;
     }
 
     dprintf(ctx->shell_stdin, "%s\n", command);
-    dprintf(ctx->shell_stdin, "echo __END__\n");
-
-    char stdout_buf[256];
-    char stderr_buf[256];
-    int stdout_done = 0;
-    int exit_code = 0;
+    dprintf(ctx->shell_stdin, "echo " END_MARKER " $?\n");
+    last_output = _elapsed(&ctx->started);
 
-    while (!stdout_done)
+    while (exit_code < 0)
     {
+        struct timeval tv;
+        double left;
+        bool limited = _time_left(ctx, last_output, &left);
         fd_set fds;
+        int maxfd, ready;
+        ssize_t n;
+
         FD_ZERO(&fds);
         FD_SET(ctx->shell_stdout, &fds);
-        FD_SET(ctx->shell_stderr, &fds);
+        maxfd = ctx->shell_stdout;
+        if (stderr_open)
+        {
+            FD_SET(ctx->shell_stderr, &fds);
+            if (ctx->shell_stderr > maxfd)
+                maxfd = ctx->shell_stderr;
+        }
 
-        int maxfd = ctx->shell_stdout > ctx->shell_stderr ? ctx->shell_stdout
-                                                          : ctx->shell_stderr;
+        if (limited && left <= 0)
+        {
+            if (ctx->timeout > 0 && _elapsed(&ctx->started) >= ctx->timeout)
+                ERROR("Timed out after %lus, killing: %s\n", ctx->timeout,
+                      command);
+            else
+                ERROR("No output for %lus, killing: %s\n",
+                      ctx->idle_timeout, command);
+            _kill(ctx);
+            return SANDBOX_ERR_TIMEOUT;
+        }
 
-        if (select(maxfd + 1, &fds, NULL, NULL, NULL) < 0)
+        if (limited)
+        {
+            tv.tv_sec = (time_t)left;
+            tv.tv_usec = (long)((left - tv.tv_sec) * 1e6);
+        }
+        ready = select(maxfd + 1, &fds, NULL, NULL, limited ? &tv : NULL);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0)
         {
             perror("select");
-            return 1;
+            return SANDBOX_ERR;
         }
 
         if (FD_ISSET(ctx->shell_stdout, &fds))
         {
-            ssize_t n =
-                read(ctx->shell_stdout, stdout_buf, sizeof(stdout_buf) - 1);
+            n = read(ctx->shell_stdout, stdout_buf + stdout_len,
+                     sizeof(stdout_buf) - stdout_len);
             if (n <= 0)
             {
-                stdout_done = 1;
-            }
-            else
-            {
-                stdout_buf[n] = '\0';
-                char* marker = strstr(stdout_buf, "__END__");
-                if (marker)
-                {
-                    *marker = '\0';
-                    stdout_done = 1;
-                }
-
-                if (!silent)
-                    printf("%s", stdout_buf);
+                /* The command ended the shell, "exit 1" say */
+                ERROR("Shell exited running: %s\n", command);
+                _kill(ctx);
+                return SANDBOX_ERR;
             }
+            stdout_len += n;
+            last_output = _elapsed(&ctx->started);
+            exit_code = _scan_output(stdout_buf, &stdout_len, silent);
         }
 
-        if (FD_ISSET(ctx->shell_stderr, &fds))
+        if (stderr_open && FD_ISSET(ctx->shell_stderr, &fds))
         {
-            ssize_t n =
-                read(ctx->shell_stderr, stderr_buf, sizeof(stderr_buf) - 1);
+            n = read(ctx->shell_stderr, stderr_buf, sizeof(stderr_buf) - 1);
             if (n > 0)
             {
                 stderr_buf[n] = '\0';
                 printf("%s", stderr_buf);
+                last_output = _elapsed(&ctx->started);
             }
+            else if (n == 0 || errno != EINTR)
+                /* Readable forever at EOF, selecting it would spin */
+                stderr_open = false;
         }
     }
+    fflush(stdout);
 
+    if (exit_code != 0)
+        ERROR("Exited with status %d: %s\n", exit_code, command);
     return exit_code;
 }
@@ -0,0 +1,1365 @@
+/******************************************************************************
+ * solver.c - Dependency resolution
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <piratpkg.h>
+#include <solver.h>
+#include <repoidx.h>
+#include <version.h>
+#include <pkg.h>
+#include <db.h>
+#include <strings.h>
+#include <log.h>
+
+/* Results of a search */
+#define SOLVER_OK 0
+#define SOLVER_FAIL 1  /* No way to complete the current choices */
+#define SOLVER_ABORT 2 /* Out of steps or memory */
+
+/* Why the deepest dead end failed */
+#define REASON_MISSING 1  /* Nothing can satisfy a requirement */
+#define REASON_MISMATCH 2 /* Another version of the name was picked */
+#define REASON_CONFLICT 3 /* PACKAGE_CONFLICTS in one direction or other */
+
+/* Ancestors shown when explaining a requirement */
+#define SOLVER_CHAIN 8
+
+/* REDIRECT hops followed for a request */
+#define SOLVER_MAX_REDIRECTS 8
+
+/* End of a list of agenda indices */
+#define SOLVER_NONE ((size_t)-1)
+
+struct solver_cand
+{
+    const char* name;
+    const char* version;
+    const char* branch;
+    const char* file; /* Manifest, NULL for the installed version */
+    struct dep* deps;
+    size_t num_deps;
+    struct dep* provides;
+    size_t num_provides;
+    struct dep* conflicts;
+    size_t num_conflicts;
+    int installed;
+    uint64_t key;  /* Random bits, XORed together to hash a choice set */
+    size_t plan;   /* Index in the plan once ordered */
+    int visiting;  /* Ordering state, 1 while on the stack and 2 when done */
+};
+
+struct solver_list
+{
+    struct solver_cand** items;
+    size_t num;
+    size_t cap;
+};
+
+struct solver_name
+{
+    const char* name;
+    int loaded;
+    struct solver_cand* installed;
+    struct solver_list cands;      /* Manifests of this name, newest first */
+    struct solver_list providers;  /* PROVIDES it */
+    struct solver_list conflicted; /* Has it in PACKAGE_CONFLICTS */
+    struct solver_list dependents; /* Installed and depending on it */
+    struct solver_cand* chosen;
+    size_t chosen_for; /* Agenda index of the requirement it was picked for */
+    size_t chosen_at;  /* Depth of that decision */
+    size_t last_req;   /* Newest agenda entry on this name, or SOLVER_NONE */
+};
+
+struct solver_req
+{
+    struct dep dep;
+    struct solver_cand* from; /* NULL for requests */
+    const char* branch;       /* Requests can be pinned to a branch */
+    struct solver_name* slot; /* Of dep.name */
+    size_t prev;              /* Previous agenda entry on the same name */
+    size_t level;             /* Depth of the pick that added it, or
+                                 SOLVER_NONE for requests */
+};
+
+/* State of one decision in the search */
+struct solver_frame
+{
+    struct solver_list cands;
+    uint64_t* blame; /* Depths the decisions failing here depend on */
+};
+
+struct solver_reason
+{
+    int kind;
+    struct dep dep;
+    struct solver_cand* chain[SOLVER_CHAIN]; /* Who needed dep, innermost
+                                                first */
+    size_t chain_len;
+    struct solver_cand* cand;  /* Candidate that was rejected */
+    struct solver_cand* other; /* What it clashed with */
+    struct solver_cand* other_for;
+    struct dep other_dep;
+};
+
+struct solver
+{
+    struct repo_index idx;
+    struct db db;
+
+    struct solver_name** names; /* Open addressing on the name */
+    size_t names_cap;
+    size_t num_names;
+    struct solver_cand** by_entry; /* Candidate of each index entry */
+
+    struct solver_req* agenda; /* Requirements, in the order they arose */
+    size_t num_agenda;
+    size_t cap_agenda;
+    struct solver_frame** frames; /* One per depth */
+    size_t num_frames;
+
+    uint64_t state;   /* XOR of the chosen candidates' keys */
+    uint64_t* failed; /* Memoized dead ends, 0 marks a free slot */
+    size_t failed_cap;
+    size_t num_failed;
+    unsigned long steps;
+
+    struct solver_reason reason;
+    size_t reason_depth;
+};
+
+/* =============================================================================
+ * Helpers
+ * ========================================================================== */
+
+static uint64_t _hash(const char* str, uint64_t h)
+{
+    while (*str != '\0')
+    {
+        h ^= (unsigned char)*str++;
+        h *= 0x100000001b3ull;
+    }
+    h ^= 0xff;
+    return h * 0x100000001b3ull;
+}
+
+/* splitmix64's finaliser, so similar names still get unrelated keys */
+static uint64_t _mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+static int _list_add(struct solver_list* list, struct solver_cand* c)
+{
+    if (list->num == list->cap)
+    {
+        size_t new_cap = list->cap ? list->cap * 2 : 4;
+        struct solver_cand** items =
+            arena_alloc(&g_arena, new_cap * sizeof(*items));
+        if (items == NULL)
+            return -1;
+        if (list->num > 0)
+            memcpy(items, list->items, list->num * sizeof(*items));
+        list->items = items;
+        list->cap = new_cap;
+    }
+
+    list->items[list->num++] = c;
+    return 0;
+}
+
+static struct solver_name* _lookup(struct solver* s, const char* name,
+                                   int create)
+{
+    size_t i;
+
+    if (s->num_names * 2 >= s->names_cap)
+    {
+        size_t new_cap = s->names_cap ? s->names_cap * 2 : 1024;
+        struct solver_name** names =
+            arena_alloc(&g_arena, new_cap * sizeof(*names));
+        if (names == NULL)
+            return NULL;
+        memset(names, 0, new_cap * sizeof(*names));
+
+        for (i = 0; i < s->names_cap; i++)
+        {
+            size_t j;
+            if (s->names[i] == NULL)
+                continue;
+            j = _hash(s->names[i]->name, 0xcbf29ce484222325ull) &
+                (new_cap - 1);
+            while (names[j] != NULL)
+                j = (j + 1) & (new_cap - 1);
+            names[j] = s->names[i];
+        }
+        s->names = names;
+        s->names_cap = new_cap;
+    }
+
+    i = _hash(name, 0xcbf29ce484222325ull) & (s->names_cap - 1);
+    while (s->names[i] != NULL)
+    {
+        if (strcmp(s->names[i]->name, name) == 0)
+            return s->names[i];
+        i = (i + 1) & (s->names_cap - 1);
+    }
+
+    if (!create)
+        return NULL;
+
+    s->names[i] = arena_alloc(&g_arena, sizeof(struct solver_name));
+    if (s->names[i] == NULL)
+        return NULL;
+    memset(s->names[i], 0, sizeof(struct solver_name));
+    s->names[i]->name = name;
+    s->names[i]->last_req = SOLVER_NONE;
+    s->num_names++;
+    return s->names[i];
+}
+
+static int _provide_match(const struct dep* provide, const struct dep* dep)
+{
+    if (strcmp(provide->name, dep->name) != 0)
+        return 0;
+    if (dep->op == DEP_ANY)
+        return 1;
+
+    /* Unversioned provides only satisfy unversioned requirements */
+    return provide->version != NULL && dep_match(dep, provide->version);
+}
+
+static struct solver_cand* _current(struct solver* s, const char* name)
+{
+    struct solver_name* slot = _lookup(s, name, 0);
+    if (slot == NULL)
+        return NULL;
+    return slot->chosen != NULL ? slot->chosen : slot->installed;
+}
+
+static int _chosen(struct solver* s, struct solver_cand* c)
+{
+    struct solver_name* slot = _lookup(s, c->name, 0);
+    return slot != NULL && slot->chosen == c;
+}
+
+/* Depth c was picked at, SOLVER_NONE if it's just installed */
+static size_t _level(struct solver* s, struct solver_cand* c)
+{
+    struct solver_name* slot = _lookup(s, c->name, 0);
+    return slot != NULL && slot->chosen == c ? slot->chosen_at : SOLVER_NONE;
+}
+
+/* =============================================================================
+ * Universe
+ * ========================================================================== */
+
+static struct solver_cand* _new_cand(const char* name, const char* version,
+                                     const char* branch, const char* depends,
+                                     const char* provides,
+                                     const char* conflicts)
+{
+    struct solver_cand* c = arena_alloc(&g_arena, sizeof(*c));
+
+    if (c == NULL)
+        return NULL;
+    memset(c, 0, sizeof(*c));
+
+    c->name = name;
+    c->version = version;
+    c->branch = branch != NULL ? branch : "";
+    if (dep_parse_list(depends, &c->deps, &c->num_deps) != 0 ||
+        dep_parse_list(provides, &c->provides, &c->num_provides) != 0 ||
+        dep_parse_list(conflicts, &c->conflicts, &c->num_conflicts) != 0)
+    {
+        WARNING("Ignoring malformed dependencies of %s-%s\n", name, version);
+        c->num_deps = c->num_provides = c->num_conflicts = 0;
+    }
+    return c;
+}
+
+/* Register c's PROVIDES, CONFLICTS and, if installed, its dependencies */
+static int _index_cand(struct solver* s, struct solver_cand* c)
+{
+    struct solver_name* slot;
+    size_t i;
+
+    c->key = _hash(c->name, 0x9e3779b97f4a7c15ull);
+    c->key = _hash(c->version, c->key);
+    c->key = _mix(_hash(c->branch, c->key) + (uint64_t)c->installed);
+
+    for (i = 0; i < c->num_provides; i++)
+    {
+        slot = _lookup(s, c->provides[i].name, 1);
+        if (slot == NULL || _list_add(&slot->providers, c) != 0)
+            return -1;
+    }
+
+    for (i = 0; i < c->num_conflicts; i++)
+    {
+        slot = _lookup(s, c->conflicts[i].name, 1);
+        if (slot == NULL || _list_add(&slot->conflicted, c) != 0)
+            return -1;
+    }
+
+    for (i = 0; c->installed && i < c->num_deps; i++)
+    {
+        slot = _lookup(s, c->deps[i].name, 1);
+        if (slot == NULL || _list_add(&slot->dependents, c) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Candidate of index entry i, the installed one if it's the same version */
+static struct solver_cand* _entry_cand(struct solver* s, size_t i)
+{
+    struct repoidx_entry e;
+    struct solver_name* slot;
+    struct solver_cand* c;
+
+    if (s->by_entry[i] != NULL)
+        return s->by_entry[i];
+
+    if (repoidx_get(&s->idx, i, &e) != ACTION_RET_OK || e.redirect != NULL)
+        return NULL;
+
+    slot = _lookup(s, e.name, 1);
+    if (slot == NULL)
+        return NULL;
+    if (slot->installed != NULL &&
+        vercmp(slot->installed->version, e.version) == 0)
+        return s->by_entry[i] = slot->installed;
+
+    c = _new_cand(e.name, e.version, e.branch, e.depends, e.provides,
+                  e.conflicts);
+    if (c == NULL)
+        return NULL;
+    c->file = e.file;
+    if (_index_cand(s, c) != 0)
+        return NULL;
+    return s->by_entry[i] = c;
+}
+
+/* Every manifest called slot->name, newest first and in branch order */
+static int _load(struct solver* s, struct solver_name* slot)
+{
+    size_t n = repoidx_count(&s->idx), i, j;
+    long first;
+
+    if (slot->loaded)
+        return 0;
+    slot->loaded = 1;
+
+    first = repoidx_find(&s->idx, slot->name, NULL);
+    for (i = first < 0 ? n : (size_t)first; i < n; i++)
+    {
+        struct repoidx_entry e;
+        struct solver_cand* c;
+
+        repoidx_get(&s->idx, i, &e);
+        if (strcmp(e.name, slot->name) != 0)
+            break;
+        if (e.redirect != NULL)
+            continue;
+
+        c = _entry_cand(s, i);
+        if (c == NULL)
+            return -1;
+        if (c->installed)
+            continue;
+
+        if (_list_add(&slot->cands, c) != 0)
+            return -1;
+        for (j = slot->cands.num - 1;
+             j > 0 && vercmp(slot->cands.items[j - 1]->version, c->version) < 0;
+             j--)
+            slot->cands.items[j] = slot->cands.items[j - 1];
+        slot->cands.items[j] = c;
+    }
+    return 0;
+}
+
+static int _init(struct solver* s)
+{
+    size_t i, n;
+    int ret;
+
+    memset(s, 0, sizeof(*s));
+
+    if (db_load(&s->db) != ACTION_RET_OK)
+    {
+        ERROR("Failed to read the installed package list.\n");
+        return ACTION_RET_ERR_IO;
+    }
+    if ((ret = repoidx_load(&s->idx)) != ACTION_RET_OK)
+        return ret;
+
+    n = repoidx_count(&s->idx);
+    s->by_entry = arena_alloc(&g_arena, (n + 1) * sizeof(*s->by_entry));
+    if (s->by_entry == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    memset(s->by_entry, 0, (n + 1) * sizeof(*s->by_entry));
+
+    for (i = 0; i < s->db.num_entries; i++)
+    {
+        struct db_entry* e = &s->db.entries[i];
+        struct solver_name* slot = _lookup(s, e->name, 1);
+        struct pkg_ctx meta;
+
+        memset(&meta, 0, sizeof(meta));
+        db_read_meta(e->name, &meta);
+
+        if (slot == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        slot->installed = _new_cand(e->name, e->version, e->branch,
+                                    meta.depends, meta.provides,
+                                    meta.conflicts);
+        if (slot->installed == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        slot->installed->installed = 1;
+        if (_index_cand(s, slot->installed) != 0)
+            return ACTION_RET_ERR_UNKNOWN;
+    }
+
+    /* Providers and conflicts have to be known before any lookup */
+    for (i = 0; i < n; i++)
+    {
+        struct repoidx_entry e;
+
+        repoidx_get(&s->idx, i, &e);
+        if (e.redirect == NULL && (*e.provides != '\0' || *e.conflicts != '\0'))
+        {
+            if (_entry_cand(s, i) == NULL)
+                return ACTION_RET_ERR_UNKNOWN;
+        }
+    }
+
+    return ACTION_RET_OK;
+}
+
+/* =============================================================================
+ * Search
+ * ========================================================================== */
+
+static int _push(struct solver* s, const struct dep* dep,
+                 struct solver_cand* from, const char* branch, size_t level)
+{
+    struct solver_name* slot = _lookup(s, dep->name, 1);
+
+    if (slot == NULL)
+        return -1;
+
+    if (s->num_agenda == s->cap_agenda)
+    {
+        size_t new_cap = s->cap_agenda ? s->cap_agenda * 2 : 256;
+        struct solver_req* agenda =
+            arena_alloc(&g_arena, new_cap * sizeof(*agenda));
+        if (agenda == NULL)
+            return -1;
+        if (s->num_agenda > 0)
+            memcpy(agenda, s->agenda, s->num_agenda * sizeof(*agenda));
+        s->agenda = agenda;
+        s->cap_agenda = new_cap;
+    }
+
+    s->agenda[s->num_agenda].dep = *dep;
+    s->agenda[s->num_agenda].from = from;
+    s->agenda[s->num_agenda].branch = branch;
+    s->agenda[s->num_agenda].slot = slot;
+    s->agenda[s->num_agenda].level = level;
+    s->agenda[s->num_agenda].prev = slot->last_req;
+    slot->last_req = s->num_agenda++;
+    return 0;
+}
+
+/* Forget the requirements from mark on */
+static void _truncate(struct solver* s, size_t mark)
+{
+    while (s->num_agenda > mark)
+    {
+        struct solver_req* r = &s->agenda[--s->num_agenda];
+        r->slot->last_req = r->prev;
+    }
+}
+
+static int _is_failed(struct solver* s, uint64_t state)
+{
+    size_t i;
+
+    if (s->failed_cap == 0)
+        return 0;
+
+    state = state ? state : 1;
+    for (i = state & (s->failed_cap - 1); s->failed[i] != 0;
+         i = (i + 1) & (s->failed_cap - 1))
+    {
+        if (s->failed[i] == state)
+            return 1;
+    }
+    return 0;
+}
+
+static void _set_failed(struct solver* s, uint64_t state)
+{
+    size_t i;
+
+    if (s->num_failed * 2 >= s->failed_cap)
+    {
+        size_t new_cap = s->failed_cap ? s->failed_cap * 2 : 4096;
+        uint64_t* failed = calloc(new_cap, sizeof(*failed));
+        if (failed == NULL)
+            return;
+        for (i = 0; i < s->failed_cap; i++)
+        {
+            size_t j;
+            if (s->failed[i] == 0)
+                continue;
+            for (j = s->failed[i] & (new_cap - 1); failed[j] != 0;
+                 j = (j + 1) & (new_cap - 1))
+                ;
+            failed[j] = s->failed[i];
+        }
+        free(s->failed);
+        s->failed = failed;
+        s->failed_cap = new_cap;
+    }
+
+    state = state ? state : 1;
+    for (i = state & (s->failed_cap - 1); s->failed[i] != 0;
+         i = (i + 1) & (s->failed_cap - 1))
+        ;
+    s->failed[i] = state;
+    s->num_failed++;
+}
+
+/* Keep the dead end found deepest into the search, it says the most */
+static struct solver_reason* _keep(struct solver* s, int kind, size_t depth)
+{
+    if (s->reason.kind != 0 && depth < s->reason_depth)
+        return NULL;
+
+    memset(&s->reason, 0, sizeof(s->reason));
+    s->reason.kind = kind;
+    s->reason_depth = depth;
+    return &s->reason;
+}
+
+/* Who needed what, back to a request. The rejected candidate itself was
+ * wanted by the requirement at pos. */
+static void _chain(struct solver* s, struct solver_reason* r,
+                   struct solver_cand* from, size_t pos)
+{
+    while (from != NULL && r->chain_len < SOLVER_CHAIN)
+    {
+        struct solver_name* slot = _lookup(s, from->name, 0);
+
+        r->chain[r->chain_len++] = from;
+        if (slot->chosen == from)
+            from = s->agenda[slot->chosen_for].from;
+        else if (from == r->cand)
+            from = s->agenda[pos].from;
+        else
+            break;
+    }
+}
+
+static void _reason(struct solver* s, int kind, size_t pos, size_t depth,
+                    struct solver_cand* cand, struct solver_cand* other)
+{
+    struct solver_reason* r = _keep(s, kind, depth);
+
+    if (r == NULL)
+        return;
+
+    r->dep = s->agenda[pos].dep;
+    r->cand = cand;
+    r->other = other;
+    _chain(s, r, s->agenda[pos].from, pos);
+
+    if (kind == REASON_MISMATCH)
+    {
+        struct solver_name* slot = _lookup(s, other->name, 0);
+        r->other_dep = s->agenda[slot->chosen_for].dep;
+        r->other_for = s->agenda[slot->chosen_for].from;
+    }
+}
+
+/* Two requirements on one name that cand can't both meet */
+static void _reason_needs(struct solver* s, size_t pos, size_t depth,
+                          struct solver_cand* cand, const struct dep* dep,
+                          struct solver_cand* from,
+                          const struct solver_req* other)
+{
+    struct solver_reason* r = _keep(s, REASON_MISMATCH, depth);
+
+    if (r == NULL)
+        return;
+
+    r->dep = *dep;
+    r->cand = cand;
+    r->other_dep = other->dep;
+    r->other_for = other->from;
+    _chain(s, r, from, pos);
+}
+
+static int _satisfied(struct solver* s, struct solver_req* r)
+{
+    struct solver_name* slot = r->slot;
+    size_t i;
+
+    if (slot->chosen != NULL && dep_match(&r->dep, slot->chosen->version) &&
+        (r->branch == NULL || strcmp(slot->chosen->branch, r->branch) == 0))
+        return 1;
+
+    for (i = 0; r->branch == NULL && i < slot->providers.num; i++)
+    {
+        struct solver_cand* p = slot->providers.items[i];
+        size_t j;
+
+        if (!_chosen(s, p))
+            continue;
+        for (j = 0; j < p->num_provides; j++)
+            if (_provide_match(&p->provides[j], &r->dep))
+                return 1;
+    }
+    return 0;
+}
+
+static int _provides(struct solver_cand* c, const struct dep* dep)
+{
+    size_t i;
+    for (i = 0; i < c->num_provides; i++)
+        if (_provide_match(&c->provides[i], dep))
+            return 1;
+    return 0;
+}
+
+/* What could satisfy r, in the order worth trying. Dependencies keep the
+ * installed version if they can, requests want the newest. */
+static int _candidates(struct solver* s, size_t pos, struct solver_list* out)
+{
+    struct solver_req* r = &s->agenda[pos];
+    struct solver_name* slot = _lookup(s, r->dep.name, 1);
+    struct solver_cand* installed;
+    size_t i;
+    int pass;
+
+    out->num = 0;
+    if (slot == NULL || _load(s, slot) != 0)
+        return -1;
+
+    installed = slot->installed;
+    if (installed != NULL && (!dep_match(&r->dep, installed->version) ||
+                              (r->branch != NULL &&
+                               strcmp(installed->branch, r->branch) != 0)))
+        installed = NULL;
+
+    if (installed != NULL && r->from != NULL)
+    {
+        if (_list_add(out, installed) != 0)
+            return -1;
+        installed = NULL;
+    }
+
+    for (i = 0; i < slot->cands.num; i++)
+    {
+        struct solver_cand* c = slot->cands.items[i];
+
+        if (installed != NULL && vercmp(installed->version, c->version) >= 0)
+        {
+            if (_list_add(out, installed) != 0)
+                return -1;
+            installed = NULL;
+        }
+
+        if (!dep_match(&r->dep, c->version) ||
+            (r->branch != NULL && strcmp(c->branch, r->branch) != 0))
+            continue;
+        if (_list_add(out, c) != 0)
+            return -1;
+    }
+    if (installed != NULL && _list_add(out, installed) != 0)
+        return -1;
+
+    /* Providers, installed ones first */
+    for (pass = 0; pass < 2 && r->branch == NULL; pass++)
+    {
+        for (i = 0; i < slot->providers.num; i++)
+        {
+            struct solver_cand* p = slot->providers.items[i];
+
+            if (p->installed != !pass || !_provides(p, &r->dep))
+                continue;
+            if (p->installed && _current(s, p->name) != p)
+                continue;
+            if (_list_add(out, p) != 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* The failure at depth depends on the decision at level */
+static void _blame(struct solver* s, size_t depth, size_t level)
+{
+    if (level != SOLVER_NONE)
+        s->frames[depth]->blame[level / 64] |= (uint64_t)1 << (level % 64);
+}
+
+/* Whether choosing c keeps the picked set consistent */
+static int _compatible(struct solver* s, size_t pos, size_t depth,
+                       struct solver_cand* c)
+{
+    struct solver_name* slot = _lookup(s, c->name, 0);
+    size_t i, j, k;
+
+    if (slot->chosen != NULL && slot->chosen != c)
+    {
+        _reason(s, REASON_MISMATCH, pos, depth, c, slot->chosen);
+        _blame(s, depth, slot->chosen_at);
+        return 0;
+    }
+
+    /* Look ahead, so a clash is found now and not after every choice made
+     * in between has been undone. Without providers, requirements still
+     * waiting on this name all need c... */
+    for (i = slot->last_req; slot->providers.num == 0 && i != SOLVER_NONE;
+         i = s->agenda[i].prev)
+    {
+        struct solver_req* q = &s->agenda[i];
+
+        if (!dep_match(&q->dep, c->version) ||
+            (q->branch != NULL && strcmp(c->branch, q->branch) != 0))
+        {
+            _reason_needs(s, pos, depth, c, &s->agenda[pos].dep,
+                          s->agenda[pos].from, q);
+            _blame(s, depth, q->level);
+            return 0;
+        }
+    }
+
+    /* ...and c's dependencies have to agree with what is picked */
+    for (i = 0; i < c->num_deps; i++)
+    {
+        struct solver_name* dslot = _lookup(s, c->deps[i].name, 0);
+
+        if (dslot == NULL || dslot->chosen == NULL ||
+            dslot->providers.num > 0 ||
+            dep_match(&c->deps[i], dslot->chosen->version))
+            continue;
+
+        _reason_needs(s, pos, depth, c, &c->deps[i], c,
+                      &s->agenda[dslot->chosen_for]);
+        _blame(s, depth, dslot->chosen_at);
+        return 0;
+    }
+
+    /* Its conflicts against what is picked or stays installed */
+    for (i = 0; i < c->num_conflicts; i++)
+    {
+        struct dep* d = &c->conflicts[i];
+        struct solver_cand* t = _current(s, d->name);
+        struct solver_name* vslot;
+
+        if (t != NULL && t != c && dep_match(d, t->version))
+        {
+            _reason(s, REASON_CONFLICT, pos, depth, c, t);
+            _blame(s, depth, _level(s, t));
+            return 0;
+        }
+
+        vslot = _lookup(s, d->name, 0);
+        for (j = 0; vslot != NULL && j < vslot->providers.num; j++)
+        {
+            struct solver_cand* p = vslot->providers.items[j];
+            if (p != c && _current(s, p->name) == p && _provides(p, d))
+            {
+                _reason(s, REASON_CONFLICT, pos, depth, c, p);
+                _blame(s, depth, _level(s, p));
+                return 0;
+            }
+        }
+    }
+
+    /* Conflicts of what is picked or installed against c and its provides */
+    for (k = 0; k <= c->num_provides; k++)
+    {
+        const char* name = k == 0 ? c->name : c->provides[k - 1].name;
+        struct solver_name* cslot = _lookup(s, name, 0);
+
+        for (i = 0; cslot != NULL && i < cslot->conflicted.num; i++)
+        {
+            struct solver_cand* t = cslot->conflicted.items[i];
+
+            if (t == c || _current(s, t->name) != t)
+                continue;
+            for (j = 0; j < t->num_conflicts; j++)
+            {
+                struct dep* d = &t->conflicts[j];
+                if (strcmp(d->name, name) != 0)
+                    continue;
+                if (k == 0 ? dep_match(d, c->version)
+                           : _provide_match(&c->provides[k - 1], d))
+                {
+                    _reason(s, REASON_CONFLICT, pos, depth, c, t);
+                    _blame(s, depth, _level(s, t));
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+static int _choose(struct solver* s, size_t pos, size_t depth,
+                   struct solver_cand* c)
+{
+    struct solver_name* slot = _lookup(s, c->name, 0);
+    size_t i, j;
+
+    slot->chosen = c;
+    slot->chosen_for = pos;
+    slot->chosen_at = depth;
+    s->state ^= c->key;
+
+    for (i = 0; i < c->num_deps; i++)
+    {
+        if (_push(s, &c->deps[i], c, NULL, depth) != 0)
+            return -1;
+    }
+
+    /* Replacing an installed version must not break what depends on it */
+    if (slot->installed != NULL && slot->installed != c)
+    {
+        for (i = 0; i < slot->dependents.num; i++)
+        {
+            struct solver_cand* d = slot->dependents.items[i];
+            if (_current(s, d->name) != d)
+                continue;
+            for (j = 0; j < d->num_deps; j++)
+            {
+                if (strcmp(d->deps[j].name, c->name) == 0 &&
+                    _push(s, &d->deps[j], d, NULL, depth) != 0)
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void _unchoose(struct solver* s, struct solver_cand* c, size_t mark)
+{
+    struct solver_name* slot = _lookup(s, c->name, 0);
+
+    slot->chosen = NULL;
+    s->state ^= c->key;
+    _truncate(s, mark);
+}
+
+/* Frame of depth, its blame cleared */
+static struct solver_frame* _frame(struct solver* s, size_t depth)
+{
+    struct solver_frame* f;
+
+    if (depth >= s->num_frames)
+    {
+        size_t new_num = s->num_frames ? s->num_frames * 2 : 64;
+        struct solver_frame** frames;
+
+        while (new_num <= depth)
+            new_num *= 2;
+        frames = arena_alloc(&g_arena, new_num * sizeof(*frames));
+        if (frames == NULL)
+            return NULL;
+        memset(frames, 0, new_num * sizeof(*frames));
+        if (s->num_frames > 0)
+            memcpy(frames, s->frames, s->num_frames * sizeof(*frames));
+        s->frames = frames;
+        s->num_frames = new_num;
+    }
+
+    if (s->frames[depth] == NULL)
+    {
+        f = arena_alloc(&g_arena, sizeof(*f));
+        if (f == NULL)
+            return NULL;
+        memset(f, 0, sizeof(*f));
+        f->blame = arena_alloc(&g_arena, (depth / 64 + 1) * sizeof(uint64_t));
+        if (f->blame == NULL)
+            return NULL;
+        s->frames[depth] = f;
+    }
+
+    f = s->frames[depth];
+    memset(f->blame, 0, (depth / 64 + 1) * sizeof(uint64_t));
+    return f;
+}
+
+/*
+ * Backtracking with conflict-directed backjumping: a dead end blames the
+ * decisions its candidates were rejected over, and a decision whose
+ * subtree failed without blaming it is skipped over entirely, so an early
+ * bad pick doesn't make every pick in between get retried. On failure the
+ * blame of depth's frame says which decisions have to change.
+ */
+static int _solve(struct solver* s, size_t pos, size_t depth)
+{
+    struct solver_frame* f;
+    size_t i, w, words = depth / 64 + 1;
+
+    /* Requirements the picks already meet cost no decision */
+    while (pos < s->num_agenda && _satisfied(s, &s->agenda[pos]))
+        pos++;
+    if (pos == s->num_agenda)
+        return SOLVER_OK;
+
+    f = _frame(s, depth);
+    if (f == NULL)
+        return SOLVER_ABORT;
+
+    /* What remains only depends on the set of picks, not how it was
+     * reached, so a set that failed once fails again. Which of them it
+     * was is lost, so blame them all. */
+    if (_is_failed(s, s->state))
+    {
+        for (i = 0; i < depth; i++)
+            _blame(s, depth, i);
+        return SOLVER_FAIL;
+    }
+    if (++s->steps > SOLVER_MAX_STEPS)
+        return SOLVER_ABORT;
+
+    if (_candidates(s, pos, &f->cands) != 0)
+        return SOLVER_ABORT;
+    if (f->cands.num == 0)
+        _reason(s, REASON_MISSING, pos, depth, NULL, NULL);
+    _blame(s, depth, s->agenda[pos].level);
+
+    for (i = 0; i < f->cands.num; i++)
+    {
+        struct solver_cand* c = f->cands.items[i];
+        size_t mark = s->num_agenda;
+        uint64_t* child;
+        int ret;
+
+        if (!_compatible(s, pos, depth, c))
+            continue;
+        if (_choose(s, pos, depth, c) != 0)
+            return SOLVER_ABORT;
+
+        ret = _solve(s, pos + 1, depth + 1);
+        if (ret != SOLVER_FAIL)
+            return ret;
+        _unchoose(s, c, mark);
+
+        child = s->frames[depth + 1]->blame;
+        if (!(child[depth / 64] & ((uint64_t)1 << (depth % 64))))
+        {
+            /* Picking differently here can't help, jump further back */
+            memcpy(f->blame, child, words * sizeof(uint64_t));
+            break;
+        }
+        for (w = 0; w < words; w++)
+            f->blame[w] |= child[w];
+        f->blame[depth / 64] &= ~((uint64_t)1 << (depth % 64));
+    }
+
+    _set_failed(s, s->state);
+    return SOLVER_FAIL;
+}
+
+/* =============================================================================
+ * Requests
+ * ========================================================================== */
+
+/* "name[op version][:branch]", where names may also be manifest file names
+ * or REDIRECTs as with pkg_parse() */
+static int _parse_request(struct solver* s, const char* text,
+                          struct solver_req* r)
+{
+    char* copy = strdup_safe(text);
+    char* colon;
+    int hops;
+
+    if (copy == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    r->from = NULL;
+    r->branch = NULL;
+
+    for (hops = 0; hops <= SOLVER_MAX_REDIRECTS; hops++)
+    {
+        size_t n = repoidx_count(&s->idx), i;
+        struct solver_name* slot;
+        const char* target = NULL;
+        char* file;
+
+        colon = strrchr(copy, ':');
+        if (colon != NULL)
+        {
+            int b;
+            for (b = 0; b < g_config.num_branches; b++)
+            {
+                if (strcmp(g_config.branches[b].name, colon + 1) == 0)
+                {
+                    *colon = '\0';
+                    r->branch = g_config.branches[b].name;
+                    break;
+                }
+            }
+        }
+
+        if (dep_parse(copy, &r->dep) != 0)
+        {
+            ERROR("Invalid package '%s'\n", text);
+            return ACTION_RET_PKG_ERR_INVALID_FORMAT;
+        }
+
+        slot = _lookup(s, r->dep.name, 1);
+        if (slot == NULL || _load(s, slot) != 0)
+            return ACTION_RET_ERR_UNKNOWN;
+        if (slot->installed != NULL || slot->cands.num > 0 ||
+            slot->providers.num > 0)
+            return ACTION_RET_OK;
+
+        /* Not a package name, maybe a manifest's file name */
+        file = arena_alloc(&g_arena, strlen(r->dep.name) + 5);
+        if (file == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        sprintf(file, "%s.pkg", r->dep.name);
+
+        for (i = 0; i < n && target == NULL; i++)
+        {
+            struct repoidx_entry e;
+
+            repoidx_get(&s->idx, i, &e);
+            if (strcmp(e.file, file) != 0 ||
+                (r->branch != NULL && strcmp(e.branch, r->branch) != 0))
+                continue;
+            target = e.redirect != NULL ? e.redirect : e.name;
+        }
+
+        if (target == NULL || strcmp(target, r->dep.name) == 0)
+            break;
+
+        /* Keep the constraint, swap the name */
+        copy = arena_alloc(&g_arena, strlen(target) + strlen(text) + 1);
+        if (copy == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        sprintf(copy, "%s%s", target, text + strcspn(text, "<>=:"));
+        if (strchr(target, ':') != NULL)
+            r->branch = NULL;
+    }
+
+    ERROR("Package '%s' not found.\n", text);
+    return ACTION_RET_PKG_ERR_NOT_FOUND;
+}
+
+/* Search from scratch for the active requests, leaving the picks of a
+ * solution in place */
+static int _attempt(struct solver* s, struct solver_req* reqs, size_t n,
+                    const int* active)
+{
+    size_t i;
+
+    for (i = 0; i < s->names_cap; i++)
+    {
+        if (s->names[i] != NULL)
+            s->names[i]->chosen = NULL;
+    }
+    _truncate(s, 0);
+    s->state = 0;
+    s->steps = 0;
+    s->num_failed = 0;
+    if (s->failed_cap > 0)
+        memset(s->failed, 0, s->failed_cap * sizeof(*s->failed));
+    memset(&s->reason, 0, sizeof(s->reason));
+    s->reason_depth = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (active[i] &&
+            _push(s, &reqs[i].dep, NULL, reqs[i].branch, SOLVER_NONE) != 0)
+            return SOLVER_ABORT;
+    }
+
+    return _solve(s, 0, 0);
+}
+
+static const char* _describe(struct solver_cand* c)
+{
+    char* text;
+
+    if (c == NULL)
+        return "the request";
+    text = arena_alloc(&g_arena, strlen(c->name) + strlen(c->version) + 2);
+    if (text == NULL)
+        return c->name;
+    sprintf(text, "%s-%s", c->name, c->version);
+    return text;
+}
+
+static void _explain(struct solver* s)
+{
+    struct solver_reason* r = &s->reason;
+    size_t i;
+
+    switch (r->kind)
+    {
+        case REASON_MISSING:
+            ERROR("Nothing provides %s, needed by %s\n", dep_format(&r->dep),
+                  _describe(r->chain_len ? r->chain[0] : NULL));
+            break;
+        case REASON_MISMATCH:
+            ERROR("%s needs %s, but %s needs %s\n",
+                  _describe(r->chain_len ? r->chain[0] : NULL),
+                  dep_format(&r->dep), _describe(r->other_for),
+                  dep_format(&r->other_dep));
+            break;
+        case REASON_CONFLICT:
+            ERROR("%s%s conflicts with %s%s\n", _describe(r->cand),
+                  r->cand->installed ? " (installed)" : "",
+                  _describe(r->other),
+                  r->other->installed ? " (installed)" : "");
+            break;
+        default:
+            ERROR("Dependencies can't be satisfied\n");
+            return;
+    }
+
+    /* Other than for conflicts, chain[0] is already named above */
+    for (i = r->kind == REASON_CONFLICT ? 0 : 1; i < r->chain_len; i++)
+        fprintf(stderr, "    needed by %s\n", _describe(r->chain[i]));
+}
+
+/* =============================================================================
+ * Plan
+ * ========================================================================== */
+
+/* What dep ended up satisfied by */
+static struct solver_cand* _target(struct solver* s, const struct dep* dep)
+{
+    struct solver_name* slot = _lookup(s, dep->name, 0);
+    size_t i;
+
+    if (slot == NULL)
+        return NULL;
+    if (slot->chosen != NULL && dep_match(dep, slot->chosen->version))
+        return slot->chosen;
+    for (i = 0; i < slot->providers.num; i++)
+    {
+        struct solver_cand* p = slot->providers.items[i];
+        if (_chosen(s, p) && _provides(p, dep))
+            return p;
+    }
+    return NULL;
+}
+
+static int _order(struct solver* s, struct solver_cand* c,
+                  struct solver_list* plan)
+{
+    size_t i;
+
+    if (c == NULL || c->installed || c->visiting == 2)
+        return ACTION_RET_OK;
+    if (c->visiting == 1)
+    {
+        ERROR("Dependency cycle through '%s'\n", c->name);
+        return ACTION_RET_PKG_ERR_DEPENDENCY;
+    }
+
+    c->visiting = 1;
+    for (i = 0; i < c->num_deps; i++)
+    {
+        int ret = _order(s, _target(s, &c->deps[i]), plan);
+        if (ret != ACTION_RET_OK)
+            return ret;
+    }
+    c->visiting = 2;
+
+    c->plan = plan->num;
+    return _list_add(plan, c) == 0 ? ACTION_RET_OK : ACTION_RET_ERR_UNKNOWN;
+}
+
+static int _build_plan(struct solver* s, struct solver_req* reqs, size_t n,
+                       struct solver_pkg** plan, size_t* num_plan)
+{
+    struct solver_list order = {NULL, 0, 0};
+    size_t i, j, skipped = 0;
+    int ret;
+
+    for (i = 0; i < n; i++)
+    {
+        struct solver_cand* c = _target(s, &reqs[i].dep);
+
+        if (c != NULL && c->installed)
+        {
+            ERROR("Package %s-%s is already installed.\n", c->name,
+                  c->version);
+            skipped++;
+        }
+        if ((ret = _order(s, c, &order)) != ACTION_RET_OK)
+            return ret;
+    }
+
+    /* Whatever the requests pulled in through replaced installs */
+    for (i = 0; i < s->names_cap; i++)
+    {
+        if (s->names[i] != NULL &&
+            (ret = _order(s, s->names[i]->chosen, &order)) != ACTION_RET_OK)
+            return ret;
+    }
+
+    *num_plan = order.num;
+    *plan = arena_alloc(&g_arena, (order.num + 1) * sizeof(**plan));
+    if (*plan == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < order.num; i++)
+    {
+        struct solver_cand* c = order.items[i];
+        struct solver_pkg* p = &(*plan)[i];
+        size_t stem = strlen(c->file) - strlen(".pkg");
+
+        /* The index is closed before the plan is used */
+        p->name = strdup_safe(c->name);
+        p->version = strdup_safe(c->version);
+        p->spec = arena_alloc(&g_arena, stem + strlen(c->branch) + 2);
+        p->deps = arena_alloc(&g_arena, (c->num_deps + 1) * sizeof(size_t));
+        p->num_deps = 0;
+        p->requested = 0;
+        if (p->name == NULL || p->version == NULL || p->spec == NULL ||
+            p->deps == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        sprintf(p->spec, "%.*s:%s", (int)stem, c->file, c->branch);
+
+        for (j = 0; j < c->num_deps; j++)
+        {
+            struct solver_cand* t = _target(s, &c->deps[j]);
+            if (t != NULL && !t->installed)
+                p->deps[p->num_deps++] = t->plan;
+        }
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        struct solver_cand* c = _target(s, &reqs[i].dep);
+        if (c != NULL && !c->installed)
+            (*plan)[c->plan].requested = 1;
+    }
+
+    if (order.num == 0 && skipped > 0)
+        return ACTION_RET_PKG_ERR_ALREADY_INSTALLED;
+    return ACTION_RET_OK;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int solver_solve(char** requests, size_t num_requests,
+                 struct solver_pkg** plan, size_t* num_plan)
+{
+    struct solver s;
+    struct solver_req* reqs;
+    int* active;
+    size_t i, num_active;
+    int ret;
+
+    *plan = NULL;
+    *num_plan = 0;
+
+    ret = _init(&s);
+    if (ret != ACTION_RET_OK)
+        goto out;
+
+    reqs = arena_alloc(&g_arena, (num_requests + 1) * sizeof(*reqs));
+    active = arena_alloc(&g_arena, (num_requests + 1) * sizeof(*active));
+    if (reqs == NULL || active == NULL)
+    {
+        ret = ACTION_RET_ERR_UNKNOWN;
+        goto out;
+    }
+
+    for (i = 0; i < num_requests; i++)
+    {
+        ret = _parse_request(&s, requests[i], &reqs[i]);
+        if (ret != ACTION_RET_OK)
+            goto out;
+        active[i] = 1;
+    }
+
+    ret = _attempt(&s, reqs, num_requests, active);
+    if (ret == SOLVER_OK)
+    {
+        MSG("Resolved in %lu steps\n", s.steps);
+        ret = _build_plan(&s, reqs, num_requests, plan, num_plan);
+        goto out;
+    }
+
+    if (ret == SOLVER_ABORT)
+    {
+        ERROR("Gave up resolving dependencies after %lu steps\n", s.steps);
+        ret = ACTION_RET_PKG_ERR_DEPENDENCY;
+        goto out;
+    }
+
+    /* Drop every request the failure doesn't need, what is left is a
+     * smallest set that can't be installed together */
+    for (i = 0; i < num_requests && num_requests > 1; i++)
+    {
+        active[i] = 0;
+        if (_attempt(&s, reqs, num_requests, active) != SOLVER_FAIL)
+            active[i] = 1;
+    }
+
+    for (i = 0, num_active = 0; i < num_requests; i++)
+        num_active += active[i];
+
+    if (num_active > 1)
+    {
+        size_t len = 1;
+        char* names;
+
+        for (i = 0; i < num_requests; i++)
+            len += active[i] ? strlen(requests[i]) + 1 : 0;
+        names = arena_alloc(&g_arena, len);
+        if (names != NULL)
+        {
+            *names = '\0';
+            for (i = 0; i < num_requests; i++)
+            {
+                if (active[i])
+                    sprintf(names + strlen(names), " %s", requests[i]);
+            }
+            ERROR("Can't install%s together:\n", names);
+        }
+    }
+    _attempt(&s, reqs, num_requests, active);
+    _explain(&s);
+
+    ret = s.reason.kind == REASON_CONFLICT ? ACTION_RET_PKG_ERR_CONFLICT
+                                           : ACTION_RET_PKG_ERR_DEPENDENCY;
+
+out:
+    free(s.failed);
+    repoidx_close(&s.idx);
+    return ret;
+}
@@ -0,0 +1,313 @@
+/******************************************************************************
+ * stage.c - Staging tree handling
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <piratpkg.h>
+#include <stage.h>
+#include <hash.h>
+#include <fs.h>
+#include <copy.h>
+#include <strings.h>
+#include <log.h>
+
+/* Suffix for temporaries next to their final path in ROOT */
+#define STAGE_TMP_SUFFIX ".piratpkg-new"
+
+struct stage_list
+{
+    struct db_file* files;
+    size_t num_files;
+    size_t cap;
+};
+
+/* =============================================================================
+ * Scanning
+ * ========================================================================== */
+
+static struct db_file* _list_push(struct stage_list* list)
+{
+    if (list->num_files == list->cap)
+    {
+        size_t new_cap = list->cap ? list->cap * 2 : 256;
+        struct db_file* files =
+            arena_alloc(&g_arena, new_cap * sizeof(struct db_file));
+        if (files == NULL)
+            return NULL;
+        if (list->num_files > 0)
+            memcpy(files, list->files,
+                   list->num_files * sizeof(struct db_file));
+        list->files = files;
+        list->cap = new_cap;
+    }
+
+    return &list->files[list->num_files++];
+}
+
+static int _scan_dir(const char* staging_dir, const char* rel,
+                     struct stage_list* list)
+{
+    char* dir_path = fs_join(staging_dir, rel);
+    DIR* d = opendir(dir_path);
+    struct dirent* p;
+
+    if (d == NULL)
+    {
+        ERROR("Failed to open '%s': %s\n", dir_path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    while ((p = readdir(d)) != NULL)
+    {
+        struct stat st;
+        struct db_file* f;
+        char* path;
+        char* full;
+
+        if (!strcmp(p->d_name, ".") || !strcmp(p->d_name, ".."))
+            continue;
+
+        path = fs_join(rel, p->d_name);
+        full = fs_join(staging_dir, path);
+        if (lstat(full, &st) != 0)
+        {
+            ERROR("Failed to stat '%s': %s\n", full, strerror(errno));
+            closedir(d);
+            return ACTION_RET_ERR_IO;
+        }
+
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode) &&
+            !S_ISLNK(st.st_mode))
+        {
+            WARNING("Skipping special file '%s'\n", path);
+            continue;
+        }
+
+        f = _list_push(list);
+        if (f == NULL)
+        {
+            closedir(d);
+            return ACTION_RET_ERR_UNKNOWN;
+        }
+
+        f->path = path;
+        f->mode = st.st_mode & 07777;
+        f->size = 0;
+        f->target = NULL;
+        strcpy(f->hash, "-");
+
+        if (S_ISDIR(st.st_mode))
+        {
+            f->type = DB_FILE_DIR;
+            if (_scan_dir(staging_dir, path, list) != ACTION_RET_OK)
+            {
+                closedir(d);
+                return ACTION_RET_ERR_IO;
+            }
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            char target[4096];
+            ssize_t n = readlink(full, target, sizeof(target) - 1);
+            if (n < 0)
+            {
+                ERROR("Failed to read link '%s': %s\n", full,
+                      strerror(errno));
+                closedir(d);
+                return ACTION_RET_ERR_IO;
+            }
+            target[n] = '\0';
+
+            f->type = DB_FILE_LNK;
+            f->size = n;
+            f->target = strdup_safe(target);
+            sha256_hex(target, (size_t)n, f->hash);
+        }
+        else
+        {
+            f->type = DB_FILE_REG;
+            f->size = st.st_size;
+            if (sha256_file(full, f->hash) != 0)
+            {
+                ERROR("Failed to hash '%s': %s\n", full, strerror(errno));
+                closedir(d);
+                return ACTION_RET_ERR_IO;
+            }
+        }
+    }
+
+    closedir(d);
+    return ACTION_RET_OK;
+}
+
+static int _cmp_file(const void* a, const void* b)
+{
+    return strcmp(((const struct db_file*)a)->path,
+                  ((const struct db_file*)b)->path);
+}
+
+int stage_scan(const char* staging_dir, struct db_file** files,
+               size_t* num_files)
+{
+    struct stage_list list = {NULL, 0, 0};
+    int ret = _scan_dir(staging_dir, "/", &list);
+
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    /* A prefix sorts before its extensions, so parents precede children */
+    if (list.num_files > 0)
+        qsort(list.files, list.num_files, sizeof(struct db_file), _cmp_file);
+
+    *files = list.files;
+    *num_files = list.num_files;
+    return ACTION_RET_OK;
+}
+
+/* =============================================================================
+ * Committing into ROOT
+ * ========================================================================== */
+
+static int _commit_entry(const char* staging_dir, struct db_file* f,
+                         struct copy_pool* pool)
+{
+    struct copy_job job;
+    char* src = fs_join(staging_dir, f->path);
+    char* dst = fs_join(g_config.root, f->path);
+    char* tmp;
+    struct stat st;
+
+    switch (f->type)
+    {
+        case DB_FILE_DIR:
+            if (mkdir(dst, f->mode) == 0)
+                return chmod(dst, f->mode);
+            /* Shared directories (or symlinks to them) are fine as is */
+            if (errno == EEXIST && stat(dst, &st) == 0 && S_ISDIR(st.st_mode))
+                return 0;
+            return -1;
+
+        case DB_FILE_REG:
+            if (rename(src, dst) == 0)
+                return 0;
+            if (errno != EXDEV)
+                return -1;
+
+            /* Staging lives on another filesystem, a worker copies next to
+             * the target and renames so a running binary is never truncated */
+            tmp = arena_alloc(&g_arena, strlen(dst) + sizeof(STAGE_TMP_SUFFIX));
+            if (tmp == NULL)
+                return -1;
+            sprintf(tmp, "%s%s", dst, STAGE_TMP_SUFFIX);
+
+            job.src_fd = -1;
+            job.src_path = src;
+            job.src_off = 0;
+            job.size = f->size;
+            job.dst = tmp;
+            job.rename_to = dst;
+            job.mode = f->mode;
+            job.hash = NULL;
+            job.name = f->path;
+            if (copy_pool_submit(pool, &job) != ACTION_RET_OK)
+            {
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+
+        case DB_FILE_LNK:
+            tmp = arena_alloc(&g_arena, strlen(dst) + sizeof(STAGE_TMP_SUFFIX));
+            if (tmp == NULL)
+                return -1;
+            sprintf(tmp, "%s%s", dst, STAGE_TMP_SUFFIX);
+            unlink(tmp);
+            if (symlink(f->target, tmp) != 0)
+                return -1;
+            return rename(tmp, dst);
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+int stage_commit(const char* staging_dir, struct db_file* files,
+                 size_t num_files, size_t* committed)
+{
+    struct copy_pool pool;
+    size_t i;
+
+    copy_pool_start(&pool, 0);
+
+    for (i = 0; i < num_files; i++)
+    {
+        if (_commit_entry(staging_dir, &files[i], &pool) != 0)
+        {
+            ERROR("Failed to install '%s': %s\n", files[i].path,
+                  strerror(errno));
+            copy_pool_finish(&pool);
+            *committed = i;
+            return ACTION_RET_ERR_IO;
+        }
+    }
+
+    /* Copies that failed can't be told apart, count them all */
+    *committed = num_files;
+    return copy_pool_finish(&pool);
+}
+
+/* =============================================================================
+ * Removing from ROOT
+ * ========================================================================== */
+
+int stage_remove(struct db_file* files, size_t num_files)
+{
+    int ret = ACTION_RET_OK;
+    size_t i;
+
+    /* Children come after their parents, so walk backwards */
+    for (i = num_files; i > 0; i--)
+    {
+        struct db_file* f = &files[i - 1];
+        char* dst = fs_join(g_config.root, f->path);
+        struct stat st;
+
+        if (lstat(dst, &st) != 0)
+            continue;
+
+        if (f->type == DB_FILE_DIR)
+        {
+            /* Still in use by something else, leave it be */
+            if (S_ISDIR(st.st_mode))
+                rmdir(dst);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode))
+        {
+            WARNING("'%s' is now a directory, not removing it\n", f->path);
+            continue;
+        }
+
+        if (unlink(dst) != 0)
+        {
+            ERROR("Failed to remove '%s': %s\n", f->path, strerror(errno));
+            ret = ACTION_RET_ERR_IO;
+        }
+    }
+
+    return ret;
+}
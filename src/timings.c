@@ -0,0 +1,268 @@
+/******************************************************************************
+ * timings.c - Build durations of past installs
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <piratpkg.h>
+#include <timings.h>
+#include <version.h>
+#include <db.h>
+#include <fs.h>
+#include <strings.h>
+#include <log.h>
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+static int _cmp_entry(const struct timings_entry* e, const char* name,
+                      const char* version, const char* function)
+{
+    int cmp = strcmp(e->name, name);
+    if (cmp == 0)
+        cmp = strcmp(e->version, version);
+    return cmp != 0 ? cmp : strcmp(e->function, function);
+}
+
+/* Index of the first entry not before (name, version, function) */
+static size_t _lower_bound(struct timings* t, const char* name,
+                           const char* version, const char* function)
+{
+    size_t lo = 0, hi = t->num_entries;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_cmp_entry(&t->entries[mid], name, version, function) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static struct timings_entry* _insert(struct timings* t, const char* name,
+                                     const char* version,
+                                     const char* function)
+{
+    size_t i = _lower_bound(t, name, version, function);
+    struct timings_entry* e;
+
+    if (i < t->num_entries &&
+        _cmp_entry(&t->entries[i], name, version, function) == 0)
+        return &t->entries[i];
+
+    if (t->num_entries == t->cap)
+    {
+        size_t new_cap = t->cap ? t->cap * 2 : 64;
+        struct timings_entry* entries =
+            arena_alloc(&g_arena, new_cap * sizeof(struct timings_entry));
+        if (entries == NULL)
+            return NULL;
+        if (t->num_entries > 0)
+            memcpy(entries, t->entries,
+                   t->num_entries * sizeof(struct timings_entry));
+        t->entries = entries;
+        t->cap = new_cap;
+    }
+
+    memmove(&t->entries[i + 1], &t->entries[i],
+            (t->num_entries - i) * sizeof(struct timings_entry));
+    e = &t->entries[i];
+    e->name = strdup_safe(name);
+    e->version = strdup_safe(version);
+    e->function = strdup_safe(function);
+    e->seconds = 0;
+    e->runs = 0;
+    t->num_entries++;
+    return e->name != NULL && e->version != NULL && e->function != NULL
+               ? e
+               : NULL;
+}
+
+/* Sum of the functions of name-version, -1 without any */
+static double _total(struct timings* t, const char* name, const char* version)
+{
+    size_t i = _lower_bound(t, name, version, "");
+    double total = -1;
+
+    for (; i < t->num_entries && strcmp(t->entries[i].name, name) == 0 &&
+           strcmp(t->entries[i].version, version) == 0;
+         i++)
+        total = (total < 0 ? 0 : total) + t->entries[i].seconds;
+    return total;
+}
+
+/* The function's average in the newest other version of name, 0 if none */
+static double _previous_version(struct timings* t, const char* name,
+                                const char* version, const char* function)
+{
+    struct timings_entry* newest = NULL;
+    size_t i;
+
+    for (i = _lower_bound(t, name, "", "");
+         i < t->num_entries && strcmp(t->entries[i].name, name) == 0; i++)
+    {
+        struct timings_entry* e = &t->entries[i];
+
+        if (strcmp(e->function, function) != 0 || e->runs == 0 ||
+            strcmp(e->version, version) == 0)
+            continue;
+        if (newest == NULL || vercmp(e->version, newest->version) > 0)
+            newest = e;
+    }
+    return newest != NULL ? newest->seconds : 0;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int timings_load(struct timings* t)
+{
+    char line[MAX_LINE_LENGTH];
+    char* path = db_path("timings.list");
+    FILE* file;
+
+    memset(t, 0, sizeof(*t));
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        /* Nothing built yet */
+        if (errno == ENOENT)
+            return ACTION_RET_OK;
+        ERROR("Failed to open '%s': %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char* save = NULL;
+        char* name = strtok_r(line, "\t\n", &save);
+        char* version = strtok_r(NULL, "\t\n", &save);
+        char* function = strtok_r(NULL, "\t\n", &save);
+        char* seconds = strtok_r(NULL, "\t\n", &save);
+        char* runs = strtok_r(NULL, "\t\n", &save);
+        char* last = strtok_r(NULL, "\t\n", &save);
+        char* history = strtok_r(NULL, "\t\n", &save);
+        struct timings_entry* e;
+
+        if (runs == NULL)
+            continue;
+
+        e = _insert(t, name, version, function);
+        if (e == NULL)
+        {
+            fclose(file);
+            return ACTION_RET_ERR_UNKNOWN;
+        }
+        e->seconds = strtod(seconds, NULL);
+        e->runs = strtoul(runs, NULL, 10);
+        e->last = last != NULL ? strtod(last, NULL) : e->seconds;
+        e->history = history != NULL ? strtod(history, NULL) : 0;
+    }
+
+    fclose(file);
+    return ACTION_RET_OK;
+}
+
+int timings_save(struct timings* t)
+{
+    char* path = db_path("timings.list");
+    char* tmp_path;
+    FILE* file;
+    size_t i;
+
+    if (fs_mkdir_p(db_path(""), 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", db_path(""), strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return ACTION_RET_ERR_IO;
+
+    for (i = 0; i < t->num_entries; i++)
+    {
+        struct timings_entry* e = &t->entries[i];
+        fprintf(file, "%s\t%s\t%s\t%.3f\t%lu\t%.3f\t%.3f\n", e->name,
+                e->version, e->function, e->seconds, e->runs, e->last,
+                e->history);
+    }
+
+    return fs_close_atomic(file, tmp_path, path);
+}
+
+int timings_record(struct timings* t, const char* name, const char* version,
+                   const char* function, double seconds)
+{
+    struct timings_entry* e = _insert(t, name, version, function);
+
+    if (e == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    e->history = e->runs > 0 ? e->seconds
+                             : _previous_version(t, name, version, function);
+    e->last = seconds;
+    e->seconds = e->runs == 0 ? seconds
+                              : TIMINGS_WEIGHT * seconds +
+                                    (1 - TIMINGS_WEIGHT) * e->seconds;
+    e->runs++;
+    return ACTION_RET_OK;
+}
+
+double timings_estimate(struct timings* t, const char* name,
+                        const char* version)
+{
+    const char* newest = NULL;
+    size_t i;
+
+    if (version != NULL && _total(t, name, version) >= 0)
+        return _total(t, name, version);
+
+    for (i = _lower_bound(t, name, "", "");
+         i < t->num_entries && strcmp(t->entries[i].name, name) == 0; i++)
+    {
+        if (newest == NULL || vercmp(t->entries[i].version, newest) > 0)
+            newest = t->entries[i].version;
+    }
+    return newest != NULL ? _total(t, name, newest) : -1;
+}
+
+void timings_last(struct timings* t, const char* name, const char* version,
+                  double* last, double* history)
+{
+    size_t i = _lower_bound(t, name, version, "");
+
+    *last = 0;
+    *history = 0;
+    for (; i < t->num_entries && strcmp(t->entries[i].name, name) == 0 &&
+           strcmp(t->entries[i].version, version) == 0;
+         i++)
+    {
+        /* Functions new to this build have nothing to compare against */
+        if (t->entries[i].history <= 0)
+            continue;
+        *last += t->entries[i].last;
+        *history += t->entries[i].history;
+    }
+}
+
+int timings_regressed(double last, double history)
+{
+    if (history <= 0 || last - history < TIMINGS_MIN_REGRESSION)
+        return 0;
+    return (last - history) * 100 > history * g_config.timings_threshold;
+}
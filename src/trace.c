@@ -0,0 +1,138 @@
+/******************************************************************************
+ * trace.c - Chrome trace output (--trace)
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <trace.h>
+#include <json.h>
+#include <log.h>
+
+static FILE* s_trace = NULL;
+static double s_start;
+static pthread_mutex_t s_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+static double _now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void _event(const char* ph, const char* name, const char* key,
+                   const char* value)
+{
+    double ts = _now_us() - s_start;
+
+    pthread_mutex_lock(&s_trace_lock);
+    if (s_trace != NULL)
+    {
+        fputs(",\n{\"ph\": ", s_trace);
+        json_string(s_trace, ph);
+        fputs(", \"name\": ", s_trace);
+        json_string(s_trace, name);
+        fprintf(s_trace, ", \"pid\": %ld, \"tid\": %ld, \"ts\": %.3f",
+                (long)getpid(), (long)syscall(SYS_gettid), ts);
+        if (value != NULL)
+        {
+            fputs(", \"args\": {", s_trace);
+            json_field(s_trace, key, value, 1);
+            fputc('}', s_trace);
+        }
+        fputc('}', s_trace);
+    }
+    pthread_mutex_unlock(&s_trace_lock);
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int trace_open(const char* path)
+{
+    s_trace = fopen(path, "w");
+    if (s_trace == NULL)
+    {
+        ERROR("Failed to open trace file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    s_start = _now_us();
+    fputc('[', s_trace);
+
+    /* The first event has no leading comma */
+    fprintf(s_trace,
+            "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %ld, "
+            "\"tid\": 0, \"args\": {\"name\": \"piratpkg\"}}",
+            (long)getpid());
+    trace_thread("main");
+    trace_begin("piratpkg", NULL);
+    atexit(trace_close);
+    return 0;
+}
+
+void trace_close(void)
+{
+    if (s_trace == NULL)
+        return;
+
+    trace_end("piratpkg");
+    pthread_mutex_lock(&s_trace_lock);
+    fputs("\n]\n", s_trace);
+    fclose(s_trace);
+    s_trace = NULL;
+    pthread_mutex_unlock(&s_trace_lock);
+}
+
+void trace_begin(const char* name, const char* detail)
+{
+    if (s_trace != NULL)
+        _event("B", name, "detail", detail);
+}
+
+void trace_end(const char* name)
+{
+    if (s_trace != NULL)
+        _event("E", name, NULL, NULL);
+}
+
+void trace_thread(const char* name)
+{
+    if (s_trace != NULL)
+        _event("M", "thread_name", "name", name);
+}
+
+void trace_counter(const char* name, double value)
+{
+    double ts = _now_us() - s_start;
+
+    pthread_mutex_lock(&s_trace_lock);
+    if (s_trace != NULL)
+    {
+        fputs(",\n{\"ph\": \"C\", \"name\": ", s_trace);
+        json_string(s_trace, name);
+        fprintf(s_trace, ", \"pid\": %ld, \"ts\": %.3f, \"args\": {",
+                (long)getpid(), ts);
+        json_string(s_trace, name);
+        fprintf(s_trace, ": %g}}", value);
+    }
+    pthread_mutex_unlock(&s_trace_lock);
+}
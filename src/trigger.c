@@ -0,0 +1,373 @@
+/******************************************************************************
+ * trigger.c - Work run once at the end of a transaction
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <piratpkg.h>
+#include <trigger.h>
+#include <parser.h>
+#include <sandbox.h>
+#include <pkg.h>
+#include <db.h>
+#include <fs.h>
+#include <trace.h>
+#include <log.h>
+
+#define TRIGGER_SUFFIX ".trigger"
+
+/* =============================================================================
+ * Loading
+ * ========================================================================== */
+
+/* Append the words of value to *list, allocated in g_arena */
+static int _add_words(char*** list, size_t* num, char* value)
+{
+    char* save = NULL;
+    char* word;
+
+    for (word = strtok_r(value, " \t", &save); word != NULL;
+         word = strtok_r(NULL, " \t", &save))
+    {
+        char** grown = arena_alloc(&g_arena, (*num + 1) * sizeof(char*));
+
+        if (grown == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        if (*num > 0)
+            memcpy(grown, *list, *num * sizeof(char*));
+        grown[(*num)++] = word;
+        *list = grown;
+    }
+    return ACTION_RET_OK;
+}
+
+static int _load_one(struct trigger* trig, const char* path)
+{
+    char line[MAX_LINE_LENGTH];
+    struct key_value_pair kv_pair;
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        WARNING("Failed to open trigger %s: %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '#' || parse_single_key_value(line, &kv_pair) != 0)
+            continue;
+
+        if (strcmp(kv_pair.key, "PATHS") == 0)
+            _add_words(&trig->paths, &trig->num_paths, kv_pair.value);
+        else if (strcmp(kv_pair.key, "AFTER") == 0)
+            _add_words(&trig->after, &trig->num_after, kv_pair.value);
+        else if (strcmp(kv_pair.key, "RUN") == 0)
+        {
+            char** grown =
+                arena_alloc(&g_arena, (trig->num_run + 1) * sizeof(char*));
+            if (grown == NULL)
+                break;
+            if (trig->num_run > 0)
+                memcpy(grown, trig->run, trig->num_run * sizeof(char*));
+            grown[trig->num_run++] = kv_pair.value;
+            trig->run = grown;
+        }
+    }
+
+    fclose(file);
+    if (trig->num_run == 0)
+        WARNING("Trigger %s has nothing to RUN\n", trig->name);
+    return ACTION_RET_OK;
+}
+
+static struct trigger* _find(struct triggers* t, const char* name)
+{
+    size_t i;
+
+    for (i = 0; i < t->num; i++)
+        if (strcmp(t->list[i].name, name) == 0)
+            return &t->list[i];
+    return NULL;
+}
+
+static void _fire(struct trigger* trig, const char* package)
+{
+    size_t len = trig->packages != NULL ? strlen(trig->packages) : 0;
+    char* packages;
+
+    /* Packages come one at a time, a repeat is always the last one */
+    if (trig->fired && len >= strlen(package) &&
+        strcmp(trig->packages + len - strlen(package), package) == 0 &&
+        (len == strlen(package) ||
+         trig->packages[len - strlen(package) - 1] == ' '))
+        return;
+
+    packages = arena_alloc(&g_arena, len + strlen(package) + 2);
+    if (packages == NULL)
+        return;
+    sprintf(packages, "%s%s%s", len ? trig->packages : "", len ? " " : "",
+            package);
+    trig->packages = packages;
+    trig->fired = true;
+}
+
+static bool _matches(struct trigger* trig, const char* path)
+{
+    size_t i;
+
+    while (*path == '/')
+        path++;
+    for (i = 0; i < trig->num_paths; i++)
+    {
+        const char* pattern = trig->paths[i];
+
+        while (*pattern == '/')
+            pattern++;
+        if (fnmatch(pattern, path, 0) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* =============================================================================
+ * Running
+ * ========================================================================== */
+
+static void* _run_one(void* arg)
+{
+    struct trigger* trig = arg;
+    struct sandbox_ctx* ctx;
+    struct sandbox_usage usage;
+    char* envp[3];
+    size_t i;
+
+    envp[0] = arena_alloc(&g_arena, strlen(g_config.root) + 8);
+    envp[1] = arena_alloc(&g_arena, strlen(trig->packages) + 18);
+    envp[2] = NULL;
+    if (envp[0] == NULL || envp[1] == NULL)
+    {
+        trig->status = ACTION_RET_ERR_UNKNOWN;
+        return NULL;
+    }
+    sprintf(envp[0], "PREFIX=%s", g_config.root);
+    sprintf(envp[1], "TRIGGER_PACKAGES=%s", trig->packages);
+
+    trace_thread("trigger");
+    trace_begin("trigger", trig->name);
+    ctx = sandbox_create(envp, NULL);
+    if (ctx == NULL)
+    {
+        trig->status = ACTION_RET_ERR_UNKNOWN;
+        trace_end("trigger");
+        return NULL;
+    }
+
+    sandbox_timeout(ctx, (unsigned long)g_config.function_timeout,
+                    (unsigned long)g_config.idle_timeout);
+    for (i = 0; i < trig->num_run && trig->status == 0; i++)
+        trig->status = sandbox_exec(ctx, trig->run[i], !g_config.verbose);
+    sandbox_finish(ctx, &usage);
+    sandbox_destroy(ctx);
+    trace_end("trigger");
+    return NULL;
+}
+
+/* Fired and waiting only for triggers that are done or didn't fire */
+static bool _ready(struct triggers* t, struct trigger* trig)
+{
+    size_t i;
+
+    if (!trig->fired || trig->started)
+        return false;
+    for (i = 0; i < trig->num_after; i++)
+    {
+        struct trigger* dep = _find(t, trig->after[i]);
+
+        if (dep != NULL && dep->fired && !dep->done)
+            return false;
+    }
+    return true;
+}
+
+static bool _any_ready(struct triggers* t)
+{
+    size_t i;
+
+    for (i = 0; i < t->num; i++)
+        if (_ready(t, &t->list[i]))
+            return true;
+    return false;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int triggers_load(struct triggers* t)
+{
+    char* dir_path = db_path("triggers");
+    struct dirent* entry;
+    size_t cap = 0;
+    DIR* dir;
+
+    memset(t, 0, sizeof(*t));
+    dir = opendir(dir_path);
+    if (dir == NULL)
+        return errno == ENOENT ? ACTION_RET_OK : ACTION_RET_ERR_IO;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(entry->d_name);
+        struct trigger* trig;
+
+        if (len <= strlen(TRIGGER_SUFFIX) ||
+            strcmp(entry->d_name + len - strlen(TRIGGER_SUFFIX),
+                   TRIGGER_SUFFIX) != 0)
+            continue;
+
+        if (t->num == cap)
+        {
+            struct trigger* grown;
+
+            cap = cap ? cap * 2 : 16;
+            grown = arena_alloc(&g_arena, cap * sizeof(struct trigger));
+            if (grown == NULL)
+                break;
+            if (t->num > 0)
+                memcpy(grown, t->list, t->num * sizeof(struct trigger));
+            t->list = grown;
+        }
+
+        trig = &t->list[t->num];
+        memset(trig, 0, sizeof(*trig));
+        trig->name = strdup_safe(entry->d_name);
+        trig->name[len - strlen(TRIGGER_SUFFIX)] = '\0';
+        if (_load_one(trig, fs_join(dir_path, entry->d_name)) ==
+            ACTION_RET_OK)
+            t->num++;
+    }
+
+    closedir(dir);
+    return ACTION_RET_OK;
+}
+
+void triggers_match_files(struct triggers* t, const char* name,
+                          struct db_file* files, size_t num_files)
+{
+    size_t i, j;
+
+    for (i = 0; i < t->num; i++)
+    {
+        for (j = 0; j < num_files; j++)
+        {
+            if (_matches(&t->list[i], files[j].path))
+            {
+                _fire(&t->list[i], name);
+                break;
+            }
+        }
+    }
+}
+
+void triggers_match(struct triggers* t, struct pkg_ctx* pkg)
+{
+    char* names;
+    char* save = NULL;
+    char* name;
+
+    triggers_match_files(t, pkg->name, pkg->files, pkg->num_files);
+    if (pkg->triggers == NULL)
+        return;
+
+    names = strdup_safe(pkg->triggers);
+    for (name = strtok_r(names, " \t", &save); name != NULL;
+         name = strtok_r(NULL, " \t", &save))
+    {
+        struct trigger* trig = _find(t, name);
+
+        if (trig != NULL)
+            _fire(trig, pkg->name);
+        else
+            WARNING("%s asks for trigger %s, which isn't installed\n",
+                    pkg->name, name);
+    }
+}
+
+size_t triggers_run(struct triggers* t, size_t jobs)
+{
+    pthread_t threads[TRIGGER_MAX_PARALLEL];
+    struct trigger* running[TRIGGER_MAX_PARALLEL];
+    size_t i, num_failed = 0;
+
+    if (jobs == 0)
+        jobs = 1;
+    if (jobs > TRIGGER_MAX_PARALLEL)
+        jobs = TRIGGER_MAX_PARALLEL;
+
+    for (;;)
+    {
+        size_t num_running = 0, pending = 0;
+
+        /* One wave of triggers that don't wait on each other */
+        for (i = 0; i < t->num && num_running < jobs; i++)
+        {
+            struct trigger* trig = &t->list[i];
+
+            if (!_ready(t, trig))
+                continue;
+            INFO("Running trigger %s for %s\n", trig->name, trig->packages);
+            trig->started = true;
+            if (pthread_create(&threads[num_running], NULL, _run_one,
+                               trig) != 0)
+            {
+                _run_one(trig);
+                trig->done = true;
+                continue;
+            }
+            running[num_running++] = trig;
+        }
+        for (i = 0; i < num_running; i++)
+        {
+            pthread_join(threads[i], NULL);
+            running[i]->done = true;
+        }
+
+        for (i = 0; i < t->num; i++)
+            if (t->list[i].fired && !t->list[i].done)
+                pending++;
+        if (pending == 0)
+            break;
+
+        /* The rest wait on each other, run them in any order */
+        if (num_running == 0 && !_any_ready(t))
+        {
+            WARNING("Triggers wait on each other in a cycle\n");
+            for (i = 0; i < t->num; i++)
+                t->list[i].num_after = 0;
+        }
+    }
+
+    for (i = 0; i < t->num; i++)
+    {
+        if (t->list[i].fired && t->list[i].status != 0)
+        {
+            WARNING("Trigger %s failed.\n", t->list[i].name);
+            num_failed++;
+        }
+    }
+    return num_failed;
+}
@@ -0,0 +1,1045 @@
+/******************************************************************************
+ * txn.c - Install transactions
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <piratpkg.h>
+#include <txn.h>
+#include <pkg.h>
+#include <db.h>
+#include <fetch.h>
+#include <solver.h>
+#include <strings.h>
+#include <log.h>
+#include <trace.h>
+#include <json.h>
+#include <fs.h>
+#include <timings.h>
+#include <time.h>
+#include <psi.h>
+#include <budget.h>
+#include <trigger.h>
+#include <wal.h>
+
+/* =============================================================================
+ * Queues
+ * ========================================================================== */
+
+static void _queue_init(struct txn_queue* q, size_t producers)
+{
+    memset(q, 0, sizeof(*q));
+    q->producers = producers;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void _queue_destroy(struct txn_queue* q)
+{
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+}
+
+static void _queue_push(struct txn_queue* q, struct txn_item* item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == TXN_QUEUE_SIZE)
+        pthread_cond_wait(&q->not_full, &q->lock);
+
+    q->items[(q->head + q->count) % TXN_QUEUE_SIZE] = item;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* Returns NULL once the queue is empty and every producer closed it */
+static struct txn_item* _queue_pop(struct txn_queue* q)
+{
+    struct txn_item* item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && q->producers > 0)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+
+    if (q->count > 0)
+    {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % TXN_QUEUE_SIZE;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return item;
+}
+
+static void _queue_close(struct txn_queue* q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->producers--;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* =============================================================================
+ * Resolve
+ * ========================================================================== */
+
+static int _add_item(struct txn* txn, struct pkg_ctx* pkg)
+{
+    if (txn->num_items == txn->cap)
+    {
+        size_t new_cap = txn->cap ? txn->cap * 2 : 16;
+        struct txn_item* grown =
+            arena_alloc(&g_arena, new_cap * sizeof(struct txn_item));
+        if (grown == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        if (txn->num_items > 0)
+            memcpy(grown, txn->items, txn->num_items * sizeof(*grown));
+        txn->items = grown;
+        txn->cap = new_cap;
+    }
+
+    memset(&txn->items[txn->num_items], 0, sizeof(struct txn_item));
+    txn->items[txn->num_items].pkg = pkg;
+    txn->items[txn->num_items].status = ACTION_RET_OK;
+    txn->num_items++;
+    return ACTION_RET_OK;
+}
+
+/* Parse every manifest the solver picked and point each item at the items
+ * it has to wait for */
+static int _load_plan(struct txn* txn, struct solver_pkg* plan, size_t n)
+{
+    size_t i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        struct pkg_ctx* pkg = pkg_parse(plan[i].spec);
+        if (pkg == NULL)
+            return ACTION_RET_PKG_ERR_NOT_FOUND;
+        pkg->reason = plan[i].requested ? PKG_REASON_EXPLICIT
+                                        : PKG_REASON_DEPENDENCY;
+        if (_add_item(txn, pkg) != ACTION_RET_OK)
+            return ACTION_RET_ERR_UNKNOWN;
+    }
+
+    /* items only stops moving once everything is added */
+    for (i = 0; i < n; i++)
+    {
+        struct txn_item* item = &txn->items[i];
+
+        item->deps =
+            arena_alloc(&g_arena, (plan[i].num_deps + 1) * sizeof(*item->deps));
+        if (item->deps == NULL)
+            return ACTION_RET_ERR_UNKNOWN;
+        for (j = 0; j < plan[i].num_deps; j++)
+            item->deps[item->num_deps++] = &txn->items[plan[i].deps[j]];
+    }
+
+    return ACTION_RET_OK;
+}
+
+/* What the install the log is from has left to do. Packages it committed
+ * are trusted as long as the database still has them at that version. */
+static int _resume_plan(struct txn* txn, struct solver_pkg** plan,
+                        size_t* num_plan)
+{
+    struct wal wal;
+    struct db db;
+    size_t* index;
+    size_t i, j;
+
+    *num_plan = 0;
+    if (wal_load(&wal) != ACTION_RET_OK || db_load(&db) != ACTION_RET_OK)
+        return ACTION_RET_ERR_IO;
+    if (wal.num_plan == 0)
+    {
+        ERROR("There is no interrupted install to resume.\n");
+        return ACTION_RET_PKG_ERR_NOT_FOUND;
+    }
+
+    *plan = arena_alloc(&g_arena, wal.num_plan * sizeof(**plan));
+    txn->resumed = arena_alloc(&g_arena, wal.num_plan * sizeof(**plan));
+    index = arena_alloc(&g_arena, wal.num_plan * sizeof(*index));
+    if (*plan == NULL || txn->resumed == NULL || index == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < wal.num_plan; i++)
+    {
+        struct solver_pkg* p = &wal.plan[i];
+        struct db_entry* entry = db_find(&db, p->name);
+
+        if (wal.committed[i] && entry != NULL &&
+            strcmp(entry->version, p->version) == 0)
+        {
+            index[i] = (size_t)-1;
+            txn->resumed[txn->num_resumed++] = *p;
+            continue;
+        }
+
+        /* Renumbered, and without the dependencies that are done */
+        index[i] = *num_plan;
+        (*plan)[*num_plan] = *p;
+        (*plan)[*num_plan].num_deps = 0;
+        for (j = 0; j < p->num_deps; j++)
+            if (index[p->deps[j]] != (size_t)-1)
+                (*plan)[*num_plan].deps[(*plan)[*num_plan].num_deps++] =
+                    index[p->deps[j]];
+        (*num_plan)++;
+    }
+
+    INFO("Resuming an interrupted install, %lu of %lu packages are already "
+         "committed.\n",
+         (unsigned long)txn->num_resumed, (unsigned long)wal.num_plan);
+    return ACTION_RET_OK;
+}
+
+/* =============================================================================
+ * Concurrency
+ * ========================================================================== */
+
+/* avg10 percentages that take a build slot away, or half of them for
+ * TXN_PSI_MEMORY_FULL */
+#define TXN_PSI_CPU_SOME 60.0
+#define TXN_PSI_MEMORY_SOME 20.0
+#define TXN_PSI_MEMORY_FULL 5.0
+#define TXN_PSI_IO_SOME 40.0
+
+/* Below all of these a slot is handed back */
+#define TXN_PSI_CPU_IDLE 20.0
+#define TXN_PSI_MEMORY_IDLE 5.0
+#define TXN_PSI_IO_IDLE 10.0
+
+static double _now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* With txn->lock held */
+static void _set_limit(struct txn* txn, size_t limit, const char* reason,
+                       double pressure)
+{
+    struct txn_jobs_change* c;
+
+    if (txn->num_changes == txn->cap_changes)
+    {
+        size_t new_cap = txn->cap_changes ? txn->cap_changes * 2 : 16;
+        struct txn_jobs_change* grown =
+            arena_alloc(&g_arena, new_cap * sizeof(*grown));
+        if (grown == NULL)
+            return;
+        if (txn->num_changes > 0)
+            memcpy(grown, txn->changes, txn->num_changes * sizeof(*grown));
+        txn->changes = grown;
+        txn->cap_changes = new_cap;
+    }
+
+    c = &txn->changes[txn->num_changes++];
+    c->at = _now() - txn->started;
+    c->from = txn->limit;
+    c->to = limit;
+    c->reason = reason;
+    c->pressure = pressure;
+
+    MSG("Running up to %lu builds at once (%s %.1f%%)\n",
+        (unsigned long)limit, reason, pressure);
+    txn->limit = limit;
+    trace_counter("jobs", (double)limit);
+    pthread_cond_broadcast(&txn->slot_free);
+}
+
+/* With txn->lock held, whether the limit changed. Stalls halve it, but
+ * builds already running keep going and avg10 takes a full window to show
+ * the drop, so even those wait out the hold. */
+static bool _adjust(struct txn* txn, const struct psi* p, bool hold)
+{
+    if (hold)
+        return false;
+    else if (p->memory_full > TXN_PSI_MEMORY_FULL && txn->limit > 1)
+        _set_limit(txn, txn->limit / 2, "memory stall", p->memory_full);
+    else if (p->memory_some > TXN_PSI_MEMORY_SOME && txn->limit > 1)
+        _set_limit(txn, txn->limit - 1, "memory pressure", p->memory_some);
+    else if (p->cpu_some > TXN_PSI_CPU_SOME && txn->limit > 1)
+        _set_limit(txn, txn->limit - 1, "cpu pressure", p->cpu_some);
+    else if (p->io_some > TXN_PSI_IO_SOME && txn->limit > 1)
+        _set_limit(txn, txn->limit - 1, "io pressure", p->io_some);
+    else if (p->cpu_some < TXN_PSI_CPU_IDLE &&
+             p->memory_some < TXN_PSI_MEMORY_IDLE &&
+             p->io_some < TXN_PSI_IO_IDLE && txn->limit < txn->jobs &&
+             txn->running >= txn->limit)
+        _set_limit(txn, txn->limit + 1, "idle", p->cpu_some);
+    else
+        return false;
+    return true;
+}
+
+/* Watches the host's pressure until the builds are done */
+static void* _monitor_stage(void* arg)
+{
+    struct txn* txn = arg;
+    double last_change = 0;
+    struct timespec until;
+    struct psi p;
+
+    trace_thread("monitor");
+    pthread_mutex_lock(&txn->lock);
+    while (!txn->finished)
+    {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += TXN_PSI_INTERVAL;
+        pthread_cond_timedwait(&txn->wake_monitor, &txn->lock, &until);
+        if (txn->finished)
+            break;
+
+        pthread_mutex_unlock(&txn->lock);
+        if (psi_read(&p) != 0)
+        {
+            pthread_mutex_lock(&txn->lock);
+            break;
+        }
+        pthread_mutex_lock(&txn->lock);
+
+        if (_adjust(txn, &p, _now() - last_change < TXN_PSI_HOLD))
+            last_change = _now();
+    }
+    pthread_mutex_unlock(&txn->lock);
+    return NULL;
+}
+
+/* Wait for a build slot */
+static void _take_slot(struct txn* txn)
+{
+    pthread_mutex_lock(&txn->lock);
+    while (txn->running >= txn->limit)
+        pthread_cond_wait(&txn->slot_free, &txn->lock);
+    txn->running++;
+    pthread_mutex_unlock(&txn->lock);
+}
+
+static void _give_slot(struct txn* txn)
+{
+    pthread_mutex_lock(&txn->lock);
+    txn->running--;
+    pthread_cond_signal(&txn->slot_free);
+    pthread_mutex_unlock(&txn->lock);
+}
+
+/* =============================================================================
+ * Stages
+ * ========================================================================== */
+
+static void _fail(struct txn_item* item, int status)
+{
+    if (item->status == ACTION_RET_OK)
+        item->status = status;
+}
+
+/* A failure that running again may get past, unlike file conflicts or a
+ * dependency that failed */
+static void _fail_retry(struct txn_item* item, int status)
+{
+    if (item->status == ACTION_RET_OK && status != ACTION_RET_OK)
+        item->retry = true;
+    _fail(item, status);
+}
+
+/* Download sources ahead of the builds that need them */
+static void* _fetch_stage(void* arg)
+{
+    struct txn* txn = arg;
+    struct txn_item* item;
+
+    trace_thread("fetch");
+    budget_background();
+    while ((item = _queue_pop(&txn->fetch)) != NULL)
+    {
+        /* Dependents may still miss the build cache once their dependencies
+         * are in, so only skip downloads for packages without any */
+        if (item->status == ACTION_RET_OK &&
+            (item->num_deps > 0 || pkg_prebuilt(item->pkg, true) == NULL))
+            _fail_retry(item, fetch_sources(&item->pkg, 1));
+        _queue_push(&txn->unpack, item);
+    }
+
+    _queue_close(&txn->unpack);
+    return NULL;
+}
+
+/* Unpack prebuilt archives, or set up the staging tree and sandbox */
+static void* _unpack_stage(void* arg)
+{
+    struct txn* txn = arg;
+    struct txn_item* item;
+
+    trace_thread("unpack");
+    budget_background();
+    while ((item = _queue_pop(&txn->unpack)) != NULL)
+    {
+        if (item->status == ACTION_RET_OK && item->num_deps == 0)
+        {
+            char* prebuilt = pkg_prebuilt(item->pkg, true);
+            if (prebuilt != NULL && pkg_unpack(item->pkg, prebuilt) == 0)
+                item->staged = true;
+        }
+
+        if (item->status == ACTION_RET_OK && !item->staged)
+            _fail_retry(item, pkg_prepare(item->pkg));
+
+        _queue_push(&txn->build, item);
+    }
+
+    _queue_close(&txn->build);
+    return NULL;
+}
+
+/* Wait until every dependency in the transaction is committed */
+static int _wait_deps(struct txn* txn, struct txn_item* item)
+{
+    int ret = ACTION_RET_OK;
+    size_t i;
+
+    pthread_mutex_lock(&txn->lock);
+    for (i = 0; i < item->num_deps; i++)
+    {
+        while (!item->deps[i]->done)
+            pthread_cond_wait(&txn->item_done, &txn->lock);
+        if (item->deps[i]->status != ACTION_RET_OK)
+        {
+            ERROR("Not installing %s, its dependency %s failed.\n",
+                  item->pkg->name, item->deps[i]->pkg->name);
+            ret = ACTION_RET_PKG_ERR_DEPENDENCY;
+        }
+    }
+    pthread_mutex_unlock(&txn->lock);
+
+    return ret;
+}
+
+/* configure() through install(), --jobs of these run at once */
+static void* _build_stage(void* arg)
+{
+    struct txn* txn = arg;
+    struct txn_item* item;
+
+    trace_thread("build");
+    budget_background();
+    while ((item = _queue_pop(&txn->build)) != NULL)
+    {
+        if (item->status == ACTION_RET_OK && item->num_deps > 0)
+        {
+            _fail(item, _wait_deps(txn, item));
+
+            /* The build key covers the dependencies just installed */
+            if (item->status == ACTION_RET_OK)
+                _fail_retry(item, pkg_refresh_build_key(item->pkg));
+            if (item->status == ACTION_RET_OK)
+            {
+                char* prebuilt = pkg_prebuilt(item->pkg, true);
+                if (prebuilt != NULL && pkg_unpack(item->pkg, prebuilt) == 0)
+                    item->staged = true;
+                else if (prebuilt != NULL)
+                    _fail_retry(item, pkg_prepare(item->pkg));
+            }
+        }
+
+        if (item->status == ACTION_RET_OK && !item->staged)
+        {
+            _take_slot(txn);
+            _fail_retry(item, pkg_build(item->pkg));
+            _give_slot(txn);
+        }
+
+        _queue_push(&txn->commit, item);
+    }
+
+    _queue_close(&txn->commit);
+    return NULL;
+}
+
+/* Commits touch ROOT and the database, so they stay on one thread */
+static void* _commit_stage(void* arg)
+{
+    struct txn* txn = arg;
+    struct txn_item* item;
+    struct pkg_db pdb;
+    int loaded;
+
+    trace_thread("commit");
+    loaded = pkg_db_open(&pdb);
+    while ((item = _queue_pop(&txn->commit)) != NULL)
+    {
+        if (item->status == ACTION_RET_OK)
+            _fail(item, loaded);
+        if (item->status == ACTION_RET_OK)
+            _fail(item, pkg_commit(item->pkg, &pdb));
+        if (item->status == ACTION_RET_OK)
+            wal_commit(&txn->wal, (size_t)(item - txn->items));
+        else
+            ERROR("Installation of %s-%s aborted.\n", item->pkg->name,
+                  item->pkg->version);
+        pkg_cleanup(item->pkg);
+
+        pthread_mutex_lock(&txn->lock);
+        item->done = true;
+        pthread_cond_broadcast(&txn->item_done);
+        pthread_mutex_unlock(&txn->lock);
+    }
+
+    pkg_db_close(&pdb);
+    return NULL;
+}
+
+/* ldconfig and the like, once for everything that was committed. Trigger
+ * files are read now, the transaction may have just installed some. */
+static void _run_triggers(struct txn* txn)
+{
+    struct triggers triggers;
+    size_t i;
+
+    if (triggers_load(&triggers) != ACTION_RET_OK)
+    {
+        WARNING("Failed to read triggers.\n");
+        return;
+    }
+    for (i = 0; i < txn->num_items; i++)
+        if (txn->items[i].status == ACTION_RET_OK)
+            triggers_match(&triggers, txn->items[i].pkg);
+
+    /* Their triggers didn't get to run before the interruption either */
+    for (i = 0; i < txn->num_resumed; i++)
+    {
+        struct db_file* files;
+        size_t num_files;
+
+        if (db_read_files(txn->resumed[i].name, &files, &num_files) ==
+            ACTION_RET_OK)
+            triggers_match_files(&triggers, txn->resumed[i].name, files,
+                                 num_files);
+    }
+    triggers_run(&triggers, txn->jobs);
+}
+
+/* =============================================================================
+ * Scheduling
+ * ========================================================================== */
+
+/* Estimates from past builds, critical paths and the build order */
+static int _schedule(struct txn* txn, struct timings* timings)
+{
+    size_t* pending;
+    size_t i, j, num_known = 0, num_order = 0;
+    double known = 0;
+
+    for (i = 0; i < txn->num_items; i++)
+    {
+        struct pkg_ctx* pkg = txn->items[i].pkg;
+        txn->items[i].estimate =
+            timings_estimate(timings, pkg->name, pkg->version);
+        if (txn->items[i].estimate >= 0)
+        {
+            known += txn->items[i].estimate;
+            num_known++;
+        }
+    }
+
+    /* Never built before, assume an average build */
+    for (i = 0; i < txn->num_items; i++)
+    {
+        if (txn->items[i].estimate < 0)
+            txn->items[i].estimate = num_known > 0 ? known / num_known : 0;
+    }
+
+    /* Items are in dependency order, so dependents are done first */
+    for (i = txn->num_items; i > 0; i--)
+    {
+        struct txn_item* item = &txn->items[i - 1];
+
+        item->critical += item->estimate;
+        for (j = 0; j < item->num_deps; j++)
+        {
+            if (item->deps[j]->critical < item->critical)
+                item->deps[j]->critical = item->critical;
+        }
+    }
+
+    txn->order = arena_alloc(&g_arena,
+                             (txn->num_items + 1) * sizeof(*txn->order));
+    pending = arena_alloc(&g_arena, (txn->num_items + 1) * sizeof(size_t));
+    if (txn->order == NULL || pending == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    for (i = 0; i < txn->num_items; i++)
+        pending[i] = txn->items[i].num_deps;
+
+    /* Of the packages whose dependencies are in, the longest chain first */
+    while (num_order < txn->num_items)
+    {
+        struct txn_item* best = NULL;
+
+        for (i = 0; i < txn->num_items; i++)
+        {
+            if (pending[i] == 0 &&
+                (best == NULL || txn->items[i].critical > best->critical))
+                best = &txn->items[i];
+        }
+
+        pending[best - txn->items] = (size_t)-1;
+        txn->order[num_order++] = best;
+        for (i = 0; i < txn->num_items; i++)
+        {
+            for (j = 0; j < txn->items[i].num_deps; j++)
+            {
+                if (txn->items[i].deps[j] == best)
+                    pending[i]--;
+            }
+        }
+    }
+
+    return ACTION_RET_OK;
+}
+
+static void _format_duration(double secs, char* buf, size_t size)
+{
+    unsigned long s = (unsigned long)(secs + 0.5);
+
+    if (s >= 3600)
+        snprintf(buf, size, "%luh %02lum", s / 3600, s / 60 % 60);
+    else if (s >= 60)
+        snprintf(buf, size, "%lum %02lus", s / 60, s % 60);
+    else
+        snprintf(buf, size, "%lus", s);
+}
+
+/* Play the build order through --jobs workers, like _build_stage() does */
+static void _dry_run(struct txn* txn, struct timings* timings)
+{
+    double* finish = arena_alloc(&g_arena, txn->num_items * sizeof(double));
+    double workers[TXN_MAX_JOBS];
+    double end = 0;
+    char buf[32];
+    char when[16];
+    time_t done;
+    size_t i, j;
+
+    if (finish == NULL)
+        return;
+    memset(workers, 0, sizeof(workers));
+
+    INFO("Build order (%lu jobs):\n", (unsigned long)txn->jobs);
+    for (i = 0; i < txn->num_items; i++)
+    {
+        struct txn_item* item = txn->order[i];
+        struct pkg_ctx* pkg = item->pkg;
+        size_t w = 0;
+        double start;
+
+        for (j = 1; j < txn->jobs; j++)
+        {
+            if (workers[j] < workers[w])
+                w = j;
+        }
+
+        start = workers[w];
+        for (j = 0; j < item->num_deps; j++)
+        {
+            double dep = finish[item->deps[j] - txn->items];
+            if (dep > start)
+                start = dep;
+        }
+        finish[item - txn->items] = workers[w] = start + item->estimate;
+        if (workers[w] > end)
+            end = workers[w];
+
+        _format_duration(item->estimate, buf, sizeof(buf));
+        printf("  %-32s %10s%s\n", pkg->name, buf,
+               timings_estimate(timings, pkg->name, pkg->version) < 0
+                   ? " (no history)"
+                   : "");
+    }
+
+    done = time(NULL) + (time_t)end;
+    strftime(when, sizeof(when), "%H:%M", localtime(&done));
+    _format_duration(end, buf, sizeof(buf));
+    INFO("Estimated time: %s, done around %s\n", buf, when);
+}
+
+/* Fold the functions of everything built from source into the history */
+static void _record_timings(struct txn* txn, struct timings* timings)
+{
+    size_t i, j;
+
+    for (i = 0; i < txn->num_items; i++)
+    {
+        struct pkg_ctx* pkg = txn->items[i].pkg;
+
+        if (txn->items[i].status != ACTION_RET_OK || txn->items[i].staged)
+            continue;
+        for (j = 0; j < pkg->num_usage; j++)
+            timings_record(timings, pkg->name, pkg->version,
+                           pkg->usage[j].function, pkg->usage[j].usage.wall);
+    }
+
+    if (timings_save(timings) != ACTION_RET_OK)
+        WARNING("Failed to save build timings.\n");
+}
+
+/* =============================================================================
+ * Resource report
+ * ========================================================================== */
+
+static void _usage_json(FILE* out, const char* function,
+                        const struct sandbox_usage* u)
+{
+    fputs("{", out);
+    if (function != NULL)
+    {
+        json_field(out, "function", function, 1);
+        fputs(", ", out);
+    }
+    fprintf(out,
+            "\"wall\": %.3f, \"user\": %.3f, \"sys\": %.3f, "
+            "\"max_rss_kib\": %ld, \"read_kib\": %ld, \"written_kib\": %ld}",
+            u->wall, u->user, u->sys, u->max_rss, u->in_blocks / 2,
+            u->out_blocks / 2);
+}
+
+/* Whether item was built from source this time and got slower than its
+ * history says it should be */
+static int _regressed(struct txn_item* item, struct timings* timings,
+                      double* last, double* history)
+{
+    *last = 0;
+    *history = 0;
+    if (item->status != ACTION_RET_OK || item->staged ||
+        item->pkg->num_usage == 0)
+        return 0;
+    timings_last(timings, item->pkg->name, item->pkg->version, last,
+                 history);
+    return timings_regressed(*last, *history);
+}
+
+static void _report_json(FILE* out, struct txn* txn, struct timings* timings)
+{
+    size_t i, j;
+
+    fputs("{\"packages\": [", out);
+    for (i = 0; i < txn->num_items; i++)
+    {
+        struct txn_item* item = &txn->items[i];
+        struct pkg_ctx* pkg = item->pkg;
+        struct sandbox_usage total;
+        double last, history;
+        int regressed = _regressed(item, timings, &last, &history);
+
+        memset(&total, 0, sizeof(total));
+        fputs(i > 0 ? ",\n  {" : "\n  {", out);
+        json_field(out, "name", pkg->name, 1);
+        json_field(out, "version", pkg->version, 0);
+        json_field(out, "status",
+                   item->status == ACTION_RET_OK ? "ok" : "failed", 0);
+        fputs(", \"prebuilt\": ", out);
+        fputs(item->staged ? "true" : "false", out);
+        fprintf(out, ", \"regressed\": %s", regressed ? "true" : "false");
+        if (history > 0)
+            fprintf(out, ", \"previous\": %.3f", history);
+        fputs(", \"functions\": [", out);
+        for (j = 0; j < pkg->num_usage; j++)
+        {
+            const struct sandbox_usage* u = &pkg->usage[j].usage;
+
+            if (j > 0)
+                fputs(", ", out);
+            _usage_json(out, pkg->usage[j].function, u);
+            total.wall += u->wall;
+            total.user += u->user;
+            total.sys += u->sys;
+            if (u->max_rss > total.max_rss)
+                total.max_rss = u->max_rss;
+            total.in_blocks += u->in_blocks;
+            total.out_blocks += u->out_blocks;
+        }
+        fputs("], \"total\": ", out);
+        _usage_json(out, NULL, &total);
+        fputs("}", out);
+    }
+    fputs("\n], \"jobs\": [", out);
+    for (i = 0; i < txn->num_changes; i++)
+    {
+        struct txn_jobs_change* c = &txn->changes[i];
+
+        fputs(i > 0 ? ",\n  {" : "\n  {", out);
+        fprintf(out, "\"at\": %.3f, \"from\": %lu, \"to\": %lu, ", c->at,
+                (unsigned long)c->from, (unsigned long)c->to);
+        json_field(out, "reason", c->reason, 1);
+        fprintf(out, ", \"pressure\": %.2f}", c->pressure);
+    }
+    fputs(txn->num_changes > 0 ? "\n]}\n" : "]}\n", out);
+}
+
+static void _report_table(struct txn* txn, struct timings* timings)
+{
+    size_t i, j;
+
+    printf("%-16s %-12s %7s %7s %7s %8s %8s %8s\n", "Package", "Function",
+           "Wall", "User", "Sys", "Max RSS", "Read", "Written");
+    for (i = 0; i < txn->num_items; i++)
+    {
+        struct pkg_ctx* pkg = txn->items[i].pkg;
+
+        for (j = 0; j < pkg->num_usage; j++)
+        {
+            const struct sandbox_usage* u = &pkg->usage[j].usage;
+
+            printf("%-16s %-12s %6.2fs %6.2fs %6.2fs %7.1fM %7.1fM %7.1fM\n",
+                   j == 0 ? pkg->name : "", pkg->usage[j].function, u->wall,
+                   u->user, u->sys, u->max_rss / 1024.0,
+                   u->in_blocks / 2048.0, u->out_blocks / 2048.0);
+        }
+    }
+
+    for (i = 0; i < txn->num_items; i++)
+    {
+        struct pkg_ctx* pkg = txn->items[i].pkg;
+        double last, history;
+
+        if (_regressed(&txn->items[i], timings, &last, &history))
+            WARNING("Build of %s-%s regressed: %.1fs, was %.1fs (+%.0f%%)\n",
+                    pkg->name, pkg->version, last, history,
+                    (last - history) * 100 / history);
+    }
+
+    for (i = 0; i < txn->num_changes; i++)
+    {
+        struct txn_jobs_change* c = &txn->changes[i];
+
+        INFO("Builds at once %lu -> %lu after %.1fs, %s %.1f%%\n",
+             (unsigned long)c->from, (unsigned long)c->to, c->at, c->reason,
+             c->pressure);
+    }
+}
+
+/* What every function used, as a table (or JSON with --json) and in
+ * report.json in the database directory, with builds that got slower than
+ * their history flagged. Expects this run's timings to be recorded. */
+static void _report(struct txn* txn, struct timings* timings)
+{
+    char* path = db_path("report.json");
+    char* tmp_path;
+    FILE* file;
+    size_t i, num_usage = 0;
+
+    for (i = 0; i < txn->num_items; i++)
+        num_usage += txn->items[i].pkg->num_usage;
+
+    if (g_config.json)
+        _report_json(stdout, txn, timings);
+    else if (num_usage > 0)
+        _report_table(txn, timings);
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return;
+    _report_json(file, txn, timings);
+    if (fs_close_atomic(file, tmp_path, path) == ACTION_RET_OK)
+        MSG("Resource report written to %s\n", path);
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+int txn_install(char** names, size_t num_names)
+{
+    pthread_t fetch, unpack, commit, monitor;
+    bool monitoring = false;
+    bool retry;
+    struct psi psi;
+    pthread_t builders[TXN_MAX_JOBS];
+    size_t num_builders = 0;
+    struct solver_pkg* plan;
+    size_t num_plan;
+    struct timings timings;
+    struct txn txn;
+    size_t i;
+    int ret;
+
+    memset(&txn, 0, sizeof(txn));
+    txn.wal.fd = -1;
+    txn.jobs = g_config.jobs > 0 ? g_config.jobs : 1;
+    if (txn.jobs > TXN_MAX_JOBS)
+        txn.jobs = TXN_MAX_JOBS;
+
+    if (g_config.resume)
+    {
+        if (num_names > 0)
+            WARNING("Resuming, the packages given are ignored.\n");
+        ret = _resume_plan(&txn, &plan, &num_plan);
+    }
+    else
+    {
+        if (wal_exists())
+            WARNING("An earlier install didn't finish, this one replaces "
+                    "it. --resume finishes it instead.\n");
+        trace_begin("solver_solve", NULL);
+        ret = solver_solve(names, num_names, &plan, &num_plan);
+        trace_end("solver_solve");
+    }
+    if (ret == ACTION_RET_OK)
+        ret = _load_plan(&txn, plan, num_plan);
+    if (ret == ACTION_RET_PKG_ERR_ALREADY_INSTALLED)
+        return ret;
+    if (ret != ACTION_RET_OK)
+    {
+        ERROR("Installation aborted.\n");
+        return ret;
+    }
+
+    /* Interrupted after the last commit, only its triggers were left */
+    if (num_plan == 0 && !g_config.dry_run)
+    {
+        _run_triggers(&txn);
+        wal_end(&txn.wal, true);
+        INFO("Nothing is left to install.\n");
+        return ACTION_RET_OK;
+    }
+
+    if (timings_load(&timings) != ACTION_RET_OK ||
+        _schedule(&txn, &timings) != ACTION_RET_OK)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    if (g_config.dry_run)
+    {
+        _dry_run(&txn, &timings);
+        return ACTION_RET_OK;
+    }
+
+    for (i = 0; i < txn.num_items; i++)
+    {
+        struct pkg_ctx* pkg = txn.items[i].pkg;
+        INFO("Package: %s-%s\n", pkg->name, pkg->version);
+        INFO("Description: %s\n", pkg->description);
+        INFO("Maintainers: %s\n", pkg->maintainers);
+    }
+
+    if (!pkg_ask_confirm("Do you want to continue installing?"))
+    {
+        INFO("Installation aborted by user.\n");
+        return ACTION_RET_OK;
+    }
+
+    /* Everything after this can be picked up again with --resume */
+    if (wal_begin(&txn.wal, txn.resumed, txn.num_resumed, plan, num_plan) !=
+        ACTION_RET_OK)
+    {
+        ERROR("Installation aborted.\n");
+        return ACTION_RET_ERR_IO;
+    }
+
+    INFO("Starting installation...\n");
+
+    _queue_init(&txn.fetch, 1);
+    _queue_init(&txn.unpack, 1);
+    _queue_init(&txn.build, 1);
+    _queue_init(&txn.commit, txn.jobs);
+    pthread_mutex_init(&txn.lock, NULL);
+    pthread_cond_init(&txn.item_done, NULL);
+    pthread_cond_init(&txn.slot_free, NULL);
+    pthread_cond_init(&txn.wake_monitor, NULL);
+    txn.limit = txn.jobs;
+    txn.started = _now();
+    trace_counter("jobs", (double)txn.limit);
+
+    if (pthread_create(&fetch, NULL, _fetch_stage, &txn) != 0 ||
+        pthread_create(&unpack, NULL, _unpack_stage, &txn) != 0 ||
+        pthread_create(&commit, NULL, _commit_stage, &txn) != 0)
+    {
+        /* Without its threads the pipeline can't be unwound, bail out */
+        ERROR("Failed to start the install pipeline: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for (i = 0; i < txn.jobs; i++)
+    {
+        if (pthread_create(&builders[num_builders], NULL, _build_stage,
+                           &txn) != 0)
+            break;
+        num_builders++;
+    }
+    /* Builders that didn't start can't close the commit queue themselves */
+    for (i = num_builders; i < txn.jobs; i++)
+        _queue_close(&txn.commit);
+    if (num_builders == 0)
+    {
+        ERROR("Failed to start any build workers\n");
+        exit(1);
+    }
+
+    /* Nothing to adapt with a single worker or without PSI */
+    if (txn.jobs > 1 && psi_read(&psi) == 0 &&
+        pthread_create(&monitor, NULL, _monitor_stage, &txn) == 0)
+        monitoring = true;
+
+    /* Resolve already ran, feed the rest of the pipeline in build order */
+    for (i = 0; i < txn.num_items; i++)
+        _queue_push(&txn.fetch, txn.order[i]);
+    _queue_close(&txn.fetch);
+
+    pthread_join(fetch, NULL);
+    pthread_join(unpack, NULL);
+    for (i = 0; i < num_builders; i++)
+        pthread_join(builders[i], NULL);
+    pthread_join(commit, NULL);
+
+    if (monitoring)
+    {
+        pthread_mutex_lock(&txn.lock);
+        txn.finished = true;
+        pthread_cond_signal(&txn.wake_monitor);
+        pthread_mutex_unlock(&txn.lock);
+        pthread_join(monitor, NULL);
+    }
+
+    pthread_cond_destroy(&txn.wake_monitor);
+    pthread_cond_destroy(&txn.slot_free);
+    pthread_cond_destroy(&txn.item_done);
+    pthread_mutex_destroy(&txn.lock);
+    _queue_destroy(&txn.commit);
+    _queue_destroy(&txn.build);
+    _queue_destroy(&txn.unpack);
+    _queue_destroy(&txn.fetch);
+
+    _run_triggers(&txn);
+    _record_timings(&txn, &timings);
+    _report(&txn, &timings);
+
+    ret = ACTION_RET_OK;
+    retry = false;
+    for (i = 0; i < txn.num_items; i++)
+    {
+        if (ret == ACTION_RET_OK)
+            ret = txn.items[i].status;
+        retry = retry || txn.items[i].retry;
+    }
+
+    wal_end(&txn.wal, ret == ACTION_RET_OK);
+    if (retry)
+        INFO("Run again with --resume to retry what failed to fetch or "
+             "build.\n");
+    return ret;
+}
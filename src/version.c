@@ -0,0 +1,200 @@
+/******************************************************************************
+ * version.c - Package version comparison
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <piratpkg.h>
+#include <version.h>
+#include <strings.h>
+
+/* Weight of a byte in a non-digit run, the end of the run weighs 0 */
+static int _order(int c)
+{
+    if (c == '~')
+        return -1;
+    if (c == '\0' || isdigit(c))
+        return 0;
+    if (isalpha(c))
+        return c;
+    return c + 256;
+}
+
+static unsigned long _epoch(const char** v)
+{
+    const char* c = *v;
+    unsigned long epoch = 0;
+
+    while (isdigit((unsigned char)*c))
+        epoch = epoch * 10 + (unsigned long)(*c++ - '0');
+
+    if (*c != ':' || c == *v)
+        return 0;
+    *v = c + 1;
+    return epoch;
+}
+
+int vercmp(const char* a, const char* b)
+{
+    unsigned long ea = _epoch(&a), eb = _epoch(&b);
+
+    if (ea != eb)
+        return ea < eb ? -1 : 1;
+
+    while (*a != '\0' || *b != '\0')
+    {
+        int first_diff = 0;
+
+        while ((*a != '\0' && !isdigit((unsigned char)*a)) ||
+               (*b != '\0' && !isdigit((unsigned char)*b)))
+        {
+            int oa = _order((unsigned char)*a), ob = _order((unsigned char)*b);
+            if (oa != ob)
+                return oa - ob;
+            a++;
+            b++;
+        }
+
+        /* Equal digit runs only differ in leading zeros */
+        while (*a == '0')
+            a++;
+        while (*b == '0')
+            b++;
+
+        while (isdigit((unsigned char)*a) && isdigit((unsigned char)*b))
+        {
+            if (first_diff == 0)
+                first_diff = *a - *b;
+            a++;
+            b++;
+        }
+
+        if (isdigit((unsigned char)*a))
+            return 1;
+        if (isdigit((unsigned char)*b))
+            return -1;
+        if (first_diff != 0)
+            return first_diff;
+    }
+
+    return 0;
+}
+
+/* =============================================================================
+ * Constraints
+ * ========================================================================== */
+
+static const char* _ops[] = {"", "=", "<", "<=", ">", ">="};
+
+int dep_parse(const char* text, struct dep* dep)
+{
+    size_t name_len = strcspn(text, "<>=");
+    const char* op = text + name_len;
+
+    if (name_len == 0)
+        return -1;
+
+    dep->name = arena_alloc(&g_arena, name_len + 1);
+    if (dep->name == NULL)
+        return -1;
+    memcpy(dep->name, text, name_len);
+    dep->name[name_len] = '\0';
+    dep->op = DEP_ANY;
+    dep->version = NULL;
+
+    if (*op == '\0')
+        return 0;
+
+    if (op[0] == '=')
+    {
+        dep->op = DEP_EQ;
+        op += op[1] == '=' ? 2 : 1;
+    }
+    else
+    {
+        int or_equal = op[1] == '=';
+        if (op[0] == '<')
+            dep->op = or_equal ? DEP_LE : DEP_LT;
+        else
+            dep->op = or_equal ? DEP_GE : DEP_GT;
+        op += or_equal ? 2 : 1;
+    }
+
+    if (*op == '\0' || strpbrk(op, "<>=") != NULL)
+        return -1;
+
+    dep->version = strdup_safe(op);
+    return dep->version != NULL ? 0 : -1;
+}
+
+int dep_parse_list(const char* text, struct dep** deps, size_t* num_deps)
+{
+    char* copy;
+    char* save = NULL;
+    char* word;
+    size_t cap;
+
+    *deps = NULL;
+    *num_deps = 0;
+    if (text == NULL || *text == '\0')
+        return 0;
+
+    copy = strdup_safe(text);
+    cap = (size_t)count_words(text) + 1;
+    *deps = arena_alloc(&g_arena, cap * sizeof(**deps));
+    if (copy == NULL || *deps == NULL)
+        return -1;
+
+    for (word = strtok_r(copy, " \t", &save); word != NULL && *num_deps < cap;
+         word = strtok_r(NULL, " \t", &save))
+    {
+        if (dep_parse(word, &(*deps)[*num_deps]) != 0)
+            return -1;
+        (*num_deps)++;
+    }
+    return 0;
+}
+
+int dep_match(const struct dep* dep, const char* version)
+{
+    int cmp;
+
+    if (dep->op == DEP_ANY)
+        return 1;
+    if (version == NULL)
+        return 0;
+
+    cmp = vercmp(version, dep->version);
+    switch (dep->op)
+    {
+        case DEP_EQ:
+            return cmp == 0;
+        case DEP_LT:
+            return cmp < 0;
+        case DEP_LE:
+            return cmp <= 0;
+        case DEP_GT:
+            return cmp > 0;
+        default:
+            return cmp >= 0;
+    }
+}
+
+char* dep_format(const struct dep* dep)
+{
+    const char* version = dep->version != NULL ? dep->version : "";
+    char* text =
+        arena_alloc(&g_arena, strlen(dep->name) + strlen(version) + 3);
+
+    if (text != NULL)
+        sprintf(text, "%s%s%s", dep->name, _ops[dep->op], version);
+    return text;
+}
@@ -0,0 +1,265 @@
+/******************************************************************************
+ * wal.c - Write-ahead log of install transactions
+ *
+ * Authors:
+ *    Kevin Alavik <kevin@alavik.se>
+ *
+ * Copyright (c) 2025 Piraterna
+ * All rights reserved.
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <piratpkg.h>
+#include <wal.h>
+#include <solver.h>
+#include <db.h>
+#include <fs.h>
+#include <strings.h>
+#include <log.h>
+
+#define WAL_FILE "txn.wal"
+
+/* =============================================================================
+ * Helper functions
+ * ========================================================================== */
+
+static int _grow(struct wal* w, size_t* cap)
+{
+    size_t new_cap = *cap ? *cap * 2 : 64;
+    struct solver_pkg* plan =
+        arena_alloc(&g_arena, new_cap * sizeof(struct solver_pkg));
+    bool* committed = arena_alloc(&g_arena, new_cap * sizeof(bool));
+
+    if (plan == NULL || committed == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    if (w->num_plan > 0)
+    {
+        memcpy(plan, w->plan, w->num_plan * sizeof(struct solver_pkg));
+        memcpy(committed, w->committed, w->num_plan * sizeof(bool));
+    }
+    w->plan = plan;
+    w->committed = committed;
+    *cap = new_cap;
+    return ACTION_RET_OK;
+}
+
+/* "3,7,12" or "-" */
+static int _parse_deps(struct solver_pkg* p, char* deps)
+{
+    char* save = NULL;
+    char* dep;
+    size_t n = 1;
+    char* c;
+
+    for (c = deps; *c != '\0'; c++)
+        if (*c == ',')
+            n++;
+    p->deps = arena_alloc(&g_arena, n * sizeof(size_t));
+    p->num_deps = 0;
+    if (p->deps == NULL)
+        return ACTION_RET_ERR_UNKNOWN;
+    if (strcmp(deps, "-") == 0)
+        return ACTION_RET_OK;
+
+    for (dep = strtok_r(deps, ",", &save); dep != NULL;
+         dep = strtok_r(NULL, ",", &save))
+        p->deps[p->num_deps++] = strtoul(dep, NULL, 10);
+    return ACTION_RET_OK;
+}
+
+static int _add_plan(struct wal* w, size_t* cap, char** fields)
+{
+    struct solver_pkg* p;
+
+    if (w->num_plan == *cap && _grow(w, cap) != ACTION_RET_OK)
+        return ACTION_RET_ERR_UNKNOWN;
+
+    p = &w->plan[w->num_plan];
+    memset(p, 0, sizeof(*p));
+    p->name = strdup_safe(fields[1]);
+    p->version = strdup_safe(fields[2]);
+    p->spec = strdup_safe(fields[3]);
+    p->requested = atoi(fields[4]);
+    if (_parse_deps(p, fields[5]) != ACTION_RET_OK)
+        return ACTION_RET_ERR_UNKNOWN;
+    w->committed[w->num_plan++] = false;
+    return ACTION_RET_OK;
+}
+
+/* =============================================================================
+ * Public functions
+ * ========================================================================== */
+
+bool wal_exists(void)
+{
+    return access(db_path(WAL_FILE), F_OK) == 0;
+}
+
+int wal_load(struct wal* w)
+{
+    char* path = db_path(WAL_FILE);
+    FILE* file = fopen(path, "r");
+    char* line = NULL;
+    size_t line_cap = 0, cap = 0, i;
+    ssize_t len;
+    int ret = ACTION_RET_OK;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    if (file == NULL)
+    {
+        if (errno == ENOENT)
+            return ACTION_RET_OK;
+        ERROR("Failed to open '%s': %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    while (ret == ACTION_RET_OK &&
+           (len = getline(&line, &line_cap, file)) > 0)
+    {
+        char* fields[6];
+        char* save = NULL;
+        int n = 0;
+
+        /* Torn by a crash halfway through appending it */
+        if (line[len - 1] != '\n')
+            break;
+        line[len - 1] = '\0';
+
+        fields[n] = strtok_r(line, "\t", &save);
+        while (fields[n] != NULL && n < 5)
+            fields[++n] = strtok_r(NULL, "\t", &save);
+
+        if (fields[0] == NULL)
+            continue;
+        if (strcmp(fields[0], "plan") == 0 && n == 5 && fields[5] != NULL)
+            ret = _add_plan(w, &cap, fields);
+        else if (strcmp(fields[0], "commit") == 0 && fields[1] != NULL)
+        {
+            size_t index = strtoul(fields[1], NULL, 10);
+            if (index < w->num_plan)
+                w->committed[index] = true;
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    /* Plans list dependencies first, anything else wasn't written by us */
+    for (i = 0; ret == ACTION_RET_OK && i < w->num_plan; i++)
+    {
+        size_t j;
+
+        for (j = 0; j < w->plan[i].num_deps; j++)
+        {
+            if (w->plan[i].deps[j] >= i)
+            {
+                ERROR("'%s' is corrupt, remove it to start over.\n", path);
+                ret = ACTION_RET_ERR_IO;
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
+/* One plan line, with its deps moved up by offset */
+static void _write_plan(FILE* file, const struct solver_pkg* p, size_t offset)
+{
+    size_t j;
+
+    fprintf(file, "plan\t%s\t%s\t%s\t%d\t", p->name, p->version, p->spec,
+            p->requested);
+    if (p->num_deps == 0)
+        fputc('-', file);
+    for (j = 0; j < p->num_deps; j++)
+        fprintf(file, "%s%lu", j ? "," : "",
+                (unsigned long)(p->deps[j] + offset));
+    fputc('\n', file);
+}
+
+int wal_begin(struct wal* w, struct solver_pkg* done, size_t num_done,
+              struct solver_pkg* plan, size_t num_plan)
+{
+    char* path = db_path(WAL_FILE);
+    char* tmp_path;
+    FILE* file;
+    size_t i;
+    int ret;
+
+    w->plan = plan;
+    w->num_plan = num_plan;
+    w->committed = NULL;
+    w->num_done = num_done;
+    w->fd = -1;
+
+    if (fs_mkdir_p(db_path(""), 0755) != 0)
+    {
+        ERROR("Failed to create '%s': %s\n", db_path(""), strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+
+    file = fs_open_atomic(path, &tmp_path);
+    if (file == NULL)
+        return ACTION_RET_ERR_IO;
+
+    /* Their deps are all committed too, nothing waits on them */
+    for (i = 0; i < num_done; i++)
+    {
+        struct solver_pkg p = done[i];
+
+        p.num_deps = 0;
+        _write_plan(file, &p, 0);
+        fprintf(file, "commit\t%lu\n", (unsigned long)i);
+    }
+    for (i = 0; i < num_plan; i++)
+        _write_plan(file, &plan[i], num_done);
+
+    ret = fs_close_atomic(file, tmp_path, path);
+    if (ret != ACTION_RET_OK)
+        return ret;
+
+    w->fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (w->fd < 0)
+    {
+        ERROR("Failed to open '%s': %s\n", path, strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+    return ACTION_RET_OK;
+}
+
+int wal_commit(struct wal* w, size_t index)
+{
+    char line[64];
+    int len;
+
+    if (w->fd < 0)
+        return ACTION_RET_OK;
+
+    /* One write(), O_APPEND keeps it in one piece unless the power goes */
+    len = sprintf(line, "commit\t%lu\n", (unsigned long)(w->num_done + index));
+    if (write(w->fd, line, (size_t)len) != len || fdatasync(w->fd) != 0)
+    {
+        WARNING("Failed to log the commit of %s: %s\n", w->plan[index].name,
+                strerror(errno));
+        return ACTION_RET_ERR_IO;
+    }
+    return ACTION_RET_OK;
+}
+
+void wal_end(struct wal* w, bool complete)
+{
+    if (w->fd >= 0)
+        close(w->fd);
+    w->fd = -1;
+
+    if (complete && unlink(db_path(WAL_FILE)) != 0 && errno != ENOENT)
+        WARNING("Failed to remove '%s': %s\n", db_path(WAL_FILE),
+                strerror(errno));
+}